@@ -0,0 +1,86 @@
+// Micro-benchmark for the grid span fill kernels.
+//
+// Compares agg_grid::fill_values (used by span_grid and
+// grid_renderer::clear) against the scalar loop span_grid used before.
+//
+//   make bench
+//   ./build/bench_grid_fill
+//
+// Span lengths cover both the short runs produced by polygon edges and full
+// rows / full-tile clears at resolution 1 on 256 and 512px tiles.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <vector>
+
+#include "grid.h"
+
+using agg_grid::grid_value;
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// the loop span_grid::render and hline used to run
+static void scalar_fill(grid_value* p, unsigned count, grid_value c)
+{
+    do { *p++ = c; }
+    while(--count);
+}
+
+typedef void (*fill_fn)(grid_value*, unsigned, grid_value);
+
+static void vector_fill(grid_value* p, unsigned count, grid_value c)
+{
+    agg_grid::fill_values(p, count, c);
+}
+
+static double run(fill_fn fn, std::vector<grid_value>& buf, unsigned len, unsigned iterations)
+{
+    unsigned size = buf.size();
+    unsigned offset = 0;
+    double start = now();
+    for(unsigned i = 0; i < iterations; ++i)
+    {
+        // walk the buffer so starts are not always aligned
+        if(offset + len > size) offset = 0;
+        fn(&buf[0] + offset, len, grid_value(i));
+        offset += len + 1;
+    }
+    return now() - start;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned lengths[] = { 3, 8, 17, 64, 256, 512, 256 * 256, 512 * 512 };
+    unsigned num_lengths = sizeof(lengths) / sizeof(lengths[0]);
+    unsigned long long target = 200000000ULL; // ids written per measurement
+
+    std::vector<grid_value> buf(512 * 512 * 2 + 1024);
+
+    printf("%10s %14s %14s %8s\n", "span", "scalar ns/id", "vector ns/id", "speedup");
+    for(unsigned i = 0; i < num_lengths; ++i)
+    {
+        unsigned len = lengths[i];
+        unsigned iterations = unsigned(target / len);
+
+        // warm up both paths once
+        run(scalar_fill, buf, len, iterations / 10 + 1);
+        run(vector_fill, buf, len, iterations / 10 + 1);
+
+        double ts = run(scalar_fill, buf, len, iterations);
+        double tv = run(vector_fill, buf, len, iterations);
+        double n = double(iterations) * len;
+        printf("%10u %14.4f %14.4f %7.2fx\n", len, ts * 1e9 / n, tv * 1e9 / n, ts / tv);
+    }
+
+    // keep the buffer observable
+    unsigned long long sum = 0;
+    for(unsigned i = 0; i < buf.size(); i += 997) sum += buf[i];
+    fprintf(stderr, "checksum %llu\n", sum);
+    return 0;
+}
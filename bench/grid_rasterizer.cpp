@@ -0,0 +1,176 @@
+// Micro-benchmark for the grid rasterizers: grid_rasterizer (outline + cell
+// sort + spans) and binary_rasterizer (edge list + pixel center sampling).
+//
+//   make bench
+//   ./build/bench_grid_rasterizer [width] [iterations] [depth]
+//
+// depth is the number of subdivisions of the coastline (default 11).
+//
+// Two synthetic workloads stand in for the layers that are slow to grid:
+//
+//   coastline - one polygon with a long, jagged fractal boundary crossing
+//               the tile many times (lots of cells on every scanline)
+//   parcels   - thousands of small quadrilaterals, one feature each (many
+//               short outlines, the per-feature overhead dominates)
+//
+// Both rasterizers run the same workloads; the last line counts the pixels
+// on which they disagree. To compare rasterizer changes, build this file
+// against both trees and run them on the same machine.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <vector>
+
+#include "grid.h"
+#include "binary_rasterizer.h"
+
+using agg_grid::grid_value;
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+struct rasterizer : agg_grid::grid_rasterizer {};
+struct binary_rasterizer : agg_grid::binary_rasterizer {};
+
+struct point { double x; double y; };
+
+// midpoint displacement along a circle, gives a coastline-like ring
+static void make_coastline(std::vector<point>& ring, double size, unsigned depth)
+{
+    ring.clear();
+    unsigned n = 16;
+    for(unsigned i = 0; i < n; ++i)
+    {
+        double a = 2.0 * M_PI * i / n;
+        point p = { size / 2 + cos(a) * size * 0.4, size / 2 + sin(a) * size * 0.4 };
+        ring.push_back(p);
+    }
+    double amp = size * 0.15;
+    for(unsigned d = 0; d < depth; ++d)
+    {
+        std::vector<point> next;
+        for(unsigned i = 0; i < ring.size(); ++i)
+        {
+            point const& a = ring[i];
+            point const& b = ring[(i + 1) % ring.size()];
+            next.push_back(a);
+            double dx = b.x - a.x;
+            double dy = b.y - a.y;
+            double r = (rand() / double(RAND_MAX) - 0.5) * amp;
+            point m = { (a.x + b.x) / 2 - dy * r / size * 4, (a.y + b.y) / 2 + dx * r / size * 4 };
+            next.push_back(m);
+        }
+        ring.swap(next);
+        amp *= 0.6;
+    }
+}
+
+static unsigned long long checksum(std::vector<grid_value> const& buf)
+{
+    unsigned long long h = 1469598103934665603ULL;
+    for(unsigned i = 0; i < buf.size(); ++i)
+    {
+        h ^= buf[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+template <class Rasterizer>
+static void run(const char* name, Rasterizer& ras,
+                std::vector<point> const& coast,
+                unsigned width, unsigned iterations,
+                std::vector<grid_value>& coast_out,
+                std::vector<grid_value>& parcels_out)
+{
+    std::vector<grid_value> pixels(width * width);
+    agg_grid::grid_rendering_buffer renbuf(&pixels[0], width, width, width);
+    agg_grid::grid_renderer<agg_grid::span_grid> ren(renbuf);
+
+    // coastline
+    double start = now();
+    for(unsigned it = 0; it < iterations; ++it)
+    {
+        ren.clear(0);
+        ras.reset();
+        ras.move_to_d(coast[0].x, coast[0].y);
+        for(unsigned i = 1; i < coast.size(); ++i)
+        {
+            ras.line_to_d(coast[i].x, coast[i].y);
+        }
+        ras.render(ren, 1);
+    }
+    double t = now() - start;
+    printf("%-7s coastline %8u vertices %10.3f ms/tile  checksum %llx\n",
+           name, unsigned(coast.size()), t * 1e3 / iterations, checksum(pixels));
+    coast_out = pixels;
+
+    // parcels
+    unsigned cells = width / 4;
+    start = now();
+    for(unsigned it = 0; it < iterations; ++it)
+    {
+        ren.clear(0);
+        grid_value id = 1;
+        for(unsigned y = 0; y < cells; ++y)
+        {
+            for(unsigned x = 0; x < cells; ++x)
+            {
+                double x0 = x * 4.0 + 0.3;
+                double y0 = y * 4.0 + 0.2;
+                ras.reset();
+                ras.move_to_d(x0, y0);
+                ras.line_to_d(x0 + 3.6, y0 + 0.4);
+                ras.line_to_d(x0 + 3.3, y0 + 3.7);
+                ras.line_to_d(x0 + 0.1, y0 + 3.4);
+                ras.render(ren, ++id);
+            }
+        }
+    }
+    t = now() - start;
+    printf("%-7s parcels   %8u features %10.3f ms/tile  checksum %llx\n",
+           name, cells * cells, t * 1e3 / iterations, checksum(pixels));
+    parcels_out = pixels;
+}
+
+static unsigned count_differences(std::vector<grid_value> const& a,
+                                  std::vector<grid_value> const& b)
+{
+    unsigned n = 0;
+    for(unsigned i = 0; i < a.size(); ++i)
+    {
+        if(a[i] != b[i]) ++n;
+    }
+    return n;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned width = argc > 1 ? atoi(argv[1]) : 512;
+    unsigned iterations = argc > 2 ? atoi(argv[2]) : 50;
+
+    srand(7);
+    std::vector<point> coast;
+    make_coastline(coast, width, argc > 3 ? atoi(argv[3]) : 11);
+
+    std::vector<grid_value> aa_coast, aa_parcels;
+    std::vector<grid_value> bin_coast, bin_parcels;
+
+    rasterizer aa;
+    run("aa", aa, coast, width, iterations, aa_coast, aa_parcels);
+
+    binary_rasterizer bin;
+    bin.clip_box(0, 0, width, width);
+    run("binary", bin, coast, width, iterations, bin_coast, bin_parcels);
+
+    printf("pixels differing between aa and binary: coastline %u, parcels %u\n",
+           count_differences(aa_coast, bin_coast),
+           count_differences(aa_parcels, bin_parcels));
+    return 0;
+}
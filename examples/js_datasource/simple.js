@@ -7,12 +7,10 @@ datasource support
 */
 
 /*
-NOTE - maps using mapnik.JSDatasource can only be rendered with
-mapnik.render_to_string() or mapnik.render_to_file() as the javascript
-callback only works if the rendering happens in the main thread.
-
-If you want async rendering using mapnik.render() then use the
-mapnik.MemoryDatasource instead of mapnik.JSDatasource.
+NOTE - the javascript callback can only be called on the main thread.
+mapnik.render_to_string() and mapnik.render_to_file() call it while they
+render; map.render() calls it for the area to render before the render
+starts, and renders from a copy of those features in the background.
 */
 
 var mapnik = require('mapnik');
@@ -68,6 +66,9 @@ var options = {
 // this will be called repeatedly as mapnik renders
 // Rendering will continue until the function
 // no longer returns a valid object of x,y,properties
+// It may also return an array of such objects, or a batch of points
+// like mapnik.MemoryDatasource.addBatch() takes, to hand over many
+// features per call
 
 // WARNING - this API will change!
 
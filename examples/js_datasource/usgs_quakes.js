@@ -9,12 +9,10 @@
 // * node-get
 
 /*
-NOTE - maps using mapnik.JSDatasource can only be rendered with
-mapnik.render_to_string() or mapnik.render_to_file() as the javascript
-callback only works if the rendering happens in the main thread.
-
-If you want async rendering using mapnik.render() then use the
-mapnik.MemoryDatasource instead of mapnik.JSDatasource.
+NOTE - the javascript callback can only be called on the main thread.
+mapnik.render_to_string() and mapnik.render_to_file() call it while they
+render; map.render() calls it for the area to render before the render
+starts, and renders from a copy of those features in the background.
 */
 
 var mapnik = require('mapnik');
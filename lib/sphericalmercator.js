@@ -1,7 +1,7 @@
 var mapnik = require('mapnik');
 
 var proj4 = '+proj=merc +a=6378137 +b=6378137 +lat_ts=0.0 +lon_0=0.0 +x_0=0.0 +y_0=0 +k=1.0 +units=m +nadgrids=@null +wktext +no_defs +over';
-var mercator = new mapnik.Projection(proj4);
+var tiles = new mapnik.SphericalMercator();
 
 /**
  * SphericalMercator constructor: precaches calculations
@@ -77,13 +77,7 @@ SphericalMercator.prototype.px_to_ll = function(px, zoom) {
  * @return Object Mapnik envelope.
  */
 SphericalMercator.prototype.xyz_to_envelope = function(x, y, zoom, tms_style) {
-    if (tms_style) {
-        y = (Math.pow(2, zoom) - 1) - y;
-    }
-    var ll = [x * this.size, (y + 1) * this.size];
-    var ur = [(x + 1) * this.size, y * this.size];
-    var bbox = this.px_to_ll(ll, zoom).concat(this.px_to_ll(ur, zoom));
-    return mercator.forward(bbox);
+    return tiles.xyzToEnvelope(x, y, zoom, !!tms_style);
 };
 
 module.exports = new SphericalMercator();
@@ -20,6 +20,10 @@
 #include "mapnik_featureset.hpp"
 #include "mapnik_js_datasource.hpp"
 #include "mapnik_memory_datasource.hpp"
+#include "mapnik_spherical_mercator.hpp"
+#include "mapnik_tile_iterator.hpp"
+#include "datasource_registry.hpp"
+#include "projection_cache.hpp"
 
 // mapnik
 #include <mapnik/version.hpp>
@@ -81,11 +85,16 @@ static Handle<Value> register_datasources(const Arguments& args)
       return ThrowException(Exception::TypeError(
         String::New("first argument must be a path to a directory of mapnik input plugins")));
 
-    std::vector<std::string> const names_before = mapnik::datasource_cache::plugin_names();
     std::string const& path = TOSTR(args[0]);
-    mapnik::datasource_cache::instance()->register_datasources(path);
-    std::vector<std::string> const& names_after = mapnik::datasource_cache::plugin_names();
-    if (names_after.size() > names_before.size())
+    std::size_t before, after;
+    {
+        // the plugin table is read by plugins created on the thread pool
+        boost::mutex::scoped_lock lock(datasource_create_mutex());
+        before = mapnik::datasource_cache::plugin_names().size();
+        mapnik::datasource_cache::instance()->register_datasources(path);
+        after = mapnik::datasource_cache::plugin_names().size();
+    }
+    if (after > before)
         return scope.Close(Boolean::New(true));
     return scope.Close(Boolean::New(false));
 }
@@ -93,7 +102,11 @@ static Handle<Value> register_datasources(const Arguments& args)
 static Handle<Value> available_input_plugins(const Arguments& args)
 {
     HandleScope scope;
-    std::vector<std::string> const& names = mapnik::datasource_cache::plugin_names();
+    std::vector<std::string> names;
+    {
+        boost::mutex::scoped_lock lock(datasource_create_mutex());
+        names = mapnik::datasource_cache::plugin_names();
+    }
     Local<Array> a = Array::New(names.size());
     for (unsigned i = 0; i < names.size(); ++i)
     {
@@ -102,6 +115,94 @@ static Handle<Value> available_input_plugins(const Arguments& args)
     return scope.Close(a);
 }
 
+/*
+ * mapnik.shared_datasources()
+ *
+ * The datasources in the registry, as [{ key: String, refs: Number }],
+ * where refs counts the Maps and mapnik.Datasources using each.
+ */
+static Handle<Value> shared_datasources(const Arguments& args)
+{
+    HandleScope scope;
+    std::vector<datasource_registry_entry> entries;
+    datasource_registry_entries(entries);
+    Local<Array> a = Array::New(entries.size());
+    for (unsigned i = 0; i < entries.size(); ++i)
+    {
+        Local<Object> entry = Object::New();
+        entry->Set(String::NewSymbol("key"), String::New(entries[i].key.c_str()));
+        entry->Set(String::NewSymbol("refs"), Number::New(entries[i].refs));
+        a->Set(i, entry);
+    }
+    return scope.Close(a);
+}
+
+/*
+ * mapnik.evict_datasources([key or options])
+ *
+ * Without an argument drops the shared datasources nothing uses anymore;
+ * with true drops them all; with a key from shared_datasources(), or the
+ * options the datasource was created with, drops that one. Datasources in
+ * use stay open until they are released. Returns how many were dropped.
+ */
+static Handle<Value> evict_shared_datasources(const Arguments& args)
+{
+    HandleScope scope;
+    if (args.Length() == 0 || args[0]->IsUndefined())
+        return scope.Close(Integer::NewFromUnsigned(evict_datasources(false)));
+
+    if (args[0]->IsBoolean())
+        return scope.Close(Integer::NewFromUnsigned(evict_datasources(args[0]->BooleanValue())));
+
+    if (args[0]->IsString())
+        return scope.Close(Integer::New(evict_datasource(TOSTR(args[0])) ? 1 : 0));
+
+    if (!args[0]->IsObject())
+        return ThrowException(Exception::TypeError(
+          String::New("optional argument must be a key, datasource options or a Boolean")));
+
+    Local<Object> options = args[0]->ToObject();
+    mapnik::parameters params;
+    Local<Array> names = options->GetPropertyNames();
+    for (uint32_t i = 0; i < names->Length(); ++i)
+    {
+        Local<Value> name = names->Get(i)->ToString();
+        std::string key = TOSTR(name);
+        if (key != "shared" && key != "bind")
+            params[key] = TOSTR(options->Get(name));
+    }
+    return scope.Close(Integer::New(evict_datasource(datasource_key(params)) ? 1 : 0));
+}
+
+static Local<Object> cache_stats_to_object(projection_cache_stats const& s)
+{
+    Local<Object> stats = Object::New();
+    stats->Set(String::NewSymbol("hits"), Number::New(s.hits));
+    stats->Set(String::NewSymbol("misses"), Number::New(s.misses));
+    stats->Set(String::NewSymbol("idle"), Integer::NewFromUnsigned(s.idle));
+    return stats;
+}
+
+/*
+ * mapnik.projection_cache()
+ *
+ * How often projections and transforms were reused from the cache instead
+ * of being initialized, as { projections: { hits, misses, idle },
+ * transforms: { hits, misses, idle } }, where idle counts those ready for
+ * reuse.
+ */
+static Handle<Value> projection_cache(const Arguments& args)
+{
+    HandleScope scope;
+    projection_cache_stats projections;
+    projection_cache_stats transforms;
+    projection_stats(projections, transforms);
+    Local<Object> stats = Object::New();
+    stats->Set(String::NewSymbol("projections"), cache_stats_to_object(projections));
+    stats->Set(String::NewSymbol("transforms"), cache_stats_to_object(transforms));
+    return scope.Close(stats);
+}
+
 static Handle<Value> register_fonts(const Arguments& args)
 {
   HandleScope scope;
@@ -174,6 +275,9 @@ extern "C" {
     NODE_SET_METHOD(target, "make_mapnik_symbols_visible", make_mapnik_symbols_visible);
     NODE_SET_METHOD(target, "register_datasources", register_datasources);
     NODE_SET_METHOD(target, "datasources", available_input_plugins);
+    NODE_SET_METHOD(target, "shared_datasources", shared_datasources);
+    NODE_SET_METHOD(target, "evict_datasources", evict_shared_datasources);
+    NODE_SET_METHOD(target, "projection_cache", projection_cache);
     NODE_SET_METHOD(target, "register_fonts", register_fonts);
     NODE_SET_METHOD(target, "fonts", available_font_faces);
     NODE_SET_METHOD(target, "gc", gc);
@@ -199,6 +303,12 @@ extern "C" {
     // MemoryDatasource
     MemoryDatasource::Initialize(target);
 
+    // SphericalMercator
+    SphericalMercator::Initialize(target);
+
+    // TileIterator
+    TileIterator::Initialize(target);
+
     // node-mapnik version
     target->Set(String::NewSymbol("version"), String::New("0.3.1"));
 
@@ -0,0 +1,346 @@
+#include "caching_datasource.hpp"
+#include "indexed_memory_datasource.hpp"
+
+// mapnik
+#include <mapnik/version.hpp>
+#include <mapnik/feature.hpp>
+#include <mapnik/vertex.hpp>
+
+// stl
+#include <algorithm>
+#include <cmath>
+#include <list>
+#include <map>
+#include <set>
+#include <sstream>
+
+namespace {
+
+// queries touching more cells than this are passed through
+const unsigned max_query_cells = 16;
+
+// Cached features are shared by the renders reading a cell at once, so
+// they are only read with get_vertex(), which leaves the geometries'
+// iterators alone, and each render gets its own copies.
+
+// the extent of the geometries of feature; false if it has none
+bool feature_envelope(mapnik::Feature const& feature, mapnik::box2d<double>& box)
+{
+    bool found = false;
+    for (unsigned i = 0; i < feature.num_geometries(); ++i)
+    {
+        mapnik::geometry_type const& geom = feature.get_geometry(i);
+        unsigned num_points = geom.num_points();
+        for (unsigned v = 0; v < num_points; ++v)
+        {
+            double x, y;
+            geom.get_vertex(v, &x, &y);
+            if (found)
+            {
+                box.expand_to_include(x, y);
+            }
+            else
+            {
+                box.init(x, y, x, y);
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+mapnik::feature_ptr copy_feature(mapnik::Feature const& feature)
+{
+    mapnik::feature_ptr copy(new mapnik::Feature(feature.id()));
+    for (unsigned i = 0; i < feature.num_geometries(); ++i)
+    {
+        mapnik::geometry_type const& geom = feature.get_geometry(i);
+        mapnik::geometry_type * part = new mapnik::geometry_type(geom.type());
+        copy->add_geometry(part);
+        unsigned num_points = geom.num_points();
+        for (unsigned v = 0; v < num_points; ++v)
+        {
+            double x, y;
+            if (geom.get_vertex(v, &x, &y) == mapnik::SEG_MOVETO)
+                part->move_to(x, y);
+            else
+                part->line_to(x, y);
+        }
+    }
+    typedef std::map<std::string,mapnik::value> properties;
+    properties const& props = feature.props();
+    for (properties::const_iterator it = props.begin(); it != props.end(); ++it)
+        boost::put(*copy, it->first, it->second);
+    return copy;
+}
+
+// roughly what a feature takes in memory: its vertices, command bytes and
+// properties, which are held as UTF-16
+std::size_t feature_bytes(mapnik::Feature const& feature)
+{
+    std::size_t bytes = sizeof(mapnik::Feature);
+    for (unsigned i = 0; i < feature.num_geometries(); ++i)
+        bytes += 64 + feature.get_geometry(i).num_points() * (2 * sizeof(double) + 1);
+    typedef std::map<std::string,mapnik::value> properties;
+    properties const& props = feature.props();
+    for (properties::const_iterator it = props.begin(); it != props.end(); ++it)
+        bytes += 48 + it->first.size() + sizeof(mapnik::value) + 2 * it->second.to_string().size();
+    return bytes;
+}
+
+struct merged_feature
+{
+    mapnik::feature_ptr feature;
+    mapnik::box2d<double> box;
+    bool has_box;
+};
+
+bool same_box(merged_feature const& a, merged_feature const& b)
+{
+    if (a.has_box != b.has_box)
+        return false;
+    return !a.has_box ||
+        (a.box.minx() == b.box.minx() && a.box.miny() == b.box.miny() &&
+         a.box.maxx() == b.box.maxx() && a.box.maxy() == b.box.maxy());
+}
+
+} // namespace
+
+caching_datasource::caching_datasource(mapnik::datasource_ptr const& ds, double cell_size, std::size_t max_bytes)
+    : mapnik::datasource(ds->params()),
+      ds_(ds),
+      cell_size_(cell_size),
+      max_bytes_(max_bytes),
+      mutex_(),
+      cells_(),
+      lru_(),
+      bytes_(0),
+      hits_(0),
+      misses_(0) {}
+
+caching_datasource::~caching_datasource() {}
+
+int caching_datasource::type() const
+{
+    return ds_->type();
+}
+
+mapnik::box2d<double> caching_datasource::envelope() const
+{
+    return ds_->envelope();
+}
+
+mapnik::layer_descriptor caching_datasource::get_descriptor() const
+{
+    return ds_->get_descriptor();
+}
+
+mapnik::featureset_ptr caching_datasource::features_at_point(mapnik::coord2d const& pt) const
+{
+    return ds_->features_at_point(pt);
+}
+
+mapnik::featureset_ptr caching_datasource::features(mapnik::query const& q) const
+{
+    if (ds_->type() == mapnik::datasource::Raster)
+        return ds_->features(q);
+
+    mapnik::box2d<double> const& box = q.get_bbox();
+    double size = cell_size_;
+    double ox = 0;
+    double oy = 0;
+    unsigned level = 0;
+    if (size <= 0)
+    {
+        mapnik::box2d<double> extent = ds_->envelope();
+        size = std::max(extent.width(), extent.height());
+        if (!(size > 0))
+            return ds_->features(q);
+        double span = std::max(box.width(), box.height());
+        while (level < 30 && size / 2 >= span)
+        {
+            size /= 2;
+            ++level;
+        }
+        ox = extent.minx();
+        oy = extent.miny();
+    }
+
+    double x0 = std::floor((box.minx() - ox) / size);
+    double y0 = std::floor((box.miny() - oy) / size);
+    double x1 = std::floor((box.maxx() - ox) / size);
+    double y1 = std::floor((box.maxy() - oy) / size);
+    if ((x1 - x0 + 1) * (y1 - y0 + 1) > max_query_cells)
+        return ds_->features(q);
+
+    // what else makes the features of a cell differ
+    std::ostringstream suffix;
+    suffix.precision(6);
+#if MAPNIK_VERSION >= 800
+    suffix << '|' << boost::get<0>(q.resolution())
+           << ',' << boost::get<1>(q.resolution())
+           << ',' << q.scale_denominator();
+#endif
+    std::set<std::string> const& names = q.property_names();
+    std::set<std::string>::const_iterator name = names.begin();
+    for (; name != names.end(); ++name)
+        suffix << '|' << *name;
+
+    // the features of the cells, each once, in the order of the first cell
+    // that has them; a feature first seen in a later cell goes right after
+    // the one it follows there, so the order of every cell is kept where
+    // the cells agree
+    std::list<merged_feature> merged;
+    typedef std::multimap<int, std::list<merged_feature>::iterator> seen_map;
+    seen_map seen;
+    for (double y = y0; y <= y1; ++y)
+    {
+        for (double x = x0; x <= x1; ++x)
+        {
+            std::ostringstream key;
+            key.precision(17);
+            key << level << '/' << x << '/' << y << suffix.str();
+
+            feature_list features;
+            if (!cached(key.str(), features))
+            {
+                mapnik::box2d<double> cell_box(ox + x * size, oy + y * size,
+                                               ox + (x + 1) * size, oy + (y + 1) * size);
+#if MAPNIK_VERSION >= 800
+                mapnik::query cq(cell_box, q.resolution(), q.scale_denominator());
+#else
+                mapnik::query cq(cell_box,1.0,1.0);
+#endif
+                for (name = names.begin(); name != names.end(); ++name)
+                    cq.add_property_name(*name);
+                mapnik::featureset_ptr fs = ds_->features(cq);
+                if (fs)
+                {
+                    mapnik::feature_ptr fp;
+                    while ((fp = fs->next()))
+                        features.push_back(fp);
+                }
+                store(key.str(), features);
+            }
+
+            // features before the first one seen in an earlier cell go in
+            // front of it, the others after the last one seen
+            std::list<merged_feature>::iterator cursor = merged.end();
+            std::vector<merged_feature> leading;
+            bool anchored = false;
+            feature_list::const_iterator itr = features.begin();
+            for (; itr != features.end(); ++itr)
+            {
+                merged_feature m;
+                m.feature = *itr;
+                m.has_box = feature_envelope(**itr, m.box);
+                if (m.has_box && !m.box.intersects(box))
+                    continue;
+
+                std::list<merged_feature>::iterator found = merged.end();
+                std::pair<seen_map::iterator, seen_map::iterator> same_id = seen.equal_range(m.feature->id());
+                for (seen_map::iterator s = same_id.first; s != same_id.second; ++s)
+                {
+                    if (same_box(*s->second, m))
+                    {
+                        found = s->second;
+                        break;
+                    }
+                }
+
+                if (found != merged.end())
+                {
+                    if (!anchored)
+                    {
+                        for (std::size_t i = 0; i < leading.size(); ++i)
+                            seen.insert(std::make_pair(leading[i].feature->id(), merged.insert(found, leading[i])));
+                        leading.clear();
+                        anchored = true;
+                    }
+                    cursor = found;
+                    ++cursor;
+                }
+                else if (anchored)
+                {
+                    seen.insert(std::make_pair(m.feature->id(), merged.insert(cursor, m)));
+                }
+                else
+                {
+                    leading.push_back(m);
+                }
+            }
+            for (std::size_t i = 0; i < leading.size(); ++i)
+                seen.insert(std::make_pair(leading[i].feature->id(), merged.insert(merged.end(), leading[i])));
+        }
+    }
+
+    std::vector<mapnik::feature_ptr> matches;
+    matches.reserve(merged.size());
+    std::list<merged_feature>::const_iterator m = merged.begin();
+    for (; m != merged.end(); ++m)
+        matches.push_back(copy_feature(*m->feature));
+    return mapnik::featureset_ptr(new indexed_memory_featureset(matches));
+}
+
+bool caching_datasource::cached(std::string const& key, feature_list& out) const
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    cell_map::iterator it = cells_.find(key);
+    if (it == cells_.end())
+    {
+        ++misses_;
+        return false;
+    }
+    ++hits_;
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+    out = it->second.features;
+    return true;
+}
+
+void caching_datasource::store(std::string const& key, feature_list const& features) const
+{
+    std::size_t bytes = key.size();
+    feature_list::const_iterator itr = features.begin();
+    for (; itr != features.end(); ++itr)
+        bytes += feature_bytes(**itr);
+    // would push out everything else
+    if (bytes > max_bytes_)
+        return;
+
+    boost::mutex::scoped_lock lock(mutex_);
+    // another render fetched it meanwhile
+    if (cells_.find(key) != cells_.end())
+        return;
+    while (!lru_.empty() && bytes_ + bytes > max_bytes_)
+    {
+        cell_map::iterator oldest = cells_.find(lru_.back());
+        bytes_ -= oldest->second.bytes;
+        cells_.erase(oldest);
+        lru_.pop_back();
+    }
+    lru_.push_front(key);
+    cell& c = cells_[key];
+    c.features = features;
+    c.bytes = bytes;
+    c.lru = lru_.begin();
+    bytes_ += bytes;
+}
+
+caching_datasource::cache_stats caching_datasource::stats() const
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    cache_stats s;
+    s.hits = hits_;
+    s.misses = misses_;
+    s.cells = cells_.size();
+    s.bytes = bytes_;
+    return s;
+}
+
+void caching_datasource::clear()
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    cells_.clear();
+    lru_.clear();
+    bytes_ = 0;
+}
@@ -0,0 +1,93 @@
+#ifndef __NODE_MAPNIK_CACHING_DATASOURCE_H__
+#define __NODE_MAPNIK_CACHING_DATASOURCE_H__
+
+// mapnik
+#include <mapnik/datasource.hpp>
+#include <mapnik/feature_layer_desc.hpp>
+#include <mapnik/query.hpp>
+
+// boost
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/utility.hpp>
+
+// stl
+#include <list>
+#include <string>
+#include <vector>
+
+// Wraps the datasource of a layer and keeps the features it returns per
+// grid cell, so the overlapping queries of neighbouring tiles and their
+// buffers are answered from memory. A query is widened to the cells it
+// touches; cells are fetched whole, and features returned by more than one
+// cell, which have the same id and extent, are returned once. The order of
+// the source is kept within each cell, and across cells where they share
+// features; features only one cell has are not ordered against those only
+// another has. Sources need ids that are the same in every query, like a
+// postgis key_field, or features of several cells come back twice.
+//
+// With cell_size 0 the grid starts at the corner of the datasource's
+// extent and a query uses the smallest power of two fraction of that
+// extent at least as large as the query, so it touches at most 4 cells and
+// queries of one zoom level share theirs. Set cell_size to the size of a
+// metatile, in the units of the layer's srs, to align cells with the tiles
+// of a grid with its origin at 0, 0, like spherical mercator's.
+//
+// The least recently used cells are dropped once their estimated size
+// exceeds max_bytes. Raster datasources and point queries are passed
+// through. Renders get copies of the cached features, since rendering a
+// geometry moves its iterator. Nothing tells the cache about changes to
+// the source, so it is for sources that do not change.
+
+class caching_datasource : public mapnik::datasource, private boost::noncopyable
+{
+public:
+    struct cache_stats
+    {
+        unsigned hits;
+        unsigned misses;
+        unsigned cells;
+        std::size_t bytes;
+    };
+
+    caching_datasource(mapnik::datasource_ptr const& ds, double cell_size, std::size_t max_bytes);
+    virtual ~caching_datasource();
+    int type() const;
+    mapnik::featureset_ptr features(mapnik::query const& q) const;
+    mapnik::featureset_ptr features_at_point(mapnik::coord2d const& pt) const;
+    mapnik::box2d<double> envelope() const;
+    mapnik::layer_descriptor get_descriptor() const;
+
+    mapnik::datasource_ptr const& source() const { return ds_; }
+    double cell_size() const { return cell_size_; }
+    std::size_t max_bytes() const { return max_bytes_; }
+    cache_stats stats() const;
+    void clear();
+
+private:
+    typedef std::vector<mapnik::feature_ptr> feature_list;
+    struct cell
+    {
+        feature_list features;
+        std::size_t bytes;
+        std::list<std::string>::iterator lru;
+    };
+    typedef boost::unordered_map<std::string, cell> cell_map;
+
+    bool cached(std::string const& key, feature_list& out) const;
+    void store(std::string const& key, feature_list const& features) const;
+
+    mapnik::datasource_ptr ds_;
+    double cell_size_;
+    std::size_t max_bytes_;
+
+    mutable boost::mutex mutex_;
+    mutable cell_map cells_;
+    // most recently used first
+    mutable std::list<std::string> lru_;
+    mutable std::size_t bytes_;
+    mutable unsigned hits_;
+    mutable unsigned misses_;
+};
+
+#endif // __NODE_MAPNIK_CACHING_DATASOURCE_H__
@@ -0,0 +1,876 @@
+#include "columnar_memory_datasource.hpp"
+
+// mapnik
+#include <mapnik/vertex.hpp>
+
+// boost
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+// stl
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <set>
+
+namespace {
+
+// numbers and booleans convert to numeric columns, strings do not
+struct number_from_value : public boost::static_visitor<bool>
+{
+    explicit number_from_value(double& out)
+        : out_(out) {}
+
+    bool operator() (int val) const
+    {
+        out_ = val;
+        return true;
+    }
+
+    bool operator() (double val) const
+    {
+        out_ = val;
+        return true;
+    }
+
+    bool operator() (bool val) const
+    {
+        out_ = val ? 1 : 0;
+        return true;
+    }
+
+    template <typename T>
+    bool operator() (T const&) const
+    {
+        return false;
+    }
+
+    double& out_;
+};
+
+// whether num is a whole number an int column can hold
+bool fits_int_column(double num)
+{
+    return num == std::floor(num) && num >= INT_MIN && num <= INT_MAX;
+}
+
+enum
+{
+    snapshot_magic = 0x53444d4e, // "NMDS"
+    snapshot_version = 2,
+    snapshot_byte_order = 0x01020304
+};
+
+}
+
+attribute_column::attribute_column(std::string const& name, value_type type)
+    : name_(name),
+      type_(type),
+      ints_(),
+      doubles_(),
+      valid_(),
+      codes_(),
+      string_offsets_(),
+      string_data_(),
+      string_codes_()
+{
+    if (type_ == string_type)
+        string_offsets_.push_back(0);
+}
+
+std::size_t attribute_column::size() const
+{
+    switch (type_)
+    {
+    case int_type:
+        return ints_.size();
+    case double_type:
+        return doubles_.size();
+    case string_type:
+        return codes_.size();
+    }
+    return 0;
+}
+
+void attribute_column::push_null()
+{
+    switch (type_)
+    {
+    case int_type:
+        ints_.push_back(0);
+        valid_.push_back(0);
+        break;
+    case double_type:
+        doubles_.push_back(0);
+        valid_.push_back(0);
+        break;
+    case string_type:
+        codes_.push_back(0);
+        break;
+    }
+}
+
+void attribute_column::push_row(attribute_column const& from, std::size_t row)
+{
+    switch (type_)
+    {
+    case int_type:
+        ints_.push_back(from.ints_[row]);
+        valid_.push_back(from.valid_[row]);
+        break;
+    case double_type:
+        doubles_.push_back(from.doubles_[row]);
+        valid_.push_back(from.valid_[row]);
+        break;
+    case string_type:
+    {
+        uint32_t code = from.codes_[row];
+        if (code == 0 || code >= from.string_offsets_.size())
+        {
+            codes_.push_back(0);
+            break;
+        }
+        uint32_t begin = from.string_offsets_[code - 1];
+        std::string utf8(from.string_data_.data() + begin, from.string_offsets_[code] - begin);
+        codes_.push_back(string_code(utf8));
+        break;
+    }
+    }
+}
+
+void attribute_column::push(mapnik::value const& v)
+{
+    if (boost::get<mapnik::value_null>(&v.base()))
+    {
+        push_null();
+        return;
+    }
+
+    if (type_ == string_type)
+    {
+        std::string utf8;
+        UnicodeString const* str = boost::get<UnicodeString>(&v.base());
+        if (str)
+            mapnik::to_utf8(*str, utf8);
+        else
+            mapnik::to_utf8(v.to_unicode(), utf8);
+        codes_.push_back(string_code(utf8));
+        return;
+    }
+
+    double num;
+    if (!boost::apply_visitor(number_from_value(num), v.base()) ||
+        (type_ == int_type && !fits_int_column(num)))
+    {
+        push_null();
+    }
+    else if (type_ == int_type)
+    {
+        ints_.push_back(static_cast<int>(num));
+        valid_.push_back(1);
+    }
+    else
+    {
+        doubles_.push_back(num);
+        valid_.push_back(1);
+    }
+}
+
+uint32_t attribute_column::string_code(std::string const& str)
+{
+    if (string_codes_.empty())
+    {
+        for (uint32_t code = 1; code < string_offsets_.size(); ++code)
+        {
+            uint32_t begin = string_offsets_[code - 1];
+            std::string key(string_data_.data() + begin, string_offsets_[code] - begin);
+            string_codes_.insert(std::make_pair(key, code));
+        }
+    }
+
+    std::map<std::string, uint32_t>::iterator pos = string_codes_.lower_bound(str);
+    if (pos != string_codes_.end() && pos->first == str)
+        return pos->second;
+
+    uint32_t code = string_offsets_.size();
+    string_data_.append(str.data(), str.data() + str.size());
+    string_offsets_.push_back(string_data_.size());
+    string_codes_.insert(pos, std::make_pair(str, code));
+    return code;
+}
+
+bool attribute_column::get(std::size_t row, mapnik::value& v) const
+{
+    switch (type_)
+    {
+    case int_type:
+        if (!valid_[row])
+            return false;
+        v = mapnik::value(ints_[row]);
+        return true;
+    case double_type:
+        if (!valid_[row])
+            return false;
+        v = mapnik::value(doubles_[row]);
+        return true;
+    case string_type:
+    {
+        uint32_t code = codes_[row];
+        if (code == 0 || code >= string_offsets_.size())
+            return false;
+        uint32_t begin = string_offsets_[code - 1];
+        UnicodeString ustr = UnicodeString::fromUTF8(
+            StringPiece(string_data_.data() + begin, string_offsets_[code] - begin));
+        v = mapnik::value(ustr);
+        return true;
+    }
+    }
+    return false;
+}
+
+void attribute_column::write(snapshot_writer& out) const
+{
+    switch (type_)
+    {
+    case int_type:
+        out.write_array(ints_);
+        out.write_array(valid_);
+        break;
+    case double_type:
+        out.write_array(doubles_);
+        out.write_array(valid_);
+        break;
+    case string_type:
+        out.write_array(codes_);
+        out.write_array(string_offsets_);
+        out.write_array(string_data_);
+        break;
+    }
+}
+
+void attribute_column::read(snapshot_reader& in)
+{
+    switch (type_)
+    {
+    case int_type:
+        in.read_array(ints_);
+        in.read_array(valid_);
+        if (valid_.size() != ints_.size())
+            throw std::runtime_error("snapshot has an invalid column '" + name_ + "'");
+        break;
+    case double_type:
+        in.read_array(doubles_);
+        in.read_array(valid_);
+        if (valid_.size() != doubles_.size())
+            throw std::runtime_error("snapshot has an invalid column '" + name_ + "'");
+        break;
+    case string_type:
+        in.read_array(codes_);
+        in.read_array(string_offsets_);
+        in.read_array(string_data_);
+        if (string_offsets_.empty() || string_offsets_.back() != string_data_.size())
+            throw std::runtime_error("snapshot has an invalid column '" + name_ + "'");
+        break;
+    }
+}
+
+
+column_store::column_store()
+    : mutex(),
+      ids_(),
+      part_begin_(1, 0),
+      part_types_(),
+      vertex_begin_(1, 0),
+      xy_(),
+      commands_(),
+      boxes_(),
+      index_(),
+      extent_(),
+      columns_(),
+      rows_by_id_(),
+      has_row_map_(false) {}
+
+column_store::column_store(column_schema const& schema)
+    : mutex(),
+      ids_(),
+      part_begin_(1, 0),
+      part_types_(),
+      vertex_begin_(1, 0),
+      xy_(),
+      commands_(),
+      boxes_(),
+      index_(),
+      extent_(),
+      columns_(),
+      rows_by_id_(),
+      has_row_map_(false)
+{
+    column_schema::const_iterator itr = schema.begin();
+    for (; itr != schema.end(); ++itr)
+        columns_.push_back(new attribute_column(itr->name, itr->type));
+}
+
+column_schema column_store::schema() const
+{
+    column_schema schema;
+    boost::ptr_vector<attribute_column>::const_iterator col = columns_.begin();
+    for (; col != columns_.end(); ++col)
+        schema.push_back(column_def(col->name(), col->type()));
+    return schema;
+}
+
+bool column_store::push(mapnik::feature_ptr const& feature)
+{
+    unsigned num_geometries = feature->num_geometries();
+    if (num_geometries == 0)
+        return false;
+
+    mapnik::box2d<double> box;
+    for (unsigned i = 0; i < num_geometries; ++i)
+    {
+        mapnik::geometry_type const& geom = feature->get_geometry(i);
+        if (i == 0)
+            box = geom.envelope();
+        else
+            box.expand_to_include(geom.envelope());
+
+        part_types_.push_back(static_cast<unsigned char>(geom.type()));
+        // get_vertex leaves the geometry's iterator alone, so features
+        // that are being rendered can be copied
+        unsigned num_points = geom.num_points();
+        for (unsigned v = 0; v < num_points; ++v)
+        {
+            double x, y;
+            unsigned cmd = geom.get_vertex(v, &x, &y);
+            xy_.push_back(x);
+            xy_.push_back(y);
+            commands_.push_back(static_cast<unsigned char>(cmd));
+        }
+        vertex_begin_.push_back(commands_.size());
+    }
+    part_begin_.push_back(part_types_.size());
+
+    if (size() == 0)
+        extent_ = box;
+    else
+        extent_.expand_to_include(box);
+    if (has_row_map_)
+        rows_by_id_[feature->id()] = static_cast<uint32_t>(ids_.size());
+    ids_.push_back(feature->id());
+    boxes_.push_back(box);
+
+    std::map<std::string, mapnik::value> const& props = feature->props();
+    boost::ptr_vector<attribute_column>::iterator col = columns_.begin();
+    for (; col != columns_.end(); ++col)
+    {
+        std::map<std::string, mapnik::value>::const_iterator pos = props.find(col->name());
+        if (pos == props.end())
+            col->push_null();
+        else
+            col->push(pos->second);
+    }
+    return true;
+}
+
+void column_store::push_row(column_store const& from, std::size_t row)
+{
+    for (uint32_t part = from.part_begin_[row]; part < from.part_begin_[row + 1]; ++part)
+    {
+        part_types_.push_back(from.part_types_[part]);
+        uint32_t begin = from.vertex_begin_[part];
+        uint32_t end = from.vertex_begin_[part + 1];
+        xy_.append(from.xy_.data() + begin * 2, from.xy_.data() + end * 2);
+        commands_.append(from.commands_.data() + begin, from.commands_.data() + end);
+        vertex_begin_.push_back(commands_.size());
+    }
+    part_begin_.push_back(part_types_.size());
+
+    mapnik::box2d<double> const& box = from.boxes_[row];
+    if (ids_.empty())
+        extent_ = box;
+    else
+        extent_.expand_to_include(box);
+    ids_.push_back(from.ids_[row]);
+    boxes_.push_back(box);
+
+    for (std::size_t i = 0; i < columns_.size(); ++i)
+        columns_[i].push_row(from.columns_[i], row);
+}
+
+void column_store::remove(std::size_t row)
+{
+    if (has_row_map_)
+        rows_by_id_.erase(ids_[row]);
+    index_.remove(row);
+}
+
+bool column_store::find_row(int id, std::size_t& row)
+{
+    if (!has_row_map_)
+    {
+        for (std::size_t i = 0; i < ids_.size(); ++i)
+        {
+            if (!index_.is_removed(i))
+                rows_by_id_[ids_[i]] = static_cast<uint32_t>(i);
+        }
+        has_row_map_ = true;
+    }
+    boost::unordered_map<int, uint32_t>::const_iterator itr = rows_by_id_.find(id);
+    if (itr == rows_by_id_.end())
+        return false;
+    row = itr->second;
+    return true;
+}
+
+void column_store::update_index()
+{
+    leveled_index::merge_plan plan;
+    while (index_.plan_merge(boxes_.size(), plan))
+    {
+        packed_rtree tree;
+        leveled_index::build_level(boxes_, plan, tree);
+        boost::mutex::scoped_lock lock(mutex);
+        index_.install(plan, tree);
+    }
+}
+
+void column_store::build_index()
+{
+    leveled_index index;
+    index.build_all(boxes_);
+    boost::mutex::scoped_lock lock(mutex);
+    index_.swap(index);
+}
+
+bool column_store::needs_compaction() const
+{
+    return index_.num_removed() > leveled_index::min_level && index_.num_removed() * 2 > ids_.size();
+}
+
+column_store_ptr column_store::compact() const
+{
+    column_store_ptr store(new column_store(schema()));
+    store->ids_.reserve(size());
+    store->boxes_.reserve(size());
+    for (std::size_t row = 0; row < ids_.size(); ++row)
+    {
+        if (!index_.is_removed(row))
+            store->push_row(*this, row);
+    }
+    store->build_index();
+    return store;
+}
+
+void column_store::query(mapnik::box2d<double> const& box, std::vector<uint32_t>& rows) const
+{
+    // in the order the features were added
+    index_.query(boxes_, box, rows);
+}
+
+mapnik::feature_ptr column_store::materialize(std::size_t row, std::vector<std::size_t> const& columns) const
+{
+    mapnik::feature_ptr feature(new mapnik::Feature(ids_[row]));
+    for (uint32_t part = part_begin_[row]; part < part_begin_[row + 1]; ++part)
+    {
+        mapnik::geometry_type * geom = new mapnik::geometry_type(static_cast<mapnik::eGeomType>(part_types_[part]));
+        feature->add_geometry(geom);
+        for (uint32_t v = vertex_begin_[part]; v < vertex_begin_[part + 1]; ++v)
+        {
+            if (commands_[v] == mapnik::SEG_MOVETO)
+                geom->move_to(xy_[v * 2], xy_[v * 2 + 1]);
+            else
+                geom->line_to(xy_[v * 2], xy_[v * 2 + 1]);
+        }
+    }
+
+    mapnik::value value;
+    std::vector<std::size_t>::const_iterator col = columns.begin();
+    for (; col != columns.end(); ++col)
+    {
+        attribute_column const& column = columns_[*col];
+        if (column.get(row, value))
+            boost::put(*feature, column.name(), value);
+    }
+    return feature;
+}
+
+
+void column_store::save(std::string const& path) const
+{
+    if (index_.num_removed() > 0)
+    {
+        compact()->save(path);
+        return;
+    }
+
+    // write next to the target and rename, so readers never map a
+    // half written file
+    std::string tmp = path + ".tmp";
+    try
+    {
+        std::ofstream file(tmp.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file)
+            throw std::runtime_error("could not open '" + tmp + "' for writing");
+
+        snapshot_writer out(file);
+        out.write_u32(snapshot_magic);
+        out.write_u32(snapshot_version);
+        out.write_u32(snapshot_byte_order);
+        out.write_u32(columns_.size());
+        boost::ptr_vector<attribute_column>::const_iterator col = columns_.begin();
+        for (; col != columns_.end(); ++col)
+        {
+            out.write_string(col->name());
+            out.write_u32(col->type());
+        }
+        out.write_double(extent_.minx());
+        out.write_double(extent_.miny());
+        out.write_double(extent_.maxx());
+        out.write_double(extent_.maxy());
+        out.write_array(ids_);
+        out.write_array(part_begin_);
+        out.write_array(part_types_);
+        out.write_array(vertex_begin_);
+        out.write_array(xy_);
+        out.write_array(commands_);
+        out.write_array(boxes_);
+        index_.write(out);
+        for (col = columns_.begin(); col != columns_.end(); ++col)
+            col->write(out);
+
+        file.close();
+        if (!file)
+            throw std::runtime_error("failed to write '" + tmp + "'");
+    }
+    catch (...)
+    {
+        std::remove(tmp.c_str());
+        throw;
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("could not replace '" + path + "'");
+    }
+}
+
+column_store_ptr column_store::load(std::string const& path, bool use_mmap)
+{
+    namespace bip = boost::interprocess;
+
+    boost::shared_ptr<void const> owner;
+    char const* data = 0;
+    std::size_t size = 0;
+    if (use_mmap)
+    {
+        try
+        {
+            bip::file_mapping mapping(path.c_str(), bip::read_only);
+            boost::shared_ptr<bip::mapped_region> region(new bip::mapped_region(mapping, bip::read_only));
+            data = static_cast<char const*>(region->get_address());
+            size = region->get_size();
+            owner = region;
+        }
+        catch (bip::interprocess_exception const& ex)
+        {
+            throw std::runtime_error("could not map '" + path + "': " + ex.what());
+        }
+    }
+    else
+    {
+        std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+        if (!file)
+            throw std::runtime_error("could not open '" + path + "'");
+        file.seekg(0, std::ios::end);
+        size = file.tellg();
+        file.seekg(0, std::ios::beg);
+        // doubles keep the arrays 8 byte aligned
+        boost::shared_ptr<std::vector<double> > buffer(new std::vector<double>((size + 7) / 8));
+        if (size > 0)
+            file.read(reinterpret_cast<char*>(&(*buffer)[0]), size);
+        if (!file)
+            throw std::runtime_error("could not read '" + path + "'");
+        data = size > 0 ? reinterpret_cast<char const*>(&(*buffer)[0]) : 0;
+        owner = buffer;
+    }
+
+    snapshot_reader in(data, size, owner);
+    if (in.read_u32() != snapshot_magic)
+        throw std::runtime_error("'" + path + "' is not a memory datasource snapshot");
+    if (in.read_u32() != snapshot_version)
+        throw std::runtime_error("'" + path + "' was written by an incompatible version");
+    if (in.read_u32() != snapshot_byte_order)
+        throw std::runtime_error("'" + path + "' was written on a machine with a different byte order");
+
+    column_store_ptr store(new column_store());
+    store->read(in);
+    return store;
+}
+
+void column_store::read(snapshot_reader& in)
+{
+    uint32_t num_columns = in.read_u32();
+    for (uint32_t i = 0; i < num_columns; ++i)
+    {
+        std::string name = in.read_string();
+        uint32_t type = in.read_u32();
+        if (type > attribute_column::string_type)
+            throw std::runtime_error("snapshot has a column of unknown type");
+        columns_.push_back(new attribute_column(name, static_cast<attribute_column::value_type>(type)));
+    }
+    double minx = in.read_double();
+    double miny = in.read_double();
+    double maxx = in.read_double();
+    double maxy = in.read_double();
+    in.read_array(ids_);
+    if (!ids_.empty())
+        extent_ = mapnik::box2d<double>(minx, miny, maxx, maxy);
+    in.read_array(part_begin_);
+    in.read_array(part_types_);
+    in.read_array(vertex_begin_);
+    in.read_array(xy_);
+    in.read_array(commands_);
+    in.read_array(boxes_);
+    index_.read(in, ids_.size());
+    boost::ptr_vector<attribute_column>::iterator col = columns_.begin();
+    for (; col != columns_.end(); ++col)
+        col->read(in);
+
+    // only the shape of the arrays is checked, their contents are trusted
+    std::size_t rows = ids_.size();
+    bool valid = part_begin_.size() == rows + 1 &&
+        part_begin_.back() == part_types_.size() &&
+        vertex_begin_.size() == part_types_.size() + 1 &&
+        vertex_begin_.back() == commands_.size() &&
+        xy_.size() == commands_.size() * 2 &&
+        boxes_.size() == rows;
+    for (col = columns_.begin(); col != columns_.end(); ++col)
+        valid = valid && col->size() == rows;
+    if (!valid)
+        throw std::runtime_error("snapshot is inconsistent");
+}
+
+
+columnar_memory_datasource::columnar_memory_datasource(mapnik::parameters const& params,
+                                                       column_schema const& schema)
+    : writable_memory_datasource(params),
+      schema_(schema),
+      mutex_(),
+      store_(new column_store(schema)),
+      desc_("in-memory datasource","utf-8")
+{
+    init_descriptor();
+}
+
+columnar_memory_datasource::columnar_memory_datasource(mapnik::parameters const& params,
+                                                       column_store_ptr const& store)
+    : writable_memory_datasource(params),
+      schema_(store->schema()),
+      mutex_(),
+      store_(store),
+      desc_("in-memory datasource","utf-8")
+{
+    init_descriptor();
+}
+
+void columnar_memory_datasource::init_descriptor()
+{
+    column_schema::const_iterator itr = schema_.begin();
+    for (; itr != schema_.end(); ++itr)
+    {
+        mapnik::eAttributeType type = mapnik::String;
+        if (itr->type == attribute_column::int_type)
+            type = mapnik::Integer;
+        else if (itr->type == attribute_column::double_type)
+            type = mapnik::Double;
+        desc_.add_descriptor(mapnik::attribute_descriptor(itr->name, type));
+    }
+}
+
+columnar_memory_datasource::~columnar_memory_datasource() {}
+
+int columnar_memory_datasource::type() const
+{
+    return mapnik::datasource::Vector;
+}
+
+column_store_ptr columnar_memory_datasource::store() const
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return store_;
+}
+
+void columnar_memory_datasource::push(mapnik::feature_ptr const& feature)
+{
+    boost::mutex::scoped_lock write_lock(write_mutex_);
+    {
+        boost::mutex::scoped_lock lock(store_->mutex);
+        store_->push(feature);
+    }
+    maintain();
+}
+
+void columnar_memory_datasource::push(std::vector<mapnik::feature_ptr> const& features)
+{
+    boost::mutex::scoped_lock write_lock(write_mutex_);
+    {
+        boost::mutex::scoped_lock lock(store_->mutex);
+        std::vector<mapnik::feature_ptr>::const_iterator itr = features.begin();
+        std::vector<mapnik::feature_ptr>::const_iterator end = features.end();
+        for (; itr != end; ++itr)
+            store_->push(*itr);
+    }
+    maintain();
+}
+
+bool columnar_memory_datasource::update(mapnik::feature_ptr const& feature)
+{
+    boost::mutex::scoped_lock write_lock(write_mutex_);
+    std::size_t row;
+    bool found = store_->find_row(feature->id(), row);
+    {
+        boost::mutex::scoped_lock lock(store_->mutex);
+        if (found)
+            store_->remove(row);
+        store_->push(feature);
+    }
+    maintain();
+    return found;
+}
+
+bool columnar_memory_datasource::remove(int id)
+{
+    boost::mutex::scoped_lock write_lock(write_mutex_);
+    std::size_t row;
+    if (!store_->find_row(id, row))
+        return false;
+    {
+        boost::mutex::scoped_lock lock(store_->mutex);
+        store_->remove(row);
+    }
+    maintain();
+    return true;
+}
+
+// Only writers replace store_, so holding write_mutex_ we can use it
+// without mutex_.
+void columnar_memory_datasource::maintain()
+{
+    if (store_->needs_compaction())
+    {
+        // featuresets still reading the old store keep it alive
+        column_store_ptr s = store_->compact();
+        boost::mutex::scoped_lock lock(mutex_);
+        store_.swap(s);
+        return;
+    }
+    store_->update_index();
+}
+
+void columnar_memory_datasource::replace(std::vector<mapnik::feature_ptr>& features)
+{
+    column_store_ptr s(new column_store(schema_));
+    std::vector<mapnik::feature_ptr>::const_iterator itr = features.begin();
+    std::vector<mapnik::feature_ptr>::const_iterator end = features.end();
+    for (; itr != end; ++itr)
+        s->push(*itr);
+    features.clear();
+    s->build_index();
+
+    // nothing else can see s yet, so it needs no locking until here
+    boost::mutex::scoped_lock write_lock(write_mutex_);
+    boost::mutex::scoped_lock lock(mutex_);
+    store_.swap(s);
+}
+
+void columnar_memory_datasource::clear()
+{
+    column_store_ptr s(new column_store(schema_));
+    boost::mutex::scoped_lock write_lock(write_mutex_);
+    boost::mutex::scoped_lock lock(mutex_);
+    store_.swap(s);
+}
+
+void columnar_memory_datasource::save(std::string const& path) const
+{
+    boost::mutex::scoped_lock write_lock(write_mutex_);
+    store_->save(path);
+}
+
+mapnik::featureset_ptr columnar_memory_datasource::features_in_box(mapnik::box2d<double> const& box,
+                                                                   std::vector<std::size_t> const& columns) const
+{
+    column_store_ptr s = store();
+    std::vector<uint32_t> rows;
+    {
+        boost::mutex::scoped_lock lock(s->mutex);
+        s->query(box, rows);
+    }
+    return mapnik::featureset_ptr(new columnar_memory_featureset(s, rows, columns));
+}
+
+mapnik::featureset_ptr columnar_memory_datasource::features(mapnik::query const& q) const
+{
+    // only the attributes the query asks for are materialized
+    std::set<std::string> const& names = q.property_names();
+    std::vector<std::size_t> columns;
+    for (std::size_t i = 0; i < schema_.size(); ++i)
+    {
+        if (names.find(schema_[i].name) != names.end())
+            columns.push_back(i);
+    }
+    return features_in_box(q.get_bbox(), columns);
+}
+
+mapnik::featureset_ptr columnar_memory_datasource::features_at_point(mapnik::coord2d const& pt) const
+{
+    std::vector<std::size_t> columns;
+    for (std::size_t i = 0; i < schema_.size(); ++i)
+        columns.push_back(i);
+    return features_in_box(mapnik::box2d<double>(pt.x, pt.y, pt.x, pt.y), columns);
+}
+
+mapnik::box2d<double> columnar_memory_datasource::envelope() const
+{
+    column_store_ptr s = store();
+    boost::mutex::scoped_lock lock(s->mutex);
+    return s->extent();
+}
+
+mapnik::layer_descriptor columnar_memory_datasource::get_descriptor() const
+{
+    return desc_;
+}
+
+size_t columnar_memory_datasource::size() const
+{
+    column_store_ptr s = store();
+    boost::mutex::scoped_lock lock(s->mutex);
+    return s->size();
+}
+
+
+columnar_memory_featureset::columnar_memory_featureset(column_store_ptr const& store,
+                                                       std::vector<uint32_t>& rows,
+                                                       std::vector<std::size_t> const& columns)
+    : store_(store),
+      rows_(),
+      columns_(columns)
+{
+    rows_.swap(rows);
+    pos_ = rows_.begin();
+}
+
+columnar_memory_featureset::~columnar_memory_featureset() {}
+
+mapnik::feature_ptr columnar_memory_featureset::next()
+{
+    if (pos_ == rows_.end())
+        return mapnik::feature_ptr();
+
+    // the store may be appended to while we read it
+    boost::mutex::scoped_lock lock(store_->mutex);
+    return store_->materialize(*pos_++, columns_);
+}
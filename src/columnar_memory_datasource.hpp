@@ -0,0 +1,219 @@
+#ifndef __NODE_MAPNIK_COLUMNAR_MEMORY_DATASOURCE_H__
+#define __NODE_MAPNIK_COLUMNAR_MEMORY_DATASOURCE_H__
+
+// mapnik
+#include <mapnik/feature_layer_desc.hpp>
+#include <mapnik/query.hpp>
+#include <mapnik/unicode.hpp>
+#include <mapnik/value.hpp>
+
+// boost
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/utility.hpp>
+
+// stl
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "mappable_vector.hpp"
+#include "memory_snapshot.hpp"
+#include "leveled_index.hpp"
+#include "writable_memory_datasource.hpp"
+
+// In-memory datasource with a declared schema that keeps attributes in one
+// typed array per column instead of a property map per feature. Feature
+// objects are only created while a query iterates over them, and then only
+// with the attributes the query asks for.
+//
+// Per feature this costs the id, the vertices, a bounding box and one value
+// per column; string values are stored once per column as utf-8 and
+// referenced by a 32 bit code. Properties that are not in the schema are
+// dropped, values of the wrong type are converted where possible and
+// stored as null otherwise.
+//
+// All of it lives in flat arrays that can be saved as a snapshot and
+// mapped back in without parsing; see column_store::save and load.
+
+class attribute_column : private boost::noncopyable
+{
+public:
+    enum value_type
+    {
+        int_type,
+        double_type,
+        string_type
+    };
+
+    attribute_column(std::string const& name, value_type type);
+
+    std::string const& name() const { return name_; }
+    value_type type() const { return type_; }
+
+    void push(mapnik::value const& v);
+    void push_null();
+    // copies row of from, a column of the same type
+    void push_row(attribute_column const& from, std::size_t row);
+    // returns false if the value at row is null
+    bool get(std::size_t row, mapnik::value& v) const;
+    std::size_t size() const;
+
+    void write(snapshot_writer& out) const;
+    void read(snapshot_reader& in);
+
+private:
+    uint32_t string_code(std::string const& str);
+
+    std::string name_;
+    value_type type_;
+    mappable_vector<int> ints_;
+    mappable_vector<double> doubles_;
+    mappable_vector<unsigned char> valid_;
+    // code 0 is null, code n is the string from string_offsets_[n - 1]
+    // to string_offsets_[n] in string_data_
+    mappable_vector<uint32_t> codes_;
+    mappable_vector<uint32_t> string_offsets_;
+    mappable_vector<char> string_data_;
+    // built on the first string pushed, so mapped columns never need it
+    std::map<std::string, uint32_t> string_codes_;
+};
+
+struct column_def
+{
+    column_def(std::string const& name_, attribute_column::value_type type_)
+        : name(name_),
+          type(type_) {}
+
+    std::string name;
+    attribute_column::value_type type;
+};
+
+typedef std::vector<column_def> column_schema;
+
+// The rows of a columnar_memory_datasource. Rows are only appended and
+// removed rows are only flagged, so a featureset can keep reading the rows
+// it matched; compact(), replace() and clear() start a new store and leave
+// the old one to the featuresets still using it.
+class column_store : private boost::noncopyable
+{
+public:
+    explicit column_store(column_schema const& schema);
+
+    // Maps the snapshot at path, or reads it into memory if use_mmap is
+    // false. Mapped stores share the page cache with every other process
+    // mapping the same file; the first write to an array copies it.
+    static boost::shared_ptr<column_store> load(std::string const& path, bool use_mmap);
+
+    // the methods below assume the caller holds mutex
+    bool push(mapnik::feature_ptr const& feature);
+    void remove(std::size_t row);
+    void query(mapnik::box2d<double> const& box, std::vector<uint32_t>& rows) const;
+    mapnik::feature_ptr materialize(std::size_t row, std::vector<std::size_t> const& columns) const;
+    // rows that are not removed
+    std::size_t size() const { return ids_.size() - index_.num_removed(); }
+    mapnik::box2d<double> const& extent() const { return extent_; }
+    column_schema schema() const;
+
+    // The methods below only read the rows and take mutex themselves when
+    // they need it; the caller must keep everyone else from writing.
+
+    // latest row with that id, if it is not removed
+    bool find_row(int id, std::size_t& row);
+    // packs the unindexed tail into the index once it is long enough
+    void update_index();
+    // indexes every row; for stores that nobody queries yet
+    void build_index();
+    bool needs_compaction() const;
+    // a new store with the rows that are not removed, fully indexed
+    boost::shared_ptr<column_store> compact() const;
+    // writes a snapshot to path, without the removed rows; the file is
+    // replaced in one step, so processes mapping the old one are unaffected
+    void save(std::string const& path) const;
+
+    mutable boost::mutex mutex;
+
+private:
+    column_store();
+    void push_row(column_store const& from, std::size_t row);
+    void read(snapshot_reader& in);
+
+    mappable_vector<int> ids_;
+    // geometries of row i are parts [part_begin_[i], part_begin_[i + 1]),
+    // vertices of part j are [vertex_begin_[j], vertex_begin_[j + 1])
+    mappable_vector<uint32_t> part_begin_;
+    mappable_vector<unsigned char> part_types_;
+    mappable_vector<uint32_t> vertex_begin_;
+    mappable_vector<double> xy_;
+    mappable_vector<unsigned char> commands_;
+    mappable_vector<mapnik::box2d<double> > boxes_;
+    leveled_index index_;
+    mapnik::box2d<double> extent_;
+    boost::ptr_vector<attribute_column> columns_;
+    // id -> latest row, built on the first find_row()
+    boost::unordered_map<int, uint32_t> rows_by_id_;
+    bool has_row_map_;
+};
+
+typedef boost::shared_ptr<column_store> column_store_ptr;
+
+class columnar_memory_datasource : public writable_memory_datasource
+{
+public:
+    columnar_memory_datasource(mapnik::parameters const& params, column_schema const& schema);
+    // serves the features of a loaded snapshot
+    columnar_memory_datasource(mapnik::parameters const& params, column_store_ptr const& store);
+    virtual ~columnar_memory_datasource();
+    int type() const;
+    mapnik::featureset_ptr features(mapnik::query const& q) const;
+    mapnik::featureset_ptr features_at_point(mapnik::coord2d const& pt) const;
+    mapnik::box2d<double> envelope() const;
+    mapnik::layer_descriptor get_descriptor() const;
+    size_t size() const;
+
+    void push(mapnik::feature_ptr const& feature);
+    void push(std::vector<mapnik::feature_ptr> const& features);
+    void replace(std::vector<mapnik::feature_ptr>& features);
+    bool update(mapnik::feature_ptr const& feature);
+    bool remove(int id);
+    void clear();
+    void save(std::string const& path) const;
+
+private:
+    void init_descriptor();
+    column_store_ptr store() const;
+    // caller holds write_mutex_
+    void maintain();
+    mapnik::featureset_ptr features_in_box(mapnik::box2d<double> const& box,
+                                           std::vector<std::size_t> const& columns) const;
+
+    column_schema schema_;
+    // guards store_ itself, the store has its own mutex
+    mutable boost::mutex mutex_;
+    // serializes writers, see indexed_memory_datasource
+    mutable boost::mutex write_mutex_;
+    column_store_ptr store_;
+    mapnik::layer_descriptor desc_;
+};
+
+class columnar_memory_featureset : public mapnik::Featureset, private boost::noncopyable
+{
+public:
+    // takes over the contents of rows
+    columnar_memory_featureset(column_store_ptr const& store,
+                               std::vector<uint32_t>& rows,
+                               std::vector<std::size_t> const& columns);
+    virtual ~columnar_memory_featureset();
+    mapnik::feature_ptr next();
+
+private:
+    column_store_ptr store_;
+    std::vector<uint32_t> rows_;
+    std::vector<uint32_t>::const_iterator pos_;
+    std::vector<std::size_t> columns_;
+};
+
+#endif // __NODE_MAPNIK_COLUMNAR_MEMORY_DATASOURCE_H__
@@ -0,0 +1,171 @@
+#include "datasource_registry.hpp"
+
+// mapnik
+#include <mapnik/datasource_cache.hpp>
+
+// boost
+#include <boost/thread/mutex.hpp>
+
+// stl
+#include <map>
+
+namespace {
+
+typedef std::map<std::string, mapnik::datasource_ptr> registry_map;
+
+boost::mutex create_mutex;
+
+boost::mutex registry_mutex;
+registry_map registry;
+
+void append_escaped(std::string& out, std::string const& s)
+{
+    for (std::string::const_iterator it = s.begin(); it != s.end(); ++it)
+    {
+        if (*it == '\\' || *it == '=' || *it == '&')
+            out.push_back('\\');
+        out.push_back(*it);
+    }
+}
+
+// Plugins whose featuresets open their own files or connections, so one
+// instance can serve several renders at once. Others, like ogr and gdal,
+// read through a handle of the datasource and are never shared.
+bool is_reentrant_plugin(std::string const& type)
+{
+    return type == "shape" || type == "postgis";
+}
+
+// whether ds came from an input plugin that can be shared, rather than
+// being a js or memory datasource that lives with its js object
+bool is_shareable_datasource(mapnik::datasource_ptr const& ds)
+{
+    boost::optional<std::string> type = ds->params().get<std::string>("type");
+    return type && is_reentrant_plugin(*type);
+}
+
+// the registered datasource for key, registering ds if there is none
+mapnik::datasource_ptr register_datasource(std::string const& key, mapnik::datasource_ptr const& ds)
+{
+    boost::mutex::scoped_lock lock(registry_mutex);
+    std::pair<registry_map::iterator, bool> res = registry.insert(std::make_pair(key, ds));
+    return res.first->second;
+}
+
+} // namespace
+
+boost::mutex& datasource_create_mutex()
+{
+    return create_mutex;
+}
+
+mapnik::datasource_ptr create_datasource(mapnik::parameters const& params, bool bind)
+{
+    mapnik::datasource_ptr ds;
+    {
+        boost::mutex::scoped_lock lock(create_mutex);
+        ds = mapnik::datasource_cache::create(params, false);
+    }
+    if (ds && bind)
+        ds->bind();
+    return ds;
+}
+
+std::string datasource_key(mapnik::parameters const& params)
+{
+    std::string key;
+    mapnik::parameters::const_iterator it = params.begin();
+    mapnik::parameters::const_iterator end = params.end();
+    for (; it != end; ++it)
+    {
+        if (!key.empty())
+            key.push_back('&');
+        append_escaped(key, it->first);
+        key.push_back('=');
+        append_escaped(key, *params.get<std::string>(it->first, ""));
+    }
+    return key;
+}
+
+mapnik::datasource_ptr shared_datasource(mapnik::parameters const& params)
+{
+    boost::optional<std::string> type = params.get<std::string>("type");
+    if (!type || !is_reentrant_plugin(*type))
+        return create_datasource(params, true);
+
+    std::string key = datasource_key(params);
+    mapnik::datasource_ptr ds;
+    {
+        boost::mutex::scoped_lock lock(registry_mutex);
+        registry_map::const_iterator it = registry.find(key);
+        if (it != registry.end())
+            ds = it->second;
+    }
+    if (ds)
+        return ds;
+    // created and bound unlocked, so a slow source does not hold up the
+    // others
+    ds = create_datasource(params, true);
+    if (!ds)
+        return ds;
+    return register_datasource(key, ds);
+}
+
+mapnik::datasource_ptr share_datasource(mapnik::datasource_ptr const& ds)
+{
+    if (!ds || !is_shareable_datasource(ds))
+        return ds;
+    return register_datasource(datasource_key(ds->params()), ds);
+}
+
+void datasource_registry_entries(std::vector<datasource_registry_entry>& entries)
+{
+    boost::mutex::scoped_lock lock(registry_mutex);
+    entries.clear();
+    entries.reserve(registry.size());
+    for (registry_map::const_iterator it = registry.begin(); it != registry.end(); ++it)
+    {
+        datasource_registry_entry entry;
+        entry.key = it->first;
+        entry.refs = it->second.use_count() - 1;
+        entries.push_back(entry);
+    }
+}
+
+bool evict_datasource(std::string const& key)
+{
+    mapnik::datasource_ptr evicted;
+    {
+        boost::mutex::scoped_lock lock(registry_mutex);
+        registry_map::iterator it = registry.find(key);
+        if (it == registry.end())
+            return false;
+        // released after the lock, plugins close their files and
+        // connections in their destructors
+        evicted = it->second;
+        registry.erase(it);
+    }
+    return true;
+}
+
+unsigned evict_datasources(bool all)
+{
+    std::vector<mapnik::datasource_ptr> evicted;
+    {
+        boost::mutex::scoped_lock lock(registry_mutex);
+        registry_map::iterator it = registry.begin();
+        while (it != registry.end())
+        {
+            if (all || it->second.unique())
+            {
+                evicted.push_back(it->second);
+                registry.erase(it++);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+    return evicted.size();
+}
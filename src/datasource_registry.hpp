@@ -0,0 +1,69 @@
+#ifndef __NODE_MAPNIK_DATASOURCE_REGISTRY_H__
+#define __NODE_MAPNIK_DATASOURCE_REGISTRY_H__
+
+// mapnik
+#include <mapnik/datasource.hpp>
+#include <mapnik/params.hpp>
+
+// boost
+#include <boost/thread/mutex.hpp>
+
+// stl
+#include <string>
+#include <vector>
+
+// Creates a plugin datasource. datasource_cache::create() looks plugins up
+// with libltdl, so it is serialized across threads; bind(), where plugins
+// connect to their database and open and scan their files, runs unlocked.
+mapnik::datasource_ptr create_datasource(mapnik::parameters const& params, bool bind);
+
+// The lock create_datasource() holds around datasource_cache::create().
+// Anything else that creates plugin datasources, like load_map(), or that
+// registers or lists plugins takes it too.
+boost::mutex& datasource_create_mutex();
+
+// A process wide registry of plugin datasources, so every Map and
+// mapnik.Datasource with the same parameters shares one instance, and one
+// set of indexes and connections. Only the shape and postgis plugins are
+// shared: their featuresets open their own files or take a pooled
+// connection, so an instance can serve several renders at once. Others,
+// like ogr, move a cursor of the datasource itself while reading and get
+// an instance of their own.
+//
+// The registry holds a reference to each of its datasources until they are
+// evicted; evicting one only stops it from being handed out again.
+
+// The canonical form of params: name=value pairs in name order, values as
+// strings, so {file: 'a.shp', type: 'shape'} is the same in any order and
+// whether numbers were given as numbers or as strings.
+std::string datasource_key(mapnik::parameters const& params);
+
+// The registered datasource for params, created, bound and registered first
+// if there is none, or a new bound instance for plugins that are not
+// shared. Only bound datasources are registered, so the instances handed
+// out are never bound again while other threads query them. Threads racing
+// to create the same datasource all get the one that was registered first.
+mapnik::datasource_ptr shared_datasource(mapnik::parameters const& params);
+
+// The registered datasource with the parameters of ds, registering ds if
+// there is none. Datasources that are not from a shared plugin are
+// returned as is.
+mapnik::datasource_ptr share_datasource(mapnik::datasource_ptr const& ds);
+
+struct datasource_registry_entry
+{
+    std::string key;
+    // references held outside the registry
+    long refs;
+};
+
+void datasource_registry_entries(std::vector<datasource_registry_entry>& entries);
+
+// Drops the datasource with key from the registry; false if there is none.
+bool evict_datasource(std::string const& key);
+
+// Drops every datasource nothing outside the registry refers to, or every
+// datasource if all is set. Returns how many were dropped.
+unsigned evict_datasources(bool all);
+
+#endif // __NODE_MAPNIK_DATASOURCE_REGISTRY_H__
@@ -0,0 +1,301 @@
+#include "datasource_stats.hpp"
+
+// mapnik
+#include <mapnik/version.hpp>
+#include <mapnik/feature.hpp>
+#include <mapnik/feature_layer_desc.hpp>
+#include <mapnik/query.hpp>
+#include <mapnik/unicode.hpp>
+
+// boost
+#include <boost/thread/mutex.hpp>
+#include <boost/variant/static_visitor.hpp>
+#include <boost/weak_ptr.hpp>
+
+// stl
+#include <cmath>
+
+namespace {
+
+// 2^12 registers
+const unsigned hll_bits = 12;
+const unsigned hll_size = 1 << hll_bits;
+
+// FNV-1a, finished with the splitmix64 mixer so every bit of the hash
+// depends on every byte of the value
+uint64_t hash_value(std::string const& value)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (std::string::const_iterator it = value.begin(); it != value.end(); ++it)
+    {
+        h ^= static_cast<unsigned char>(*it);
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+enum value_kind
+{
+    kind_null,
+    kind_number,
+    kind_string
+};
+
+// booleans count as the numbers 0 and 1
+struct value_kind_of : public boost::static_visitor<value_kind>
+{
+    value_kind operator () ( bool ) const { return kind_number; }
+    value_kind operator () ( int ) const { return kind_number; }
+    value_kind operator () ( double ) const { return kind_number; }
+    value_kind operator () ( std::string const& ) const { return kind_string; }
+    value_kind operator () ( UnicodeString const& ) const { return kind_string; }
+
+    template <typename T>
+    value_kind operator () ( T const& ) const { return kind_null; }
+};
+
+struct value_as_double : public boost::static_visitor<double>
+{
+    double operator () ( bool val ) const { return val ? 1 : 0; }
+    double operator () ( int val ) const { return val; }
+    double operator () ( double val ) const { return val; }
+
+    template <typename T>
+    double operator () ( T const& ) const { return 0; }
+};
+
+void add_value(field_stats& field, mapnik::value const& value)
+{
+    value_kind kind = boost::apply_visitor(value_kind_of(), value.base());
+    if (kind == kind_null)
+    {
+        ++field.nulls;
+        return;
+    }
+    std::string text = value.to_string();
+    field.distinct.add(text);
+    if (kind == kind_number)
+    {
+        double number = boost::apply_visitor(value_as_double(), value.base());
+        if (field.numbers == 0 || number < field.min_number)
+            field.min_number = number;
+        if (field.numbers == 0 || number > field.max_number)
+            field.max_number = number;
+        ++field.numbers;
+    }
+    else
+    {
+        if (field.strings == 0 || text < field.min_string)
+            field.min_string = text;
+        if (field.strings == 0 || text > field.max_string)
+            field.max_string = text;
+        ++field.strings;
+    }
+}
+
+void scan(mapnik::datasource_ptr const& ds, datasource_stats& stats)
+{
+#if MAPNIK_VERSION >= 800
+    mapnik::query q(ds->envelope());
+#else
+    mapnik::query q(ds->envelope(),1.0,1.0);
+#endif
+
+    mapnik::layer_descriptor ld = ds->get_descriptor();
+    std::vector<mapnik::attribute_descriptor> const& desc = ld.get_descriptors();
+    std::vector<mapnik::attribute_descriptor>::const_iterator itr = desc.begin();
+    std::vector<mapnik::attribute_descriptor>::const_iterator end = desc.end();
+    for (; itr != end; ++itr)
+    {
+        q.add_property_name(itr->get_name());
+        stats.fields[itr->get_name()];
+    }
+
+    mapnik::featureset_ptr fs = ds->features(q);
+    if (!fs)
+        return;
+
+    typedef std::map<std::string,mapnik::value> properties;
+    mapnik::feature_ptr fp;
+    while ((fp = fs->next()))
+    {
+        for (unsigned i = 0; i < fp->num_geometries(); ++i)
+        {
+            mapnik::geometry_type const& geom = fp->get_geometry(i);
+            if (geom.num_points() == 0)
+                continue;
+            ++stats.geometry_types[geom.type()];
+            mapnik::box2d<double> box = geom.envelope();
+            if (stats.extent.valid())
+                stats.extent.expand_to_include(box);
+            else
+                stats.extent = box;
+        }
+
+        properties const& props = fp->props();
+        for (properties::const_iterator it = props.begin(); it != props.end(); ++it)
+        {
+            std::map<std::string, field_stats>::iterator field = stats.fields.find(it->first);
+            if (field == stats.fields.end())
+            {
+                // first seen now, so it was missing from the features before
+                field = stats.fields.insert(std::make_pair(it->first, field_stats())).first;
+                field->second.nulls = stats.count;
+            }
+            add_value(field->second, it->second);
+        }
+        ++stats.count;
+
+        // and the fields this feature lacks
+        for (std::map<std::string, field_stats>::iterator field = stats.fields.begin();
+             field != stats.fields.end(); ++field)
+        {
+            field_stats& f = field->second;
+            if (f.nulls + f.numbers + f.strings < stats.count)
+                ++f.nulls;
+        }
+    }
+}
+
+struct cache_entry
+{
+    cache_entry() : ds(), generation(0), stats() {}
+    // tells a datasource from a later one at the same address
+    boost::weak_ptr<mapnik::datasource> ds;
+    unsigned generation;
+    datasource_stats_ptr stats;
+};
+
+typedef std::map<mapnik::datasource const*, cache_entry> stats_cache;
+
+boost::mutex cache_mutex;
+stats_cache cache;
+
+// the entry of ds, replacing one left by a freed datasource; caller holds
+// cache_mutex
+cache_entry& entry_for(mapnik::datasource_ptr const& ds)
+{
+    cache_entry& entry = cache[ds.get()];
+    if (entry.ds.expired() || entry.ds.lock() != ds)
+    {
+        entry = cache_entry();
+        entry.ds = ds;
+    }
+    return entry;
+}
+
+// drops the entries of freed datasources; caller holds cache_mutex
+void sweep()
+{
+    stats_cache::iterator it = cache.begin();
+    while (it != cache.end())
+    {
+        if (it->second.ds.expired())
+            cache.erase(it++);
+        else
+            ++it;
+    }
+}
+
+} // namespace
+
+hyperloglog::hyperloglog()
+    : registers_(hll_size, 0) {}
+
+void hyperloglog::add(std::string const& value)
+{
+    uint64_t h = hash_value(value);
+    unsigned index = static_cast<unsigned>(h >> (64 - hll_bits));
+    // the position of the first 1 bit in the remaining bits
+    uint64_t rest = h << hll_bits;
+    unsigned char rank = 1;
+    while (rank <= 64 - hll_bits && !(rest & (1ULL << 63)))
+    {
+        rest <<= 1;
+        ++rank;
+    }
+    if (rank > registers_[index])
+        registers_[index] = rank;
+}
+
+double hyperloglog::estimate() const
+{
+    double m = hll_size;
+    double sum = 0;
+    unsigned zeros = 0;
+    for (unsigned i = 0; i < hll_size; ++i)
+    {
+        sum += std::ldexp(1.0, -registers_[i]);
+        if (registers_[i] == 0)
+            ++zeros;
+    }
+    double alpha = 0.7213 / (1 + 1.079 / m);
+    double e = alpha * m * m / sum;
+    // linear counting is more accurate for small sets; 64 bit hashes make
+    // the large range correction unnecessary
+    if (e <= 2.5 * m && zeros > 0)
+        e = m * std::log(m / zeros);
+    return e;
+}
+
+field_stats::field_stats()
+    : nulls(0),
+      numbers(0),
+      strings(0),
+      min_number(0),
+      max_number(0),
+      min_string(),
+      max_string(),
+      distinct() {}
+
+datasource_stats::datasource_stats()
+    : count(0),
+      extent(),
+      geometry_types(),
+      fields() {}
+
+datasource_stats_ptr datasource_statistics(mapnik::datasource_ptr const& ds)
+{
+    unsigned generation;
+    {
+        boost::mutex::scoped_lock lock(cache_mutex);
+        cache_entry& entry = entry_for(ds);
+        if (entry.stats)
+            return entry.stats;
+        generation = entry.generation;
+    }
+
+    boost::shared_ptr<datasource_stats> stats(new datasource_stats());
+    scan(ds, *stats);
+
+    boost::mutex::scoped_lock lock(cache_mutex);
+    sweep();
+    cache_entry& entry = entry_for(ds);
+    if (entry.generation == generation)
+        entry.stats = stats;
+    return stats;
+}
+
+datasource_stats_ptr cached_statistics(mapnik::datasource_ptr const& ds)
+{
+    boost::mutex::scoped_lock lock(cache_mutex);
+    stats_cache::const_iterator it = cache.find(ds.get());
+    if (it == cache.end() || it->second.ds.lock() != ds)
+        return datasource_stats_ptr();
+    return it->second.stats;
+}
+
+void invalidate_statistics(mapnik::datasource const* ds)
+{
+    boost::mutex::scoped_lock lock(cache_mutex);
+    stats_cache::iterator it = cache.find(ds);
+    if (it == cache.end())
+        return;
+    ++it->second.generation;
+    it->second.stats.reset();
+}
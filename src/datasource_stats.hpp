@@ -0,0 +1,73 @@
+#ifndef __NODE_MAPNIK_DATASOURCE_STATS_H__
+#define __NODE_MAPNIK_DATASOURCE_STATS_H__
+
+// mapnik
+#include <mapnik/box2d.hpp>
+#include <mapnik/datasource.hpp>
+
+// boost
+#include <boost/shared_ptr.hpp>
+
+// stl
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Estimates the number of distinct values in a stream in a fixed 4kB, with
+// a standard error of about 1.6%, after Flajolet et al., "HyperLogLog: the
+// analysis of a near-optimal cardinality estimation algorithm".
+class hyperloglog
+{
+public:
+    hyperloglog();
+    void add(std::string const& value);
+    double estimate() const;
+
+private:
+    std::vector<unsigned char> registers_;
+};
+
+struct field_stats
+{
+    field_stats();
+
+    // features without the property or with a null value
+    unsigned nulls;
+    unsigned numbers;
+    unsigned strings;
+    double min_number;
+    double max_number;
+    std::string min_string;
+    std::string max_string;
+    hyperloglog distinct;
+};
+
+// What one full scan of a datasource finds out.
+struct datasource_stats
+{
+    datasource_stats();
+
+    unsigned count;
+    // of the geometries; invalid if there are none
+    mapnik::box2d<double> extent;
+    // geometries by mapnik::eGeomType
+    std::map<int, unsigned> geometry_types;
+    std::map<std::string, field_stats> fields;
+};
+
+typedef boost::shared_ptr<datasource_stats const> datasource_stats_ptr;
+
+// The statistics of ds, scanned on the first call and cached until ds is
+// freed or invalidate_statistics(ds) is called. Scans the whole datasource,
+// so call it from the thread pool. Concurrent first calls each scan.
+datasource_stats_ptr datasource_statistics(mapnik::datasource_ptr const& ds);
+
+// The cached statistics of ds, or an empty pointer, without scanning.
+datasource_stats_ptr cached_statistics(mapnik::datasource_ptr const& ds);
+
+// Drops the statistics of ds, to be called after its features change. A
+// scan that overlaps the change is not cached.
+void invalidate_statistics(mapnik::datasource const* ds);
+
+#endif // __NODE_MAPNIK_DATASOURCE_STATS_H__
@@ -8,13 +8,45 @@
 #include <node.h>
 
 // mapnik
+#include <mapnik/version.hpp>
 #include <mapnik/layer.hpp>
 #include <mapnik/params.hpp>
 #include <mapnik/feature_layer_desc.hpp>
+#if MAPNIK_VERSION >= 800
+#include <mapnik/filter_factory.hpp>
+#include <mapnik/attribute_collector.hpp>
+#endif
+
+#include "datasource_stats.hpp"
+#include "filtered_featureset.hpp"
+
+// boost
+#include <boost/optional.hpp>
+
+// stl
+#include <cmath>
+#include <set>
+#include <string>
+#include <vector>
 
 using namespace v8;
 using namespace node;
 
+static const char* geometry_type_name(int type)
+{
+    switch (type)
+    {
+        case mapnik::Point:
+            return "point";
+        case mapnik::LineString:
+            return "linestring";
+        case mapnik::Polygon:
+            return "polygon";
+        default:
+            return "unknown";
+    }
+}
+
 static void describe_datasource(Local<Object> description, mapnik::datasource_ptr ds)
 {
 
@@ -73,6 +105,22 @@ static void describe_datasource(Local<Object> description, mapnik::datasource_pt
     }
     description->Set(String::NewSymbol("fields"), fields);
 
+    // with statistics already scanned, the most common geometry type
+    datasource_stats_ptr stats = cached_statistics(ds);
+    if (stats)
+    {
+        description->Set(String::NewSymbol("has_features"), Boolean::New(stats->count > 0));
+        description->Set(String::NewSymbol("geometry_type"), Undefined());
+        std::map<int, unsigned>::const_iterator t = stats->geometry_types.begin();
+        std::map<int, unsigned>::const_iterator common = t;
+        for (; t != stats->geometry_types.end(); ++t)
+            if (t->second > common->second)
+                common = t;
+        if (common != stats->geometry_types.end())
+            description->Set(String::NewSymbol("geometry_type"), String::New(geometry_type_name(common->first)));
+        return;
+    }
+
     // get first geometry type using naive first hit approach
     // TODO proper approach --> https://trac.mapnik.org/ticket/701
 #if MAPNIK_VERSION >= 800
@@ -158,7 +206,10 @@ static void datasource_features(Local<Array> a, mapnik::datasource_ptr ds, unsig
         unsigned idx = 0;
         while ((fp = fs->next()))
         {
-            if  ((idx >= first) && (idx <= last || last == 0)) {
+            // the rest would only be skipped
+            if (last != 0 && idx > last)
+                break;
+            if (idx >= first) {
                 std::map<std::string,mapnik::value> const& fprops = fp->props();
                 Local<Object> feat = Object::New();
                 std::map<std::string,mapnik::value>::const_iterator it = fprops.begin();
@@ -181,123 +232,195 @@ static void datasource_features(Local<Array> a, mapnik::datasource_ptr ds, unsig
     }
 }
 
-/*
-// start, limit
-static void datasource_stats(Local<Object> stats, mapnik::datasource_ptr ds, unsigned first, unsigned last)
+// Reads the options of datasource.featureset([options]):
+//
+//   extent: [minx, miny, maxx, maxy], only features within it
+//   properties: [names], the only properties to read, plus those the
+//               filter uses
+//   filter: a mapnik expression, eg "[POP2005] > 1000000", only features
+//           it is true for
+//
+// Returns false with the error in error_name if they are malformed.
+static bool featureset_options(Local<Value> arg,
+                               boost::optional<mapnik::box2d<double> >& extent,
+                               std::vector<std::string>& names,
+                               std::string& filter,
+                               std::string& error_name)
 {
-    // TODO 
-    // for strings, collect first 15 unique
-    // allow options to specific which fields
+    if (arg->IsUndefined())
+        return true;
+    if (!arg->IsObject())
+    {
+        error_name = "options must be an object, eg {extent: [minx, miny, maxx, maxy], properties: ['name'], filter: \"[name] = 'a'\"}";
+        return false;
+    }
+    Local<Object> options = arg->ToObject();
+
+    if (options->Has(String::NewSymbol("extent")))
+    {
+        Local<Value> e = options->Get(String::NewSymbol("extent"));
+        if (!e->IsArray() || Local<Array>::Cast(e)->Length() != 4)
+        {
+            error_name = "'extent' must be an array of [minx, miny, maxx, maxy]";
+            return false;
+        }
+        Local<Array> a = Local<Array>::Cast(e);
+        extent = mapnik::box2d<double>(a->Get(0)->NumberValue(),
+                                       a->Get(1)->NumberValue(),
+                                       a->Get(2)->NumberValue(),
+                                       a->Get(3)->NumberValue());
+    }
+
+    if (options->Has(String::NewSymbol("properties")))
+    {
+        Local<Value> p = options->Get(String::NewSymbol("properties"));
+        if (!p->IsArray())
+        {
+            error_name = "'properties' must be an array of property names";
+            return false;
+        }
+        Local<Array> a = Local<Array>::Cast(p);
+        for (uint32_t i = 0; i < a->Length(); ++i)
+            names.push_back(TOSTR(a->Get(i)));
+    }
 
+    if (options->Has(String::NewSymbol("filter")))
+    {
+        Local<Value> f = options->Get(String::NewSymbol("filter"));
+        if (!f->IsString())
+        {
+            error_name = "'filter' must be a string, eg \"[name] = 'a'\"";
+            return false;
+        }
 #if MAPNIK_VERSION >= 800
-    mapnik::query q(ds->envelope());
+        filter = TOSTR(f);
 #else
-    mapnik::query q(ds->envelope(),1.0,1.0);
+        error_name = "'filter' needs mapnik 0.8 or later";
+        return false;
 #endif
+    }
+    return true;
+}
 
-    mapnik::layer_descriptor ld = ds->get_descriptor();
-    std::vector<mapnik::attribute_descriptor> const& desc = ld.get_descriptors();
-    Local<Object> fields = Object::New();
-    std::vector<mapnik::attribute_descriptor>::const_iterator itr = desc.begin();
-    std::vector<mapnik::attribute_descriptor>::const_iterator end = desc.end();
-    unsigned int size = 0;
-    typedef std::vector<mapnik::value> vals;
-    std::map<std::string, vals > values;
-    //Local<Object> values = Object::New();
-    while (itr != end)
+// Queries ds within extent, or all of it, for the properties in names, or
+// all of the ones it describes, and keeps the features filter, unless
+// empty, is true for. Throws if the filter does not parse.
+static mapnik::featureset_ptr datasource_featureset(mapnik::datasource_ptr ds,
+                                                    boost::optional<mapnik::box2d<double> > const& extent,
+                                                    std::vector<std::string> const& names,
+                                                    std::string const& filter)
+{
+    mapnik::box2d<double> box = extent ? *extent : ds->envelope();
+#if MAPNIK_VERSION >= 800
+    mapnik::query q(box);
+#else
+    mapnik::query q(box,1.0,1.0);
+#endif
+
+    if (names.empty())
     {
-        q.add_property_name(itr->get_name());
-        Local<Object> field_hash = Object::New();
-        int field_type = itr->get_type();
-        std::string type("");
-        if (field_type == 1) type = "Number";
-        else if (field_type == 2) type = "Number";
-        else if (field_type == 3) type = "Number";
-        else if (field_type == 4) type = "String";
-        else if (field_type == 5) type = "Geometry";
-        else if (field_type == 6) type = "Mapnik Object";
-        field_hash->Set(String::NewSymbol("type"),String::New(type.c_str()));
-        fields->Set(String::NewSymbol(itr->get_name().c_str()),field_hash);
-        //values->Set(String::NewSymbol(itr->get_name().c_str()),Local<Array>::New());
-        ++itr;
-        ++size;
+        mapnik::layer_descriptor ld = ds->get_descriptor();
+        std::vector<mapnik::attribute_descriptor> const& desc = ld.get_descriptors();
+        std::vector<mapnik::attribute_descriptor>::const_iterator itr = desc.begin();
+        std::vector<mapnik::attribute_descriptor>::const_iterator end = desc.end();
+        for (; itr != end; ++itr)
+            q.add_property_name(itr->get_name());
+    }
+    else
+    {
+        std::vector<std::string>::const_iterator itr = names.begin();
+        for (; itr != names.end(); ++itr)
+            q.add_property_name(*itr);
     }
-    stats->Set(String::NewSymbol("fields"), fields);
 
-    // todo - ability to get mapnik features without also parseing geometries
-    mapnik::featureset_ptr fs = ds->features(q);
-    unsigned idx = 0;
-    if (fs)
+#if MAPNIK_VERSION >= 800
+    if (!filter.empty())
     {
-        mapnik::feature_ptr fp;
-        typedef std::map<std::string,mapnik::value> properties;
-        properties min_prop;
-        properties max_prop;
-        first = true;
-        while ((fp = fs->next()))
+        mapnik::expression_ptr expr = mapnik::parse_expression(filter, "utf8");
+        // the filter needs its properties read even if names leaves them out
+        if (!names.empty())
         {
-            ++idx;
-            properties const& fprops = fp->props();
-            properties::const_iterator it;
-            properties::const_iterator end;
-            if (first){
-                first = false;
-                it = fprops.begin();
-                end = fprops.end();
-                for (; it != end; ++it)
-                {
-                    min_prop[it->first] = it->second;
-                    max_prop[it->first] = it->second;
-                    vals& v = values[it->first];
-                    if(std::find(v.begin(), v.end(), it->second) == v.end()) {
-                        v.push_back(it->second);
-                    }
-                }
-            }
-            else
-            {
-                it = fprops.begin();
-                end = fprops.end();
-                for (; it != end; ++it)
-                {
-                    vals& v = values[it->first];
-                    if(std::find(v.begin(), v.end(), it->second) == v.end()) {
-                        v.push_back(it->second);
-                        if (it->second > max_prop[it->first])
-                            max_prop[it->first] = it->second;
-                            
-                        if (it->second < min_prop[it->first])
-                            min_prop[it->first] = it->second;
-                    }
-                }
-            }
+            std::set<std::string> filter_names;
+            mapnik::expression_attributes collector(filter_names);
+            boost::apply_visitor(collector, *expr);
+            std::set<std::string>::const_iterator itr = filter_names.begin();
+            for (; itr != filter_names.end(); ++itr)
+                q.add_property_name(*itr);
         }
-        
-        Local<Array> names = fields->GetPropertyNames();
-        uint32_t i = 0;
-        uint32_t a_length = names->Length();
-        while (i < a_length) {
-            Local<Value> name = names->Get(i)->ToString();
-            Local<Object> hash = fields->Get(name)->ToObject();
-            std::string key = TOSTR(name);
-            params_to_object serializer_min(hash, "min");
-            boost::apply_visitor( serializer_min, min_prop[key].base() );
-            params_to_object serializer_max(hash, "max");
-            boost::apply_visitor( serializer_max, max_prop[key].base() );
-            vals& v = values[key];
-            unsigned int num_vals = v.size();
-            Local<Array> a = Array::New(num_vals);
-            for (unsigned j = 0; j < num_vals; ++j)
-            {
-                a->Set(j, boost::apply_visitor(value_converter(),v[j].base()) );
-            }
-            hash->Set(String::NewSymbol("values"),a);
-            i++;
-        }
-        
+        mapnik::featureset_ptr fs = ds->features(q);
+        if (!fs)
+            return fs;
+        return mapnik::featureset_ptr(new filtered_featureset(fs, expr));
     }
-    
-    stats->Set(String::NewSymbol("count"), Number::New(idx));
+#endif
+    return ds->features(q);
 }
-*/
+
+// {count, extent, geometry_types: {point: n, ...},
+//  fields: {name: {type, min, max, nulls, distinct}}}, where type is
+// 'Number', 'String', 'Mixed' or undefined if every value is null, and
+// distinct is an estimate.
+static Local<Object> statistics_to_object(datasource_stats const& stats)
+{
+    HandleScope scope;
+    Local<Object> result = Object::New();
+    result->Set(String::NewSymbol("count"), Number::New(stats.count));
+
+    if (stats.extent.valid())
+    {
+        Local<Array> a = Array::New(4);
+        a->Set(0, Number::New(stats.extent.minx()));
+        a->Set(1, Number::New(stats.extent.miny()));
+        a->Set(2, Number::New(stats.extent.maxx()));
+        a->Set(3, Number::New(stats.extent.maxy()));
+        result->Set(String::NewSymbol("extent"), a);
+    }
+    else
+    {
+        result->Set(String::NewSymbol("extent"), Undefined());
+    }
+
+    Local<Object> types = Object::New();
+    std::map<int, unsigned>::const_iterator t = stats.geometry_types.begin();
+    for (; t != stats.geometry_types.end(); ++t)
+    {
+        Local<String> name = String::NewSymbol(geometry_type_name(t->first));
+        unsigned count = t->second + types->Get(name)->Uint32Value();
+        types->Set(name, Number::New(count));
+    }
+    result->Set(String::NewSymbol("geometry_types"), types);
+
+    Local<Object> fields = Object::New();
+    std::map<std::string, field_stats>::const_iterator f = stats.fields.begin();
+    for (; f != stats.fields.end(); ++f)
+    {
+        field_stats const& field = f->second;
+        Local<Object> hash = Object::New();
+        if (field.numbers > 0 && field.strings > 0)
+            hash->Set(String::NewSymbol("type"), String::New("Mixed"));
+        else if (field.numbers > 0)
+            hash->Set(String::NewSymbol("type"), String::New("Number"));
+        else if (field.strings > 0)
+            hash->Set(String::NewSymbol("type"), String::New("String"));
+        else
+            hash->Set(String::NewSymbol("type"), Undefined());
+
+        // numbers sort before strings
+        if (field.numbers > 0)
+            hash->Set(String::NewSymbol("min"), Number::New(field.min_number));
+        else if (field.strings > 0)
+            hash->Set(String::NewSymbol("min"), String::New(field.min_string.c_str()));
+        if (field.strings > 0)
+            hash->Set(String::NewSymbol("max"), String::New(field.max_string.c_str()));
+        else if (field.numbers > 0)
+            hash->Set(String::NewSymbol("max"), Number::New(field.max_number));
+
+        hash->Set(String::NewSymbol("nulls"), Number::New(field.nulls));
+        hash->Set(String::NewSymbol("distinct"), Number::New(std::floor(field.distinct.estimate() + 0.5)));
+        fields->Set(String::NewSymbol(f->first.c_str()), hash);
+    }
+    result->Set(String::NewSymbol("fields"), fields);
+    return scope.Close(result);
+}
+
 #endif
@@ -0,0 +1,327 @@
+#ifndef __NODE_MAPNIK_FEATURE_BATCH_H__
+#define __NODE_MAPNIK_FEATURE_BATCH_H__
+
+// v8
+#include <v8.h>
+
+// mapnik
+#include <mapnik/feature.hpp>
+#include <mapnik/unicode.hpp>
+
+// stl
+#include <climits>
+#include <cmath>
+#include <exception>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "feature_reader.hpp"
+#include "utils.hpp"
+
+using namespace v8;
+
+// Features given to mapnik.MemoryDatasource and mapnik.JSDatasource from
+// javascript, either as one object per feature:
+//
+//   {x: 1, y: 2, properties: {...}}  or  {wkt: 'POINT (1 2)', properties: {...}}
+//
+// or as a batch of points with one array per coordinate and property:
+//
+//   {x: Float64Array, y: Float64Array, ids: Uint32Array,
+//    columns: {name: [...], speed: Float64Array}}
+//
+// Batches are copied out of V8 in one pass, so the features can be built
+// later and off the main thread.
+//
+// The readers take the set of property names to copy, usually the ones a
+// query asks for; null copies all of them. Properties that are left out are
+// never converted from V8.
+
+static inline bool wanted_property(std::set<std::string> const* names, std::string const& name)
+{
+    return !names || names->find(name) != names->end();
+}
+
+// Builds the feature with the given id described by obj. feature is left
+// empty if obj has neither x and y nor wkt; returns false with the error in
+// error_name if the wkt is invalid.
+static bool feature_from_object(Local<Object> obj,
+                                int id,
+                                mapnik::transcoder const& tr,
+                                mapnik::feature_ptr& feature,
+                                std::string& error_name,
+                                std::set<std::string> const* names = 0)
+{
+    if (obj->Has(String::New("wkt")))
+    {
+        std::string wkt = TOSTR(obj->Get(String::New("wkt")));
+        std::vector<mapnik::feature_ptr> parsed;
+        int next_id = id;
+        try
+        {
+            read_wkt(wkt.data(), wkt.size(), parsed, next_id);
+        }
+        catch (const std::exception & ex)
+        {
+            error_name = ex.what();
+            return false;
+        }
+        if (parsed.size() != 1)
+        {
+            error_name = "'wkt' must hold exactly one geometry";
+            return false;
+        }
+        feature = parsed[0];
+    }
+    else if (obj->Has(String::New("x")) && obj->Has(String::New("y")))
+    {
+        Local<Value> x = obj->Get(String::New("x"));
+        Local<Value> y = obj->Get(String::New("y"));
+        if (!x->IsUndefined() && x->IsNumber() && !y->IsUndefined() && y->IsNumber())
+        {
+            mapnik::geometry_type * pt = new mapnik::geometry_type(mapnik::Point);
+            pt->move_to(x->NumberValue(),y->NumberValue());
+            feature.reset(new mapnik::Feature(id));
+            feature->add_geometry(pt);
+        }
+    }
+
+    if (feature && obj->Has(String::New("properties")))
+    {
+        Local<Value> props = obj->Get(String::New("properties"));
+        if (props->IsObject())
+        {
+            Local<Object> p_obj = props->ToObject();
+            Local<Array> keys = p_obj->GetPropertyNames();
+            uint32_t a_length = keys->Length();
+            for (uint32_t i = 0; i < a_length; ++i)
+            {
+                Local<Value> name = keys->Get(i)->ToString();
+                std::string key = TOSTR(name);
+                if (!wanted_property(names, key))
+                    continue;
+                Local<Value> value = p_obj->Get(name);
+                if (value->IsString()) {
+                    UnicodeString ustr = tr.transcode(TOSTR(value));
+                    boost::put(*feature,key,ustr);
+                } else if (value->IsNumber()) {
+                    double num = value->NumberValue();
+                    // todo - round
+                    if (num == value->IntegerValue()) {
+                        int integer = value->IntegerValue();
+                        boost::put(*feature,key,integer);
+                    } else {
+                        double dub_val = value->NumberValue();
+                        boost::put(*feature,key,dub_val);
+                    }
+                } else {
+                    std::clog << "unhandled type for property: " << key << "\n";
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// One property column of a batch.
+struct batch_column
+{
+    enum value_kind
+    {
+        kind_none = 0,
+        kind_int,
+        kind_double,
+        kind_string
+    };
+
+    std::string name;
+    std::vector<char> kinds;
+    std::vector<double> numbers;
+    std::vector<std::string> strings;
+};
+
+struct point_batch
+{
+    std::vector<double> x;
+    std::vector<double> y;
+    // empty unless the batch has ids
+    std::vector<double> ids;
+    std::vector<batch_column> columns;
+
+    std::size_t size() const { return x.size(); }
+};
+
+// whether num can be stored as an int property or feature id
+static inline bool fits_int(double num)
+{
+    return num == std::floor(num) && num >= INT_MIN && num <= INT_MAX;
+}
+
+// whether obj is a batch rather than a single feature
+static inline bool is_point_batch(Local<Object> obj)
+{
+    Local<Value> x = obj->Get(String::NewSymbol("x"));
+    return x->IsArray() || (x->IsObject() && x->ToObject()->HasIndexedPropertiesInExternalArrayData());
+}
+
+// Reads one column into col, returns false if it is not an array of
+// length n.
+static bool read_batch_column(Local<Value> value, std::size_t n, batch_column& col)
+{
+    bool integral = false;
+    if (value->IsObject() && value->ToObject()->HasIndexedPropertiesInExternalArrayData())
+    {
+        if (!read_number_array(value, col.numbers, integral) || col.numbers.size() != n)
+            return false;
+        col.kinds.assign(n, batch_column::kind_double);
+        // Uint32Array values above INT_MAX stay doubles
+        if (integral)
+            for (std::size_t i = 0; i < n; ++i)
+                if (fits_int(col.numbers[i]))
+                    col.kinds[i] = batch_column::kind_int;
+        return true;
+    }
+
+    if (!value->IsArray())
+        return false;
+    Local<Array> a = Local<Array>::Cast(value);
+    if (a->Length() != n)
+        return false;
+
+    col.kinds.assign(n, batch_column::kind_none);
+    col.numbers.assign(n, 0);
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        Local<Value> v = a->Get(i);
+        if (v->IsString()) {
+            if (col.strings.empty())
+                col.strings.resize(n);
+            col.strings[i] = TOSTR(v);
+            col.kinds[i] = batch_column::kind_string;
+        } else if (v->IsNumber()) {
+            double num = v->NumberValue();
+            col.numbers[i] = num;
+            col.kinds[i] = fits_int(num) ? batch_column::kind_int : batch_column::kind_double;
+        }
+        // null, undefined and other types leave the property unset
+    }
+    return true;
+}
+
+// Copies the arrays of obj into batch; returns false with the error in
+// error_name if they are missing or their lengths differ. Columns not in
+// names are skipped unchecked.
+static bool read_point_batch(Local<Object> obj,
+                             point_batch& batch,
+                             std::string& error_name,
+                             std::set<std::string> const* names = 0)
+{
+    bool integral;
+    if (!read_number_array(obj->Get(String::NewSymbol("x")), batch.x, integral) ||
+        !read_number_array(obj->Get(String::NewSymbol("y")), batch.y, integral))
+    {
+        error_name = "'x' and 'y' must be arrays of numbers";
+        return false;
+    }
+
+    std::size_t n = batch.x.size();
+    if (batch.y.size() != n)
+    {
+        error_name = "'x' and 'y' must have the same length";
+        return false;
+    }
+
+    if (obj->Has(String::NewSymbol("ids")))
+    {
+        bool valid = read_number_array(obj->Get(String::NewSymbol("ids")), batch.ids, integral) &&
+                     batch.ids.size() == n;
+        for (std::size_t i = 0; valid && i < n; ++i)
+            valid = fits_int(batch.ids[i]);
+        if (!valid)
+        {
+            error_name = "'ids' must be an array of 32 bit integers with the same length as 'x'";
+            return false;
+        }
+    }
+
+    if (obj->Has(String::NewSymbol("columns")))
+    {
+        Local<Value> columns = obj->Get(String::NewSymbol("columns"));
+        if (!columns->IsObject())
+        {
+            error_name = "'columns' must be an object of arrays";
+            return false;
+        }
+        Local<Object> c_obj = columns->ToObject();
+        Local<Array> keys = c_obj->GetPropertyNames();
+        uint32_t a_length = keys->Length();
+        batch.columns.reserve(a_length);
+        for (uint32_t i = 0; i < a_length; ++i)
+        {
+            Local<Value> name = keys->Get(i)->ToString();
+            std::string key = TOSTR(name);
+            if (!wanted_property(names, key))
+                continue;
+            batch.columns.push_back(batch_column());
+            batch_column& col = batch.columns.back();
+            col.name = key;
+            if (!read_batch_column(c_obj->Get(name), n, col))
+            {
+                std::ostringstream s;
+                s << "column '" << col.name << "' must be an array with the same length as 'x'";
+                error_name = s.str();
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Appends the point features of batch to features; without ids they are
+// numbered from first_id. Does not touch V8.
+static void build_point_batch(point_batch const& batch,
+                              unsigned int first_id,
+                              mapnik::transcoder const& tr,
+                              std::vector<mapnik::feature_ptr>& features)
+{
+    std::size_t n = batch.size();
+    bool has_ids = !batch.ids.empty();
+    features.reserve(features.size() + n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        int id = has_ids ? static_cast<int>(batch.ids[i]) : static_cast<int>(first_id + i);
+        mapnik::feature_ptr feature(new mapnik::Feature(id));
+        mapnik::geometry_type * pt = new mapnik::geometry_type(mapnik::Point);
+        pt->move_to(batch.x[i],batch.y[i]);
+        feature->add_geometry(pt);
+
+        std::vector<batch_column>::const_iterator col = batch.columns.begin();
+        std::vector<batch_column>::const_iterator end = batch.columns.end();
+        for (; col != end; ++col)
+        {
+            switch (col->kinds[i])
+            {
+            case batch_column::kind_int:
+                boost::put(*feature,col->name,static_cast<int>(col->numbers[i]));
+                break;
+            case batch_column::kind_double:
+                boost::put(*feature,col->name,col->numbers[i]);
+                break;
+            case batch_column::kind_string:
+            {
+                UnicodeString ustr = tr.transcode(col->strings[i].c_str());
+                boost::put(*feature,col->name,ustr);
+                break;
+            }
+            default:
+                break;
+            }
+        }
+        features.push_back(feature);
+    }
+}
+
+#endif // __NODE_MAPNIK_FEATURE_BATCH_H__
@@ -0,0 +1,1223 @@
+#include "feature_reader.hpp"
+
+// mapnik
+#include <mapnik/unicode.hpp>
+#include <mapnik/value.hpp>
+
+// boost
+#include <boost/utility.hpp>
+
+// stl
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <stdint.h>
+
+namespace {
+
+typedef std::vector<std::pair<std::string, mapnik::value> > property_list;
+
+// Owns geometries until they are handed to a feature.
+class geometry_list : private boost::noncopyable
+{
+public:
+    geometry_list() {}
+
+    ~geometry_list()
+    {
+        clear();
+    }
+
+    bool empty() const { return items_.empty(); }
+
+    void push_back(mapnik::geometry_type * geom)
+    {
+        try
+        {
+            items_.push_back(geom);
+        }
+        catch (...)
+        {
+            delete geom;
+            throw;
+        }
+    }
+
+    void splice(geometry_list& other)
+    {
+        items_.insert(items_.end(), other.items_.begin(), other.items_.end());
+        other.items_.clear();
+    }
+
+    void release_into(mapnik::Feature& feature)
+    {
+        std::vector<mapnik::geometry_type*>::iterator itr = items_.begin();
+        for (; itr != items_.end(); ++itr)
+        {
+            mapnik::geometry_type * geom = *itr;
+            *itr = 0;
+            feature.add_geometry(geom);
+        }
+        items_.clear();
+    }
+
+    void clear()
+    {
+        std::vector<mapnik::geometry_type*>::iterator itr = items_.begin();
+        for (; itr != items_.end(); ++itr)
+            delete *itr;
+        items_.clear();
+    }
+
+private:
+    std::vector<mapnik::geometry_type*> items_;
+};
+
+static void make_feature(int id, geometry_list& geoms, property_list const& props,
+                         std::vector<mapnik::feature_ptr>& features)
+{
+    mapnik::feature_ptr feature(new mapnik::Feature(id));
+    geoms.release_into(*feature);
+    property_list::const_iterator itr = props.begin();
+    for (; itr != props.end(); ++itr)
+        boost::put(*feature, itr->first, itr->second);
+    features.push_back(feature);
+}
+
+// Points are x, y pairs; a ring is a run of points starting with move_to.
+static mapnik::geometry_type * make_path(mapnik::eGeomType type, double const* xy, unsigned num_points)
+{
+    mapnik::geometry_type * geom = new mapnik::geometry_type(type);
+    geom->move_to(xy[0], xy[1]);
+    for (unsigned i = 1; i < num_points; ++i)
+        geom->line_to(xy[i * 2], xy[i * 2 + 1]);
+    return geom;
+}
+
+static void add_ring(mapnik::geometry_type & geom, double const* xy, unsigned num_points)
+{
+    geom.move_to(xy[0], xy[1]);
+    for (unsigned i = 1; i < num_points; ++i)
+        geom.line_to(xy[i * 2], xy[i * 2 + 1]);
+}
+
+static void parse_error(char const* format, std::size_t offset, char const* what)
+{
+    std::ostringstream s;
+    s << format << " parse error at byte " << offset << ": " << what;
+    throw std::runtime_error(s.str());
+}
+
+//
+// GeoJSON
+//
+
+// GeoJSON coordinates, flattened. depth is 1 for a position, 2 for an
+// array of positions, 3 for an array of those and 4 for MultiPolygon
+// coordinates; sizes[d - 2] lists the number of children of every array
+// of depth d, in document order. Empty arrays are dropped.
+struct coord_array
+{
+    coord_array()
+        : depth(0) {}
+
+    int depth;
+    std::vector<double> xy;
+    std::vector<unsigned> sizes[3];
+};
+
+// Whatever a JSON object can contribute to a feature. The members of a
+// GeoJSON object may come in any order, so geometries are built only once
+// the whole object, and with it the type, has been read.
+struct json_object : private boost::noncopyable
+{
+    json_object()
+        : has_id(false),
+          id(0) {}
+
+    std::string type;
+    coord_array coords;
+    geometry_list geometries;
+    property_list properties;
+    bool has_id;
+    int id;
+};
+
+// GeoJSON objects nested deeper than this, geometry collections in
+// geometry collections say, are refused rather than recursed into
+static const unsigned max_object_nesting = 32;
+
+class geojson_parser : private boost::noncopyable
+{
+public:
+    geojson_parser(char const* data, std::size_t size,
+                   std::vector<mapnik::feature_ptr>& features, int& next_id)
+        : begin_(data),
+          pos_(data),
+          end_(data + size),
+          features_(features),
+          next_id_(next_id),
+          tr_("utf8"),
+          ids_(),
+          unnumbered_() {}
+
+    ~geojson_parser()
+    {
+        for (std::size_t i = 0; i < unnumbered_.size(); ++i)
+            delete unnumbered_[i];
+    }
+
+    // A single GeoJSON object, or several of them one after the other as
+    // in newline delimited GeoJSON.
+    void parse()
+    {
+        skip_ws();
+        while (pos_ < end_)
+        {
+            json_object obj;
+            parse_object(obj, 0);
+            if (obj.type != "FeatureCollection")
+                emit_feature(obj);
+            skip_ws();
+            if (pos_ < end_ && *pos_ == ',')
+            {
+                ++pos_;
+                skip_ws();
+            }
+        }
+        number_features();
+    }
+
+private:
+    // A feature without an id of its own, which is numbered once all the
+    // ids given in the input are known so the two never collide.
+    struct unnumbered_feature : private boost::noncopyable
+    {
+        std::size_t index;
+        geometry_list geoms;
+        property_list properties;
+    };
+
+    void number_features()
+    {
+        for (std::size_t i = 0; i < unnumbered_.size(); ++i)
+        {
+            while (ids_.find(next_id_) != ids_.end())
+                ++next_id_;
+            unnumbered_feature& u = *unnumbered_[i];
+            std::vector<mapnik::feature_ptr> one;
+            make_feature(next_id_++, u.geoms, u.properties, one);
+            features_[u.index] = one[0];
+        }
+        // past the given ids too, so later features do not reuse them
+        if (!ids_.empty() && *ids_.rbegin() >= next_id_)
+            next_id_ = *ids_.rbegin() + 1;
+    }
+
+    void error(char const* what) const
+    {
+        parse_error("GeoJSON", pos_ - begin_, what);
+    }
+
+    void skip_ws()
+    {
+        while (pos_ < end_ && (*pos_ == ' ' || *pos_ == '\n' || *pos_ == '\r' || *pos_ == '\t'))
+            ++pos_;
+    }
+
+    char peek()
+    {
+        skip_ws();
+        if (pos_ >= end_)
+            error("unexpected end of input");
+        return *pos_;
+    }
+
+    void expect(char c)
+    {
+        if (peek() != c)
+        {
+            char what[] = "expected ' '";
+            what[10] = c;
+            error(what);
+        }
+        ++pos_;
+    }
+
+    // true and consumes the literal if it comes next
+    bool literal(char const* word)
+    {
+        std::size_t len = std::strlen(word);
+        if (static_cast<std::size_t>(end_ - pos_) >= len && std::memcmp(pos_, word, len) == 0)
+        {
+            pos_ += len;
+            return true;
+        }
+        return false;
+    }
+
+    // nesting counts the objects around obj, a feature collection holding
+    // a feature holding a geometry collection is nested 3 deep
+    void parse_object(json_object& obj, unsigned nesting)
+    {
+        if (nesting > max_object_nesting)
+            error("objects nested too deeply");
+        expect('{');
+        if (peek() == '}')
+        {
+            ++pos_;
+            return;
+        }
+        std::string key;
+        for (;;)
+        {
+            parse_string(key);
+            expect(':');
+            if (key == "type")
+            {
+                parse_string(obj.type);
+            }
+            else if (key == "coordinates")
+            {
+                if (!parse_null())
+                    parse_coords(obj.coords, 1);
+            }
+            else if (key == "geometry")
+            {
+                if (!parse_null())
+                {
+                    json_object geom;
+                    parse_object(geom, nesting + 1);
+                    to_geometries(geom, obj.geometries);
+                }
+            }
+            else if (key == "geometries")
+            {
+                expect('[');
+                if (peek() == ']')
+                    ++pos_;
+                else for (;;)
+                {
+                    json_object geom;
+                    parse_object(geom, nesting + 1);
+                    to_geometries(geom, obj.geometries);
+                    if (!next_element(']'))
+                        break;
+                }
+            }
+            else if (key == "features")
+            {
+                expect('[');
+                if (peek() == ']')
+                    ++pos_;
+                else for (;;)
+                {
+                    json_object feature;
+                    parse_object(feature, nesting + 1);
+                    emit_feature(feature);
+                    if (!next_element(']'))
+                        break;
+                }
+            }
+            else if (key == "properties")
+            {
+                if (!parse_null())
+                    parse_properties(obj.properties);
+            }
+            else if (key == "id" && peek() != '"' && peek() != 'n')
+            {
+                double num;
+                if (parse_number(num))
+                {
+                    obj.has_id = true;
+                    obj.id = static_cast<int>(num);
+                }
+            }
+            else
+            {
+                skip_value();
+            }
+            if (!next_element('}'))
+                break;
+        }
+    }
+
+    // after an element: true if another one follows, false if close ends
+    // the container
+    bool next_element(char close)
+    {
+        char c = peek();
+        ++pos_;
+        if (c == ',')
+            return true;
+        if (c != close)
+            error(close == '}' ? "expected ',' or '}'" : "expected ',' or ']'");
+        return false;
+    }
+
+    bool parse_null()
+    {
+        if (peek() == 'n')
+        {
+            if (!literal("null"))
+                error("invalid literal");
+            return true;
+        }
+        return false;
+    }
+
+    void parse_properties(property_list& props)
+    {
+        expect('{');
+        if (peek() == '}')
+        {
+            ++pos_;
+            return;
+        }
+        std::string key;
+        std::string str;
+        for (;;)
+        {
+            parse_string(key);
+            expect(':');
+            char c = peek();
+            if (c == '"')
+            {
+                parse_string(str);
+                props.push_back(std::make_pair(key, mapnik::value(tr_.transcode(str.c_str()))));
+            }
+            else if (c == '-' || (c >= '0' && c <= '9'))
+            {
+                double num;
+                if (parse_number(num))
+                    props.push_back(std::make_pair(key, mapnik::value(static_cast<int>(num))));
+                else
+                    props.push_back(std::make_pair(key, mapnik::value(num)));
+            }
+            else if (literal("true"))
+            {
+                props.push_back(std::make_pair(key, mapnik::value(true)));
+            }
+            else if (literal("false"))
+            {
+                props.push_back(std::make_pair(key, mapnik::value(false)));
+            }
+            else if (c == '{' || c == '[')
+            {
+                // nested values are kept as their JSON text
+                char const* start = pos_;
+                skip_value();
+                str.assign(start, pos_);
+                props.push_back(std::make_pair(key, mapnik::value(tr_.transcode(str.c_str()))));
+            }
+            else if (!parse_null())
+            {
+                error("invalid value");
+            }
+            if (!next_element('}'))
+                break;
+        }
+    }
+
+    // Returns true if the number fits an int and has no fraction or
+    // exponent.
+    bool parse_number(double& num)
+    {
+        skip_ws();
+        char const* start = pos_;
+        bool integral = true;
+        if (pos_ < end_ && *pos_ == '-') ++pos_;
+        char const* digits = pos_;
+        while (pos_ < end_ && *pos_ >= '0' && *pos_ <= '9') ++pos_;
+        if (pos_ == digits)
+            error("invalid number");
+        if (pos_ < end_ && *pos_ == '.')
+        {
+            integral = false;
+            ++pos_;
+            while (pos_ < end_ && *pos_ >= '0' && *pos_ <= '9') ++pos_;
+        }
+        if (pos_ < end_ && (*pos_ == 'e' || *pos_ == 'E'))
+        {
+            integral = false;
+            ++pos_;
+            if (pos_ < end_ && (*pos_ == '+' || *pos_ == '-')) ++pos_;
+            while (pos_ < end_ && *pos_ >= '0' && *pos_ <= '9') ++pos_;
+        }
+
+        // short integers are the common case and need no strtod
+        if (integral && pos_ - digits <= 9)
+        {
+            int value = 0;
+            for (char const* p = digits; p < pos_; ++p)
+                value = value * 10 + (*p - '0');
+            num = (start == digits) ? value : -value;
+            return true;
+        }
+
+        char buf[64];
+        std::size_t len = pos_ - start;
+        if (len >= sizeof(buf))
+            error("number too long");
+        std::memcpy(buf, start, len);
+        buf[len] = '\0';
+        num = std::strtod(buf, 0);
+        return integral && num >= -2147483648.0 && num <= 2147483647.0;
+    }
+
+    void parse_string(std::string& out)
+    {
+        expect('"');
+        out.clear();
+        for (;;)
+        {
+            char const* start = pos_;
+            while (pos_ < end_ && *pos_ != '"' && *pos_ != '\\') ++pos_;
+            out.append(start, pos_);
+            if (pos_ >= end_)
+                error("unterminated string");
+            if (*pos_++ == '"')
+                return;
+            if (pos_ >= end_)
+                error("unterminated string");
+            char c = *pos_++;
+            switch (c)
+            {
+            case '"': case '\\': case '/': out += c; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u':
+            {
+                uint32_t cp = parse_hex4();
+                if (cp >= 0xd800 && cp < 0xdc00 && end_ - pos_ >= 6 && pos_[0] == '\\' && pos_[1] == 'u')
+                {
+                    pos_ += 2;
+                    uint32_t low = parse_hex4();
+                    if (low >= 0xdc00 && low < 0xe000)
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                    else
+                        error("invalid surrogate pair");
+                }
+                append_utf8(out, cp);
+                break;
+            }
+            default:
+                error("invalid escape");
+            }
+        }
+    }
+
+    uint32_t parse_hex4()
+    {
+        if (end_ - pos_ < 4)
+            error("invalid unicode escape");
+        uint32_t cp = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            char c = *pos_++;
+            cp <<= 4;
+            if (c >= '0' && c <= '9') cp |= c - '0';
+            else if (c >= 'a' && c <= 'f') cp |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') cp |= c - 'A' + 10;
+            else error("invalid unicode escape");
+        }
+        return cp;
+    }
+
+    static void append_utf8(std::string& out, uint32_t cp)
+    {
+        if (cp < 0x80)
+        {
+            out += static_cast<char>(cp);
+        }
+        else if (cp < 0x800)
+        {
+            out += static_cast<char>(0xc0 | (cp >> 6));
+            out += static_cast<char>(0x80 | (cp & 0x3f));
+        }
+        else if (cp < 0x10000)
+        {
+            out += static_cast<char>(0xe0 | (cp >> 12));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (cp & 0x3f));
+        }
+        else
+        {
+            out += static_cast<char>(0xf0 | (cp >> 18));
+            out += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (cp & 0x3f));
+        }
+    }
+
+    void skip_value()
+    {
+        char c = peek();
+        if (c == '{' || c == '[')
+        {
+            // strings are the only place brackets can hide in
+            int nesting = 0;
+            std::string ignored;
+            do
+            {
+                c = peek();
+                if (c == '"')
+                {
+                    parse_string(ignored);
+                    continue;
+                }
+                if (c == '{' || c == '[') ++nesting;
+                else if (c == '}' || c == ']') --nesting;
+                ++pos_;
+            }
+            while (nesting > 0);
+        }
+        else if (c == '"')
+        {
+            std::string ignored;
+            parse_string(ignored);
+        }
+        else if (c == '-' || (c >= '0' && c <= '9'))
+        {
+            double ignored;
+            parse_number(ignored);
+        }
+        else if (!literal("true") && !literal("false") && !literal("null"))
+        {
+            error("invalid value");
+        }
+    }
+
+    // Returns the depth of the array, 0 if it holds no positions. level is
+    // 1 for the coordinates member itself, and positions can be no deeper
+    // than the 4 of a MultiPolygon.
+    int parse_coords(coord_array& coords, unsigned level)
+    {
+        if (level > 4)
+            error("coordinates nested too deeply");
+        expect('[');
+        char c = peek();
+        if (c == ']')
+        {
+            ++pos_;
+            return 0;
+        }
+
+        if (c == '-' || (c >= '0' && c <= '9'))
+        {
+            double x, y, ignored;
+            parse_number(x);
+            expect(',');
+            parse_number(y);
+            while (peek() == ',')
+            {
+                ++pos_;
+                parse_number(ignored);
+            }
+            expect(']');
+            coords.xy.push_back(x);
+            coords.xy.push_back(y);
+            if (level == 1)
+                coords.depth = 1;
+            return 1;
+        }
+
+        int depth = 0;
+        unsigned children = 0;
+        for (;;)
+        {
+            int child = parse_coords(coords, level + 1);
+            if (child > 0)
+            {
+                if (depth == 0)
+                    depth = child + 1;
+                else if (child + 1 != depth)
+                    error("mixed coordinate nesting");
+                ++children;
+            }
+            if (!next_element(']'))
+                break;
+        }
+        if (depth >= 2)
+            coords.sizes[depth - 2].push_back(children);
+        if (level == 1)
+            coords.depth = depth;
+        return depth;
+    }
+
+    void coords_mismatch(std::string const& type) const
+    {
+        std::string what = "coordinates do not match geometry type '" + type + "'";
+        error(what.c_str());
+    }
+
+    void to_geometries(json_object& obj, geometry_list& out)
+    {
+        std::string const& type = obj.type;
+        coord_array const& c = obj.coords;
+        double const* xy = c.xy.empty() ? 0 : &c.xy[0];
+        unsigned num_points = c.xy.size() / 2;
+
+        if (type == "GeometryCollection")
+        {
+            out.splice(obj.geometries);
+        }
+        else if (c.depth == 0)
+        {
+            // empty geometries add nothing
+            if (type != "Point" && type != "MultiPoint" && type != "LineString" &&
+                type != "MultiLineString" && type != "Polygon" && type != "MultiPolygon")
+                error("unknown geometry type");
+        }
+        else if (type == "Point")
+        {
+            if (c.depth != 1) coords_mismatch(type);
+            out.push_back(make_path(mapnik::Point, xy, 1));
+        }
+        else if (type == "MultiPoint")
+        {
+            if (c.depth != 2) coords_mismatch(type);
+            for (unsigned i = 0; i < num_points; ++i)
+                out.push_back(make_path(mapnik::Point, xy + i * 2, 1));
+        }
+        else if (type == "LineString")
+        {
+            if (c.depth != 2) coords_mismatch(type);
+            out.push_back(make_path(mapnik::LineString, xy, num_points));
+        }
+        else if (type == "MultiLineString")
+        {
+            if (c.depth != 3) coords_mismatch(type);
+            std::vector<unsigned>::const_iterator line = c.sizes[0].begin();
+            for (; line != c.sizes[0].end(); ++line)
+            {
+                out.push_back(make_path(mapnik::LineString, xy, *line));
+                xy += *line * 2;
+            }
+        }
+        else if (type == "Polygon" || type == "MultiPolygon")
+        {
+            std::vector<unsigned> one_polygon;
+            std::vector<unsigned> const* polygons = &c.sizes[1];
+            if (type == "Polygon")
+            {
+                if (c.depth != 3) coords_mismatch(type);
+                one_polygon.push_back(c.sizes[0].size());
+                polygons = &one_polygon;
+            }
+            else if (c.depth != 4)
+            {
+                coords_mismatch(type);
+            }
+            std::vector<unsigned>::const_iterator ring = c.sizes[0].begin();
+            std::vector<unsigned>::const_iterator poly = polygons->begin();
+            for (; poly != polygons->end(); ++poly)
+            {
+                mapnik::geometry_type * geom = new mapnik::geometry_type(mapnik::Polygon);
+                out.push_back(geom);
+                for (unsigned i = 0; i < *poly; ++i, ++ring)
+                {
+                    add_ring(*geom, xy, *ring);
+                    xy += *ring * 2;
+                }
+            }
+        }
+        else
+        {
+            error("unknown geometry type");
+        }
+    }
+
+    void emit_feature(json_object& obj)
+    {
+        if (obj.type == "FeatureCollection")
+            return;
+        geometry_list geoms;
+        if (obj.type == "Feature" || obj.type.empty())
+            geoms.splice(obj.geometries);
+        else
+            to_geometries(obj, geoms);
+        if (obj.has_id)
+        {
+            ids_.insert(obj.id);
+            make_feature(obj.id, geoms, obj.properties, features_);
+            return;
+        }
+        std::auto_ptr<unnumbered_feature> u(new unnumbered_feature());
+        u->index = features_.size();
+        u->geoms.splice(geoms);
+        u->properties.swap(obj.properties);
+        unnumbered_.push_back(u.get());
+        u.release();
+        // its place in document order
+        features_.push_back(mapnik::feature_ptr());
+    }
+
+    char const* begin_;
+    char const* pos_;
+    char const* end_;
+    std::vector<mapnik::feature_ptr>& features_;
+    int& next_id_;
+    mapnik::transcoder tr_;
+    std::set<int> ids_;
+    std::vector<unnumbered_feature*> unnumbered_;
+};
+
+//
+// WKB
+//
+
+class wkb_parser : private boost::noncopyable
+{
+public:
+    enum
+    {
+        ewkb_z = 0x80000000,
+        ewkb_m = 0x40000000,
+        ewkb_srid = 0x20000000
+    };
+
+    wkb_parser(char const* data, std::size_t size,
+               std::vector<mapnik::feature_ptr>& features, int& next_id)
+        : begin_(data),
+          pos_(data),
+          end_(data + size),
+          features_(features),
+          next_id_(next_id),
+          swap_(false)
+    {
+        uint16_t one = 1;
+        native_little_ = *reinterpret_cast<unsigned char*>(&one) == 1;
+    }
+
+    void parse()
+    {
+        property_list no_properties;
+        while (pos_ < end_)
+        {
+            geometry_list geoms;
+            parse_geometry(geoms, 0);
+            make_feature(next_id_++, geoms, no_properties, features_);
+        }
+    }
+
+private:
+    void error(char const* what) const
+    {
+        parse_error("WKB", pos_ - begin_, what);
+    }
+
+    void need(std::size_t bytes) const
+    {
+        if (static_cast<std::size_t>(end_ - pos_) < bytes)
+            error("unexpected end of input");
+    }
+
+    uint32_t read_uint32()
+    {
+        need(4);
+        uint32_t v;
+        std::memcpy(&v, pos_, 4);
+        pos_ += 4;
+        if (swap_)
+            v = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+        return v;
+    }
+
+    // reads num_points points of dims doubles, keeping x and y
+    void read_points(std::vector<double>& xy, uint32_t num_points, unsigned dims)
+    {
+        if (num_points > static_cast<std::size_t>(end_ - pos_) / (dims * 8))
+            error("unexpected end of input");
+        xy.resize(num_points * 2);
+        for (uint32_t i = 0; i < num_points; ++i)
+        {
+            xy[i * 2] = read_double(pos_);
+            xy[i * 2 + 1] = read_double(pos_ + 8);
+            pos_ += dims * 8;
+        }
+    }
+
+    double read_double(char const* p) const
+    {
+        uint64_t bits;
+        std::memcpy(&bits, p, 8);
+        if (swap_)
+        {
+            uint64_t r = 0;
+            for (int i = 0; i < 8; ++i)
+            {
+                r = (r << 8) | (bits & 0xff);
+                bits >>= 8;
+            }
+            bits = r;
+        }
+        double v;
+        std::memcpy(&v, &bits, 8);
+        return v;
+    }
+
+    void parse_geometry(geometry_list& out, unsigned nesting)
+    {
+        if (nesting > 32)
+            error("geometry nested too deeply");
+        need(1);
+        unsigned char order = static_cast<unsigned char>(*pos_++);
+        if (order > 1)
+            error("invalid byte order");
+        swap_ = (order == 1) != native_little_;
+
+        uint32_t type = read_uint32();
+        unsigned dims = 2;
+        if (type & ewkb_z) ++dims;
+        if (type & ewkb_m) ++dims;
+        if (type & ewkb_srid) read_uint32();
+        type &= 0x0fffffff;
+        switch (type / 1000)
+        {
+        case 1: case 2: dims = 3; break;
+        case 3: dims = 4; break;
+        }
+        type %= 1000;
+
+        std::vector<double> xy;
+        switch (type)
+        {
+        case 1: // Point
+            read_points(xy, 1, dims);
+            // empty points are written as NaN
+            if (xy[0] == xy[0] && xy[1] == xy[1])
+                out.push_back(make_path(mapnik::Point, &xy[0], 1));
+            break;
+        case 2: // LineString
+        {
+            uint32_t num_points = read_uint32();
+            read_points(xy, num_points, dims);
+            if (num_points > 0)
+                out.push_back(make_path(mapnik::LineString, &xy[0], num_points));
+            break;
+        }
+        case 3: // Polygon
+        {
+            uint32_t num_rings = read_uint32();
+            mapnik::geometry_type * geom = 0;
+            for (uint32_t i = 0; i < num_rings; ++i)
+            {
+                uint32_t num_points = read_uint32();
+                read_points(xy, num_points, dims);
+                if (num_points == 0)
+                    continue;
+                if (!geom)
+                {
+                    geom = new mapnik::geometry_type(mapnik::Polygon);
+                    out.push_back(geom);
+                }
+                add_ring(*geom, &xy[0], num_points);
+            }
+            break;
+        }
+        case 4: // MultiPoint
+        case 5: // MultiLineString
+        case 6: // MultiPolygon
+        case 7: // GeometryCollection
+        {
+            uint32_t num_parts = read_uint32();
+            for (uint32_t i = 0; i < num_parts; ++i)
+                parse_geometry(out, nesting + 1);
+            break;
+        }
+        default:
+            error("unknown geometry type");
+        }
+    }
+
+    char const* begin_;
+    char const* pos_;
+    char const* end_;
+    std::vector<mapnik::feature_ptr>& features_;
+    int& next_id_;
+    bool swap_;
+    bool native_little_;
+};
+
+//
+// WKT
+//
+
+class wkt_parser : private boost::noncopyable
+{
+public:
+    wkt_parser(char const* data, std::size_t size,
+               std::vector<mapnik::feature_ptr>& features, int& next_id)
+        : begin_(data),
+          pos_(data),
+          end_(data + size),
+          features_(features),
+          next_id_(next_id) {}
+
+    void parse()
+    {
+        property_list no_properties;
+        skip_ws();
+        while (pos_ < end_)
+        {
+            geometry_list geoms;
+            if (keyword("SRID"))
+            {
+                expect('=');
+                parse_number();
+                expect(';');
+            }
+            parse_geometry(geoms, 0);
+            make_feature(next_id_++, geoms, no_properties, features_);
+            skip_ws();
+        }
+    }
+
+private:
+    void error(char const* what) const
+    {
+        parse_error("WKT", pos_ - begin_, what);
+    }
+
+    void skip_ws()
+    {
+        while (pos_ < end_ && (*pos_ == ' ' || *pos_ == '\n' || *pos_ == '\r' || *pos_ == '\t'))
+            ++pos_;
+    }
+
+    bool next_is(char c)
+    {
+        skip_ws();
+        return pos_ < end_ && *pos_ == c;
+    }
+
+    void expect(char c)
+    {
+        if (!next_is(c))
+        {
+            char what[] = "expected ' '";
+            what[10] = c;
+            error(what);
+        }
+        ++pos_;
+    }
+
+    // consumes a ',' if it comes next
+    bool comma()
+    {
+        if (!next_is(','))
+            return false;
+        ++pos_;
+        return true;
+    }
+
+    static bool is_alpha(char c)
+    {
+        return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+    }
+
+    // case insensitive, consumes the keyword if it comes next
+    bool keyword(char const* word)
+    {
+        skip_ws();
+        char const* p = pos_;
+        for (; *word; ++word, ++p)
+        {
+            if (p >= end_ || (*p & ~0x20) != *word)
+                return false;
+        }
+        if (p < end_ && is_alpha(*p))
+            return false;
+        pos_ = p;
+        return true;
+    }
+
+    double parse_number()
+    {
+        skip_ws();
+        char buf[64];
+        std::size_t len = 0;
+        while (pos_ + len < end_ && len < sizeof(buf) - 1)
+        {
+            char c = pos_[len];
+            if (!((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E'))
+                break;
+            buf[len++] = c;
+        }
+        buf[len] = '\0';
+        char* stop;
+        double v = std::strtod(buf, &stop);
+        if (stop == buf)
+            error("expected a number");
+        pos_ += stop - buf;
+        return v;
+    }
+
+    // reads coordinates until the next ',' or ')', keeping x and y
+    void parse_point(std::vector<double>& xy)
+    {
+        xy.push_back(parse_number());
+        xy.push_back(parse_number());
+        skip_ws();
+        while (pos_ < end_ && *pos_ != ',' && *pos_ != ')')
+            parse_number();
+    }
+
+    // '(' point {',' point} ')', returns the number of points
+    unsigned parse_points(std::vector<double>& xy)
+    {
+        expect('(');
+        unsigned num_points = 0;
+        do
+        {
+            parse_point(xy);
+            ++num_points;
+        }
+        while (comma());
+        expect(')');
+        return num_points;
+    }
+
+    void parse_polygon(geometry_list& out)
+    {
+        std::vector<double> xy;
+        expect('(');
+        mapnik::geometry_type * geom = new mapnik::geometry_type(mapnik::Polygon);
+        out.push_back(geom);
+        do
+        {
+            xy.clear();
+            unsigned num_points = parse_points(xy);
+            add_ring(*geom, &xy[0], num_points);
+        }
+        while (comma());
+        expect(')');
+    }
+
+    void parse_geometry(geometry_list& out, unsigned nesting)
+    {
+        if (nesting > 32)
+            error("geometry nested too deeply");
+
+        enum { point, linestring, polygon, multipoint, multilinestring, multipolygon, collection } type;
+        if (keyword("POINT")) type = point;
+        else if (keyword("LINESTRING")) type = linestring;
+        else if (keyword("POLYGON")) type = polygon;
+        else if (keyword("MULTIPOINT")) type = multipoint;
+        else if (keyword("MULTILINESTRING")) type = multilinestring;
+        else if (keyword("MULTIPOLYGON")) type = multipolygon;
+        else if (keyword("GEOMETRYCOLLECTION")) type = collection;
+        else error("unknown geometry type");
+
+        // dimension markers are implied by the number of coordinates
+        if (!keyword("ZM") && !keyword("Z"))
+            keyword("M");
+        if (keyword("EMPTY"))
+            return;
+
+        std::vector<double> xy;
+        switch (type)
+        {
+        case point:
+            parse_points(xy);
+            out.push_back(make_path(mapnik::Point, &xy[0], 1));
+            break;
+        case linestring:
+        {
+            unsigned num_points = parse_points(xy);
+            out.push_back(make_path(mapnik::LineString, &xy[0], num_points));
+            break;
+        }
+        case polygon:
+            parse_polygon(out);
+            break;
+        case multipoint:
+            // both MULTIPOINT (1 2, 3 4) and MULTIPOINT ((1 2), (3 4))
+            expect('(');
+            do
+            {
+                xy.clear();
+                if (keyword("EMPTY"))
+                    continue;
+                if (next_is('('))
+                    parse_points(xy);
+                else
+                    parse_point(xy);
+                out.push_back(make_path(mapnik::Point, &xy[0], 1));
+            }
+            while (comma());
+            expect(')');
+            break;
+        case multilinestring:
+            expect('(');
+            do
+            {
+                xy.clear();
+                if (keyword("EMPTY"))
+                    continue;
+                unsigned num_points = parse_points(xy);
+                out.push_back(make_path(mapnik::LineString, &xy[0], num_points));
+            }
+            while (comma());
+            expect(')');
+            break;
+        case multipolygon:
+            expect('(');
+            do
+            {
+                if (!keyword("EMPTY"))
+                    parse_polygon(out);
+            }
+            while (comma());
+            expect(')');
+            break;
+        case collection:
+            expect('(');
+            do
+            {
+                parse_geometry(out, nesting + 1);
+            }
+            while (comma());
+            expect(')');
+            break;
+        }
+    }
+
+    char const* begin_;
+    char const* pos_;
+    char const* end_;
+    std::vector<mapnik::feature_ptr>& features_;
+    int& next_id_;
+};
+
+} // namespace
+
+void read_geojson(char const* data, std::size_t size,
+                  std::vector<mapnik::feature_ptr>& features, int& next_id)
+{
+    geojson_parser parser(data, size, features, next_id);
+    parser.parse();
+}
+
+void read_wkb(char const* data, std::size_t size,
+              std::vector<mapnik::feature_ptr>& features, int& next_id)
+{
+    wkb_parser parser(data, size, features, next_id);
+    parser.parse();
+}
+
+void read_wkt(char const* data, std::size_t size,
+              std::vector<mapnik::feature_ptr>& features, int& next_id)
+{
+    wkt_parser parser(data, size, features, next_id);
+    parser.parse();
+}
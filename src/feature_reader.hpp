@@ -0,0 +1,35 @@
+#ifndef __NODE_MAPNIK_FEATURE_READER_H__
+#define __NODE_MAPNIK_FEATURE_READER_H__
+
+// mapnik
+#include <mapnik/feature.hpp>
+
+// stl
+#include <vector>
+
+// Parsers that turn a serialized buffer straight into mapnik features,
+// without building a V8 or DOM representation first, so they can run on
+// the thread pool.
+//
+// Each appends one feature per GeoJSON feature (or bare geometry) and per
+// WKB/WKT geometry to features. Features without an id of their own are
+// numbered from next_id on. Malformed input throws std::runtime_error with
+// the byte offset of the error.
+//
+// Multi geometries and geometry collections become one mapnik geometry per
+// part; Z and M values are read and dropped.
+
+void read_geojson(char const* data, std::size_t size,
+                  std::vector<mapnik::feature_ptr>& features, int& next_id);
+
+// Any number of WKB geometries, one after the other. Both byte orders, the
+// ISO Z/M type codes and PostGIS EWKB flags and SRIDs are understood.
+void read_wkb(char const* data, std::size_t size,
+              std::vector<mapnik::feature_ptr>& features, int& next_id);
+
+// Any number of WKT geometries separated by whitespace or newlines, with an
+// optional EWKT "SRID=n;" prefix.
+void read_wkt(char const* data, std::size_t size,
+              std::vector<mapnik::feature_ptr>& features, int& next_id);
+
+#endif // __NODE_MAPNIK_FEATURE_READER_H__
@@ -0,0 +1,29 @@
+#include "filtered_featureset.hpp"
+
+#if MAPNIK_VERSION >= 800
+
+// mapnik
+#include <mapnik/feature.hpp>
+#include <mapnik/expression_evaluator.hpp>
+
+filtered_featureset::filtered_featureset(mapnik::featureset_ptr const& fs,
+                                         mapnik::expression_ptr const& filter)
+    : fs_(fs),
+      filter_(filter) {}
+
+filtered_featureset::~filtered_featureset() {}
+
+mapnik::feature_ptr filtered_featureset::next()
+{
+    mapnik::feature_ptr feature;
+    while ((feature = fs_->next()))
+    {
+        mapnik::value_type result = boost::apply_visitor(
+            mapnik::evaluate<mapnik::Feature,mapnik::value_type>(*feature), *filter_);
+        if (result.to_bool())
+            return feature;
+    }
+    return mapnik::feature_ptr();
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef __NODE_MAPNIK_FILTERED_FEATURESET_H__
+#define __NODE_MAPNIK_FILTERED_FEATURESET_H__
+
+// mapnik
+#include <mapnik/version.hpp>
+#include <mapnik/datasource.hpp>
+
+#if MAPNIK_VERSION >= 800
+
+#include <mapnik/expression_node.hpp>
+
+// boost
+#include <boost/utility.hpp>
+
+// Returns the features of fs the filter, a mapnik expression like
+// "[NAME] = 'Iceland'", evaluates to true for. The features are only
+// tested as they are read, so a featureset paged through on the thread
+// pool filters there too.
+class filtered_featureset : public mapnik::Featureset, private boost::noncopyable
+{
+public:
+    filtered_featureset(mapnik::featureset_ptr const& fs, mapnik::expression_ptr const& filter);
+    virtual ~filtered_featureset();
+    mapnik::feature_ptr next();
+
+private:
+    mapnik::featureset_ptr fs_;
+    mapnik::expression_ptr filter_;
+};
+
+#endif
+
+#endif // __NODE_MAPNIK_FILTERED_FEATURESET_H__
@@ -0,0 +1,230 @@
+#include "geometry_writer.hpp"
+
+// mapnik
+#include <mapnik/geometry.hpp>
+#include <mapnik/vertex.hpp>
+
+// stl
+#include <cstring>
+
+namespace {
+
+enum wkb_type
+{
+    wkb_point = 1,
+    wkb_linestring = 2,
+    wkb_polygon = 3,
+    wkb_multipoint = 4,
+    wkb_multilinestring = 5,
+    wkb_multipolygon = 6,
+    wkb_geometrycollection = 7
+};
+
+// The vertices of one geometry split into rings.
+struct ring_list
+{
+    std::vector<double> xy;
+    // first vertex of each ring
+    std::vector<uint32_t> begin;
+
+    std::size_t num_rings() const { return begin.size(); }
+    std::size_t ring_begin(std::size_t i) const { return begin[i]; }
+    std::size_t ring_end(std::size_t i) const
+    {
+        return i + 1 < begin.size() ? begin[i + 1] : xy.size() / 2;
+    }
+};
+
+// get_vertex leaves the geometry's iterator alone, so features that are
+// being rendered can be written
+static void read_rings(mapnik::geometry_type const& geom, ring_list& rings)
+{
+    rings.xy.clear();
+    rings.begin.clear();
+    unsigned num_points = geom.num_points();
+    rings.xy.reserve(num_points * 2);
+    for (unsigned v = 0; v < num_points; ++v)
+    {
+        double x, y;
+        unsigned cmd = geom.get_vertex(v, &x, &y);
+        if (cmd != mapnik::SEG_MOVETO && cmd != mapnik::SEG_LINETO)
+            continue;
+        if (cmd == mapnik::SEG_MOVETO || rings.begin.empty())
+            rings.begin.push_back(rings.xy.size() / 2);
+        rings.xy.push_back(x);
+        rings.xy.push_back(y);
+    }
+}
+
+static void write_u8(std::string& out, unsigned char value)
+{
+    out.push_back(static_cast<char>(value));
+}
+
+static void write_u32(std::string& out, uint32_t value)
+{
+    for (unsigned i = 0; i < 4; ++i)
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+static void write_double(std::string& out, double value)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    for (unsigned i = 0; i < 8; ++i)
+        out.push_back(static_cast<char>((bits >> (8 * i)) & 0xff));
+}
+
+static void write_header(std::string& out, wkb_type type)
+{
+    write_u8(out, 1); // little endian
+    write_u32(out, type);
+}
+
+static void write_points(std::string& out, ring_list const& rings,
+                         std::size_t begin, std::size_t end, bool close)
+{
+    bool closing = close && end - begin > 1 &&
+        (rings.xy[2 * begin] != rings.xy[2 * (end - 1)] ||
+         rings.xy[2 * begin + 1] != rings.xy[2 * (end - 1) + 1]);
+    write_u32(out, static_cast<uint32_t>(end - begin + (closing ? 1 : 0)));
+    for (std::size_t i = begin; i < end; ++i)
+    {
+        write_double(out, rings.xy[2 * i]);
+        write_double(out, rings.xy[2 * i + 1]);
+    }
+    if (closing)
+    {
+        write_double(out, rings.xy[2 * begin]);
+        write_double(out, rings.xy[2 * begin + 1]);
+    }
+}
+
+// The WKB parts of one mapnik geometry, see the header.
+static std::size_t num_parts(mapnik::geometry_type const& geom, ring_list const& rings)
+{
+    switch (geom.type())
+    {
+    case mapnik::Point:
+        return rings.xy.size() / 2;
+    case mapnik::LineString:
+        return rings.num_rings();
+    default:
+        return rings.num_rings() > 0 ? 1 : 0;
+    }
+}
+
+static wkb_type part_type(mapnik::geometry_type const& geom)
+{
+    switch (geom.type())
+    {
+    case mapnik::Point:
+        return wkb_point;
+    case mapnik::LineString:
+        return wkb_linestring;
+    default:
+        return wkb_polygon;
+    }
+}
+
+static void write_parts(std::string& out, mapnik::geometry_type const& geom, ring_list const& rings)
+{
+    switch (geom.type())
+    {
+    case mapnik::Point:
+        for (std::size_t i = 0; i < rings.xy.size() / 2; ++i)
+        {
+            write_header(out, wkb_point);
+            write_double(out, rings.xy[2 * i]);
+            write_double(out, rings.xy[2 * i + 1]);
+        }
+        break;
+    case mapnik::LineString:
+        for (std::size_t r = 0; r < rings.num_rings(); ++r)
+        {
+            write_header(out, wkb_linestring);
+            write_points(out, rings, rings.ring_begin(r), rings.ring_end(r), false);
+        }
+        break;
+    default:
+        if (rings.num_rings() == 0)
+            break;
+        write_header(out, wkb_polygon);
+        write_u32(out, static_cast<uint32_t>(rings.num_rings()));
+        for (std::size_t r = 0; r < rings.num_rings(); ++r)
+            write_points(out, rings, rings.ring_begin(r), rings.ring_end(r), true);
+        break;
+    }
+}
+
+} // namespace
+
+void write_wkb(mapnik::Feature const& feature, std::string& out)
+{
+    unsigned num_geometries = feature.num_geometries();
+
+    // count the parts first, the collection header needs their number
+    ring_list rings;
+    std::size_t total = 0;
+    wkb_type type = wkb_geometrycollection;
+    bool same_type = true;
+    for (unsigned i = 0; i < num_geometries; ++i)
+    {
+        mapnik::geometry_type const& geom = feature.get_geometry(i);
+        read_rings(geom, rings);
+        std::size_t n = num_parts(geom, rings);
+        if (n == 0)
+            continue;
+        if (total == 0)
+            type = part_type(geom);
+        else if (part_type(geom) != type)
+            same_type = false;
+        total += n;
+    }
+
+    if (total == 0)
+    {
+        write_header(out, wkb_geometrycollection);
+        write_u32(out, 0);
+        return;
+    }
+
+    if (total > 1)
+    {
+        write_header(out, same_type ? static_cast<wkb_type>(type + 3) : wkb_geometrycollection);
+        write_u32(out, static_cast<uint32_t>(total));
+    }
+    for (unsigned i = 0; i < num_geometries; ++i)
+    {
+        mapnik::geometry_type const& geom = feature.get_geometry(i);
+        read_rings(geom, rings);
+        write_parts(out, geom, rings);
+    }
+}
+
+geometry_coords::geometry_coords()
+    : xy(),
+      rings(1, 0),
+      parts(1, 0),
+      types(),
+      features(1, 0) {}
+
+void write_coords(mapnik::Feature const& feature, geometry_coords& out)
+{
+    ring_list rings;
+    unsigned num_geometries = feature.num_geometries();
+    for (unsigned i = 0; i < num_geometries; ++i)
+    {
+        mapnik::geometry_type const& geom = feature.get_geometry(i);
+        read_rings(geom, rings);
+        uint32_t first = out.xy.size() / 2;
+        out.xy.insert(out.xy.end(), rings.xy.begin(), rings.xy.end());
+        for (std::size_t r = 1; r < rings.num_rings(); ++r)
+            out.rings.push_back(first + rings.ring_begin(r));
+        if (rings.num_rings() > 0)
+            out.rings.push_back(out.xy.size() / 2);
+        out.parts.push_back(out.rings.size() - 1);
+        out.types.push_back(static_cast<unsigned char>(geom.type()));
+    }
+    out.features.push_back(out.parts.size() - 1);
+}
@@ -0,0 +1,49 @@
+#ifndef __NODE_MAPNIK_GEOMETRY_WRITER_H__
+#define __NODE_MAPNIK_GEOMETRY_WRITER_H__
+
+// mapnik
+#include <mapnik/feature.hpp>
+
+// stl
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// The counterpart of feature_reader.hpp: writers that serialize the
+// geometries of mapnik features straight from their vertices, without
+// building a V8 representation first, so they can run on the thread pool.
+//
+// A mapnik geometry holds one or more rings, each starting with a move_to.
+// A point geometry is one point per vertex, a linestring geometry one
+// linestring per ring and a polygon geometry one polygon of all its rings.
+
+// Appends the geometries of feature to out as one little-endian WKB
+// geometry: a Point, LineString or Polygon if it has a single part, a
+// MultiPoint, MultiLineString or MultiPolygon if all its parts have the
+// same type, else a GeometryCollection, which is also what a feature
+// without geometries becomes. Polygon rings are closed if they are not.
+void write_wkb(mapnik::Feature const& feature, std::string& out);
+
+// The geometries of any number of features as flat arrays. Every offset
+// array starts with 0 and ends with the total, so item i of each level is
+// [offsets[i], offsets[i + 1]) of the level below.
+struct geometry_coords
+{
+    geometry_coords();
+
+    // x, y of every vertex
+    std::vector<double> xy;
+    // first vertex of each ring
+    std::vector<uint32_t> rings;
+    // first ring of each part, one part per mapnik geometry
+    std::vector<uint32_t> parts;
+    // mapnik::eGeomType of each part: 1 point, 2 linestring, 3 polygon
+    std::vector<unsigned char> types;
+    // first part of each feature
+    std::vector<uint32_t> features;
+};
+
+// Appends the geometries of feature to out as one more feature.
+void write_coords(mapnik::Feature const& feature, geometry_coords& out);
+
+#endif // __NODE_MAPNIK_GEOMETRY_WRITER_H__
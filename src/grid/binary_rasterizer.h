@@ -0,0 +1,457 @@
+#ifndef BINARY_RASTERIZER_H
+#define BINARY_RASTERIZER_H
+
+#include <algorithm>
+#include <vector>
+#include "grid.h"
+
+
+namespace agg_grid
+{
+
+    //========================================================================
+    // Non-antialiased rasterizer for grids.
+    //
+    // A grid pixel only records which feature covers it, so the cover and
+    // area bookkeeping of grid_rasterizer (and the covers array span_grid
+    // then ignores) is wasted work. This rasterizer samples every pixel at
+    // its center instead: the pixel belongs to the polygon when the center
+    // is inside according to the filling rule.
+    //
+    // Paths are kept as a list of edges. Each edge is clipped against the
+    // clip box and set up once when it is added, then walked one scanline
+    // at a time in 16.16 fixed point. The crossings of a scanline become
+    // solid spans handed to grid_renderer::copy_hline().
+    //
+    // The interface follows grid_rasterizer, so both can be used by the
+    // same rendering code.
+    //========================================================================
+    class binary_rasterizer
+    {
+        enum
+        {
+            fixed_shift = 16,
+            fixed_one   = 1 << fixed_shift,
+            fixed_half  = fixed_one >> 1,
+
+            // edge storage is counted in blocks of this many edges,
+            // see num_blocks() and shrink()
+            edge_block_size = 4096
+        };
+
+        enum status_e
+        {
+            status_initial,
+            status_move_to,
+            status_line_to
+        };
+
+        struct edge
+        {
+            int y_start;  // first scanline whose pixel centers it crosses
+            int y_end;    // one past the last such scanline
+            int x;        // 16.16 x at the center of scanline y_start
+            int dx;       // 16.16 x step per scanline
+            int dir;      // +1 going down, -1 going up
+            int next;     // next edge starting on the same row in render()
+        };
+
+        // an edge crossing the current scanline, walked in render()
+        struct active_edge
+        {
+            int x;
+            int dx;
+            int y_end;
+            int dir;
+        };
+
+    public:
+        binary_rasterizer() :
+            m_filling_rule(fill_non_zero),
+            m_clipping(false),
+            m_clip_x1(0), m_clip_y1(0), m_clip_x2(0), m_clip_y2(0),
+            m_min_y(0x7FFFFFFF),
+            m_max_y(-0x7FFFFFFF),
+            m_start_x(0), m_start_y(0),
+            m_cur_x(0), m_cur_y(0),
+            m_status(status_initial)
+        {
+        }
+
+        //--------------------------------------------------------------------
+        void reset()
+        {
+            m_edges.clear();
+            m_min_y = 0x7FFFFFFF;
+            m_max_y = -0x7FFFFFFF;
+            m_status = status_initial;
+        }
+
+        //--------------------------------------------------------------------
+        // Like reset(), but also gives back edge storage beyond max_blocks
+        // blocks of edges.
+        void shrink(unsigned max_blocks)
+        {
+            reset();
+            if(m_edges.capacity() > max_blocks * unsigned(edge_block_size))
+            {
+                std::vector<edge>().swap(m_edges);
+                std::vector<active_edge>().swap(m_active);
+                std::vector<int>().swap(m_row_edges);
+            }
+        }
+
+        unsigned num_blocks() const
+        {
+            return (m_edges.capacity() + edge_block_size - 1) / edge_block_size;
+        }
+
+        //--------------------------------------------------------------------
+        void filling_rule(filling_rule_e filling_rule)
+        {
+            m_filling_rule = filling_rule;
+        }
+
+        //--------------------------------------------------------------------
+        // Edges are clipped to this box when they are added. Without a clip
+        // box the coordinates must stay within the 16.16 range, as with the
+        // cell coordinates of grid_rasterizer.
+        void clip_box(double x1, double y1, double x2, double y2)
+        {
+            m_clipping = true;
+            m_clip_x1 = x1 - 1.0;
+            m_clip_y1 = y1;
+            m_clip_x2 = x2 + 1.0;
+            m_clip_y2 = y2;
+        }
+
+        void reset_clipping() { m_clipping = false; }
+
+        //--------------------------------------------------------------------
+        void move_to_d(double x, double y)
+        {
+            close_polygon();
+            m_start_x = m_cur_x = x;
+            m_start_y = m_cur_y = y;
+            m_status = status_move_to;
+        }
+
+        void line_to_d(double x, double y)
+        {
+            if(m_status == status_initial) return;
+            add_line(m_cur_x, m_cur_y, x, y);
+            m_cur_x = x;
+            m_cur_y = y;
+            m_status = status_line_to;
+        }
+
+        void close_polygon()
+        {
+            if(m_status == status_line_to)
+            {
+                add_line(m_cur_x, m_cur_y, m_start_x, m_start_y);
+            }
+            m_status = status_initial;
+        }
+
+        //--------------------------------------------------------------------
+        void add_vertex(double x, double y, unsigned cmd)
+        {
+            cmd &= grid_rasterizer::path_cmd_mask;
+            if(cmd == grid_rasterizer::path_cmd_move_to)
+            {
+                move_to_d(x, y);
+            }
+            else
+            if(cmd >= grid_rasterizer::path_cmd_line_to &&
+               cmd < grid_rasterizer::path_cmd_end_poly)
+            {
+                line_to_d(x, y);
+            }
+        }
+
+        //--------------------------------------------------------------------
+        template<class VertexSource>
+        void add_path(VertexSource& vs, unsigned path_id=0)
+        {
+            double x;
+            double y;
+
+            unsigned cmd;
+            vs.rewind(path_id);
+            while((cmd = vs.vertex(&x, &y)) != grid_rasterizer::path_cmd_stop)
+            {
+                add_vertex(x, y, cmd);
+            }
+        }
+
+        //--------------------------------------------------------------------
+        int min_y() const { return m_min_y; }
+        int max_y() const { return m_max_y - 1; }
+        unsigned num_edges() const { return m_edges.size(); }
+
+        //--------------------------------------------------------------------
+        template<class Renderer> void render(Renderer& r, grid_value c)
+        {
+            close_polygon();
+            if(m_edges.empty()) return;
+
+            int y = std::max(m_min_y, 0);
+            int y_end = std::min(m_max_y, int(r.rbuf().height()));
+            if(y >= y_end) return;
+
+            // bucket the edges by the first row they are active on, edges
+            // that start above the buffer go to its first row
+            int y_first = y;
+            m_row_edges.assign(y_end - y_first, -1);
+            int k;
+            for(k = int(m_edges.size()) - 1; k >= 0; k--)
+            {
+                edge& e = m_edges[k];
+                if(e.y_end <= y_first || e.y_start >= y_end) continue;
+                int row = std::max(e.y_start, y_first) - y_first;
+                e.next = m_row_edges[row];
+                m_row_edges[row] = k;
+            }
+            m_active.clear();
+
+            for(; y < y_end; y++)
+            {
+                // drop the edges that ended above this scanline
+                unsigned num_active = 0;
+                unsigned i;
+                for(i = 0; i < m_active.size(); i++)
+                {
+                    if(m_active[i].y_end > y) m_active[num_active++] = m_active[i];
+                }
+                m_active.resize(num_active);
+
+                // pick up the edges starting on this row
+                for(k = m_row_edges[y - y_first]; k >= 0; k = m_edges[k].next)
+                {
+                    const edge& e = m_edges[k];
+                    active_edge a;
+                    a.x = e.x + e.dx * (y - e.y_start);
+                    a.dx = e.dx;
+                    a.y_end = e.y_end;
+                    a.dir = e.dir;
+                    m_active.push_back(a);
+                }
+
+                if(m_active.empty()) continue;
+
+                // the order changes only where edges cross, so insertion
+                // sort is close to linear here
+                active_edge* active = &m_active[0];
+                num_active = m_active.size();
+                for(i = 1; i < num_active; i++)
+                {
+                    active_edge e = active[i];
+                    unsigned j = i;
+                    for(; j > 0 && e.x < active[j - 1].x; j--)
+                    {
+                        active[j] = active[j - 1];
+                    }
+                    active[j] = e;
+                }
+
+                // a pixel is inside when its center is at or right of the
+                // crossing that enters the shape and left of the one that
+                // leaves it
+                int winding = 0;
+                int x_enter = 0;
+                for(i = 0; i < num_active; i++)
+                {
+                    active_edge* e = active + i;
+                    bool was_inside = inside(winding);
+                    winding += e->dir;
+                    bool is_inside = inside(winding);
+                    if(!was_inside && is_inside)
+                    {
+                        x_enter = e->x;
+                    }
+                    else
+                    if(was_inside && !is_inside)
+                    {
+                        int x1 = (x_enter + fixed_half - 1) >> fixed_shift;
+                        int x2 = ((e->x + fixed_half - 1) >> fixed_shift) - 1;
+                        if(x2 >= x1) r.copy_hline(x1, y, x2, c);
+                    }
+                    e->x += e->dx;
+                }
+            }
+        }
+
+        //--------------------------------------------------------------------
+        bool hit_test(int tx, int ty)
+        {
+            close_polygon();
+            int cx = (tx << fixed_shift) + fixed_half;
+            int winding = 0;
+            std::vector<edge>::const_iterator itr = m_edges.begin();
+            std::vector<edge>::const_iterator end = m_edges.end();
+            for(; itr != end; ++itr)
+            {
+                if(ty < itr->y_start || ty >= itr->y_end) continue;
+                if(itr->x + itr->dx * (ty - itr->y_start) <= cx)
+                {
+                    winding += itr->dir;
+                }
+            }
+            return inside(winding);
+        }
+
+    private:
+        binary_rasterizer(const binary_rasterizer&);
+        const binary_rasterizer& operator = (const binary_rasterizer&);
+
+        //--------------------------------------------------------------------
+        bool inside(int winding) const
+        {
+            if(m_filling_rule == fill_even_odd) return (winding & 1) != 0;
+            return winding != 0;
+        }
+
+        //--------------------------------------------------------------------
+        // floor() and ceil() for values known to be in the int range,
+        // without the libm calls
+        static int ifloor(double v)
+        {
+            int i = int(v);
+            return (double(i) > v) ? i - 1 : i;
+        }
+
+        static int iceil(double v)
+        {
+            int i = int(v);
+            return (double(i) < v) ? i + 1 : i;
+        }
+
+        static int to_fixed(double v)
+        {
+            return ifloor(v * fixed_one + 0.5);
+        }
+
+        //--------------------------------------------------------------------
+        // Splits the line where it leaves the clip box horizontally. Parts
+        // left or right of the box become vertical edges on its border:
+        // they still change the winding of the pixels inside, but need no
+        // room in the fixed point range.
+        void add_line(double x1, double y1, double x2, double y2)
+        {
+            if(!m_clipping)
+            {
+                add_edge(x1, y1, x2, y2);
+                return;
+            }
+
+            if((y1 < m_clip_y1 && y2 < m_clip_y1) ||
+               (y1 >= m_clip_y2 && y2 >= m_clip_y2))
+            {
+                return;
+            }
+
+            if(x1 >= m_clip_x1 && x1 <= m_clip_x2 &&
+               x2 >= m_clip_x1 && x2 <= m_clip_x2)
+            {
+                add_edge(x1, y1, x2, y2);
+                return;
+            }
+
+            double t[4];
+            unsigned n = 0;
+            t[n++] = 0.0;
+            if(x1 != x2)
+            {
+                double t1 = (m_clip_x1 - x1) / (x2 - x1);
+                double t2 = (m_clip_x2 - x1) / (x2 - x1);
+                if(t1 > t2) std::swap(t1, t2);
+                if(t1 > 0.0 && t1 < 1.0) t[n++] = t1;
+                if(t2 > 0.0 && t2 < 1.0) t[n++] = t2;
+            }
+            t[n++] = 1.0;
+
+            double px = clip_x(x1);
+            double py = y1;
+            for(unsigned i = 1; i < n; i++)
+            {
+                double nx = (i == n - 1) ? x2 : x1 + (x2 - x1) * t[i];
+                double ny = (i == n - 1) ? y2 : y1 + (y2 - y1) * t[i];
+                nx = clip_x(nx);
+                add_edge(px, py, nx, ny);
+                px = nx;
+                py = ny;
+            }
+        }
+
+        double clip_x(double x) const
+        {
+            if(x < m_clip_x1) return m_clip_x1;
+            if(x > m_clip_x2) return m_clip_x2;
+            return x;
+        }
+
+        //--------------------------------------------------------------------
+        void add_edge(double x1, double y1, double x2, double y2)
+        {
+            if(y1 == y2) return;
+
+            edge e;
+            e.dir = 1;
+            if(y1 > y2)
+            {
+                std::swap(x1, x2);
+                std::swap(y1, y2);
+                e.dir = -1;
+            }
+
+            // scanline y samples at y + 0.5; the edge covers the
+            // half-open range [y1, y2)
+            int ys;
+            int ye;
+            if(m_clipping)
+            {
+                ys = iceil(std::max(y1, m_clip_y1) - 0.5);
+                ye = iceil(std::min(y2, m_clip_y2) - 0.5);
+            }
+            else
+            {
+                ys = iceil(y1 - 0.5);
+                ye = iceil(y2 - 0.5);
+            }
+            if(ys >= ye) return;
+
+            double slope = (x2 - x1) / (y2 - y1);
+            e.y_start = ys;
+            e.y_end = ye;
+            e.x = to_fixed(x1 + (ys + 0.5 - y1) * slope);
+            e.dx = (ye - ys > 1) ? to_fixed(slope) : 0;
+
+            if(e.y_start < m_min_y) m_min_y = e.y_start;
+            if(e.y_end > m_max_y) m_max_y = e.y_end;
+            m_edges.push_back(e);
+        }
+
+    private:
+        std::vector<edge>  m_edges;
+        std::vector<active_edge> m_active;
+        std::vector<int>   m_row_edges;
+        filling_rule_e     m_filling_rule;
+        bool               m_clipping;
+        double             m_clip_x1;
+        double             m_clip_y1;
+        double             m_clip_x2;
+        double             m_clip_y2;
+        int                m_min_y;
+        int                m_max_y;
+        double             m_start_x;
+        double             m_start_y;
+        double             m_cur_x;
+        double             m_cur_y;
+        status_e           m_status;
+    };
+
+}
+
+
+#endif
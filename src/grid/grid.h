@@ -4,6 +4,7 @@
 #include <string.h>
 //#include <iostream>
 #include "renderer.h"
+#include "grid_fill.h"
 
 
 namespace agg_grid
@@ -110,10 +111,21 @@ namespace agg_grid
         //--------------------------------------------------------------------
         void clear(grid_value c)
         {
+            unsigned width = m_rbuf->width();
+            unsigned height = m_rbuf->height();
+            if(width == 0 || height == 0) return;
+
+            // contiguous buffer, fill it in one pass
+            if(m_rbuf->stride() == int(width))
+            {
+                fill_values(m_rbuf->row(0), width * height, c);
+                return;
+            }
+
             unsigned y;
-            for(y = 0; y < m_rbuf->height(); y++)
+            for(y = 0; y < height; y++)
             {
-                m_span.hline(m_rbuf->row(y), 0, m_rbuf->width(), c);
+                m_span.hline(m_rbuf->row(y), 0, width, c);
             }
         }
 
@@ -152,6 +164,18 @@ namespace agg_grid
             while(--num_spans);
         }
 
+        //--------------------------------------------------------------------
+        // Solid span from x1 to x2 inclusive, clipped to the buffer. Used by
+        // binary_rasterizer, which has no covers to pass along.
+        void copy_hline(int x1, int y, int x2, grid_value c)
+        {
+            if(y < 0 || y >= int(m_rbuf->height())) return;
+            if(x1 < 0) x1 = 0;
+            if(x2 >= int(m_rbuf->width())) x2 = m_rbuf->width() - 1;
+            if(x1 > x2) return;
+            m_span.hline(m_rbuf->row(y), x1, x2 - x1 + 1, c);
+        }
+
         //--------------------------------------------------------------------
         grid_rendering_buffer& rbuf() { return *m_rbuf; }
 
@@ -295,6 +319,13 @@ namespace agg_grid
         //--------------------------------------------------------------------
         void reset() { m_outline.reset(); }
 
+        //--------------------------------------------------------------------
+        // Like reset(), but also gives back cell storage beyond max_blocks
+        // blocks. Used to bound rasterizers that are kept alive between
+        // requests.
+        void shrink(unsigned max_blocks) { m_outline.free_blocks(max_blocks); }
+        unsigned num_blocks() const { return m_outline.num_blocks(); }
+
         //--------------------------------------------------------------------
         void filling_rule(filling_rule_e filling_rule) 
         { 
@@ -553,9 +584,7 @@ namespace agg_grid
                            const unsigned char* covers, 
                            grid_value c)
         {
-            grid_value* p = ptr + x;
-            do { *p++ = c; }
-            while(--count);
+            fill_values(ptr + x, count, c);
         }
 
         //--------------------------------------------------------------------
@@ -564,9 +593,7 @@ namespace agg_grid
                           unsigned count, 
                           grid_value c)
         {
-            grid_value* p = ptr + x;
-            do { *p++ = c; }
-            while(--count);
+            fill_values(ptr + x, count, c);
         }
 
         //--------------------------------------------------------------------
@@ -0,0 +1,108 @@
+#ifndef GRID_FILL_H
+#define GRID_FILL_H
+
+#include <stddef.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace agg_grid
+{
+
+    //------------------------------------------------------------------------
+    // Fill kernels used by span_grid and grid_renderer::clear.
+    //
+    // Grid spans are runs of identical 32-bit feature ids, so filling them
+    // is a plain memory broadcast. The generic version is the scalar loop
+    // the span renderer always used; the 32-bit specialization aligns the
+    // destination and then writes whole vector registers (8 ids per store
+    // with AVX2, 4 with SSE2). Short spans stay on the scalar path since the
+    // alignment prologue would cost more than it saves.
+    //------------------------------------------------------------------------
+    enum
+    {
+        fill_vector_threshold = 16
+    };
+
+    //------------------------------------------------------------------------
+    template<class T> inline void fill_values(T* p, unsigned count, T c)
+    {
+        while(count--) *p++ = c;
+    }
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+    //------------------------------------------------------------------------
+    template<> inline void fill_values<unsigned int>(unsigned int* p,
+                                                     unsigned count,
+                                                     unsigned int c)
+    {
+        if(count < fill_vector_threshold)
+        {
+            if(count)
+            {
+                do { *p++ = c; }
+                while(--count);
+            }
+            return;
+        }
+
+#if defined(__AVX2__)
+        const size_t align = 32;
+#else
+        const size_t align = 16;
+#endif
+        // the grid buffers are at least 4-byte aligned, so the
+        // prologue is never more than (align / 4 - 1) ids
+        while(((size_t)p & (align - 1)) && count)
+        {
+            *p++ = c;
+            --count;
+        }
+
+#if defined(__AVX2__)
+        __m256i v = _mm256_set1_epi32(int(c));
+        while(count >= 32)
+        {
+            _mm256_store_si256((__m256i*)(p),      v);
+            _mm256_store_si256((__m256i*)(p + 8),  v);
+            _mm256_store_si256((__m256i*)(p + 16), v);
+            _mm256_store_si256((__m256i*)(p + 24), v);
+            p += 32;
+            count -= 32;
+        }
+        while(count >= 8)
+        {
+            _mm256_store_si256((__m256i*)p, v);
+            p += 8;
+            count -= 8;
+        }
+#else
+        __m128i v = _mm_set1_epi32(int(c));
+        while(count >= 16)
+        {
+            _mm_store_si128((__m128i*)(p),      v);
+            _mm_store_si128((__m128i*)(p + 4),  v);
+            _mm_store_si128((__m128i*)(p + 8),  v);
+            _mm_store_si128((__m128i*)(p + 12), v);
+            p += 16;
+            count -= 16;
+        }
+        while(count >= 4)
+        {
+            _mm_store_si128((__m128i*)p, v);
+            p += 4;
+            count -= 4;
+        }
+#endif
+        while(count--) *p++ = c;
+    }
+
+#endif
+
+}
+
+#endif
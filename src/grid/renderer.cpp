@@ -161,6 +161,8 @@ namespace agg_grid
     //------------------------------------------------------------------------
     outline::~outline()
     {
+        delete [] m_sort_tmp;
+        delete [] m_sorted_y;
         delete [] m_sorted_cells;
         if(m_num_blocks)
         {
@@ -185,6 +187,10 @@ namespace agg_grid
         m_cur_cell_ptr(0),
         m_sorted_cells(0),
         m_sorted_size(0),
+        m_sorted_y(0),
+        m_sorted_y_size(0),
+        m_sort_tmp(0),
+        m_sort_tmp_size(0),
         m_cur_x(0),
         m_cur_y(0),
         m_close_x(0),
@@ -215,6 +221,36 @@ namespace agg_grid
 
 
 
+    //------------------------------------------------------------------------
+    void outline::free_blocks(unsigned max_blocks)
+    {
+        reset();
+        while(m_num_blocks > max_blocks)
+        {
+            --m_num_blocks;
+            delete [] m_cells[m_num_blocks];
+        }
+        if(m_num_blocks == 0 && m_cells)
+        {
+            delete [] m_cells;
+            m_cells = 0;
+            m_max_blocks = 0;
+        }
+        if(m_sorted_size > (max_blocks << cell_block_shift))
+        {
+            delete [] m_sorted_cells;
+            m_sorted_cells = 0;
+            m_sorted_size = 0;
+        }
+        if(m_sort_tmp_size > (max_blocks << cell_block_shift))
+        {
+            delete [] m_sort_tmp;
+            m_sort_tmp = 0;
+            m_sort_tmp_size = 0;
+        }
+    }
+
+
     //------------------------------------------------------------------------
     void outline::allocate_block()
     {
@@ -531,7 +567,8 @@ namespace agg_grid
 
     enum
     {
-        qsort_threshold = 9
+        qsort_threshold = 9,
+        radix_threshold = 64
     };
 
 
@@ -658,6 +695,92 @@ namespace agg_grid
     }
 
     //------------------------------------------------------------------------
+    // Sorts the cells of one scanline by x. All cells share the same y, so
+    // comparing packed_coord is comparing x. Rows are usually a handful of
+    // cells, which insertion sort handles best. Long rows (detailed polygons
+    // at high resolution) get an LSD radix sort on x - min_x, one or two
+    // byte-wide passes through m_sort_tmp, unless the x range does not fit
+    // in 16 bits, where qsort_cells is used instead.
+    void outline::sort_row(cell** start, unsigned num, bool radix)
+    {
+        cell** limit = start + num;
+        cell** i;
+        cell** j;
+
+        if(num <= radix_threshold || !radix)
+        {
+            if(num > qsort_threshold)
+            {
+                qsort_cells(start, num);
+                return;
+            }
+            for(i = start + 1; i < limit; i++)
+            {
+                cell* c = *i;
+                for(j = i; j > start && c->packed_coord < (*(j - 1))->packed_coord; j--)
+                {
+                    *j = *(j - 1);
+                }
+                *j = c;
+            }
+            return;
+        }
+
+        unsigned lo_count[256];
+        unsigned hi_count[256];
+        memset(lo_count, 0, sizeof(lo_count));
+        memset(hi_count, 0, sizeof(hi_count));
+
+        unsigned max_key = 0;
+        for(i = start; i < limit; i++)
+        {
+            unsigned key = unsigned((*i)->x - m_min_x);
+            lo_count[key & 0xFF]++;
+            hi_count[(key >> 8) & 0xFF]++;
+            if(key > max_key) max_key = key;
+        }
+
+        unsigned k;
+        unsigned sum = 0;
+        for(k = 0; k < 256; k++)
+        {
+            unsigned c = lo_count[k];
+            lo_count[k] = sum;
+            sum += c;
+        }
+        for(i = start; i < limit; i++)
+        {
+            m_sort_tmp[lo_count[unsigned((*i)->x - m_min_x) & 0xFF]++] = *i;
+        }
+
+        if(max_key < 256)
+        {
+            memcpy(start, m_sort_tmp, num * sizeof(cell*));
+            return;
+        }
+
+        sum = 0;
+        for(k = 0; k < 256; k++)
+        {
+            unsigned c = hi_count[k];
+            hi_count[k] = sum;
+            sum += c;
+        }
+        cell** tmp = m_sort_tmp;
+        cell** tmp_limit = m_sort_tmp + num;
+        for(; tmp < tmp_limit; tmp++)
+        {
+            start[hi_count[(unsigned((*tmp)->x - m_min_x) >> 8) & 0xFF]++] = *tmp;
+        }
+    }
+
+
+    //------------------------------------------------------------------------
+    // Cells are sorted in two steps, as in later versions of AGG: a
+    // counting sort distributes them into scanlines by y (two linear passes,
+    // no comparisons) and then each scanline is sorted by x on its own with
+    // sort_row(). The result is the same (y, x) order a full sort by
+    // packed_coord gives.
     void outline::sort_cells()
     {
         if(m_num_cells == 0) return;
@@ -667,32 +790,144 @@ namespace agg_grid
             m_sorted_size = m_num_cells;
             m_sorted_cells = new cell* [m_num_cells + 1];
         }
+        m_sorted_cells[m_num_cells] = 0;
 
-        cell** sorted_ptr = m_sorted_cells;
-        cell** block_ptr = m_cells;
-        cell*  cell_ptr;
+        // cell::y is 16 bit; anything outside the tracked range means the
+        // coordinates wrapped, so fall back to sorting on packed_coord
+        bool bucketed = m_min_y <= m_max_y &&
+                        m_min_y >= -0x8000 && m_max_y <= 0x7FFF;
+
+        unsigned num_rows = bucketed ? unsigned(m_max_y - m_min_y + 1) : 0;
+        if(bucketed && num_rows + 1 > m_sorted_y_size)
+        {
+            delete [] m_sorted_y;
+            m_sorted_y_size = num_rows + 1;
+            m_sorted_y = new unsigned [m_sorted_y_size];
+        }
 
-        unsigned nb = m_num_cells >> cell_block_shift;
+        cell** block_ptr;
+        cell*  cell_ptr;
+        unsigned nb;
         unsigned i;
 
-        while(nb--)
+        if(bucketed)
+        {
+            // count cells per scanline
+            memset(m_sorted_y, 0, (num_rows + 1) * sizeof(unsigned));
+
+            block_ptr = m_cells;
+            nb = m_num_cells >> cell_block_shift;
+            while(nb--)
+            {
+                cell_ptr = *block_ptr++;
+                i = cell_block_size;
+                while(i--)
+                {
+                    int row = cell_ptr->y - m_min_y;
+                    if(row < 0 || row >= int(num_rows)) { bucketed = false; break; }
+                    m_sorted_y[row + 1]++;
+                    ++cell_ptr;
+                }
+                if(!bucketed) break;
+            }
+            if(bucketed)
+            {
+                cell_ptr = *block_ptr++;
+                i = m_num_cells & cell_block_mask;
+                while(i--)
+                {
+                    int row = cell_ptr->y - m_min_y;
+                    if(row < 0 || row >= int(num_rows)) { bucketed = false; break; }
+                    m_sorted_y[row + 1]++;
+                    ++cell_ptr;
+                }
+            }
+        }
+
+        if(!bucketed)
         {
+            cell** sorted_ptr = m_sorted_cells;
+            block_ptr = m_cells;
+            nb = m_num_cells >> cell_block_shift;
+
+            while(nb--)
+            {
+                cell_ptr = *block_ptr++;
+                i = cell_block_size;
+                while(i--)
+                {
+                    *sorted_ptr++ = cell_ptr++;
+                }
+            }
+
             cell_ptr = *block_ptr++;
-            i = cell_block_size;
+            i = m_num_cells & cell_block_mask;
             while(i--)
             {
                 *sorted_ptr++ = cell_ptr++;
             }
+            qsort_cells(m_sorted_cells, m_num_cells);
+            return;
+        }
+
+        // turn the counts into start offsets, m_sorted_y[row] is where
+        // the cells of that scanline begin
+        unsigned row;
+        for(row = 1; row <= num_rows; row++)
+        {
+            m_sorted_y[row] += m_sorted_y[row - 1];
         }
 
+        // scatter the cells into their scanlines, advancing each start
+        // offset; afterwards m_sorted_y[row] is the end of that scanline
+        block_ptr = m_cells;
+        nb = m_num_cells >> cell_block_shift;
+        while(nb--)
+        {
+            cell_ptr = *block_ptr++;
+            i = cell_block_size;
+            while(i--)
+            {
+                m_sorted_cells[m_sorted_y[cell_ptr->y - m_min_y]++] = cell_ptr;
+                ++cell_ptr;
+            }
+        }
         cell_ptr = *block_ptr++;
         i = m_num_cells & cell_block_mask;
         while(i--)
         {
-            *sorted_ptr++ = cell_ptr++;
+            m_sorted_cells[m_sorted_y[cell_ptr->y - m_min_y]++] = cell_ptr;
+            ++cell_ptr;
+        }
+
+        // sort every scanline by x; the radix path needs the keys to
+        // fit in 16 bits and scratch space for the longest row
+        bool radix = m_min_x <= m_max_x && m_max_x - m_min_x < 0x10000;
+        unsigned start = 0;
+        unsigned longest = 0;
+        for(row = 0; row < num_rows; row++)
+        {
+            unsigned end = m_sorted_y[row];
+            if(end - start > longest) longest = end - start;
+            start = end;
+        }
+        if(radix && longest > radix_threshold && longest > m_sort_tmp_size)
+        {
+            delete [] m_sort_tmp;
+            m_sort_tmp_size = longest;
+            m_sort_tmp = new cell* [longest];
+        }
+
+        start = 0;
+        for(row = 0; row < num_rows; row++)
+        {
+            unsigned end = m_sorted_y[row];
+            if(end - start > 1)
+            {
+                sort_row(m_sorted_cells + start, end - start, radix);
+            }
+            start = end;
         }
-        m_sorted_cells[m_num_cells] = 0;
-        qsort_cells(m_sorted_cells, m_num_cells);
     }
 
 
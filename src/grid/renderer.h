@@ -282,6 +282,12 @@ namespace agg_grid
 
         void reset();
 
+        // reset() keeps the allocated cell blocks and the sorted cell
+        // array so a long-lived outline can be reused without touching
+        // the heap. free_blocks() returns everything past max_blocks.
+        void free_blocks(unsigned max_blocks);
+        unsigned num_blocks() const { return m_num_blocks; }
+
         void move_to(int x, int y);
         void line_to(int x, int y);
 
@@ -305,6 +311,7 @@ namespace agg_grid
         void allocate_block();
 
         static void qsort_cells(cell** start, unsigned num);
+        void sort_row(cell** start, unsigned num, bool radix);
 
     private:
         unsigned  m_num_blocks;
@@ -315,6 +322,10 @@ namespace agg_grid
         cell*     m_cur_cell_ptr;
         cell**    m_sorted_cells;
         unsigned  m_sorted_size;
+        unsigned* m_sorted_y;
+        unsigned  m_sorted_y_size;
+        cell**    m_sort_tmp;
+        unsigned  m_sort_tmp_size;
         cell      m_cur_cell;
         int       m_cur_x;
         int       m_cur_y;
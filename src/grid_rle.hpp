@@ -0,0 +1,192 @@
+#ifndef __NODE_MAPNIK_GRID_RLE_H__
+#define __NODE_MAPNIK_GRID_RLE_H__
+
+// stl
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Run-length encoded binary grid, a compact alternative to the UTFGrid
+// JSON for clients that can decode it. Every integer is a little-endian
+// uint32:
+//
+//   magic ("GRL1"), width, height, number of keys
+//   key table:  per key its length in bytes, then its utf-8 bytes
+//               padded with zeros to a multiple of 4
+//   rows:       per row the number of runs, then that many pairs of
+//               (key index, run length); a row with 0 runs repeats the
+//               row above it
+//
+// Key indexes point into the key table, which lists the keys in the order
+// they first appear in the grid, the same order as the "keys" array of the
+// JSON output. Pixels whose grid value has no key are left out of their
+// row, as they are in the JSON output, so the runs of such a row add up to
+// less than the width. Because everything is 4-byte aligned, a client can read the
+// whole buffer through a single Uint32Array.
+//
+// Grid values are mapped to keys once per run rather than once per pixel,
+// so encoding is also cheaper than building the JSON grid.
+
+template <typename Value>
+class grid_rle_encoder
+{
+public:
+    enum { magic = 0x314c5247 }; // "GRL1"
+    // key_index() of grid values without a key
+    static const uint32_t no_key = 0xffffffff;
+
+    grid_rle_encoder(unsigned width, unsigned height)
+        : width_(width),
+          height_(height),
+          prev_row_(-1)
+    {
+        runs_.reserve(height * 3);
+    }
+
+    // Appends the next row. feature_keys maps grid values to join field
+    // values, pixels with unknown grid values are skipped.
+    template <typename KeyMap>
+    void add_row(Value const* row, KeyMap const& feature_keys)
+    {
+        std::size_t start = runs_.size();
+        runs_.push_back(0);
+        uint32_t num_runs = 0;
+        unsigned x = 0;
+        while (x < width_)
+        {
+            Value v = row[x];
+            unsigned len = 1;
+            while (x + len < width_ && row[x + len] == v) ++len;
+            uint32_t idx = key_index(v, feature_keys);
+            if (idx == no_key)
+            {
+                x += len;
+                continue;
+            }
+            // distinct grid values can share a key
+            if (num_runs > 0 && runs_[runs_.size() - 2] == idx)
+            {
+                runs_.back() += len;
+            }
+            else
+            {
+                runs_.push_back(idx);
+                runs_.push_back(len);
+                ++num_runs;
+            }
+            x += len;
+        }
+        runs_[start] = num_runs;
+
+        if (prev_row_ >= 0 && same_runs(prev_row_, start))
+        {
+            runs_.resize(start + 1);
+            runs_[start] = 0;
+        }
+        else
+        {
+            prev_row_ = static_cast<long>(start);
+        }
+    }
+
+    std::vector<std::string> const& key_order() const
+    {
+        return key_order_;
+    }
+
+    void write(std::string& out) const
+    {
+        std::size_t size = 16 + runs_.size() * 4;
+        std::vector<std::string>::const_iterator itr = key_order_.begin();
+        std::vector<std::string>::const_iterator end = key_order_.end();
+        for (; itr != end; ++itr)
+        {
+            size += 4 + ((itr->size() + 3) & ~std::size_t(3));
+        }
+
+        out.clear();
+        out.reserve(size);
+        put_u32(out, magic);
+        put_u32(out, width_);
+        put_u32(out, height_);
+        put_u32(out, key_order_.size());
+        for (itr = key_order_.begin(); itr != end; ++itr)
+        {
+            put_u32(out, itr->size());
+            out.append(*itr);
+            out.append((4 - (itr->size() & 3)) & 3, '\0');
+        }
+        std::vector<uint32_t>::const_iterator run = runs_.begin();
+        for (; run != runs_.end(); ++run)
+        {
+            put_u32(out, *run);
+        }
+    }
+
+private:
+    template <typename KeyMap>
+    uint32_t key_index(Value v, KeyMap const& feature_keys)
+    {
+        typename std::map<Value, uint32_t>::const_iterator pos = value_index_.find(v);
+        if (pos != value_index_.end())
+            return pos->second;
+
+        typename KeyMap::const_iterator feature_pos = feature_keys.find(v);
+        if (feature_pos == feature_keys.end())
+        {
+            value_index_[v] = no_key;
+            return no_key;
+        }
+        std::string const& key = feature_pos->second;
+
+        uint32_t idx;
+        std::map<std::string, uint32_t>::const_iterator key_pos = keys_.find(key);
+        if (key_pos == keys_.end())
+        {
+            idx = key_order_.size();
+            keys_[key] = idx;
+            key_order_.push_back(key);
+        }
+        else
+        {
+            idx = key_pos->second;
+        }
+        value_index_[v] = idx;
+        return idx;
+    }
+
+    bool same_runs(std::size_t a, std::size_t b) const
+    {
+        uint32_t n = runs_[b];
+        if (runs_[a] != n) return false;
+        for (std::size_t i = 1; i <= n * 2; ++i)
+        {
+            if (runs_[a + i] != runs_[b + i]) return false;
+        }
+        return true;
+    }
+
+    static void put_u32(std::string& out, uint32_t v)
+    {
+        char b[4];
+        b[0] = static_cast<char>(v & 0xff);
+        b[1] = static_cast<char>((v >> 8) & 0xff);
+        b[2] = static_cast<char>((v >> 16) & 0xff);
+        b[3] = static_cast<char>((v >> 24) & 0xff);
+        out.append(b, 4);
+    }
+
+    unsigned width_;
+    unsigned height_;
+    long prev_row_;
+    std::vector<uint32_t> runs_;
+    std::map<Value, uint32_t> value_index_;
+    std::map<std::string, uint32_t> keys_;
+    std::vector<std::string> key_order_;
+};
+
+template <typename Value>
+const uint32_t grid_rle_encoder<Value>::no_key;
+
+#endif // __NODE_MAPNIK_GRID_RLE_H__
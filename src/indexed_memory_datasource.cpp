@@ -0,0 +1,381 @@
+#include "indexed_memory_datasource.hpp"
+#include "columnar_memory_datasource.hpp"
+
+// stl
+#include <algorithm>
+#include <map>
+
+namespace {
+
+// the narrowest column type that holds every value seen so far
+struct column_type_of_value : public boost::static_visitor<>
+{
+    explicit column_type_of_value(attribute_column::value_type& type)
+        : type_(type) {}
+
+    void operator() (double) const
+    {
+        if (type_ == attribute_column::int_type)
+            type_ = attribute_column::double_type;
+    }
+
+    void operator() (UnicodeString const&) const
+    {
+        type_ = attribute_column::string_type;
+    }
+
+    template <typename T>
+    void operator() (T const&) const {}
+
+    attribute_column::value_type& type_;
+};
+
+}
+
+indexed_memory_datasource::indexed_memory_datasource(mapnik::parameters const& params)
+    : writable_memory_datasource(params),
+      mutex_(),
+      write_mutex_(),
+      features_(),
+      boxes_(),
+      index_(),
+      slots_(),
+      has_slot_map_(false),
+      extent_(),
+      desc_("in-memory datasource","utf-8") {}
+
+indexed_memory_datasource::~indexed_memory_datasource() {}
+
+int indexed_memory_datasource::type() const
+{
+    return mapnik::datasource::Vector;
+}
+
+void indexed_memory_datasource::push(mapnik::feature_ptr const& feature)
+{
+    boost::mutex::scoped_lock write_lock(write_mutex_);
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        push_locked(feature);
+    }
+    maintain();
+}
+
+void indexed_memory_datasource::push(std::vector<mapnik::feature_ptr> const& features)
+{
+    boost::mutex::scoped_lock write_lock(write_mutex_);
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        features_.reserve(features_.size() + features.size());
+        boxes_.reserve(boxes_.size() + features.size());
+        std::vector<mapnik::feature_ptr>::const_iterator itr = features.begin();
+        std::vector<mapnik::feature_ptr>::const_iterator end = features.end();
+        for (; itr != end; ++itr)
+            push_locked(*itr);
+    }
+    maintain();
+}
+
+bool indexed_memory_datasource::update(mapnik::feature_ptr const& feature)
+{
+    boost::mutex::scoped_lock write_lock(write_mutex_);
+    bool found;
+    {
+        std::size_t slot;
+        found = find_slot(feature->id(), slot);
+        boost::mutex::scoped_lock lock(mutex_);
+        if (found)
+            remove_slot(slot);
+        push_locked(feature);
+    }
+    maintain();
+    return found;
+}
+
+bool indexed_memory_datasource::remove(int id)
+{
+    boost::mutex::scoped_lock write_lock(write_mutex_);
+    std::size_t slot;
+    if (!find_slot(id, slot))
+        return false;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        remove_slot(slot);
+    }
+    maintain();
+    return true;
+}
+
+bool indexed_memory_datasource::feature_box(mapnik::feature_ptr const& feature, mapnik::box2d<double>& box)
+{
+    unsigned num_geometries = feature->num_geometries();
+    if (num_geometries == 0)
+        return false;
+
+    box = feature->get_geometry(0).envelope();
+    for (unsigned i = 1; i < num_geometries; ++i)
+        box.expand_to_include(feature->get_geometry(i).envelope());
+    return true;
+}
+
+// caller holds write_mutex_; only writers touch the slot map
+bool indexed_memory_datasource::find_slot(int id, std::size_t& slot)
+{
+    if (!has_slot_map_)
+    {
+        for (std::size_t i = 0; i < features_.size(); ++i)
+        {
+            if (features_[i])
+                slots_[features_[i]->id()] = static_cast<uint32_t>(i);
+        }
+        has_slot_map_ = true;
+    }
+    slot_map::const_iterator itr = slots_.find(id);
+    if (itr == slots_.end())
+        return false;
+    slot = itr->second;
+    return true;
+}
+
+// caller holds both mutexes
+void indexed_memory_datasource::remove_slot(std::size_t slot)
+{
+    if (has_slot_map_)
+        slots_.erase(features_[slot]->id());
+    // the feature lives on in the featuresets that matched it
+    features_[slot].reset();
+    index_.remove(slot);
+}
+
+// caller holds both mutexes
+void indexed_memory_datasource::push_locked(mapnik::feature_ptr const& feature)
+{
+    mapnik::box2d<double> box;
+    if (!feature_box(feature, box))
+        return;
+
+    if (features_.size() == index_.num_removed())
+        extent_ = box;
+    else
+        extent_.expand_to_include(box);
+    if (has_slot_map_)
+        slots_[feature->id()] = static_cast<uint32_t>(features_.size());
+    features_.push_back(feature);
+    boxes_.push_back(box);
+}
+
+void indexed_memory_datasource::maintain()
+{
+    if (index_.num_removed() > leveled_index::min_level && index_.num_removed() * 2 > features_.size())
+    {
+        compact();
+        return;
+    }
+
+    leveled_index::merge_plan plan;
+    while (index_.plan_merge(boxes_.size(), plan))
+    {
+        packed_rtree tree;
+        leveled_index::build_level(boxes_, plan, tree);
+        boost::mutex::scoped_lock lock(mutex_);
+        index_.install(plan, tree);
+    }
+}
+
+// Rebuilds the slots without the removed ones, then swaps them in. Slot
+// numbers change, so the index and the slot map are rebuilt with them.
+void indexed_memory_datasource::compact()
+{
+    std::size_t live = features_.size() - index_.num_removed();
+    std::vector<mapnik::feature_ptr> features;
+    std::vector<mapnik::box2d<double> > boxes;
+    features.reserve(live);
+    boxes.reserve(live);
+    mapnik::box2d<double> extent;
+    for (std::size_t i = 0; i < features_.size(); ++i)
+    {
+        if (index_.is_removed(i))
+            continue;
+        if (features.empty())
+            extent = boxes_[i];
+        else
+            extent.expand_to_include(boxes_[i]);
+        features.push_back(features_[i]);
+        boxes.push_back(boxes_[i]);
+    }
+
+    leveled_index index;
+    index.build_all(boxes);
+
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        features_.swap(features);
+        boxes_.swap(boxes);
+        index_.swap(index);
+        extent_ = extent;
+    }
+    slots_.clear();
+    has_slot_map_ = false;
+    // the old features are released here, outside the lock
+}
+
+void indexed_memory_datasource::replace(std::vector<mapnik::feature_ptr>& features)
+{
+    std::vector<mapnik::feature_ptr> kept;
+    std::vector<mapnik::box2d<double> > boxes;
+    mapnik::box2d<double> extent;
+    kept.reserve(features.size());
+    boxes.reserve(features.size());
+
+    mapnik::box2d<double> box;
+    std::vector<mapnik::feature_ptr>::const_iterator itr = features.begin();
+    std::vector<mapnik::feature_ptr>::const_iterator end = features.end();
+    for (; itr != end; ++itr)
+    {
+        if (!feature_box(*itr, box))
+            continue;
+        if (kept.empty())
+            extent = box;
+        else
+            extent.expand_to_include(box);
+        kept.push_back(*itr);
+        boxes.push_back(box);
+    }
+    features.clear();
+
+    leveled_index index;
+    index.build_all(boxes);
+
+    boost::mutex::scoped_lock write_lock(write_mutex_);
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        features_.swap(kept);
+        boxes_.swap(boxes);
+        index_.swap(index);
+        extent_ = extent;
+    }
+    slots_.clear();
+    has_slot_map_ = false;
+}
+
+void indexed_memory_datasource::save(std::string const& path) const
+{
+    std::vector<mapnik::feature_ptr> features;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        features.reserve(features_.size() - index_.num_removed());
+        std::vector<mapnik::feature_ptr>::const_iterator itr = features_.begin();
+        for (; itr != features_.end(); ++itr)
+        {
+            if (*itr)
+                features.push_back(*itr);
+        }
+    }
+
+    typedef std::map<std::string, attribute_column::value_type> type_map;
+    type_map types;
+    std::vector<std::string> names;
+    std::vector<mapnik::feature_ptr>::const_iterator itr = features.begin();
+    for (; itr != features.end(); ++itr)
+    {
+        std::map<std::string, mapnik::value> const& props = (*itr)->props();
+        std::map<std::string, mapnik::value>::const_iterator prop = props.begin();
+        for (; prop != props.end(); ++prop)
+        {
+            std::pair<type_map::iterator, bool> pos =
+                types.insert(std::make_pair(prop->first, attribute_column::int_type));
+            if (pos.second)
+                names.push_back(prop->first);
+            boost::apply_visitor(column_type_of_value(pos.first->second), prop->second.base());
+        }
+    }
+
+    column_schema schema;
+    std::vector<std::string>::const_iterator name = names.begin();
+    for (; name != names.end(); ++name)
+        schema.push_back(column_def(*name, types[*name]));
+
+    column_store store(schema);
+    for (itr = features.begin(); itr != features.end(); ++itr)
+        store.push(*itr);
+    store.build_index();
+    store.save(path);
+}
+
+void indexed_memory_datasource::clear()
+{
+    std::vector<mapnik::feature_ptr> features;
+    boost::mutex::scoped_lock write_lock(write_mutex_);
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        features_.swap(features);
+        boxes_.clear();
+        index_.clear();
+        extent_ = mapnik::box2d<double>();
+    }
+    slots_.clear();
+    has_slot_map_ = false;
+}
+
+mapnik::featureset_ptr indexed_memory_datasource::features_in_box(mapnik::box2d<double> const& box) const
+{
+    std::vector<mapnik::feature_ptr> matches;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        // in the order the features were added, it is the order they
+        // are drawn in
+        std::vector<uint32_t> hits;
+        index_.query(boxes_, box, hits);
+
+        matches.reserve(hits.size());
+        std::vector<uint32_t>::const_iterator itr = hits.begin();
+        std::vector<uint32_t>::const_iterator end = hits.end();
+        for (; itr != end; ++itr)
+            matches.push_back(features_[*itr]);
+    }
+    return mapnik::featureset_ptr(new indexed_memory_featureset(matches));
+}
+
+mapnik::featureset_ptr indexed_memory_datasource::features(mapnik::query const& q) const
+{
+    return features_in_box(q.get_bbox());
+}
+
+mapnik::featureset_ptr indexed_memory_datasource::features_at_point(mapnik::coord2d const& pt) const
+{
+    return features_in_box(mapnik::box2d<double>(pt.x, pt.y, pt.x, pt.y));
+}
+
+mapnik::box2d<double> indexed_memory_datasource::envelope() const
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return extent_;
+}
+
+mapnik::layer_descriptor indexed_memory_datasource::get_descriptor() const
+{
+    return desc_;
+}
+
+size_t indexed_memory_datasource::size() const
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return features_.size() - index_.num_removed();
+}
+
+
+indexed_memory_featureset::indexed_memory_featureset(std::vector<mapnik::feature_ptr>& features)
+    : features_()
+{
+    features_.swap(features);
+    pos_ = features_.begin();
+}
+
+indexed_memory_featureset::~indexed_memory_featureset() {}
+
+mapnik::feature_ptr indexed_memory_featureset::next()
+{
+    if (pos_ != features_.end())
+        return *pos_++;
+    return mapnik::feature_ptr();
+}
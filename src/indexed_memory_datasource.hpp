@@ -0,0 +1,97 @@
+#ifndef __NODE_MAPNIK_INDEXED_MEMORY_DATASOURCE_H__
+#define __NODE_MAPNIK_INDEXED_MEMORY_DATASOURCE_H__
+
+// mapnik
+#include <mapnik/feature_layer_desc.hpp>
+#include <mapnik/query.hpp>
+
+// boost
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/utility.hpp>
+
+// stl
+#include <vector>
+
+#include "leveled_index.hpp"
+#include "writable_memory_datasource.hpp"
+
+// In-memory datasource behind mapnik.MemoryDatasource. Unlike
+// mapnik::memory_datasource, which scans every feature for every query, it
+// answers bbox and point queries from a leveled_index of packed R-trees.
+//
+// Features live in append-only slots. update() and remove() flag the old
+// slot as removed and update() appends the new feature, so a query copies
+// out the features it matches and holds on to that version of them however
+// the datasource changes afterwards. Once more than half of the slots are
+// removed, the next write compacts them.
+//
+// Writers are serialized by write_mutex_ and hold mutex_, the lock queries
+// take, only to publish their change. Index merges and compaction read the
+// current slots under write_mutex_ alone and swap their result in, so they
+// never hold up a render thread for longer than the swap.
+
+class indexed_memory_datasource : public writable_memory_datasource
+{
+public:
+    explicit indexed_memory_datasource(mapnik::parameters const& params);
+    virtual ~indexed_memory_datasource();
+    int type() const;
+    mapnik::featureset_ptr features(mapnik::query const& q) const;
+    mapnik::featureset_ptr features_at_point(mapnik::coord2d const& pt) const;
+    mapnik::box2d<double> envelope() const;
+    mapnik::layer_descriptor get_descriptor() const;
+    size_t size() const;
+
+    void push(mapnik::feature_ptr const& feature);
+    void push(std::vector<mapnik::feature_ptr> const& features);
+    // the index is built before locking, so concurrent queries are not
+    // held up by the build
+    void replace(std::vector<mapnik::feature_ptr>& features);
+    bool update(mapnik::feature_ptr const& feature);
+    bool remove(int id);
+    void clear();
+    // saves a columnar snapshot, with a column for every property name;
+    // its type is string if any value is a string, else double if any
+    // value is a double, else int
+    void save(std::string const& path) const;
+
+private:
+    mapnik::featureset_ptr features_in_box(mapnik::box2d<double> const& box) const;
+    bool find_slot(int id, std::size_t& slot);
+    void remove_slot(std::size_t slot);
+    void push_locked(mapnik::feature_ptr const& feature);
+    // merges index levels and compacts; caller holds write_mutex_ only
+    void maintain();
+    void compact();
+    static bool feature_box(mapnik::feature_ptr const& feature, mapnik::box2d<double>& box);
+
+    typedef boost::unordered_map<int, uint32_t> slot_map;
+
+    mutable boost::mutex mutex_;
+    mutable boost::mutex write_mutex_;
+    // slot -> feature, null once removed
+    std::vector<mapnik::feature_ptr> features_;
+    std::vector<mapnik::box2d<double> > boxes_;
+    leveled_index index_;
+    // feature id -> latest slot, built on the first update() or remove()
+    slot_map slots_;
+    bool has_slot_map_;
+    mapnik::box2d<double> extent_;
+    mapnik::layer_descriptor desc_;
+};
+
+class indexed_memory_featureset : public mapnik::Featureset, private boost::noncopyable
+{
+public:
+    // takes over the contents of features
+    explicit indexed_memory_featureset(std::vector<mapnik::feature_ptr>& features);
+    virtual ~indexed_memory_featureset();
+    mapnik::feature_ptr next();
+
+private:
+    std::vector<mapnik::feature_ptr> features_;
+    std::vector<mapnik::feature_ptr>::const_iterator pos_;
+};
+
+#endif // __NODE_MAPNIK_INDEXED_MEMORY_DATASOURCE_H__
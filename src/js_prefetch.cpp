@@ -0,0 +1,117 @@
+#include "js_prefetch.hpp"
+#include "indexed_memory_datasource.hpp"
+#include "projection_batch.hpp"
+#include "projection_cache.hpp"
+
+// mapnik
+#include <mapnik/version.hpp>
+#include <mapnik/attribute_collector.hpp>
+#include <mapnik/feature_type_style.hpp>
+#include <mapnik/layer.hpp>
+#include <mapnik/projection.hpp>
+#include <mapnik/proj_transform.hpp>
+#include <mapnik/query.hpp>
+
+// stl
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+bool is_js_datasource(mapnik::datasource_ptr const& ds)
+{
+    if (!ds)
+        return false;
+    boost::optional<std::string> type = ds->params().get<std::string>("type");
+    return type && *type == "js";
+}
+
+// box, in the srs of the map, in the srs of the layer; false if it cannot
+// be projected
+static bool layer_query_box(mapnik::Map const& map,
+                            mapnik::layer const& layer,
+                            mapnik::box2d<double> const& box,
+                            mapnik::box2d<double>& out)
+{
+    boost::shared_ptr<mapnik::proj_transform> prj_trans = acquire_transform(map.srs(), layer.srs());
+
+    out = box;
+    return forward_box(*prj_trans, out);
+}
+
+// the attributes the rules of the layer's styles refer to, at any scale
+static void style_property_names(mapnik::Map const& map,
+                                 mapnik::layer const& layer,
+                                 std::set<std::string>& names)
+{
+#if MAPNIK_VERSION >= 800
+    mapnik::attribute_collector collector(names);
+#else
+    mapnik::attribute_collector<mapnik::Feature> collector(names);
+#endif
+    std::map<std::string,mapnik::feature_type_style> const& styles = map.styles();
+    std::vector<std::string> const& style_names = layer.styles();
+    std::vector<std::string>::const_iterator name = style_names.begin();
+    for (; name != style_names.end(); ++name)
+    {
+        std::map<std::string,mapnik::feature_type_style>::const_iterator style = styles.find(*name);
+        if (style == styles.end())
+            continue;
+        mapnik::rules const& rules = style->second.get_rules();
+        mapnik::rules::const_iterator rule = rules.begin();
+        for (; rule != rules.end(); ++rule)
+            collector(*rule);
+    }
+}
+
+boost::shared_ptr<mapnik::Map> prefetch_js_layers(mapnik::Map const& map,
+                                                  mapnik::box2d<double> const& bbox,
+                                                  std::set<std::string> const& names)
+{
+    boost::shared_ptr<mapnik::Map> copy;
+    std::vector<mapnik::layer> const& layers = map.layers();
+    for (std::size_t i = 0; i < layers.size(); ++i)
+    {
+        mapnik::datasource_ptr ds = layers[i].datasource();
+        if (!is_js_datasource(ds))
+            continue;
+
+        if (!copy)
+        {
+            copy.reset(new mapnik::Map(map));
+            copy->zoom_to_box(bbox);
+        }
+        mapnik::layer& layer = copy->layers()[i];
+
+        mapnik::box2d<double> box;
+        if (!layer_query_box(*copy, layer, copy->get_buffered_extent(), box))
+            box = ds->envelope();
+
+#if MAPNIK_VERSION >= 800
+        mapnik::query q(box);
+#else
+        mapnik::query q(box,1.0,1.0);
+#endif
+        std::set<std::string> property_names(names);
+        style_property_names(*copy, layer, property_names);
+        std::set<std::string>::const_iterator itr = property_names.begin();
+        for (; itr != property_names.end(); ++itr)
+            q.add_property_name(*itr);
+
+        std::vector<mapnik::feature_ptr> features;
+        mapnik::featureset_ptr fs = ds->features(q);
+        if (fs)
+        {
+            mapnik::feature_ptr feature;
+            while ((feature = fs->next()))
+                features.push_back(feature);
+        }
+
+        mapnik::parameters params = ds->params();
+        params["type"] = "memory";
+        boost::shared_ptr<indexed_memory_datasource> mem(new indexed_memory_datasource(params));
+        mem->replace(features);
+        layer.set_datasource(mem);
+    }
+    return copy;
+}
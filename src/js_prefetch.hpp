@@ -0,0 +1,31 @@
+#ifndef __NODE_MAPNIK_JS_PREFETCH_H__
+#define __NODE_MAPNIK_JS_PREFETCH_H__
+
+// mapnik
+#include <mapnik/box2d.hpp>
+#include <mapnik/datasource.hpp>
+#include <mapnik/map.hpp>
+
+// boost
+#include <boost/shared_ptr.hpp>
+
+// stl
+#include <set>
+#include <string>
+
+// whether ds is a mapnik.JSDatasource, whose features come from a js callback
+bool is_js_datasource(mapnik::datasource_ptr const& ds);
+
+// JSDatasources call into V8, so they can only be queried on the main
+// thread. Called on the main thread before an async render, this reads the
+// features of every JS layer within bbox, plus the map's buffer, into an
+// in-memory datasource, and returns a copy of map that renders those
+// instead. Returns an empty pointer if map has no JS layers.
+//
+// Only the properties used by the layer's styles, plus names, are asked
+// for and kept.
+boost::shared_ptr<mapnik::Map> prefetch_js_layers(mapnik::Map const& map,
+                                                  mapnik::box2d<double> const& bbox,
+                                                  std::set<std::string> const& names = std::set<std::string>());
+
+#endif // __NODE_MAPNIK_JS_PREFETCH_H__
@@ -0,0 +1,239 @@
+#ifndef __NODE_MAPNIK_LEVELED_INDEX_H__
+#define __NODE_MAPNIK_LEVELED_INDEX_H__
+
+// mapnik
+#include <mapnik/box2d.hpp>
+
+// boost
+#include <boost/ptr_container/ptr_vector.hpp>
+
+// stl
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+
+#include "memory_snapshot.hpp"
+#include "packed_rtree.hpp"
+
+// Spatial index over an append-only array of boxes, or slots, that is kept
+// up to date incrementally. New slots collect in a tail that queries scan.
+// Once the tail reaches min_level slots it is packed into a packed_rtree
+// level of its own, merged with the levels before it that are at most
+// twice its size. Levels grow geometrically, so every slot is re-packed
+// O(log n) times and no single update rebuilds the whole index.
+//
+// Slots never change. Removing one only flags it, and queries skip it,
+// until the owner compacts its storage and starts a new index.
+//
+// Locking is up to the owner. query(), remove() and install() need the
+// lock that readers take; plan_merge() and build_level() only read, and
+// may run without it as long as no one appends to the boxes meanwhile.
+
+class leveled_index
+{
+public:
+    enum { min_level = 256 };
+
+    struct merge_plan
+    {
+        std::size_t begin;
+        std::size_t end;
+        // how many of the last levels the new one replaces
+        std::size_t levels;
+    };
+
+    leveled_index()
+        : levels_(),
+          removed_(),
+          num_removed_(0) {}
+
+    // slots before this are in a level, the ones after it in the tail
+    std::size_t indexed_end() const
+    {
+        return levels_.empty() ? 0 : levels_.back().end;
+    }
+
+    std::size_t num_removed() const { return num_removed_; }
+    std::size_t num_levels() const { return levels_.size(); }
+
+    bool is_removed(std::size_t slot) const
+    {
+        return slot < removed_.size() && removed_[slot];
+    }
+
+    void remove(std::size_t slot)
+    {
+        if (removed_.size() <= slot)
+            removed_.resize(slot + 1, 0);
+        if (!removed_[slot])
+        {
+            removed_[slot] = 1;
+            ++num_removed_;
+        }
+    }
+
+    void clear()
+    {
+        levels_.clear();
+        removed_.clear();
+        num_removed_ = 0;
+    }
+
+    void swap(leveled_index& other)
+    {
+        levels_.swap(other.levels_);
+        removed_.swap(other.removed_);
+        std::swap(num_removed_, other.num_removed_);
+    }
+
+    // Appends the slots intersecting box that are not removed to slots,
+    // in the order they were added.
+    template <typename Boxes>
+    void query(Boxes const& boxes, mapnik::box2d<double> const& box, std::vector<uint32_t>& slots) const
+    {
+        boost::ptr_vector<level>::const_iterator itr = levels_.begin();
+        for (; itr != levels_.end(); ++itr)
+        {
+            std::size_t first = slots.size();
+            itr->tree.query(box, slots);
+            for (std::size_t i = first; i < slots.size(); ++i)
+                slots[i] += itr->begin;
+        }
+        for (std::size_t i = indexed_end(); i < boxes.size(); ++i)
+        {
+            if (box.intersects(boxes[i]))
+                slots.push_back(static_cast<uint32_t>(i));
+        }
+        if (num_removed_ > 0)
+            slots.erase(std::remove_if(slots.begin(), slots.end(), removed_slot(*this)), slots.end());
+        std::sort(slots.begin(), slots.end());
+    }
+
+    // Decides whether the tail of num_slots slots is due to be packed, and
+    // which levels go into the new one.
+    bool plan_merge(std::size_t num_slots, merge_plan& plan) const
+    {
+        std::size_t begin = indexed_end();
+        if (num_slots - begin < min_level)
+            return false;
+        plan.end = num_slots;
+        plan.levels = 0;
+        std::size_t k = levels_.size();
+        while (k > 0 && levels_[k - 1].end - levels_[k - 1].begin <= 2 * (plan.end - begin))
+        {
+            --k;
+            begin = levels_[k].begin;
+            ++plan.levels;
+        }
+        plan.begin = begin;
+        return true;
+    }
+
+    template <typename Boxes>
+    static void build_level(Boxes const& boxes, merge_plan const& plan, packed_rtree& tree)
+    {
+        tree.build(box_range<Boxes>(boxes, plan.begin, plan.end));
+    }
+
+    // takes over tree as the level planned by plan
+    void install(merge_plan const& plan, packed_rtree& tree)
+    {
+        levels_.erase(levels_.end() - plan.levels, levels_.end());
+        level * l = new level();
+        levels_.push_back(l);
+        l->begin = plan.begin;
+        l->end = plan.end;
+        l->tree.swap(tree);
+    }
+
+    // Packs every slot into one level; for indexes that nobody queries yet.
+    template <typename Boxes>
+    void build_all(Boxes const& boxes)
+    {
+        clear();
+        merge_plan plan;
+        plan.begin = 0;
+        plan.end = boxes.size();
+        plan.levels = 0;
+        if (plan.end == 0)
+            return;
+        packed_rtree tree;
+        build_level(boxes, plan, tree);
+        install(plan, tree);
+    }
+
+    // removed slots are not saved, callers compact first
+    void write(snapshot_writer& out) const
+    {
+        out.write_u32(levels_.size());
+        boost::ptr_vector<level>::const_iterator itr = levels_.begin();
+        for (; itr != levels_.end(); ++itr)
+        {
+            out.write_u64(itr->begin);
+            out.write_u64(itr->end);
+            itr->tree.write(out);
+        }
+    }
+
+    void read(snapshot_reader& in, std::size_t num_slots)
+    {
+        clear();
+        uint32_t num_levels = in.read_u32();
+        std::size_t end = 0;
+        for (uint32_t i = 0; i < num_levels; ++i)
+        {
+            level * l = new level();
+            levels_.push_back(l);
+            l->begin = in.read_u64();
+            l->end = in.read_u64();
+            l->tree.read(in);
+            if (l->begin != end || l->end < l->begin || l->end > num_slots ||
+                l->tree.size() != l->end - l->begin)
+                throw std::runtime_error("snapshot has an invalid spatial index");
+            end = l->end;
+        }
+    }
+
+private:
+    struct level
+    {
+        std::size_t begin;
+        std::size_t end;
+        packed_rtree tree;
+    };
+
+    template <typename Boxes>
+    struct box_range
+    {
+        box_range(Boxes const& boxes, std::size_t begin, std::size_t end)
+            : boxes_(boxes),
+              begin_(begin),
+              end_(end) {}
+
+        std::size_t size() const { return end_ - begin_; }
+        mapnik::box2d<double> const& operator[](std::size_t i) const { return boxes_[begin_ + i]; }
+
+        Boxes const& boxes_;
+        std::size_t begin_;
+        std::size_t end_;
+    };
+
+    struct removed_slot
+    {
+        explicit removed_slot(leveled_index const& index)
+            : index_(index) {}
+
+        bool operator() (uint32_t slot) const
+        {
+            return index_.is_removed(slot);
+        }
+
+        leveled_index const& index_;
+    };
+
+    boost::ptr_vector<level> levels_;
+    std::vector<unsigned char> removed_;
+    std::size_t num_removed_;
+};
+
+#endif // __NODE_MAPNIK_LEVELED_INDEX_H__
@@ -5,9 +5,14 @@
 #include "mapnik_featureset.hpp"
 #include "utils.hpp"
 #include "ds_emitter.hpp"
+#include "js_prefetch.hpp"
+#include "datasource_registry.hpp"
+#include "datasource_stats.hpp"
 
 // stl
 #include <exception>
+#include <string>
+#include <vector>
 
 Persistent<FunctionTemplate> Datasource::constructor;
 
@@ -24,8 +29,58 @@ void Datasource::Initialize(Handle<Object> target) {
     NODE_SET_PROTOTYPE_METHOD(constructor, "describe", describe);
     NODE_SET_PROTOTYPE_METHOD(constructor, "features", features);
     NODE_SET_PROTOTYPE_METHOD(constructor, "featureset", featureset);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "statistics", statistics);
 
-    target->Set(String::NewSymbol("Datasource"),constructor->GetFunction());
+    Local<Function> ctor = constructor->GetFunction();
+    ctor->Set(String::NewSymbol("create"), FunctionTemplate::New(create)->GetFunction());
+
+    target->Set(String::NewSymbol("Datasource"),ctor);
+}
+
+// Copies the options of new mapnik.Datasource(options) into params, and
+// the bind and shared options, which are not parameters, into bind and
+// shared. Shared datasources are always bound, so bind does not change
+// which one is shared.
+bool Datasource::read_options(Local<Object> options,
+                              mapnik::parameters& params,
+                              bool& bind,
+                              bool& shared,
+                              std::string& error_name)
+{
+    if (options->Has(String::New("bind")))
+    {
+        Local<Value> bind_opt = options->Get(String::New("bind"));
+        if (!bind_opt->IsBoolean())
+        {
+            error_name = "'bind' must be a Boolean";
+            return false;
+        }
+        bind = bind_opt->BooleanValue();
+    }
+
+    if (options->Has(String::New("shared")))
+    {
+        Local<Value> shared_opt = options->Get(String::New("shared"));
+        if (!shared_opt->IsBoolean())
+        {
+            error_name = "'shared' must be a Boolean";
+            return false;
+        }
+        shared = shared_opt->BooleanValue();
+    }
+
+    Local<Array> names = options->GetPropertyNames();
+    uint32_t i = 0;
+    uint32_t a_length = names->Length();
+    while (i < a_length) {
+        Local<Value> name = names->Get(i)->ToString();
+        Local<Value> value = options->Get(name);
+        std::string key = TOSTR(name);
+        if (key != "shared" && key != "bind")
+            params[key] = TOSTR(value);
+        i++;
+    }
+    return true;
 }
 
 Datasource::Datasource() :
@@ -66,31 +121,20 @@ Handle<Value> Datasource::New(const Arguments& args)
     // TODO - maybe validate in js?
 
     bool bind=true;
-    if (options->Has(String::New("bind")))
-    {
-        Local<Value> bind_opt = options->Get(String::New("bind"));
-        if (!bind_opt->IsBoolean())
-          return ThrowException(Exception::TypeError(
-            String::New("'bind' must be a Boolean")));
-
-        bind = bind_opt->BooleanValue();
-    }
-
+    bool shared=false;
     mapnik::parameters params;
-    Local<Array> names = options->GetPropertyNames();
-    uint32_t i = 0;
-    uint32_t a_length = names->Length();
-    while (i < a_length) {
-        Local<Value> name = names->Get(i)->ToString();
-        Local<Value> value = options->Get(name);
-        params[TOSTR(name)] = TOSTR(value);
-        i++;
-    }
+    std::string error_name;
+    if (!read_options(options, params, bind, shared, error_name))
+      return ThrowException(Exception::TypeError(
+        String::New(error_name.c_str())));
 
     mapnik::datasource_ptr ds;
     try
     {
-        ds = mapnik::datasource_cache::create(params, bind);
+        if (shared)
+            ds = shared_datasource(params);
+        else
+            ds = create_datasource(params, bind);
     }
     catch (const mapnik::config_error & ex )
     {
@@ -128,6 +172,105 @@ Handle<Value> Datasource::New(const Arguments& args)
     return Undefined();
 }
 
+typedef struct {
+    mapnik::parameters params;
+    bool bind;
+    bool shared;
+    mapnik::datasource_ptr ds;
+    bool error;
+    std::string error_name;
+    Persistent<Function> cb;
+} create_baton_t;
+
+/*
+ * mapnik.Datasource.create(options, callback)
+ *
+ * Like new mapnik.Datasource(options), but the plugin is created and bound
+ * on the thread pool, so slow database connections and file scans do not
+ * block the event loop. Calls callback(err, datasource).
+ */
+Handle<Value> Datasource::create(const Arguments& args)
+{
+    HandleScope scope;
+
+    if (args.Length() != 2 || !args[0]->IsObject())
+        return ThrowException(Exception::TypeError(
+          String::New("must provide an object, eg {type: 'shape', file : 'world.shp'}, and a callback")));
+
+    if (!args[1]->IsFunction())
+        return ThrowException(Exception::TypeError(
+                  String::New("last argument must be a callback function")));
+
+    create_baton_t *closure = new create_baton_t();
+    closure->bind = true;
+    closure->shared = false;
+    closure->error = false;
+    if (!read_options(args[0]->ToObject(), closure->params, closure->bind, closure->shared, closure->error_name))
+    {
+        Local<Value> err = Exception::TypeError(String::New(closure->error_name.c_str()));
+        delete closure;
+        return ThrowException(err);
+    }
+    closure->cb = Persistent<Function>::New(Handle<Function>::Cast(args[1]));
+    eio_custom(EIO_Create, EIO_PRI_DEFAULT, EIO_AfterCreate, closure);
+    ev_ref(EV_DEFAULT_UC);
+    return Undefined();
+}
+
+int Datasource::EIO_Create(eio_req *req)
+{
+    create_baton_t *closure = static_cast<create_baton_t *>(req->data);
+    try
+    {
+        if (closure->shared)
+            closure->ds = shared_datasource(closure->params);
+        else
+            closure->ds = create_datasource(closure->params, closure->bind);
+        if (!closure->ds)
+        {
+            closure->error = true;
+            closure->error_name = "could not create datasource";
+        }
+    }
+    catch (const std::exception & ex)
+    {
+        closure->error = true;
+        closure->error_name = ex.what();
+    }
+    catch (...)
+    {
+        closure->error = true;
+        closure->error_name = "unknown exception happened, please file bug";
+    }
+    return 0;
+}
+
+int Datasource::EIO_AfterCreate(eio_req *req)
+{
+    HandleScope scope;
+
+    create_baton_t *closure = static_cast<create_baton_t *>(req->data);
+    ev_unref(EV_DEFAULT_UC);
+
+    TryCatch try_catch;
+
+    if (closure->error) {
+        Local<Value> argv[1] = { Exception::Error(String::New(closure->error_name.c_str())) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 1, argv);
+    } else {
+        Local<Value> argv[2] = { Local<Value>::New(Null()), Local<Value>::New(Datasource::New(closure->ds)) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 2, argv);
+    }
+
+    if (try_catch.HasCaught()) {
+      FatalException(try_catch);
+    }
+
+    closure->cb.Dispose();
+    delete closure;
+    return 0;
+}
+
 Handle<Value> Datasource::New(mapnik::datasource_ptr ds_ptr) {
     HandleScope scope;
     Datasource* d = new Datasource();
@@ -195,6 +338,15 @@ Handle<Value> Datasource::features(const Arguments& args)
     return scope.Close(a);
 }
 
+/*
+ * ds.featureset([options])
+ *
+ * Opens a cursor over the features within options.extent, or all of
+ * them, with the properties in options.properties, or all of them. With
+ * options.filter, a mapnik expression like "[NAME] = 'Iceland'", only the
+ * features it is true for are read. See Featureset.next() for reading it
+ * a page at a time.
+ */
 Handle<Value> Datasource::featureset(const Arguments& args)
 {
 
@@ -202,22 +354,119 @@ Handle<Value> Datasource::featureset(const Arguments& args)
 
     Datasource* ds = ObjectWrap::Unwrap<Datasource>(args.This());
 
-    mapnik::query q(ds->datasource_->envelope());
-    mapnik::layer_descriptor ld = ds->datasource_->get_descriptor();
-    std::vector<mapnik::attribute_descriptor> const& desc = ld.get_descriptors();
-    std::vector<mapnik::attribute_descriptor>::const_iterator itr = desc.begin();
-    std::vector<mapnik::attribute_descriptor>::const_iterator end = desc.end();
-    while (itr != end)
+    boost::optional<mapnik::box2d<double> > extent;
+    std::vector<std::string> names;
+    std::string filter;
+    std::string error_name;
+    if (!featureset_options(args[0], extent, names, filter, error_name))
+        return ThrowException(Exception::TypeError(
+          String::New(error_name.c_str())));
+
+    mapnik::featureset_ptr fs;
+    try
     {
-        q.add_property_name(itr->get_name());
-        ++itr;
+        fs = datasource_featureset(ds->datasource_, extent, names, filter);
+    }
+    catch (const std::exception & ex)
+    {
+        return ThrowException(Exception::Error(
+          String::New(ex.what())));
     }
-
-    mapnik::featureset_ptr fs = ds->datasource_->features(q);
     if (fs)
     {
-        return scope.Close(Featureset::New(fs));
+        return scope.Close(Featureset::New(fs, is_js_datasource(ds->datasource_)));
     }
 
     return Undefined();
 }
+
+typedef struct {
+    mapnik::datasource_ptr ds;
+    datasource_stats_ptr stats;
+    bool error;
+    std::string error_name;
+    Persistent<Function> cb;
+} statistics_baton_t;
+
+/*
+ * ds.statistics(callback)
+ *
+ * Scans every feature once on the thread pool and calls callback(err,
+ * stats) with the feature count, exact extent, number of geometries of
+ * each type and, per field, its type, min, max, number of nulls and an
+ * estimate of its number of distinct values. The result is kept until the
+ * features change, and describe() then uses it too.
+ */
+Handle<Value> Datasource::statistics(const Arguments& args)
+{
+    HandleScope scope;
+    Datasource* d = ObjectWrap::Unwrap<Datasource>(args.This());
+    return scope.Close(queue_statistics(d->datasource_, args));
+}
+
+Handle<Value> Datasource::queue_statistics(mapnik::datasource_ptr ds, const Arguments& args)
+{
+    HandleScope scope;
+
+    if (args.Length() != 1 || !args[0]->IsFunction())
+        return ThrowException(Exception::TypeError(
+                  String::New("last argument must be a callback function")));
+
+    if (is_js_datasource(ds))
+        return ThrowException(Exception::Error(
+          String::New("a js datasource can only be read on the main thread, use features() instead")));
+
+    statistics_baton_t *closure = new statistics_baton_t();
+    closure->ds = ds;
+    closure->error = false;
+    closure->cb = Persistent<Function>::New(Handle<Function>::Cast(args[0]));
+    eio_custom(EIO_Statistics, EIO_PRI_DEFAULT, EIO_AfterStatistics, closure);
+    ev_ref(EV_DEFAULT_UC);
+    return Undefined();
+}
+
+int Datasource::EIO_Statistics(eio_req *req)
+{
+    statistics_baton_t *closure = static_cast<statistics_baton_t *>(req->data);
+    try
+    {
+        closure->stats = datasource_statistics(closure->ds);
+    }
+    catch (const std::exception & ex)
+    {
+        closure->error = true;
+        closure->error_name = ex.what();
+    }
+    catch (...)
+    {
+        closure->error = true;
+        closure->error_name = "unknown exception happened while reading features";
+    }
+    return 0;
+}
+
+int Datasource::EIO_AfterStatistics(eio_req *req)
+{
+    HandleScope scope;
+
+    statistics_baton_t *closure = static_cast<statistics_baton_t *>(req->data);
+    ev_unref(EV_DEFAULT_UC);
+
+    TryCatch try_catch;
+
+    if (closure->error) {
+        Local<Value> argv[1] = { Exception::Error(String::New(closure->error_name.c_str())) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 1, argv);
+    } else {
+        Local<Value> argv[2] = { Local<Value>::New(Null()), statistics_to_object(*closure->stats) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 2, argv);
+    }
+
+    if (try_catch.HasCaught()) {
+      FatalException(try_catch);
+    }
+
+    closure->cb.Dispose();
+    delete closure;
+    return 0;
+}
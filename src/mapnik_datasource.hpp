@@ -6,6 +6,10 @@
 #include <node_object_wrap.h>
 
 #include <mapnik/datasource.hpp>
+#include <mapnik/params.hpp>
+
+// stl
+#include <string>
 
 using namespace v8;
 using namespace node;
@@ -22,11 +26,26 @@ class Datasource: public node::ObjectWrap {
 
     static Handle<Value> featureset(const Arguments &args);
 
+    static Handle<Value> statistics(const Arguments &args);
+    // statistics() for any datasource, also used by MemoryDatasource
+    static Handle<Value> queue_statistics(mapnik::datasource_ptr ds, const Arguments &args);
+    static int EIO_Statistics(eio_req *req);
+    static int EIO_AfterStatistics(eio_req *req);
+
+    static Handle<Value> create(const Arguments &args);
+    static int EIO_Create(eio_req *req);
+    static int EIO_AfterCreate(eio_req *req);
+
     Datasource();
     inline mapnik::datasource_ptr get() { return datasource_; }
 
   private:
     ~Datasource();
+    static bool read_options(Local<Object> options,
+                             mapnik::parameters& params,
+                             bool& bind,
+                             bool& shared,
+                             std::string& error_name);
     mapnik::datasource_ptr datasource_;
 };
 
@@ -1,6 +1,22 @@
+#include <node_buffer.h>
+#include <node_version.h>
+
 #include "mapnik_featureset.hpp"
+#include "geometry_writer.hpp"
 #include "utils.hpp"
 
+// boost
+#include <boost/variant/static_visitor.hpp>
+
+// stl
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
 Persistent<FunctionTemplate> Featureset::constructor;
 
 void Featureset::Initialize(Handle<Object> target) {
@@ -12,13 +28,16 @@ void Featureset::Initialize(Handle<Object> target) {
     constructor->SetClassName(String::NewSymbol("Featureset"));
 
     NODE_SET_PROTOTYPE_METHOD(constructor, "next", next);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "nextBatch", nextBatch);
 
     target->Set(String::NewSymbol("Featureset"),constructor->GetFunction());
 }
 
 Featureset::Featureset() :
   ObjectWrap(),
-  this_() {}
+  this_(),
+  main_thread_only_(false),
+  busy_(false) {}
 
 Featureset::~Featureset()
 {
@@ -44,58 +63,570 @@ Handle<Value> Featureset::New(const Arguments& args)
       String::New("Sorry a Featureset cannot currently be created, only accessed via an existing datasource")));
 }
 
+enum geometry_format
+{
+    geometry_none = 0,
+    geometry_wkb,
+    geometry_coords
+};
+
+// what next() and nextBatch() return besides properties and ids
+struct output_options
+{
+    output_options()
+        : fields(),
+          include_extent(false),
+          geometry(geometry_none) {}
+
+    // nextBatch() only, empty for every property of the batch's features
+    std::vector<std::string> fields;
+    bool include_extent;
+    geometry_format geometry;
+};
+
+// Reads {extent: bool, geometry: 'wkb'|'coords'} and, if with_fields, the
+// fields of nextBatch(); a bare boolean is the older include_extent flag.
+static bool read_output_options(Local<Value> arg,
+                                bool with_fields,
+                                output_options& options,
+                                std::string& error_name)
+{
+    if (arg->IsBoolean())
+    {
+        options.include_extent = arg->BooleanValue();
+        return true;
+    }
+    if (!arg->IsObject())
+    {
+        error_name = "options must be an object, eg {extent: true, geometry: 'wkb'}";
+        return false;
+    }
+    Local<Object> opts = arg->ToObject();
+    if (with_fields && opts->Has(String::NewSymbol("fields")))
+    {
+        Local<Value> fields = opts->Get(String::NewSymbol("fields"));
+        if (!fields->IsArray())
+        {
+            error_name = "'fields' must be an array of property names";
+            return false;
+        }
+        Local<Array> a = Local<Array>::Cast(fields);
+        for (uint32_t i = 0; i < a->Length(); ++i)
+            options.fields.push_back(TOSTR(a->Get(i)));
+    }
+    if (opts->Has(String::NewSymbol("extent")))
+    {
+        Local<Value> extent = opts->Get(String::NewSymbol("extent"));
+        if (!extent->IsBoolean())
+        {
+            error_name = "'extent' must be a boolean";
+            return false;
+        }
+        options.include_extent = extent->BooleanValue();
+    }
+    if (opts->Has(String::NewSymbol("geometry")))
+    {
+        std::string geometry = TOSTR(opts->Get(String::NewSymbol("geometry")));
+        if (geometry == "wkb")
+            options.geometry = geometry_wkb;
+        else if (geometry == "coords")
+            options.geometry = geometry_coords;
+        else
+        {
+            error_name = "'geometry' must be 'wkb' or 'coords'";
+            return false;
+        }
+    }
+    return true;
+}
+
+static Local<Value> new_buffer(std::string const& data)
+{
+    #if NODE_VERSION_AT_LEAST(0,3,0)
+      node::Buffer *buf = Buffer::New((char *)data.data(),data.size());
+    #else
+      node::Buffer *buf = Buffer::New(data.size());
+      memcpy(buf->data(), data.data(), data.size());
+    #endif
+    return Local<Value>::New(buf->handle_);
+}
+
+// {coords: Float64Array, rings, parts, features: Uint32Array, types: Uint8Array},
+// see geometry_coords
+static Local<Object> coords_to_object(geometry_coords const& c)
+{
+    Local<Object> geometry = Object::New();
+    geometry->Set(String::NewSymbol("coords"), new_typed_array("Float64Array", c.xy));
+    geometry->Set(String::NewSymbol("rings"), new_typed_array("Uint32Array", c.rings));
+    geometry->Set(String::NewSymbol("parts"), new_typed_array("Uint32Array", c.parts));
+    geometry->Set(String::NewSymbol("types"), new_typed_array("Uint8Array", c.types));
+    geometry->Set(String::NewSymbol("features"), new_typed_array("Uint32Array", c.features));
+    return geometry;
+}
+
+static Local<Object> feature_to_object(mapnik::feature_ptr const& fp, output_options const& options)
+{
+    std::map<std::string,mapnik::value> const& fprops = fp->props();
+    Local<Object> feat = Object::New();
+    std::map<std::string,mapnik::value>::const_iterator it = fprops.begin();
+    std::map<std::string,mapnik::value>::const_iterator end = fprops.end();
+    for (; it != end; ++it)
+    {
+        params_to_object serializer( feat , it->first);
+        boost::apply_visitor( serializer, it->second.base() );
+    }
+
+    // add feature id
+    feat->Set(String::NewSymbol("__id__"), Integer::New(fp->id()));
+
+    if (options.include_extent) {
+        Local<Array> a = Array::New(4);
+        mapnik::box2d<double> const& e = fp->envelope();
+        a->Set(0, Number::New(e.minx()));
+        a->Set(1, Number::New(e.miny()));
+        a->Set(2, Number::New(e.maxx()));
+        a->Set(3, Number::New(e.maxy()));
+        feat->Set(String::NewSymbol("_extent"),a);
+    }
+
+    if (options.geometry == geometry_wkb) {
+        std::string wkb;
+        write_wkb(*fp, wkb);
+        feat->Set(String::NewSymbol("_geometry"), new_buffer(wkb));
+    } else if (options.geometry == geometry_coords) {
+        geometry_coords coords;
+        write_coords(*fp, coords);
+        feat->Set(String::NewSymbol("_geometry"), coords_to_object(coords));
+    }
+    return feat;
+}
+
+struct value_number : public boost::static_visitor<double>
+{
+    // as next() reports them
+    double operator () ( bool val ) const { return val ? 1 : 0; }
+    double operator () ( int val ) const { return val; }
+    double operator () ( double val ) const { return val; }
+
+    template <typename T>
+    double operator () ( T const& ) const
+    {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+};
+
+// like value_converter, but leaves missing values undefined
+struct column_value : public value_converter
+{
+    using value_converter::operator();
+
+    Local<Value> operator () ( mapnik::value_null const& ) const
+    {
+        return Local<Value>::New(Undefined());
+    }
+};
+
+struct value_is_text : public boost::static_visitor<bool>
+{
+    bool operator () ( std::string const& ) const { return true; }
+    bool operator () ( UnicodeString const& ) const { return true; }
+
+    template <typename T>
+    bool operator () ( T const& ) const { return false; }
+};
+
+// One column per field: a Float64Array, with NaN where a feature lacks the
+// property, if every value is a number, else an Array.
+static Local<Value> property_column(std::vector<mapnik::feature_ptr> const& features,
+                                    std::string const& name)
+{
+    typedef std::map<std::string,mapnik::value> properties;
+    std::size_t n = features.size();
+
+    bool text = false;
+    for (std::size_t i = 0; i < n && !text; ++i)
+    {
+        properties const& props = features[i]->props();
+        properties::const_iterator it = props.find(name);
+        if (it != props.end())
+            text = boost::apply_visitor(value_is_text(), it->second.base());
+    }
+
+    if (!text)
+    {
+        std::vector<double> numbers(n, std::numeric_limits<double>::quiet_NaN());
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            properties const& props = features[i]->props();
+            properties::const_iterator it = props.find(name);
+            if (it != props.end())
+                numbers[i] = boost::apply_visitor(value_number(), it->second.base());
+        }
+        return new_typed_array("Float64Array", numbers);
+    }
+
+    Local<Array> a = Array::New(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        properties const& props = features[i]->props();
+        properties::const_iterator it = props.find(name);
+        if (it == props.end())
+            a->Set(i, Undefined());
+        else
+            a->Set(i, boost::apply_visitor(column_value(), it->second.base()));
+    }
+    return a;
+}
+
+// The geometries of a batch, encoded without touching V8.
+struct batch_geometry
+{
+    batch_geometry()
+        : wkb(),
+          wkb_offsets(1, 0),
+          coords() {}
+
+    std::string wkb;
+    // feature i is wkb bytes [wkb_offsets[i], wkb_offsets[i + 1])
+    std::vector<uint32_t> wkb_offsets;
+    geometry_coords coords;
+};
+
+static void encode_geometries(std::vector<mapnik::feature_ptr> const& features,
+                              geometry_format format,
+                              batch_geometry& out)
+{
+    std::vector<mapnik::feature_ptr>::const_iterator itr = features.begin();
+    for (; itr != features.end(); ++itr)
+    {
+        if (format == geometry_wkb)
+        {
+            write_wkb(**itr, out.wkb);
+            out.wkb_offsets.push_back(out.wkb.size());
+        }
+        else if (format == geometry_coords)
+        {
+            write_coords(**itr, out.coords);
+        }
+    }
+}
+
+// {length, ids: Uint32Array, columns: {name: column}, [extents: Float64Array],
+//  [geometry: Buffer, geometryOffsets: Uint32Array | geometry: coords]}
+static Local<Object> features_to_columns(std::vector<mapnik::feature_ptr> const& features,
+                                         output_options const& options,
+                                         batch_geometry const& geometry)
+{
+    std::size_t n = features.size();
+    Local<Object> batch = Object::New();
+    batch->Set(String::NewSymbol("length"), Integer::NewFromUnsigned(n));
+
+    std::vector<uint32_t> ids(n);
+    for (std::size_t i = 0; i < n; ++i)
+        ids[i] = static_cast<uint32_t>(features[i]->id());
+    batch->Set(String::NewSymbol("ids"), new_typed_array("Uint32Array", ids));
+
+    std::vector<std::string> fields(options.fields);
+    if (fields.empty())
+    {
+        std::set<std::string> names;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            std::map<std::string,mapnik::value> const& props = features[i]->props();
+            std::map<std::string,mapnik::value>::const_iterator it = props.begin();
+            for (; it != props.end(); ++it)
+                names.insert(it->first);
+        }
+        fields.assign(names.begin(), names.end());
+    }
+
+    Local<Object> columns = Object::New();
+    std::vector<std::string>::const_iterator field = fields.begin();
+    for (; field != fields.end(); ++field)
+        columns->Set(String::New(field->c_str()), property_column(features, *field));
+    batch->Set(String::NewSymbol("columns"), columns);
+
+    if (options.include_extent)
+    {
+        std::vector<double> extents(4 * n);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            mapnik::box2d<double> const& e = features[i]->envelope();
+            extents[4 * i] = e.minx();
+            extents[4 * i + 1] = e.miny();
+            extents[4 * i + 2] = e.maxx();
+            extents[4 * i + 3] = e.maxy();
+        }
+        batch->Set(String::NewSymbol("extents"), new_typed_array("Float64Array", extents));
+    }
+
+    if (options.geometry == geometry_wkb)
+    {
+        batch->Set(String::NewSymbol("geometry"), new_buffer(geometry.wkb));
+        batch->Set(String::NewSymbol("geometryOffsets"), new_typed_array("Uint32Array", geometry.wkb_offsets));
+    }
+    else if (options.geometry == geometry_coords)
+    {
+        batch->Set(String::NewSymbol("geometry"), coords_to_object(geometry.coords));
+    }
+    return batch;
+}
+
+// Reads up to count more features of fs into features.
+static void read_features(fs_ptr const& fs, unsigned int count, std::vector<mapnik::feature_ptr>& features)
+{
+    if (!fs)
+        return;
+    features.reserve(count);
+    mapnik::feature_ptr fp;
+    while (features.size() < count && (fp = fs->next()))
+        features.push_back(fp);
+}
+
+typedef struct {
+    Featureset* fs;
+    unsigned int count;
+    // nextBatch() rather than next()
+    bool columnar;
+    output_options options;
+    std::vector<mapnik::feature_ptr> features;
+    // nextBatch() geometries, encoded on the thread pool
+    batch_geometry geometry;
+    bool error;
+    std::string error_name;
+    Persistent<Function> cb;
+} next_baton_t;
+
+/*
+ * featureset.next([options])
+ *
+ * Returns the next feature, or undefined after the last one. Options are
+ *
+ *   extent: true to add the feature's extent as _extent
+ *   geometry: 'wkb' to add its geometry as _geometry, a Buffer of WKB, or
+ *             'coords' for flat coordinate arrays, see geometry_writer.hpp
+ *
+ * A boolean in their place is taken as the extent option.
+ *
+ * featureset.next(count, [options], callback)
+ *
+ * Reads up to count features on the thread pool and calls
+ * callback(err, features); fewer than count features means the featureset
+ * is done. The featureset stays open between calls, so paging through it
+ * costs the same per page however far in it is.
+ */
 Handle<Value> Featureset::next(const Arguments& args)
 {
     HandleScope scope;
     
-    bool include_extent = false;
-    
-    if ((args.Length() > 0)) {
-        if (!args[0]->IsBoolean())
+    Featureset* fs = ObjectWrap::Unwrap<Featureset>(args.This());
+
+    std::string error_name;
+    output_options options;
+
+    if (args.Length() > 0 && args[args.Length()-1]->IsFunction())
+    {
+        if (!args[0]->IsNumber() || args[0]->IntegerValue() < 1)
             return ThrowException(Exception::TypeError(
-               String::New("option to include extent must be a boolean")));
-        include_extent = args[0]->BooleanValue();
+               String::New("first argument must be the number of features to read")));
+
+        if (args.Length() > 2 && !read_output_options(args[1], false, options, error_name))
+            return ThrowException(Exception::TypeError(
+               String::New(error_name.c_str())));
+
+        if (fs->main_thread_only_)
+            return ThrowException(Exception::Error(
+               String::New("a JSDatasource featureset can only be read one feature at a time with next()")));
+        if (fs->busy_)
+            return ThrowException(Exception::Error(
+               String::New("the featureset is already reading a page")));
+
+        next_baton_t *closure = new next_baton_t();
+        closure->fs = fs;
+        closure->count = static_cast<unsigned int>(args[0]->IntegerValue());
+        closure->columnar = false;
+        closure->options = options;
+        closure->error = false;
+        closure->cb = Persistent<Function>::New(Handle<Function>::Cast(args[args.Length()-1]));
+        fs->busy_ = true;
+        eio_custom(EIO_Next, EIO_PRI_DEFAULT, EIO_AfterNext, closure);
+        ev_ref(EV_DEFAULT_UC);
+        fs->Ref();
+        return Undefined();
     }
 
-    Featureset* fs = ObjectWrap::Unwrap<Featureset>(args.This());
+    if (args.Length() > 0 && !read_output_options(args[0], false, options, error_name))
+        return ThrowException(Exception::TypeError(
+           String::New(error_name.c_str())));
+
+    if (fs->busy_)
+        return ThrowException(Exception::Error(
+           String::New("the featureset is already reading a page")));
 
-    // TODO - allow filtering which fields are returned
     if (fs->this_) {
         mapnik::feature_ptr fp = fs->this_->next();
         if (fp) {
-            std::map<std::string,mapnik::value> const& fprops = fp->props();
-            Local<Object> feat = Object::New();
-            std::map<std::string,mapnik::value>::const_iterator it = fprops.begin();
-            std::map<std::string,mapnik::value>::const_iterator end = fprops.end();
-            for (; it != end; ++it)
-            {
-                params_to_object serializer( feat , it->first);
-                boost::apply_visitor( serializer, it->second.base() );
-            }
-            
-            // add feature id
-            feat->Set(String::NewSymbol("__id__"), Integer::New(fp->id()));
-            
-            if (include_extent) {
-                Local<Array> a = Array::New(4);
-                mapnik::box2d<double> const& e = fp->envelope();
-                a->Set(0, Number::New(e.minx()));
-                a->Set(1, Number::New(e.miny()));
-                a->Set(2, Number::New(e.maxx()));
-                a->Set(3, Number::New(e.maxy()));
-                feat->Set(String::NewSymbol("_extent"),a);
-            }
-            return scope.Close(feat);
+            return scope.Close(feature_to_object(fp, options));
         }
     }
     return Undefined();
 }
 
-Handle<Value> Featureset::New(mapnik::featureset_ptr fs_ptr)
+int Featureset::EIO_Next(eio_req *req)
+{
+    next_baton_t *closure = static_cast<next_baton_t *>(req->data);
+    try
+    {
+        read_features(closure->fs->this_, closure->count, closure->features);
+        if (closure->columnar)
+            encode_geometries(closure->features, closure->options.geometry, closure->geometry);
+    }
+    catch (const std::exception & ex)
+    {
+        closure->error = true;
+        closure->error_name = ex.what();
+    }
+    catch (...)
+    {
+        closure->error = true;
+        closure->error_name = "unknown exception happened while reading features";
+    }
+    return 0;
+}
+
+int Featureset::EIO_AfterNext(eio_req *req)
+{
+    HandleScope scope;
+
+    next_baton_t *closure = static_cast<next_baton_t *>(req->data);
+    ev_unref(EV_DEFAULT_UC);
+
+    Featureset* fs = closure->fs;
+    fs->busy_ = false;
+
+    // done, let go of whatever the datasource holds open for it
+    if (closure->error || closure->features.size() < closure->count)
+        fs->this_.reset();
+
+    TryCatch try_catch;
+
+    if (closure->error) {
+        Local<Value> argv[1] = { Exception::Error(String::New(closure->error_name.c_str())) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 1, argv);
+    } else {
+        Local<Value> result;
+        if (closure->columnar)
+        {
+            result = features_to_columns(closure->features, closure->options, closure->geometry);
+        }
+        else
+        {
+            std::size_t n = closure->features.size();
+            Local<Array> a = Array::New(n);
+            for (std::size_t i = 0; i < n; ++i)
+                a->Set(i, feature_to_object(closure->features[i], closure->options));
+            result = a;
+        }
+        Local<Value> argv[2] = { Local<Value>::New(Null()), result };
+        closure->cb->Call(Context::GetCurrent()->Global(), 2, argv);
+    }
+
+    if (try_catch.HasCaught()) {
+      FatalException(try_catch);
+    }
+
+    fs->Unref();
+    closure->cb.Dispose();
+    delete closure;
+    return 0;
+}
+
+/*
+ * featureset.nextBatch(count, [options], [callback])
+ *
+ * Reads up to count features into columns instead of one object each:
+ *
+ *   {length: n, ids: Uint32Array,
+ *    columns: {name: Array, speed: Float64Array},
+ *    extents: Float64Array of minx, miny, maxx, maxy per feature,
+ *    geometry: Buffer, geometryOffsets: Uint32Array}
+ *
+ * Columns whose values are all numbers are Float64Arrays, with NaN where
+ * a feature lacks the property; the others are Arrays. options.fields
+ * picks the columns, by default every property the features have, and
+ * options.extent adds extents. options.geometry 'wkb' adds the WKB of all
+ * features in one Buffer, feature i at bytes [geometryOffsets[i],
+ * geometryOffsets[i + 1]); 'coords' adds flat coordinate arrays, see
+ * geometry_writer.hpp. With a callback the features are read and their
+ * geometries encoded on the thread pool, and callback(err, batch) gets
+ * the result. A batch shorter than count means the featureset is done.
+ */
+Handle<Value> Featureset::nextBatch(const Arguments& args)
+{
+    HandleScope scope;
+
+    if (args.Length() < 1 || !args[0]->IsNumber() || args[0]->IntegerValue() < 1)
+        return ThrowException(Exception::TypeError(
+           String::New("first argument must be the number of features to read")));
+    unsigned int count = static_cast<unsigned int>(args[0]->IntegerValue());
+
+    bool async = args[args.Length()-1]->IsFunction();
+    output_options options;
+    std::string error_name;
+    if (args.Length() > 1 && !args[1]->IsFunction() &&
+        !read_output_options(args[1], true, options, error_name))
+        return ThrowException(Exception::TypeError(
+           String::New(error_name.c_str())));
+
+    Featureset* fs = ObjectWrap::Unwrap<Featureset>(args.This());
+
+    if (fs->busy_)
+        return ThrowException(Exception::Error(
+           String::New("the featureset is already reading a page")));
+
+    if (!async)
+    {
+        std::vector<mapnik::feature_ptr> features;
+        batch_geometry geometry;
+        try
+        {
+            read_features(fs->this_, count, features);
+            encode_geometries(features, options.geometry, geometry);
+        }
+        catch (const std::exception & ex)
+        {
+            return ThrowException(Exception::Error(
+              String::New(ex.what())));
+        }
+        if (features.size() < count)
+            fs->this_.reset();
+        return scope.Close(features_to_columns(features, options, geometry));
+    }
+
+    if (fs->main_thread_only_)
+        return ThrowException(Exception::Error(
+           String::New("a JSDatasource featureset can only be read on the main thread, call nextBatch() without a callback")));
+
+    next_baton_t *closure = new next_baton_t();
+    closure->fs = fs;
+    closure->count = count;
+    closure->columnar = true;
+    closure->options = options;
+    closure->error = false;
+    closure->cb = Persistent<Function>::New(Handle<Function>::Cast(args[args.Length()-1]));
+    fs->busy_ = true;
+    eio_custom(EIO_Next, EIO_PRI_DEFAULT, EIO_AfterNext, closure);
+    ev_ref(EV_DEFAULT_UC);
+    fs->Ref();
+    return Undefined();
+}
+
+Handle<Value> Featureset::New(mapnik::featureset_ptr fs_ptr, bool main_thread_only)
 {
     HandleScope scope;
     Featureset* fs = new Featureset();
     fs->this_ = fs_ptr;
+    fs->main_thread_only_ = main_thread_only;
     Handle<Value> ext = External::New(fs);
     Handle<Object> obj = constructor->GetFunction()->NewInstance(1, &ext);
     return scope.Close(obj);
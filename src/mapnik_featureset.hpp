@@ -16,14 +16,22 @@ class Featureset: public node::ObjectWrap {
     static Persistent<FunctionTemplate> constructor;
     static void Initialize(Handle<Object> target);
     static Handle<Value> New(const Arguments &args);
-    static Handle<Value> New(mapnik::featureset_ptr fs_ptr);
+    // featuresets of JS datasources call into V8 and cannot be paged
+    // through on the thread pool, pass main_thread_only for those
+    static Handle<Value> New(mapnik::featureset_ptr fs_ptr, bool main_thread_only = false);
     static Handle<Value> next(const Arguments &args);
+    static Handle<Value> nextBatch(const Arguments &args);
+    static int EIO_Next(eio_req *req);
+    static int EIO_AfterNext(eio_req *req);
     
     Featureset();
 
   private:
     ~Featureset();
     fs_ptr this_;
+    bool main_thread_only_;
+    // a page is being read on the thread pool
+    bool busy_;
 };
 
 #endif
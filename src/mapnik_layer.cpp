@@ -4,6 +4,8 @@
 #include "mapnik_datasource.hpp"
 #include "mapnik_js_datasource.hpp"
 #include "mapnik_memory_datasource.hpp"
+#include "mapnik_featureset.hpp"
+#include "js_prefetch.hpp"
 #include "ds_emitter.hpp"
 #include "layer_emitter.hpp"
 
@@ -26,6 +28,7 @@ void Layer::Initialize(Handle<Object> target) {
     // methods
     NODE_SET_PROTOTYPE_METHOD(constructor, "describe", describe);
     NODE_SET_PROTOTYPE_METHOD(constructor, "features", features);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "featureset", featureset);
     NODE_SET_PROTOTYPE_METHOD(constructor, "describe_data", describe_data);
 
     // properties
@@ -296,3 +299,40 @@ Handle<Value> Layer::features(const Arguments& args)
     return scope.Close(a);
 }
 
+// layer.featureset([options]), see Datasource.featureset()
+Handle<Value> Layer::featureset(const Arguments& args)
+{
+    HandleScope scope;
+
+    boost::optional<mapnik::box2d<double> > extent;
+    std::vector<std::string> names;
+    std::string filter;
+    std::string error_name;
+    if (!featureset_options(args[0], extent, names, filter, error_name))
+        return ThrowException(Exception::TypeError(
+          String::New(error_name.c_str())));
+
+    Layer* l = ObjectWrap::Unwrap<Layer>(args.This());
+
+    mapnik::datasource_ptr ds = l->layer_->datasource();
+    if (!ds)
+        return Undefined();
+
+    mapnik::featureset_ptr fs;
+    try
+    {
+        fs = datasource_featureset(ds, extent, names, filter);
+    }
+    catch (const std::exception & ex)
+    {
+        return ThrowException(Exception::Error(
+          String::New(ex.what())));
+    }
+    if (fs)
+    {
+        return scope.Close(Featureset::New(fs, is_js_datasource(ds)));
+    }
+
+    return Undefined();
+}
+
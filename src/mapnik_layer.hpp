@@ -24,6 +24,7 @@ class Layer: public node::ObjectWrap {
     static Handle<Value> New(mapnik::layer & lay_ref);
     static Handle<Value> describe(const Arguments &args);
     static Handle<Value> features(const Arguments &args);
+    static Handle<Value> featureset(const Arguments &args);
     static Handle<Value> describe_data(const Arguments &args);
 
     static Handle<Value> get_prop(Local<String> property,
@@ -24,8 +24,8 @@
 #include <mapnik/grid/grid_renderer.hpp>
 #else
 #include "grid/grid.h"
+#include "grid/binary_rasterizer.h"
 #include "grid/renderer.h"
-#include "grid/grid_buffer.h"
 #include "agg/agg_conv_stroke.h"
 // ellipse drawing
 #include <math.h>
@@ -41,12 +41,21 @@
 
 // boost
 #include <boost/foreach.hpp>
+#include <boost/thread/tss.hpp>
 
 #include "utils.hpp"
 #include "mapnik_map.hpp"
 #include "ds_emitter.hpp"
 #include "layer_emitter.hpp"
+#include "grid_rle.hpp"
 #include "mapnik_layer.hpp"
+#include "mapnik_featureset.hpp"
+#include "js_prefetch.hpp"
+#include "datasource_registry.hpp"
+#include "caching_datasource.hpp"
+#include "writable_memory_datasource.hpp"
+#include "projection_batch.hpp"
+#include "projection_cache.hpp"
 
 Persistent<FunctionTemplate> Map::constructor;
 
@@ -88,7 +97,10 @@ void Map::Initialize(Handle<Object> target) {
     // temp hack to expose layer metadata
     NODE_SET_PROTOTYPE_METHOD(constructor, "layers", layers);
     NODE_SET_PROTOTYPE_METHOD(constructor, "features", features);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "featureset", featureset);
     NODE_SET_PROTOTYPE_METHOD(constructor, "describe_data", describe_data);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "cache_layer", cache_layer);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "cache_stats", cache_stats);
 
     // properties
     ATTR(constructor, "srs", get_prop, set_prop);
@@ -388,6 +400,190 @@ Handle<Value> Map::features(const Arguments& args)
 
 }
 
+/*
+ * map.featureset(index, [options])
+ *
+ * A cursor over the features of the layer at index, see
+ * Datasource.featureset() for the options.
+ */
+Handle<Value> Map::featureset(const Arguments& args)
+{
+    HandleScope scope;
+
+    if (args.Length() < 1 || !args[0]->IsNumber())
+      return ThrowException(Exception::TypeError(
+        String::New("layer index must be an integer")));
+
+    boost::optional<mapnik::box2d<double> > extent;
+    std::vector<std::string> names;
+    std::string filter;
+    std::string error_name;
+    if (!featureset_options(args[1], extent, names, filter, error_name))
+        return ThrowException(Exception::TypeError(
+          String::New(error_name.c_str())));
+
+    unsigned index = args[0]->IntegerValue();
+
+    Map* m = ObjectWrap::Unwrap<Map>(args.This());
+
+    std::vector<mapnik::layer> const & layers = m->map_->layers();
+    if (index >= layers.size())
+      return ThrowException(Exception::Error(
+        String::New("invalid layer index")));
+
+    mapnik::datasource_ptr ds = layers[index].datasource();
+    if (!ds)
+        return Undefined();
+
+    mapnik::featureset_ptr fs;
+    try
+    {
+        fs = datasource_featureset(ds, extent, names, filter);
+    }
+    catch (const std::exception & ex)
+    {
+        return ThrowException(Exception::Error(
+          String::New(ex.what())));
+    }
+    if (fs)
+    {
+        return scope.Close(Featureset::New(fs, is_js_datasource(ds)));
+    }
+
+    return Undefined();
+}
+
+/*
+ * map.cache_layer(index, [options])
+ *
+ * Keeps the features the datasource of layer index returns for renders in
+ * memory, per grid cell, so neighbouring tiles share their queries; see
+ * caching_datasource.hpp. options:
+ *
+ *   max_bytes: the estimated size of the cached features, 64MB by default
+ *   cell_size: the size of a cell in the units of the layer's srs, eg of a
+ *              metatile; by default it follows the size of the queries
+ *
+ * Features are told apart by their ids, so postgis layers need a
+ * key_field. A render spanning several cells gets the features of each
+ * cell in the order of the source, but features only found in different
+ * cells are not ordered against each other, which matters for layers
+ * relying on an ORDER BY to draw overlapping features.
+ *
+ * Pass false instead of options to stop caching and drop the features.
+ */
+Handle<Value> Map::cache_layer(const Arguments& args)
+{
+    HandleScope scope;
+
+    if (args.Length() < 1 || args.Length() > 2 || !args[0]->IsNumber())
+      return ThrowException(Exception::TypeError(
+        String::New("first argument must be a layer index")));
+
+    Map* m = ObjectWrap::Unwrap<Map>(args.This());
+    std::vector<mapnik::layer> & layers = m->map_->layers();
+    unsigned index = args[0]->IntegerValue();
+    if (index >= layers.size())
+      return ThrowException(Exception::Error(
+        String::New("invalid layer index")));
+
+    mapnik::layer & layer = layers[index];
+    mapnik::datasource_ptr ds = layer.datasource();
+    if (!ds)
+      return ThrowException(Exception::Error(
+        String::New("layer has no datasource")));
+
+    // replacing or removing the cache starts from the source again
+    caching_datasource* cache = dynamic_cast<caching_datasource*>(ds.get());
+    if (cache)
+        ds = cache->source();
+
+    if (args.Length() == 2 && args[1]->IsBoolean() && !args[1]->BooleanValue())
+    {
+        layer.set_datasource(ds);
+        return Undefined();
+    }
+
+    double cell_size = 0;
+    std::size_t max_bytes = 64 * 1024 * 1024;
+    if (args.Length() == 2)
+    {
+        if (!args[1]->IsObject())
+          return ThrowException(Exception::TypeError(
+            String::New("optional second argument must be an options object or false")));
+        Local<Object> options = args[1]->ToObject();
+        if (options->Has(String::New("max_bytes")))
+        {
+            Local<Value> opt = options->Get(String::New("max_bytes"));
+            if (!opt->IsNumber() || opt->NumberValue() < 0)
+              return ThrowException(Exception::TypeError(
+                String::New("'max_bytes' must be a positive number")));
+            max_bytes = static_cast<std::size_t>(opt->NumberValue());
+        }
+        if (options->Has(String::New("cell_size")))
+        {
+            Local<Value> opt = options->Get(String::New("cell_size"));
+            if (!opt->IsNumber() || opt->NumberValue() < 0)
+              return ThrowException(Exception::TypeError(
+                String::New("'cell_size' must be a positive number")));
+            cell_size = opt->NumberValue();
+        }
+    }
+
+    // js datasources are read on the main thread only, before each render
+    if (is_js_datasource(ds))
+      return ThrowException(Exception::Error(
+        String::New("the features of a js datasource cannot be cached")));
+
+    // without a key field postgis numbers the features of each query
+    // from 1, so the same feature gets other ids in other cells
+    boost::optional<std::string> type = ds->params().get<std::string>("type");
+    if (type && *type == "postgis" && !ds->params().get<std::string>("key_field"))
+      return ThrowException(Exception::Error(
+        String::New("the features of a postgis layer can only be cached with a key_field")));
+
+    // already in memory, and the cells would go stale on add(), update(),
+    // remove() and load()
+    if (dynamic_cast<writable_memory_datasource*>(ds.get()))
+      return ThrowException(Exception::Error(
+        String::New("the features of a memory datasource cannot be cached")));
+
+    layer.set_datasource(mapnik::datasource_ptr(new caching_datasource(ds, cell_size, max_bytes)));
+    return Undefined();
+}
+
+/*
+ * map.cache_stats()
+ *
+ * {layer name: {hits, misses, cells, bytes, max_bytes, cell_size}} for the
+ * layers cache_layer() was called for, counting cells.
+ */
+Handle<Value> Map::cache_stats(const Arguments& args)
+{
+    HandleScope scope;
+    Map* m = ObjectWrap::Unwrap<Map>(args.This());
+    std::vector<mapnik::layer> const & layers = m->map_->layers();
+
+    Local<Object> result = Object::New();
+    for (unsigned i = 0; i < layers.size(); ++i)
+    {
+        mapnik::datasource_ptr ds = layers[i].datasource();
+        caching_datasource const* cache = dynamic_cast<caching_datasource const*>(ds.get());
+        if (!cache)
+            continue;
+        caching_datasource::cache_stats stats = cache->stats();
+        Local<Object> s = Object::New();
+        s->Set(String::NewSymbol("hits"), Number::New(stats.hits));
+        s->Set(String::NewSymbol("misses"), Number::New(stats.misses));
+        s->Set(String::NewSymbol("cells"), Number::New(stats.cells));
+        s->Set(String::NewSymbol("bytes"), Number::New(stats.bytes));
+        s->Set(String::NewSymbol("max_bytes"), Number::New(cache->max_bytes()));
+        s->Set(String::NewSymbol("cell_size"), Number::New(cache->cell_size()));
+        result->Set(String::NewSymbol(layers[i].name().c_str()), s);
+    }
+    return scope.Close(result);
+}
+
 Handle<Value> Map::clear(const Arguments& args)
 {
     HandleScope scope;
@@ -454,19 +650,72 @@ Handle<Value> Map::buffer_size(const Arguments& args)
     return Undefined();
 }
 
+// Reads the options of map.load() and map.from_string().
+static bool read_load_options(Local<Value> arg, bool& shared, std::string& error_name)
+{
+    if (arg->IsUndefined())
+        return true;
+    if (!arg->IsObject())
+    {
+        error_name = "optional last argument must be an options object, eg { shared: true }";
+        return false;
+    }
+    Local<Object> options = arg->ToObject();
+    if (options->Has(String::New("shared")))
+    {
+        Local<Value> shared_opt = options->Get(String::New("shared"));
+        if (!shared_opt->IsBoolean())
+        {
+            error_name = "'shared' must be a Boolean";
+            return false;
+        }
+        shared = shared_opt->BooleanValue();
+    }
+    return true;
+}
+
+// load_map creates the datasources of the layers itself, so sharing them
+// swaps each for the registered one with the same parameters afterwards.
+static void share_layer_datasources(mapnik::Map& map)
+{
+    std::vector<mapnik::layer>& layers = map.layers();
+    for (unsigned i = 0; i < layers.size(); ++i)
+    {
+        mapnik::datasource_ptr ds = layers[i].datasource();
+        // layers from before the load may be cached by cache_layer()
+        if (dynamic_cast<caching_datasource*>(ds.get()))
+            continue;
+        mapnik::datasource_ptr shared = share_datasource(ds);
+        if (shared != ds)
+            layers[i].set_datasource(shared);
+    }
+}
+
 Handle<Value> Map::load(const Arguments& args)
 {
     HandleScope scope;
-    if (args.Length() != 1 || !args[0]->IsString())
+    if (args.Length() < 1 || args.Length() > 2 || !args[0]->IsString())
       return ThrowException(Exception::TypeError(
         String::New("first argument must be a path to a mapnik stylesheet")));
 
+    bool shared = false;
+    std::string error_name;
+    if (!read_load_options(args[1], shared, error_name))
+      return ThrowException(Exception::TypeError(
+        String::New(error_name.c_str())));
+
     Map* m = ObjectWrap::Unwrap<Map>(args.This());
     std::string const& stylesheet = TOSTR(args[0]);
     bool strict = false;
     try
     {
-        mapnik::load_map(*m->map_,stylesheet,strict);
+        {
+            // load_map creates and binds the layer datasources
+            boost::mutex::scoped_lock lock(datasource_create_mutex());
+            mapnik::load_map(*m->map_,stylesheet,strict);
+        }
+        if (shared)
+            share_layer_datasources(*m->map_);
     }
     catch (const mapnik::config_error & ex )
     {
@@ -511,13 +760,25 @@ Handle<Value> Map::from_string(const Arguments& args)
       return ThrowException(Exception::TypeError(
         String::New("second argument must be a base_url to interpret any relative path from")));
 
+    bool shared = false;
+    std::string error_name;
+    if (!read_load_options(args[2], shared, error_name))
+      return ThrowException(Exception::TypeError(
+        String::New(error_name.c_str())));
+
     Map* m = ObjectWrap::Unwrap<Map>(args.This());
     std::string const& stylesheet = TOSTR(args[0]);
     bool strict = false;
     std::string const& base_url = TOSTR(args[1]);
     try
     {
-        mapnik::load_map_string(*m->map_,stylesheet,strict,base_url);
+        {
+            // load_map creates and binds the layer datasources
+            boost::mutex::scoped_lock lock(datasource_create_mutex());
+            mapnik::load_map_string(*m->map_,stylesheet,strict,base_url);
+        }
+        if (shared)
+            share_layer_datasources(*m->map_);
     }
     catch (const mapnik::config_error & ex )
     {
@@ -645,6 +906,8 @@ Handle<Value> Map::zoom_to_box(const Arguments& args)
 
 typedef struct {
     Map *m;
+    // the map to render, a copy of m's if it has JS layers
+    map_ptr map;
     std::string format;
     mapnik::box2d<double> bbox;
     bool error;
@@ -720,6 +983,21 @@ Handle<Value> Map::render(const Arguments& args)
     closure->format = TOSTR(args[1]);
     closure->error = false;
     closure->bbox = mapnik::box2d<double>(minx,miny,maxx,maxy);
+
+    // JS datasources cannot be queried from the thread pool
+    try
+    {
+        closure->map = prefetch_js_layers(*m->map_, closure->bbox);
+    }
+    catch (const std::exception & ex)
+    {
+        delete closure;
+        return ThrowException(Exception::Error(
+          String::New(ex.what())));
+    }
+    if (!closure->map)
+        closure->map = m->map_;
+
     closure->cb = Persistent<Function>::New(Handle<Function>::Cast(args[args.Length()-1]));
     eio_custom(EIO_Render, EIO_PRI_DEFAULT, EIO_AfterRender, closure);
     ev_ref(EV_DEFAULT_UC);
@@ -733,11 +1011,11 @@ int Map::EIO_Render(eio_req *req)
     closure_t *closure = static_cast<closure_t *>(req->data);
 
     // zoom to
-    closure->m->map_->zoom_to_box(closure->bbox);
+    closure->map->zoom_to_box(closure->bbox);
     try
     {
-        mapnik::image_32 im(closure->m->map_->width(),closure->m->map_->height());
-        mapnik::agg_renderer<mapnik::image_32> ren(*closure->m->map_,im);
+        mapnik::image_32 im(closure->map->width(),closure->map->height());
+        mapnik::agg_renderer<mapnik::image_32> ren(*closure->map,im);
         ren.apply();
         closure->im_string = save_to_string(im, closure->format);
     }
@@ -989,6 +1267,8 @@ Handle<Value> Map::render_to_file(const Arguments& args)
 
 struct grid_t {
     Map *m;
+    // the map to render, a copy of m's if it has JS layers
+    map_ptr map;
     boost::shared_ptr<mapnik::grid> grid_ptr;
     std::size_t layer_idx;
     std::string layer_name;
@@ -1000,6 +1280,9 @@ struct grid_t {
     bool include_features;
     Persistent<Function> cb;
     bool grid_initialized;
+    bool rle;
+    std::string rle_data;
+    std::vector<mapnik::grid::lookup_type> key_order;
 };
 
 Handle<Value> Map::render_grid(const Arguments& args)
@@ -1063,6 +1346,22 @@ Handle<Value> Map::render_grid(const Arguments& args)
         step = param_val->IntegerValue();
     }
 
+    bool rle = false;
+    param = String::New("format");
+    if (options->Has(param))
+    {
+        Local<Value> param_val = options->Get(param);
+        if (!param_val->IsString())
+          return ThrowException(Exception::TypeError(
+            String::New("'format' must be a string")));
+        std::string format = TOSTR(param_val);
+        if (format == "rle")
+            rle = true;
+        else if (format != "utf")
+          return ThrowException(Exception::TypeError(
+            String::New("'format' must be 'utf' or 'rle'")));
+    }
+
     
     /*    
     // http://graphics.stanford.edu/~seander/bithacks.html#DetermineIfPowerOf2
@@ -1088,6 +1387,7 @@ Handle<Value> Map::render_grid(const Arguments& args)
     closure->m = m;
     closure->join_field = join_field;
     closure->error = false;
+    closure->rle = rle;
     closure->cb = Persistent<Function>::New(Handle<Function>::Cast(callback));
     closure->num_fields = 0;
     
@@ -1117,6 +1417,24 @@ Handle<Value> Map::render_grid(const Arguments& args)
         }
     }
 
+    // JS datasources cannot be queried from the thread pool
+    try
+    {
+        // the grid asks for its fields and join field on top of the styles'
+        std::set<std::string> names = closure->grid_ptr->property_names();
+        if (join_field != closure->grid_ptr->id_name_)
+            names.insert(join_field);
+        closure->map = prefetch_js_layers(*m->map_, m->map_->get_current_extent(), names);
+    }
+    catch (const std::exception & ex)
+    {
+        delete closure;
+        return ThrowException(Exception::Error(
+          String::New(ex.what())));
+    }
+    if (!closure->map)
+        closure->map = m->map_;
+
     eio_custom(EIO_RenderGrid, EIO_PRI_DEFAULT, EIO_AfterRenderGrid, closure);
     ev_ref(EV_DEFAULT_UC);
     m->acquire();
@@ -1126,12 +1444,26 @@ Handle<Value> Map::render_grid(const Arguments& args)
 }
 
 
+void grid2rle(mapnik::grid const& grid,
+    std::string& out,
+    std::vector<mapnik::grid::lookup_type>& key_order)
+{
+    mapnik::grid::data_type const& data = grid.data();
+    grid_rle_encoder<mapnik::grid::value_type> encoder(data.width(), data.height());
+    for (unsigned y = 0; y < data.height(); ++y)
+    {
+        encoder.add_row(data.getRow(y), grid.get_feature_keys());
+    }
+    encoder.write(out);
+    key_order = encoder.key_order();
+}
+
 int Map::EIO_RenderGrid(eio_req *req)
 {
 
     grid_t *closure = static_cast<grid_t *>(req->data);
 
-    std::vector<mapnik::layer> const& layers = closure->m->map_->layers();
+    std::vector<mapnik::layer> const& layers = closure->map->layers();
     
     if (!closure->layer_name.empty()) {
         bool found = false;
@@ -1191,9 +1523,13 @@ int Map::EIO_RenderGrid(eio_req *req)
 
     try
     {
-        mapnik::grid_renderer<mapnik::grid> ren(*closure->m->map_,*closure->grid_ptr,1.0,0,0);
+        mapnik::grid_renderer<mapnik::grid> ren(*closure->map,*closure->grid_ptr,1.0,0,0);
         mapnik::layer const& layer = layers[closure->layer_idx];
         ren.apply(layer,attributes);
+
+        // the binary grid is encoded here rather than in the callback
+        if (closure->rle)
+            grid2rle(*closure->grid_ptr,closure->rle_data,closure->key_order);
     }
     catch (const mapnik::config_error & ex )
     {
@@ -1353,10 +1689,23 @@ int Map::EIO_AfterRenderGrid(eio_req *req)
         Local<Value> argv[1] = { Exception::Error(String::New(closure->error_name.c_str())) };
         closure->cb->Call(Context::GetCurrent()->Global(), 1, argv);
     } else {
-        // convert buffer to utf and gather key order
-        Local<Array> grid_array = Array::New();
-        std::vector<mapnik::grid::lookup_type> key_order;
-        grid2utf(*closure->grid_ptr,grid_array,key_order);
+        // convert buffer to utf and gather key order, unless the
+        // binary grid was already encoded
+        Local<Value> grid_value;
+        std::vector<mapnik::grid::lookup_type>& key_order = closure->key_order;
+        if (closure->rle) {
+            #if NODE_VERSION_AT_LEAST(0,3,0)
+              node::Buffer *retbuf = Buffer::New((char *)closure->rle_data.data(),closure->rle_data.size());
+            #else
+              node::Buffer *retbuf = Buffer::New(closure->rle_data.size());
+              memcpy(retbuf->data(), closure->rle_data.data(), closure->rle_data.size());
+            #endif
+            grid_value = Local<Value>::New(retbuf->handle_);
+        } else {
+            Local<Array> grid_array = Array::New();
+            grid2utf(*closure->grid_ptr,grid_array,key_order);
+            grid_value = grid_array;
+        }
     
         // convert key order to proper javascript array
         Local<Array> keys_a = Array::New(key_order.size());
@@ -1380,7 +1729,7 @@ int Map::EIO_AfterRenderGrid(eio_req *req)
         
         // Create the return hash.
         Local<Object> json = Object::New();
-        json->Set(String::NewSymbol("grid"), grid_array);
+        json->Set(String::NewSymbol("grid"), grid_value);
         json->Set(String::NewSymbol("keys"), keys_a);
         json->Set(String::NewSymbol("data"), feature_data);
         Local<Value> argv[2] = { Local<Value>::New(Null()), Local<Value>::New(json) };
@@ -1407,6 +1756,8 @@ int Map::EIO_AfterRenderGrid(eio_req *req)
 
 struct grid_t {
     Map *m;
+    // m's map, or a copy with its js layers read ahead
+    map_ptr map;
     std::size_t layer_idx;
     unsigned int step;
     std::string join_field;
@@ -1415,6 +1766,9 @@ struct grid_t {
     bool error;
     bool include_features;
     bool grid_initialized;
+    bool binary;
+    bool rle;
+    std::string rle_data;
     std::set<std::string> property_names;
     std::string error_name;
     std::map<std::string, UChar> keys;
@@ -1422,7 +1776,7 @@ struct grid_t {
     std::vector<std::string> key_order;
     Persistent<Function> cb;
 
-    grid_t() : m(NULL), grid(NULL) {
+    grid_t() : m(NULL), grid(NULL), binary(false), rle(false) {
     }
 
     ~grid_t() {
@@ -1484,6 +1838,19 @@ void grid2utf(agg_grid::grid_rendering_buffer& renbuf,
     closure->grid[index - 1] = (uint16_t)']';
 }
 
+void grid2rle(agg_grid::grid_rendering_buffer& renbuf,
+    grid_t* closure,
+    std::map<agg_grid::grid_value, std::string> const& feature_keys)
+{
+    grid_rle_encoder<agg_grid::grid_value> encoder(renbuf.width(), renbuf.height());
+    for (unsigned y = 0; y < renbuf.height(); ++y)
+    {
+        encoder.add_row(renbuf.row(y), feature_keys);
+    }
+    encoder.write(closure->rle_data);
+    closure->key_order = encoder.key_order();
+}
+
 Handle<Value> Map::render_grid(const Arguments& args)
 {
     HandleScope scope;
@@ -1500,9 +1867,45 @@ Handle<Value> Map::render_grid(const Arguments& args)
         return ThrowException(Exception::TypeError(
            String::New("layer join_field must be a string")));
 
+    // optional options object just before the callback
+    int num_args = args.Length();
+    bool binary = false;
+    bool rle = false;
+    if (num_args > 4) {
+        Local<Value> last_arg = args[num_args-2];
+        if (last_arg->IsObject() && !last_arg->IsArray() && !last_arg->IsFunction()) {
+            Local<Object> options = last_arg->ToObject();
+            if (options->Has(String::New("rasterizer"))) {
+                Local<Value> ras = options->Get(String::New("rasterizer"));
+                if (!ras->IsString())
+                    return ThrowException(Exception::TypeError(
+                       String::New("'rasterizer' option must be a string")));
+                std::string ras_name = TOSTR(ras);
+                if (ras_name == "binary")
+                    binary = true;
+                else if (ras_name != "aa")
+                    return ThrowException(Exception::TypeError(
+                       String::New("'rasterizer' option must be 'aa' or 'binary'")));
+            }
+            if (options->Has(String::New("format"))) {
+                Local<Value> format = options->Get(String::New("format"));
+                if (!format->IsString())
+                    return ThrowException(Exception::TypeError(
+                       String::New("'format' option must be a string")));
+                std::string format_name = TOSTR(format);
+                if (format_name == "rle")
+                    rle = true;
+                else if (format_name != "utf")
+                    return ThrowException(Exception::TypeError(
+                       String::New("'format' option must be 'utf' or 'rle'")));
+            }
+            --num_args;
+        }
+    }
+
     bool include_features = false;
 
-    if ((args.Length() > 4)) {
+    if ((num_args > 4)) {
         if (!args[3]->IsBoolean())
             return ThrowException(Exception::TypeError(
                String::New("option to include feature data must be a boolean")));
@@ -1510,7 +1913,7 @@ Handle<Value> Map::render_grid(const Arguments& args)
     }
 
     std::set<std::string> property_names;
-    if ((args.Length() > 5)) {
+    if ((num_args > 5)) {
         if (!args[4]->IsArray())
             return ThrowException(Exception::TypeError(
                String::New("option to restrict to certain field names must be an array")));
@@ -1564,14 +1967,35 @@ Handle<Value> Map::render_grid(const Arguments& args)
     closure->property_names = property_names;
     closure->error = false;
     closure->grid_initialized = false;
+    closure->binary = binary;
+    closure->rle = rle;
+
+    // JS datasources cannot be queried from the thread pool
+    try
+    {
+        std::set<std::string> names = property_names;
+        names.insert(closure->join_field);
+        closure->map = prefetch_js_layers(*m->map_, m->map_->get_current_extent(), names);
+    }
+    catch (const std::exception & ex)
+    {
+        delete closure;
+        return ThrowException(Exception::Error(
+          String::New(ex.what())));
+    }
+    if (!closure->map)
+        closure->map = m->map_;
+
     closure->cb = Persistent<Function>::New(Handle<Function>::Cast(args[args.Length()-1]));
 
     // The exact string length:
     //   +3: length + two quotes and a comma
     //   +1: we don't need the last comma, but we need [ and ]
-    unsigned int width = w/closure->step;
-    closure->grid_length = width * (width + 3) + 1;
-    closure->grid = new uint16_t[closure->grid_length];
+    if (!rle) {
+        unsigned int width = w/closure->step;
+        closure->grid_length = width * (width + 3) + 1;
+        closure->grid = new uint16_t[closure->grid_length];
+    }
 
     eio_custom(EIO_RenderGrid, EIO_PRI_DEFAULT, EIO_AfterRenderGrid, closure);
     ev_ref(EV_DEFAULT_UC);
@@ -1581,14 +2005,198 @@ Handle<Value> Map::render_grid(const Arguments& args)
 }
 
 
-struct rasterizer :  agg_grid::grid_rasterizer, boost::noncopyable {};
+struct rasterizer :  agg_grid::grid_rasterizer, boost::noncopyable
+{
+    // cells outside the buffer are dropped when spans are rendered
+    void clip_box(double, double, double, double) {}
+};
+
+struct binary_rasterizer :  agg_grid::binary_rasterizer, boost::noncopyable {};
+
+// Per eio thread grid rendering state, one per rasterizer type. The
+// rasterizer keeps its cell or edge storage across reset(), and the pixel
+// and row buffers are reused, so once a thread has rendered a tile of a
+// given size further grids do not allocate in the rasterizer at all.
+template <typename Rasterizer>
+struct grid_context : boost::noncopyable
+{
+    enum
+    {
+        // storage blocks (4096 cells or edges each) kept between requests,
+        // anything a very complex layer needed beyond that is released again
+        max_retained_blocks = 64,
+        // pixels kept between requests, enough for a 2048x2048 grid; the
+        // buffer of a larger one is freed again
+        max_retained_pixels = 2048 * 2048
+    };
+
+    Rasterizer ras;
+    std::vector<agg_grid::grid_value> pixels;
+    agg_grid::grid_rendering_buffer renbuf;
+
+    grid_context() : ras(), pixels(), renbuf(0, 0, 0, 0) {}
+
+    void attach(unsigned width, unsigned height)
+    {
+        pixels.resize(width * height);
+        renbuf.attach(pixels.empty() ? 0 : &pixels[0], width, height, width);
+        ras.reset();
+        ras.clip_box(0, 0, width, height);
+    }
+
+    void release()
+    {
+        if (ras.num_blocks() > max_retained_blocks)
+            ras.shrink(max_retained_blocks);
+        if (pixels.capacity() > max_retained_pixels)
+        {
+            std::vector<agg_grid::grid_value>().swap(pixels);
+            renbuf.attach(0, 0, 0, 0);
+        }
+    }
+
+    static grid_context& local()
+    {
+        grid_context* ctx = tls.get();
+        if (!ctx)
+        {
+            ctx = new grid_context();
+            tls.reset(ctx);
+        }
+        return *ctx;
+    }
+
+    static boost::thread_specific_ptr<grid_context> tls;
+};
+
+template <typename Rasterizer>
+boost::thread_specific_ptr<grid_context<Rasterizer> > grid_context<Rasterizer>::tls;
+
+// Releases a grid_context when rendering is done, or throws.
+template <typename Rasterizer>
+struct grid_context_guard : boost::noncopyable
+{
+    explicit grid_context_guard(grid_context<Rasterizer>& ctx) : ctx_(ctx) {}
+    ~grid_context_guard() { ctx_.release(); }
+    grid_context<Rasterizer>& ctx_;
+};
+
+// Rasterizes the features of one layer into this thread's grid buffer and
+// utf-izes the result into the closure. Templated on the rasterizer so the
+// feature loop is the same for the antialiased and the binary one.
+template <typename Rasterizer>
+static void render_grid_features(grid_t* closure,
+                                 mapnik::featureset_ptr const& fs,
+                                 mapnik::proj_transform const& prj_trans,
+                                 mapnik::CoordTransform const& tr,
+                                 unsigned int width,
+                                 unsigned int height)
+{
+    unsigned int step = closure->step;
+    std::string const& join_field = closure->join_field;
+
+    typedef mapnik::coord_transform2<mapnik::CoordTransform,mapnik::geometry_type> path_type;
+
+    agg_grid::grid_value feature_id = 1;
+    std::map<agg_grid::grid_value, std::string> feature_keys;
+    std::map<agg_grid::grid_value, std::string>::const_iterator feature_pos;
+
+    grid_context<Rasterizer>& ctx = grid_context<Rasterizer>::local();
+    grid_context_guard<Rasterizer> guard(ctx);
+    ctx.attach(width, height);
+    agg_grid::grid_rendering_buffer& renbuf = ctx.renbuf;
+    agg_grid::grid_renderer<agg_grid::span_grid> ren_grid(renbuf);
+    Rasterizer& ras_grid = ctx.ras;
+
+    agg_grid::grid_value no_hit = 0;
+    std::string no_hit_val = "";
+    feature_keys[no_hit] = no_hit_val;
+    ren_grid.clear(no_hit);
+
+    mapnik::feature_ptr feature;
+    while ((feature = fs->next()))
+    {
+        ras_grid.reset();
+        ++feature_id;
+
+        for (unsigned i=0;i<feature->num_geometries();++i)
+        {
+            mapnik::geometry_type const& geom=feature->get_geometry(i);
+            mapnik::eGeomType g_type = geom.type();
+            if (g_type == mapnik::Point)
+            {
+
+                double x;
+                double y;
+                double z=0;
+                int i;
+                geom.label_position(&x, &y);
+                // TODO - check return of proj_trans
+                prj_trans.backward(x,y,z);
+                //bool ok = prj_trans.backward(x,y,z);
+                //if (!ok)
+                //    std::clog << "warning proj_trans failed\n";
+                tr.forward(&x,&y);
+                //if (x < 0 || y < 0)
+                //    std::clog << "warning: invalid point values being rendered: " << x << " " << y << "\n";
+                int approximation_steps = 360;
+                int rx = 10/step; // arbitary pixel width
+                int ry = 10/step; // arbitary pixel height
+                ras_grid.move_to_d(x + rx, y);
+                for(i = 1; i < approximation_steps; i++)
+                {
+                    double a = double(i) * 3.1415926 / 180.0;
+                    ras_grid.line_to_d(x + cos(a) * rx, y + sin(a) * ry);
+                }
+            }
+            else if (geom.num_points() > 1)
+            {
+                if (g_type == mapnik::LineString) {
+                    path_type path(tr,geom,prj_trans);
+                    agg::conv_stroke<path_type>  stroke(path);
+                    ras_grid.add_path(stroke);
+                }
+                else {
+                    path_type path(tr,geom,prj_trans);
+                    ras_grid.add_path(path);
+                }
+            }
+        }
+
+        std::string val = "";
+        std::map<std::string,mapnik::value> const& fprops = feature->props();
+        std::map<std::string,mapnik::value>::const_iterator const& itr = fprops.find(join_field);
+        if (itr != fprops.end())
+        {
+            val = itr->second.to_string();
+        }
+
+        feature_pos = feature_keys.find(feature_id);
+        if (feature_pos == feature_keys.end())
+        {
+            feature_keys[feature_id] = val;
+            if (closure->include_features && (val != ""))
+                closure->features[val] = fprops;
+        }
+
+        ras_grid.render(ren_grid, feature_id);
+
+    }
+
+    // resample and utf-ize the grid, or encode the binary one
+    closure->grid_initialized = true;
+    if (closure->rle)
+        grid2rle(renbuf, closure, feature_keys);
+    else
+        grid2utf(renbuf, closure, feature_keys);
+}
 
 int Map::EIO_RenderGrid(eio_req *req)
 {
 
     grid_t *closure = static_cast<grid_t *>(req->data);
 
-    std::vector<mapnik::layer> const& layers = closure->m->map_->layers();
+    std::vector<mapnik::layer> const& layers = closure->map->layers();
     std::size_t layer_num = layers.size();
     unsigned int layer_idx = closure->layer_idx;
 
@@ -1621,49 +2229,36 @@ int Map::EIO_RenderGrid(eio_req *req)
     unsigned int step = closure->step;
     std::string join_field = closure->join_field;
 
-    unsigned int width = closure->m->map_->width()/step;
-    unsigned int height = closure->m->map_->height()/step;
+    unsigned int width = closure->map->width()/step;
+    unsigned int height = closure->map->height()/step;
     
-    const mapnik::box2d<double>&  ext = closure->m->map_->get_current_extent();
-    //const mapnik::box2d<double>&  ext = closure->m->map_->get_buffered_extent();
+    const mapnik::box2d<double>&  ext = closure->map->get_current_extent();
+    //const mapnik::box2d<double>&  ext = closure->map->get_buffered_extent();
     mapnik::CoordTransform tr = mapnik::CoordTransform(width,height,ext);
 
     try
     {
 
         //double z = 0;
-        mapnik::projection proj0(closure->m->map_->srs());
-        mapnik::projection proj1(layer.srs());
-        mapnik::proj_transform prj_trans(proj0,proj1);
+        boost::shared_ptr<mapnik::proj_transform> trans = acquire_transform(closure->map->srs(), layer.srs());
+        mapnik::proj_transform const& prj_trans = *trans;
 
 
+        // the layer's extent in the map's srs, sampled along its edges so
+        // the query below is no larger than it needs to be
         mapnik::box2d<double> layer_ext = layer.envelope();
-           
-        double lx0 = layer_ext.minx();
-        double ly0 = layer_ext.miny();
-        double lz0 = 0.0;
-        double lx1 = layer_ext.maxx();
-        double ly1 = layer_ext.maxy();
-        double lz1 = 0.0;
-        prj_trans.backward(lx0,ly0,lz0);
-        prj_trans.backward(lx1,ly1,lz1);
-        if ( lx0 > ext.maxx() || lx1 < ext.minx() || ly0 > ext.maxy() || ly1 < ext.miny() )
+        if (!backward_box(prj_trans, layer_ext) || !layer_ext.intersects(ext))
         {
             //closure->error = true;
             //closure->error_name = "Layer does not interesect with map";
             //std::clog << "bbox of " << layer.name() << " does not intersect map, skipping\n";
             return 0;
         }
-        
+
         // clip query bbox
-        lx0 = std::max(ext.minx(),lx0);
-        ly0 = std::max(ext.miny(),ly0);
-        lx1 = std::min(ext.maxx(),lx1);
-        ly1 = std::min(ext.maxy(),ly1);
-        
-        prj_trans.forward(lx0,ly0,lz0);
-        prj_trans.forward(lx1,ly1,lz1);
-        mapnik::box2d<double> bbox(lx0,ly0,lx1,ly1);
+        mapnik::box2d<double> bbox = layer_ext.intersect(ext);
+        if (!forward_box(prj_trans, bbox))
+            return 0;
 
         #if MAPNIK_VERSION >= 800
             mapnik::query q(bbox);
@@ -1727,98 +2322,12 @@ int Map::EIO_RenderGrid(eio_req *req)
         }
 
         mapnik::featureset_ptr fs = ds->features(q);
-        typedef mapnik::coord_transform2<mapnik::CoordTransform,mapnik::geometry_type> path_type;
-    
-        agg_grid::grid_value feature_id = 1;
-        std::map<agg_grid::grid_value, std::string> feature_keys;
-        std::map<agg_grid::grid_value, std::string>::const_iterator feature_pos;
-        
         if (fs)
         {
-            
-            grid_buffer pixmap_(width,height);
-            agg_grid::grid_rendering_buffer renbuf(pixmap_.getData(), width, height, width);
-            agg_grid::grid_renderer<agg_grid::span_grid> ren_grid(renbuf);
-            rasterizer ras_grid;
-            
-            agg_grid::grid_value no_hit = 0;
-            std::string no_hit_val = "";
-            feature_keys[no_hit] = no_hit_val;
-            ren_grid.clear(no_hit);
-    
-            mapnik::feature_ptr feature;
-            while ((feature = fs->next()))
-            {
-                ras_grid.reset();
-                ++feature_id;
- 
-                for (unsigned i=0;i<feature->num_geometries();++i)
-                {
-                    mapnik::geometry_type const& geom=feature->get_geometry(i);
-                    mapnik::eGeomType g_type = geom.type();
-                    if (g_type == mapnik::Point)
-                    {
-    
-                        double x;
-                        double y;
-                        double z=0;
-                        int i;
-                        geom.label_position(&x, &y);
-                        // TODO - check return of proj_trans
-                        prj_trans.backward(x,y,z);
-                        //bool ok = prj_trans.backward(x,y,z);
-                        //if (!ok)
-                        //    std::clog << "warning proj_trans failed\n";
-                        tr.forward(&x,&y);
-                        //if (x < 0 || y < 0)
-                        //    std::clog << "warning: invalid point values being rendered: " << x << " " << y << "\n";
-                        int approximation_steps = 360;
-                        int rx = 10/step; // arbitary pixel width
-                        int ry = 10/step; // arbitary pixel height
-                        ras_grid.move_to_d(x + rx, y);
-                        for(i = 1; i < approximation_steps; i++)
-                        {
-                            double a = double(i) * 3.1415926 / 180.0;
-                            ras_grid.line_to_d(x + cos(a) * rx, y + sin(a) * ry);
-                        }
-                    }
-                    else if (geom.num_points() > 1)
-                    {
-                        if (g_type == mapnik::LineString) {
-                            path_type path(tr,geom,prj_trans);
-                            agg::conv_stroke<path_type>  stroke(path);
-                            ras_grid.add_path(stroke);
-                        }
-                        else {
-                            path_type path(tr,geom,prj_trans);
-                            ras_grid.add_path(path);
-                        }
-                    }
-                }
-    
-                std::string val = "";
-                std::map<std::string,mapnik::value> const& fprops = feature->props();
-                std::map<std::string,mapnik::value>::const_iterator const& itr = fprops.find(join_field);
-                if (itr != fprops.end())
-                {
-                    val = itr->second.to_string();
-                }
-    
-                feature_pos = feature_keys.find(feature_id);
-                if (feature_pos == feature_keys.end())
-                {
-                    feature_keys[feature_id] = val;
-                    if (closure->include_features && (val != ""))
-                        closure->features[val] = fprops;
-                }
-                
-                ras_grid.render(ren_grid, feature_id);
-    
-            }
-            
-            // resample and utf-ize the grid
-            closure->grid_initialized = true;
-            grid2utf(renbuf, closure, feature_keys);
+            if (closure->binary)
+                render_grid_features<binary_rasterizer>(closure, fs, prj_trans, tr, width, height);
+            else
+                render_grid_features<rasterizer>(closure, fs, prj_trans, tr, width, height);
         }
 
     }
@@ -1878,7 +2387,7 @@ int Map::EIO_AfterRenderGrid(eio_req *req)
         Local<Value> argv[1] = { Exception::Error(String::New(closure->error_name.c_str())) };
         closure->cb->Call(Context::GetCurrent()->Global(), 1, argv);
     } else {
-        Local<Array> keys_a = Array::New(closure->keys.size());
+        Local<Array> keys_a = Array::New(closure->key_order.size());
         std::vector<std::string>::iterator it;
         unsigned int i;
         for (it = closure->key_order.begin(), i = 0; it < closure->key_order.end(); ++it, ++i)
@@ -1914,7 +2423,16 @@ int Map::EIO_AfterRenderGrid(eio_req *req)
         
         // Create the return hash.
         Local<Object> json = Object::New();
-        if (closure->grid_initialized) {
+        if (closure->grid_initialized && closure->rle) {
+            #if NODE_VERSION_AT_LEAST(0,3,0)
+              node::Buffer *retbuf = Buffer::New((char *)closure->rle_data.data(),closure->rle_data.size());
+            #else
+              node::Buffer *retbuf = Buffer::New(closure->rle_data.size());
+              memcpy(retbuf->data(), closure->rle_data.data(), closure->rle_data.size());
+            #endif
+            json->Set(String::NewSymbol("grid"), retbuf->handle_);
+        }
+        else if (closure->grid_initialized) {
             json->Set(String::NewSymbol("grid"), String::New(closure->grid, closure->grid_length));
         }
         else {
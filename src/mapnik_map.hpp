@@ -40,7 +40,10 @@ class Map: public node::ObjectWrap {
     static Handle<Value> render_to_file(const Arguments &args);
     static Handle<Value> layers(const Arguments &args);
     static Handle<Value> features(const Arguments &args);
+    static Handle<Value> featureset(const Arguments &args);
     static Handle<Value> describe_data(const Arguments &args);
+    static Handle<Value> cache_layer(const Arguments &args);
+    static Handle<Value> cache_stats(const Arguments &args);
     static Handle<Value> scale_denominator(const Arguments &args);
     static Handle<Value> render_grid(const Arguments &args);
 
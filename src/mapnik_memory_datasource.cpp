@@ -1,16 +1,26 @@
+#include <node_buffer.h>
+#include <node_version.h>
 
 //#include <mapnik/datasource_cache.hpp>
-#include <mapnik/memory_datasource.hpp>
 #include <mapnik/unicode.hpp>
 #include "mapnik_memory_datasource.hpp"
+#include "indexed_memory_datasource.hpp"
+#include "columnar_memory_datasource.hpp"
+#include "feature_batch.hpp"
+#include "feature_reader.hpp"
 
 #include "mapnik_datasource.hpp"
 #include "mapnik_featureset.hpp"
 #include "utils.hpp"
 #include "ds_emitter.hpp"
+#include "datasource_stats.hpp"
 
 // stl
 #include <exception>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
 
 Persistent<FunctionTemplate> MemoryDatasource::constructor;
 
@@ -27,7 +37,14 @@ void MemoryDatasource::Initialize(Handle<Object> target) {
     NODE_SET_PROTOTYPE_METHOD(constructor, "describe", describe);
     NODE_SET_PROTOTYPE_METHOD(constructor, "features", features);
     NODE_SET_PROTOTYPE_METHOD(constructor, "featureset", featureset);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "statistics", statistics);
     NODE_SET_PROTOTYPE_METHOD(constructor, "add", add);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "addBatch", addBatch);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "update", update);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "remove", remove);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "clear", clear);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "load", load);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "save", save);
 
     target->Set(String::NewSymbol("MemoryDatasource"),constructor->GetFunction());
 }
@@ -36,7 +53,9 @@ MemoryDatasource::MemoryDatasource() :
   ObjectWrap(),
   datasource_(),
   feature_id_(1),
-  tr_(new mapnik::transcoder("utf8")) {}
+  loading_(false),
+  tr_(new mapnik::transcoder("utf8")),
+  properties_() {}
 
 MemoryDatasource::~MemoryDatasource()
 {
@@ -82,6 +101,58 @@ Handle<Value> MemoryDatasource::New(const Arguments& args)
         bind = bind_opt->BooleanValue();
     }
 
+    // a schema switches to columnar storage
+    bool columnar = false;
+    column_schema schema;
+    if (options->Has(String::New("schema")))
+    {
+        Local<Value> schema_opt = options->Get(String::New("schema"));
+        if (!schema_opt->IsObject())
+          return ThrowException(Exception::TypeError(
+            String::New("'schema' must be an object of field names and types, eg {name: 'string', lanes: 'int'}")));
+
+        Local<Object> s_obj = schema_opt->ToObject();
+        Local<Array> fields = s_obj->GetPropertyNames();
+        uint32_t a_length = fields->Length();
+        for (uint32_t i = 0; i < a_length; ++i)
+        {
+            Local<Value> name = fields->Get(i)->ToString();
+            std::string type = TOSTR(s_obj->Get(name));
+            if (type == "int" || type == "integer")
+                schema.push_back(column_def(TOSTR(name), attribute_column::int_type));
+            else if (type == "double" || type == "float" || type == "number")
+                schema.push_back(column_def(TOSTR(name), attribute_column::double_type));
+            else if (type == "string")
+                schema.push_back(column_def(TOSTR(name), attribute_column::string_type));
+            else
+              return ThrowException(Exception::TypeError(
+                String::New("schema types must be 'int', 'double' or 'string'")));
+        }
+        columnar = true;
+    }
+
+    // the only properties worth keeping, if the maps using the datasource
+    // are known to need no others; the rest are never read from V8
+    std::set<std::string> properties;
+    if (options->Has(String::New("properties")))
+    {
+        Local<Value> prop_opt = options->Get(String::New("properties"));
+        if (!prop_opt->IsArray())
+          return ThrowException(Exception::TypeError(
+            String::New("'properties' must be an array of property names")));
+
+        Local<Array> a = Local<Array>::Cast(prop_opt);
+        uint32_t a_length = a->Length();
+        for (uint32_t i = 0; i < a_length; ++i)
+        {
+            Local<Value> name = a->Get(i);
+            if (!name->IsString())
+              return ThrowException(Exception::TypeError(
+                String::New("'properties' must be an array of property names")));
+            properties.insert(TOSTR(name));
+        }
+    }
+
     mapnik::parameters params;
     Local<Array> names = options->GetPropertyNames();
     uint32_t i = 0;
@@ -89,16 +160,52 @@ Handle<Value> MemoryDatasource::New(const Arguments& args)
     while (i < a_length) {
         Local<Value> name = names->Get(i)->ToString();
         Local<Value> value = options->Get(name);
-        params[TOSTR(name)] = TOSTR(value);
+        std::string key = TOSTR(name);
+        if ((!columnar || key != "schema") && key != "properties")
+            params[key] = TOSTR(value);
         i++;
     }
 
-    
-    //memory_datasource cache;
-    mapnik::datasource_ptr ds(new mapnik::memory_datasource());
+    // a snapshot written by save(), mapped unless mmap is false
+    column_store_ptr store;
+    if (options->Has(String::New("file")))
+    {
+        if (columnar)
+          return ThrowException(Exception::TypeError(
+            String::New("'schema' cannot be combined with 'file', the snapshot has its own")));
+
+        bool use_mmap = true;
+        if (options->Has(String::New("mmap")))
+        {
+            Local<Value> mmap_opt = options->Get(String::New("mmap"));
+            if (!mmap_opt->IsBoolean())
+              return ThrowException(Exception::TypeError(
+                String::New("'mmap' must be a Boolean")));
+            use_mmap = mmap_opt->BooleanValue();
+        }
+
+        try
+        {
+            store = column_store::load(TOSTR(options->Get(String::New("file"))), use_mmap);
+        }
+        catch (const std::exception & ex)
+        {
+            return ThrowException(Exception::Error(
+              String::New(ex.what())));
+        }
+    }
+
+    mapnik::datasource_ptr ds;
+    if (store)
+        ds.reset(new columnar_memory_datasource(params, store));
+    else if (columnar)
+        ds.reset(new columnar_memory_datasource(params, schema));
+    else
+        ds.reset(new indexed_memory_datasource(params));
     MemoryDatasource* d = new MemoryDatasource();
     d->Wrap(args.This());
     d->datasource_ = ds;
+    d->properties_.swap(properties);
     return args.This();
 
     return Undefined();
@@ -176,6 +283,7 @@ Handle<Value> MemoryDatasource::features(const Arguments& args)
     return scope.Close(a);
 }
 
+// ds.featureset([options]), see Datasource.featureset()
 Handle<Value> MemoryDatasource::featureset(const Arguments& args)
 {
 
@@ -183,19 +291,25 @@ Handle<Value> MemoryDatasource::featureset(const Arguments& args)
 
     MemoryDatasource* d = ObjectWrap::Unwrap<MemoryDatasource>(args.This());
 
+    boost::optional<mapnik::box2d<double> > extent;
+    std::vector<std::string> names;
+    std::string filter;
+    std::string error_name;
+    if (!featureset_options(args[0], extent, names, filter, error_name))
+        return ThrowException(Exception::TypeError(
+          String::New(error_name.c_str())));
+
     if (d->datasource_) {
-        mapnik::query q(d->datasource_->envelope());
-        mapnik::layer_descriptor ld = d->datasource_->get_descriptor();
-        std::vector<mapnik::attribute_descriptor> const& desc = ld.get_descriptors();
-        std::vector<mapnik::attribute_descriptor>::const_iterator itr = desc.begin();
-        std::vector<mapnik::attribute_descriptor>::const_iterator end = desc.end();
-        while (itr != end)
+        mapnik::featureset_ptr fs;
+        try
         {
-            q.add_property_name(itr->get_name());
-            ++itr;
+            fs = datasource_featureset(d->datasource_, extent, names, filter);
+        }
+        catch (const std::exception & ex)
+        {
+            return ThrowException(Exception::Error(
+              String::New(ex.what())));
         }
-    
-        mapnik::featureset_ptr fs = d->datasource_->features(q);
         if (fs)
         {
             return scope.Close(Featureset::New(fs));
@@ -205,6 +319,14 @@ Handle<Value> MemoryDatasource::featureset(const Arguments& args)
     return Undefined();
 }
 
+// see Datasource::statistics
+Handle<Value> MemoryDatasource::statistics(const Arguments& args)
+{
+    HandleScope scope;
+    MemoryDatasource* d = ObjectWrap::Unwrap<MemoryDatasource>(args.This());
+    return scope.Close(Datasource::queue_statistics(d->datasource_, args));
+}
+
 Handle<Value> MemoryDatasource::add(const Arguments& args)
 {
 
@@ -218,60 +340,614 @@ Handle<Value> MemoryDatasource::add(const Arguments& args)
 
     MemoryDatasource* d = ObjectWrap::Unwrap<MemoryDatasource>(args.This());
 
-    Local<Object> obj = args[0]->ToObject();
+    if (d->loading_)
+    {
+        return ThrowException(Exception::Error(
+           String::New("the datasource cannot be changed while load() is running")));
+    }
+
+    writable_memory_datasource *cache = dynamic_cast<writable_memory_datasource *>(d->datasource_.get());
+    if (!cache)
+    {
+        return ThrowException(Exception::Error(
+           String::New("features can only be added to an in-memory datasource")));
+    }
 
-    if (obj->Has(String::New("wkt")) || (obj->Has(String::New("x")) && obj->Has(String::New("y"))))
+    mapnik::feature_ptr feature;
+    std::string error_name;
+    if (!feature_from_object(args[0]->ToObject(), d->feature_id_, *d->tr_, feature, error_name, d->property_filter()))
     {
-        if (obj->Has(String::New("wkt")))
+        return ThrowException(Exception::Error(
+          String::New(error_name.c_str())));
+    }
+
+    if (feature)
+    {
+        ++(d->feature_id_);
+        cache->push(feature);
+        invalidate_statistics(cache);
+    }
+    return scope.Close(Boolean::New(false));
+}
+
+Handle<Value> MemoryDatasource::update(const Arguments& args)
+{
+    HandleScope scope;
+
+    if ((args.Length() != 2) || !args[0]->IsNumber() || !args[1]->IsObject())
+    {
+        return ThrowException(Exception::Error(
+           String::New("accepts two arguments: a feature id and an object including x and y (or wkt) and properties")));
+    }
+
+    MemoryDatasource* d = ObjectWrap::Unwrap<MemoryDatasource>(args.This());
+
+    if (d->loading_)
+    {
+        return ThrowException(Exception::Error(
+           String::New("the datasource cannot be changed while load() is running")));
+    }
+
+    writable_memory_datasource *cache = dynamic_cast<writable_memory_datasource *>(d->datasource_.get());
+    if (!cache)
+    {
+        return ThrowException(Exception::Error(
+           String::New("features can only be updated in an in-memory datasource")));
+    }
+
+    int id = args[0]->Int32Value();
+    mapnik::feature_ptr feature;
+    std::string error_name;
+    if (!feature_from_object(args[1]->ToObject(), id, *d->tr_, feature, error_name, d->property_filter()))
+    {
+        return ThrowException(Exception::Error(
+          String::New(error_name.c_str())));
+    }
+    if (!feature)
+    {
+        return ThrowException(Exception::Error(
+           String::New("the feature needs x and y (or wkt)")));
+    }
+
+    // keep add() from handing out this id again
+    if (id >= 0 && static_cast<unsigned int>(id) >= d->feature_id_)
+        d->feature_id_ = id + 1;
+
+    bool replaced;
+    try
+    {
+        replaced = cache->update(feature);
+        invalidate_statistics(cache);
+    }
+    catch (const std::exception & ex)
+    {
+        return ThrowException(Exception::Error(
+          String::New(ex.what())));
+    }
+    return scope.Close(Boolean::New(replaced));
+}
+
+Handle<Value> MemoryDatasource::remove(const Arguments& args)
+{
+    HandleScope scope;
+
+    if ((args.Length() != 1) || !args[0]->IsNumber())
+    {
+        return ThrowException(Exception::Error(
+           String::New("accepts one argument: a feature id")));
+    }
+
+    MemoryDatasource* d = ObjectWrap::Unwrap<MemoryDatasource>(args.This());
+
+    if (d->loading_)
+    {
+        return ThrowException(Exception::Error(
+           String::New("the datasource cannot be changed while load() is running")));
+    }
+
+    writable_memory_datasource *cache = dynamic_cast<writable_memory_datasource *>(d->datasource_.get());
+    if (!cache)
+    {
+        return ThrowException(Exception::Error(
+           String::New("features can only be removed from an in-memory datasource")));
+    }
+
+    bool removed;
+    try
+    {
+        removed = cache->remove(args[0]->Int32Value());
+        if (removed)
+            invalidate_statistics(cache);
+    }
+    catch (const std::exception & ex)
+    {
+        return ThrowException(Exception::Error(
+          String::New(ex.what())));
+    }
+    return scope.Close(Boolean::New(removed));
+}
+
+Handle<Value> MemoryDatasource::clear(const Arguments& args)
+{
+    HandleScope scope;
+
+    MemoryDatasource* d = ObjectWrap::Unwrap<MemoryDatasource>(args.This());
+
+    if (d->loading_)
+    {
+        return ThrowException(Exception::Error(
+           String::New("the datasource cannot be changed while load() is running")));
+    }
+
+    writable_memory_datasource *cache = dynamic_cast<writable_memory_datasource *>(d->datasource_.get());
+    if (!cache)
+    {
+        return ThrowException(Exception::Error(
+           String::New("only an in-memory datasource can be cleared")));
+    }
+
+    cache->clear();
+    invalidate_statistics(cache);
+    return scope.Close(Undefined());
+}
+
+
+typedef struct {
+    MemoryDatasource* d;
+    point_batch batch;
+    unsigned int first_id;
+    bool error;
+    std::string error_name;
+    Persistent<Function> cb;
+} add_batch_baton_t;
+
+// Builds the point features of a batch and adds them to the datasource.
+// Does not touch V8, so it can run on the thread pool.
+static void build_batch(add_batch_baton_t* closure, writable_memory_datasource& ds)
+{
+    mapnik::transcoder tr("utf8");
+    std::vector<mapnik::feature_ptr> features;
+    build_point_batch(closure->batch, closure->first_id, tr, features);
+    ds.push(features);
+    invalidate_statistics(&ds);
+}
+
+/*
+ * ds.addBatch({x: Float64Array, y: Float64Array, ids: Uint32Array,
+ *              columns: {name: [...], speed: Float64Array}}, [callback])
+ *
+ * Adds one point feature per x/y pair. ids and columns are optional; every
+ * array must have the same length as x. Typed arrays are copied straight
+ * from their storage, plain arrays may hold numbers and strings. Without a
+ * callback the features are added before returning; with one, they are
+ * built on the thread pool and callback(err, count) is called when they
+ * are queryable.
+ */
+Handle<Value> MemoryDatasource::addBatch(const Arguments& args)
+{
+    HandleScope scope;
+
+    if (args.Length() < 1 || !args[0]->IsObject())
+    {
+        return ThrowException(Exception::TypeError(
+           String::New("first argument must be an object with x and y arrays")));
+    }
+
+    bool async = false;
+    if (args.Length() > 1)
+    {
+        if (!args[args.Length()-1]->IsFunction())
+            return ThrowException(Exception::TypeError(
+                      String::New("last argument must be a callback function")));
+        async = true;
+    }
+
+    MemoryDatasource* d = ObjectWrap::Unwrap<MemoryDatasource>(args.This());
+    if (d->loading_)
+    {
+        return ThrowException(Exception::Error(
+           String::New("the datasource cannot be changed while load() is running")));
+    }
+
+    writable_memory_datasource *cache = dynamic_cast<writable_memory_datasource *>(d->datasource_.get());
+    if (!cache)
+    {
+        return ThrowException(Exception::Error(
+           String::New("features can only be added to an in-memory datasource")));
+    }
+
+    std::auto_ptr<add_batch_baton_t> closure(new add_batch_baton_t());
+    std::string error_name;
+    if (!read_point_batch(args[0]->ToObject(), closure->batch, error_name, d->property_filter()))
+    {
+        return ThrowException(Exception::TypeError(
+           String::New(error_name.c_str())));
+    }
+
+    std::size_t n = closure->batch.size();
+    closure->d = d;
+    closure->error = false;
+    closure->first_id = d->feature_id_;
+    if (closure->batch.ids.empty())
+        d->feature_id_ += n;
+    // keep add() from handing out the given ids again, as update() does
+    for (std::size_t i = 0; i < closure->batch.ids.size(); ++i)
+    {
+        double id = closure->batch.ids[i];
+        if (id >= 0 && id >= d->feature_id_)
+            d->feature_id_ = static_cast<unsigned int>(id) + 1;
+    }
+
+    if (!async)
+    {
+        try
+        {
+            build_batch(closure.get(), *cache);
+        }
+        catch (const std::exception & ex)
+        {
             return ThrowException(Exception::Error(
-               String::New("wkt not yet supported")));
+              String::New(ex.what())));
+        }
+        return scope.Close(Integer::New(n));
+    }
+
+    closure->cb = Persistent<Function>::New(Handle<Function>::Cast(args[args.Length()-1]));
+    eio_custom(EIO_AddBatch, EIO_PRI_DEFAULT, EIO_AfterAddBatch, closure.release());
+    ev_ref(EV_DEFAULT_UC);
+    d->Ref();
+    return Undefined();
+}
+
+int MemoryDatasource::EIO_AddBatch(eio_req *req)
+{
+    add_batch_baton_t *closure = static_cast<add_batch_baton_t *>(req->data);
+    try
+    {
+        writable_memory_datasource *cache = static_cast<writable_memory_datasource *>(closure->d->datasource_.get());
+        build_batch(closure, *cache);
+    }
+    catch (const std::exception & ex)
+    {
+        closure->error = true;
+        closure->error_name = ex.what();
+    }
+    catch (...)
+    {
+        closure->error = true;
+        closure->error_name = "unknown exception happened while adding features";
+    }
+    return 0;
+}
+
+int MemoryDatasource::EIO_AfterAddBatch(eio_req *req)
+{
+    HandleScope scope;
+
+    add_batch_baton_t *closure = static_cast<add_batch_baton_t *>(req->data);
+    ev_unref(EV_DEFAULT_UC);
+
+    TryCatch try_catch;
+
+    if (closure->error) {
+        Local<Value> argv[1] = { Exception::Error(String::New(closure->error_name.c_str())) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 1, argv);
+    } else {
+        Local<Value> argv[2] = { Local<Value>::New(Null()), Integer::New(closure->batch.size()) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 2, argv);
+    }
+
+    if (try_catch.HasCaught()) {
+      FatalException(try_catch);
+    }
+
+    closure->d->Unref();
+    closure->cb.Dispose();
+    delete closure;
+    return 0;
+}
+
+
+typedef void (*feature_reader_fn)(char const*, std::size_t, std::vector<mapnik::feature_ptr>&, int&);
+
+typedef struct {
+    MemoryDatasource* d;
+    // the data stays in the js buffer, which is kept alive until the
+    // load is done; strings are copied
+    Persistent<Object> buffer;
+    std::string string_data;
+    char const* data;
+    std::size_t size;
+    feature_reader_fn reader;
+    bool append;
+    int next_id;
+    std::size_t count;
+    bool error;
+    std::string error_name;
+    Persistent<Function> cb;
+} load_baton_t;
+
+/*
+ * ds.load(data, [options], callback)
+ *
+ * Parses a Buffer or string of GeoJSON, WKB or WKT on the thread pool and
+ * calls callback(err, count) with the number of features read. options:
+ *
+ *   format: 'geojson' (default), 'wkb' or 'wkt'
+ *   append: false (default) to replace all features of the datasource in
+ *           one step, including ones added while the load was running,
+ *           true to add to them
+ *
+ * Nothing changes if the data cannot be parsed.
+ */
+Handle<Value> MemoryDatasource::load(const Arguments& args)
+{
+    HandleScope scope;
+
+    if (args.Length() < 2 || !args[args.Length()-1]->IsFunction())
+        return ThrowException(Exception::TypeError(
+                  String::New("requires data and a callback function")));
 
-        Local<Value> x = obj->Get(String::New("x"));
-        Local<Value> y = obj->Get(String::New("y"));
-        if (!x->IsUndefined() && x->IsNumber() && !y->IsUndefined() && y->IsNumber())
+    if (!args[0]->IsString() && !(args[0]->IsObject() && Buffer::HasInstance(args[0])))
+        return ThrowException(Exception::TypeError(
+                  String::New("first argument must be a Buffer or a string")));
+
+    MemoryDatasource* d = ObjectWrap::Unwrap<MemoryDatasource>(args.This());
+    if (d->loading_)
+    {
+        return ThrowException(Exception::Error(
+           String::New("the datasource cannot be changed while load() is running")));
+    }
+    if (!dynamic_cast<writable_memory_datasource *>(d->datasource_.get()))
+    {
+        return ThrowException(Exception::Error(
+           String::New("features can only be added to an in-memory datasource")));
+    }
+
+    std::string format("geojson");
+    bool append = false;
+    if (args.Length() > 2)
+    {
+        if (!args[1]->IsObject())
+            return ThrowException(Exception::TypeError(
+                      String::New("optional second argument must be an options object")));
+
+        Local<Object> options = args[1]->ToObject();
+        if (options->Has(String::New("format")))
+        {
+            Local<Value> format_opt = options->Get(String::New("format"));
+            if (!format_opt->IsString())
+              return ThrowException(Exception::TypeError(
+                String::New("'format' must be a string")));
+            format = TOSTR(format_opt);
+        }
+        if (options->Has(String::New("append")))
         {
-            mapnik::geometry_type * pt = new mapnik::geometry_type(mapnik::Point);
-            pt->move_to(x->NumberValue(),y->NumberValue());
-            mapnik::feature_ptr feature(new mapnik::Feature(d->feature_id_));
-            ++(d->feature_id_);
-            feature->add_geometry(pt);
-            if (obj->Has(String::New("properties")))
-            {
-                Local<Value> props = obj->Get(String::New("properties"));
-                if (props->IsObject())
-                {
-                    Local<Object> p_obj = props->ToObject();
-                    Local<Array> names = p_obj->GetPropertyNames();
-                    uint32_t i = 0;
-                    uint32_t a_length = names->Length();
-                    while (i < a_length)
-                    {
-                        Local<Value> name = names->Get(i)->ToString();
-                        // if name in q.property_names() ?
-                        Local<Value> value = p_obj->Get(name);
-                        if (value->IsString()) {
-                            UnicodeString ustr = d->tr_->transcode(TOSTR(value));
-                            boost::put(*feature,TOSTR(name),ustr);
-                        } else if (value->IsNumber()) {
-                            double num = value->NumberValue();
-                            // todo - round
-                            if (num == value->IntegerValue()) {
-                                int integer = value->IntegerValue();
-                                boost::put(*feature,TOSTR(name),integer);
-                            } else {
-                                double dub_val = value->NumberValue();
-                                boost::put(*feature,TOSTR(name),dub_val);
-                            }
-                        } else {
-                            std::clog << "unhandled type for property: " << TOSTR(name) << "\n";
-                        }
-                        i++;
-                    }
-                }
-            }
-            mapnik::memory_datasource *cache = dynamic_cast<mapnik::memory_datasource *>(d->datasource_.get());
-            cache->push(feature);
+            Local<Value> append_opt = options->Get(String::New("append"));
+            if (!append_opt->IsBoolean())
+              return ThrowException(Exception::TypeError(
+                String::New("'append' must be a Boolean")));
+            append = append_opt->BooleanValue();
         }
     }
-    return scope.Close(Boolean::New(false));
+
+    feature_reader_fn reader;
+    if (format == "geojson")
+        reader = read_geojson;
+    else if (format == "wkb")
+        reader = read_wkb;
+    else if (format == "wkt")
+        reader = read_wkt;
+    else
+        return ThrowException(Exception::TypeError(
+                  String::New("'format' must be one of 'geojson', 'wkb' or 'wkt'")));
+
+    load_baton_t *closure = new load_baton_t();
+    if (args[0]->IsString())
+    {
+        closure->string_data = TOSTR(args[0]);
+        closure->data = closure->string_data.data();
+        closure->size = closure->string_data.size();
+    }
+    else
+    {
+        Local<Object> obj = args[0]->ToObject();
+        closure->buffer = Persistent<Object>::New(obj);
+        #if NODE_VERSION_AT_LEAST(0,3,0)
+          closure->data = Buffer::Data(obj);
+          closure->size = Buffer::Length(obj);
+        #else
+          Buffer *buf = ObjectWrap::Unwrap<Buffer>(obj);
+          closure->data = buf->data();
+          closure->size = buf->length();
+        #endif
+    }
+    closure->d = d;
+    closure->reader = reader;
+    closure->append = append;
+    closure->next_id = append ? d->feature_id_ : 1;
+    closure->count = 0;
+    closure->error = false;
+    closure->cb = Persistent<Function>::New(Handle<Function>::Cast(args[args.Length()-1]));
+    d->loading_ = true;
+    eio_custom(EIO_Load, EIO_PRI_DEFAULT, EIO_AfterLoad, closure);
+    ev_ref(EV_DEFAULT_UC);
+    d->Ref();
+    return Undefined();
+}
+
+int MemoryDatasource::EIO_Load(eio_req *req)
+{
+    load_baton_t *closure = static_cast<load_baton_t *>(req->data);
+    try
+    {
+        std::vector<mapnik::feature_ptr> features;
+        closure->reader(closure->data, closure->size, features, closure->next_id);
+        closure->count = features.size();
+        writable_memory_datasource *cache = static_cast<writable_memory_datasource *>(closure->d->datasource_.get());
+        if (closure->append)
+            cache->push(features);
+        else
+            cache->replace(features);
+        invalidate_statistics(cache);
+    }
+    catch (const std::exception & ex)
+    {
+        closure->error = true;
+        closure->error_name = ex.what();
+    }
+    catch (...)
+    {
+        closure->error = true;
+        closure->error_name = "unknown exception happened while loading features";
+    }
+    return 0;
+}
+
+int MemoryDatasource::EIO_AfterLoad(eio_req *req)
+{
+    HandleScope scope;
+
+    load_baton_t *closure = static_cast<load_baton_t *>(req->data);
+    ev_unref(EV_DEFAULT_UC);
+    closure->d->loading_ = false;
+
+    TryCatch try_catch;
+
+    if (closure->error) {
+        Local<Value> argv[1] = { Exception::Error(String::New(closure->error_name.c_str())) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 1, argv);
+    } else {
+        // keep ids handed out by add() unique
+        if (closure->next_id > static_cast<int>(closure->d->feature_id_))
+            closure->d->feature_id_ = closure->next_id;
+        Local<Value> argv[2] = { Local<Value>::New(Null()), Integer::New(closure->count) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 2, argv);
+    }
+
+    if (try_catch.HasCaught()) {
+      FatalException(try_catch);
+    }
+
+    closure->d->Unref();
+    closure->cb.Dispose();
+    if (!closure->buffer.IsEmpty())
+        closure->buffer.Dispose();
+    delete closure;
+    return 0;
+}
+
+
+typedef struct {
+    MemoryDatasource* d;
+    std::string path;
+    bool error;
+    std::string error_name;
+    Persistent<Function> cb;
+} save_baton_t;
+
+/*
+ * ds.save(path, [callback])
+ *
+ * Writes a snapshot that new mapnik.MemoryDatasource({file: path}) maps
+ * back in. With a callback the file is written on the thread pool and
+ * callback(err) is called when it is complete.
+ */
+Handle<Value> MemoryDatasource::save(const Arguments& args)
+{
+    HandleScope scope;
+
+    if (args.Length() < 1 || !args[0]->IsString())
+        return ThrowException(Exception::TypeError(
+                  String::New("first argument must be a path to save to")));
+
+    bool async = false;
+    if (args.Length() > 1)
+    {
+        if (!args[args.Length()-1]->IsFunction())
+            return ThrowException(Exception::TypeError(
+                      String::New("last argument must be a callback function")));
+        async = true;
+    }
+
+    MemoryDatasource* d = ObjectWrap::Unwrap<MemoryDatasource>(args.This());
+    writable_memory_datasource *cache = dynamic_cast<writable_memory_datasource *>(d->datasource_.get());
+    if (!cache)
+    {
+        return ThrowException(Exception::Error(
+           String::New("only in-memory datasources can be saved")));
+    }
+
+    std::string path = TOSTR(args[0]);
+    if (!async)
+    {
+        try
+        {
+            cache->save(path);
+        }
+        catch (const std::exception & ex)
+        {
+            return ThrowException(Exception::Error(
+              String::New(ex.what())));
+        }
+        return Undefined();
+    }
+
+    save_baton_t *closure = new save_baton_t();
+    closure->d = d;
+    closure->path = path;
+    closure->error = false;
+    closure->cb = Persistent<Function>::New(Handle<Function>::Cast(args[args.Length()-1]));
+    eio_custom(EIO_Save, EIO_PRI_DEFAULT, EIO_AfterSave, closure);
+    ev_ref(EV_DEFAULT_UC);
+    d->Ref();
+    return Undefined();
+}
+
+int MemoryDatasource::EIO_Save(eio_req *req)
+{
+    save_baton_t *closure = static_cast<save_baton_t *>(req->data);
+    try
+    {
+        writable_memory_datasource *cache = static_cast<writable_memory_datasource *>(closure->d->datasource_.get());
+        cache->save(closure->path);
+    }
+    catch (const std::exception & ex)
+    {
+        closure->error = true;
+        closure->error_name = ex.what();
+    }
+    catch (...)
+    {
+        closure->error = true;
+        closure->error_name = "unknown exception happened while saving";
+    }
+    return 0;
+}
+
+int MemoryDatasource::EIO_AfterSave(eio_req *req)
+{
+    HandleScope scope;
+
+    save_baton_t *closure = static_cast<save_baton_t *>(req->data);
+    ev_unref(EV_DEFAULT_UC);
+
+    TryCatch try_catch;
+
+    if (closure->error) {
+        Local<Value> argv[1] = { Exception::Error(String::New(closure->error_name.c_str())) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 1, argv);
+    } else {
+        Local<Value> argv[1] = { Local<Value>::New(Null()) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 1, argv);
+    }
+
+    if (try_catch.HasCaught()) {
+      FatalException(try_catch);
+    }
+
+    closure->d->Unref();
+    closure->cb.Dispose();
+    delete closure;
+    return 0;
 }
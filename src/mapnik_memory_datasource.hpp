@@ -6,7 +6,12 @@
 #include <node_object_wrap.h>
 
 #include <boost/scoped_ptr.hpp>
-#include <mapnik/memory_datasource.hpp>
+#include <mapnik/datasource.hpp>
+#include <mapnik/unicode.hpp>
+
+// stl
+#include <set>
+#include <string>
 
 using namespace v8;
 using namespace node;
@@ -21,16 +26,38 @@ class MemoryDatasource: public node::ObjectWrap {
     static Handle<Value> describe(const Arguments &args);
     static Handle<Value> features(const Arguments &args);
     static Handle<Value> featureset(const Arguments &args);
+    static Handle<Value> statistics(const Arguments &args);
     static Handle<Value> add(const Arguments &args);
+    static Handle<Value> addBatch(const Arguments &args);
+    static Handle<Value> update(const Arguments &args);
+    static Handle<Value> remove(const Arguments &args);
+    static Handle<Value> clear(const Arguments &args);
+    static int EIO_AddBatch(eio_req *req);
+    static int EIO_AfterAddBatch(eio_req *req);
+    static Handle<Value> load(const Arguments &args);
+    static int EIO_Load(eio_req *req);
+    static int EIO_AfterLoad(eio_req *req);
+    static Handle<Value> save(const Arguments &args);
+    static int EIO_Save(eio_req *req);
+    static int EIO_AfterSave(eio_req *req);
 
     MemoryDatasource();
     inline mapnik::datasource_ptr get() { return datasource_; }
 
   private:
     ~MemoryDatasource();
+    // the properties add(), update() and addBatch() keep, null for all
+    std::set<std::string> const* property_filter() const
+    {
+        return properties_.empty() ? 0 : &properties_;
+    }
     mapnik::datasource_ptr datasource_;
     unsigned int feature_id_;
+    // a load() is running on the thread pool; until it is done its ids are
+    // not known, so writes are refused
+    bool loading_;
     boost::scoped_ptr<mapnik::transcoder> tr_;
+    std::set<std::string> properties_;
 };
 
 #endif
@@ -1,6 +1,14 @@
 #include "mapnik_projection.hpp"
+#include "projection_batch.hpp"
+#include "projection_cache.hpp"
 #include "utils.hpp"
 
+// stl
+#include <cstring>
+#include <exception>
+#include <string>
+#include <vector>
+
 Persistent<FunctionTemplate> Projection::constructor;
 
 void Projection::Initialize(Handle<Object> target) {
@@ -13,13 +21,18 @@ void Projection::Initialize(Handle<Object> target) {
 
     NODE_SET_PROTOTYPE_METHOD(constructor, "forward", forward);
     NODE_SET_PROTOTYPE_METHOD(constructor, "inverse", inverse);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "forwardMany", forwardMany);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "inverseMany", inverseMany);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "forwardBox", forwardBox);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "inverseBox", inverseBox);
 
     target->Set(String::NewSymbol("Projection"),constructor->GetFunction());
 }
 
 Projection::Projection(std::string const& name) :
   ObjectWrap(),
-  projection_(new mapnik::projection(name)) {}
+  projection_(acquire_projection(name)),
+  merc_(is_spherical_mercator(projection_->params())) {}
 
 Projection::~Projection()
 {
@@ -145,3 +158,266 @@ Handle<Value> Projection::inverse(const Arguments& args)
   }
 }
 
+
+typedef struct {
+    proj_ptr projection;
+    bool merc;
+    bool forward;
+    std::vector<double> xy;
+    // the array to write the result into, if options.inPlace
+    Persistent<Object> target;
+    bool error;
+    std::string error_name;
+    Persistent<Function> cb;
+} transform_baton_t;
+
+// Writes xy into target, a Float64Array or an Array of the same length.
+static void write_coords(Local<Object> target, std::vector<double> const& xy)
+{
+#if NODE_VERSION_AT_LEAST(0,5,0)
+    if (target->HasIndexedPropertiesInExternalArrayData())
+    {
+        if (xy.size() > 0)
+            memcpy(target->GetIndexedPropertiesExternalArrayData(), &xy[0], xy.size() * sizeof(double));
+        return;
+    }
+#endif
+    for (uint32_t i = 0; i < xy.size(); ++i)
+        target->Set(i, Number::New(xy[i]));
+}
+
+// Whether coords can take the result in place: a Float64Array, where the
+// runtime has them, or an Array.
+static bool can_write_in_place(Local<Object> coords)
+{
+    if (coords->HasIndexedPropertiesInExternalArrayData())
+    {
+#if NODE_VERSION_AT_LEAST(0,5,0)
+        return coords->GetIndexedPropertiesExternalArrayDataType() == kExternalDoubleArray;
+#else
+        return false;
+#endif
+    }
+    return coords->IsArray();
+}
+
+/*
+ * proj.forwardMany(coords, [options], [callback])
+ * proj.inverseMany(coords, [options], [callback])
+ *
+ * Projects the x, y pairs interleaved in coords, a Float64Array or any
+ * array of numbers, and returns them as a new Float64Array. With
+ * options.inPlace they are written back into coords instead, which must
+ * then be a Float64Array or an Array. With a callback the points are
+ * projected on the thread pool and callback(err, result) is called.
+ * Spherical mercator is projected in closed form, without proj4. Points
+ * that cannot be projected, like the poles in mercator, come back as
+ * Infinity.
+ */
+Handle<Value> Projection::forwardMany(const Arguments& args)
+{
+    return transform_many(args, true);
+}
+
+Handle<Value> Projection::inverseMany(const Arguments& args)
+{
+    return transform_many(args, false);
+}
+
+Handle<Value> Projection::transform_many(const Arguments& args, bool forward)
+{
+    HandleScope scope;
+    Projection* p = ObjectWrap::Unwrap<Projection>(args.This());
+
+    if (args.Length() < 1 || !args[0]->IsObject())
+        return ThrowException(Exception::TypeError(
+          String::New("first argument must be a Float64Array or an array of x, y pairs")));
+
+    Local<Function> cb;
+    int argc = args.Length();
+    if (args[argc - 1]->IsFunction())
+    {
+        cb = Local<Function>::Cast(args[argc - 1]);
+        --argc;
+    }
+
+    bool in_place = false;
+    if (argc > 1)
+    {
+        if (!args[1]->IsObject())
+            return ThrowException(Exception::TypeError(
+              String::New("optional second argument must be an options object, eg { inPlace: true }")));
+        Local<Object> options = args[1]->ToObject();
+        if (options->Has(String::New("inPlace")))
+        {
+            Local<Value> opt = options->Get(String::New("inPlace"));
+            if (!opt->IsBoolean())
+                return ThrowException(Exception::TypeError(
+                  String::New("'inPlace' must be a Boolean")));
+            in_place = opt->BooleanValue();
+        }
+    }
+
+    Local<Object> coords = args[0]->ToObject();
+    if (in_place && !can_write_in_place(coords))
+        return ThrowException(Exception::TypeError(
+          String::New("coordinates can only be projected in place in a Float64Array or an Array")));
+
+    std::vector<double> xy;
+    bool integral;
+    if (!read_number_array(coords, xy, integral))
+        return ThrowException(Exception::TypeError(
+          String::New("first argument must be a Float64Array or an array of x, y pairs")));
+    if (xy.size() % 2 != 0)
+        return ThrowException(Exception::Error(
+          String::New("coordinates must be x, y pairs")));
+
+    if (cb.IsEmpty())
+    {
+        if (forward)
+            forward_many(*p->projection_, p->merc_, xy.empty() ? 0 : &xy[0], xy.size() / 2);
+        else
+            inverse_many(*p->projection_, p->merc_, xy.empty() ? 0 : &xy[0], xy.size() / 2);
+        if (in_place)
+        {
+            write_coords(coords, xy);
+            return scope.Close(coords);
+        }
+        return scope.Close(new_typed_array("Float64Array", xy));
+    }
+
+    transform_baton_t *closure = new transform_baton_t();
+    closure->projection = p->projection_;
+    closure->merc = p->merc_;
+    closure->forward = forward;
+    closure->xy.swap(xy);
+    if (in_place)
+        closure->target = Persistent<Object>::New(coords);
+    closure->error = false;
+    closure->cb = Persistent<Function>::New(cb);
+    eio_custom(EIO_TransformMany, EIO_PRI_DEFAULT, EIO_AfterTransformMany, closure);
+    ev_ref(EV_DEFAULT_UC);
+    return Undefined();
+}
+
+int Projection::EIO_TransformMany(eio_req *req)
+{
+    transform_baton_t *closure = static_cast<transform_baton_t *>(req->data);
+    try
+    {
+        double* xy = closure->xy.empty() ? 0 : &closure->xy[0];
+        if (closure->forward)
+            forward_many(*closure->projection, closure->merc, xy, closure->xy.size() / 2);
+        else
+            inverse_many(*closure->projection, closure->merc, xy, closure->xy.size() / 2);
+    }
+    catch (const std::exception & ex)
+    {
+        closure->error = true;
+        closure->error_name = ex.what();
+    }
+    return 0;
+}
+
+int Projection::EIO_AfterTransformMany(eio_req *req)
+{
+    HandleScope scope;
+
+    transform_baton_t *closure = static_cast<transform_baton_t *>(req->data);
+    ev_unref(EV_DEFAULT_UC);
+
+    TryCatch try_catch;
+
+    if (closure->error) {
+        Local<Value> argv[1] = { Exception::Error(String::New(closure->error_name.c_str())) };
+        closure->cb->Call(Context::GetCurrent()->Global(), 1, argv);
+    } else {
+        Local<Value> result;
+        if (!closure->target.IsEmpty())
+        {
+            write_coords(Local<Object>::New(closure->target), closure->xy);
+            result = Local<Object>::New(closure->target);
+        }
+        else
+        {
+            result = new_typed_array("Float64Array", closure->xy);
+        }
+        Local<Value> argv[2] = { Local<Value>::New(Null()), result };
+        closure->cb->Call(Context::GetCurrent()->Global(), 2, argv);
+    }
+
+    if (try_catch.HasCaught()) {
+      FatalException(try_catch);
+    }
+
+    if (!closure->target.IsEmpty())
+        closure->target.Dispose();
+    closure->cb.Dispose();
+    delete closure;
+    return 0;
+}
+
+/*
+ * proj.forwardBox([minx, miny, maxx, maxy], [options])
+ * proj.inverseBox([minx, miny, maxx, maxy], [options])
+ *
+ * The extent of the projected box, found by projecting options.densify
+ * points (20 by default) between each pair of corners as well as the
+ * corners themselves. Unlike forward() of a box, it holds all of the box
+ * where the transform curves its edges. Throws if no point of the edges
+ * can be projected.
+ */
+Handle<Value> Projection::forwardBox(const Arguments& args)
+{
+    return transform_box(args, true);
+}
+
+Handle<Value> Projection::inverseBox(const Arguments& args)
+{
+    return transform_box(args, false);
+}
+
+Handle<Value> Projection::transform_box(const Arguments& args, bool forward)
+{
+    HandleScope scope;
+    Projection* p = ObjectWrap::Unwrap<Projection>(args.This());
+
+    if (args.Length() < 1 || !args[0]->IsArray() || Local<Array>::Cast(args[0])->Length() != 4)
+        return ThrowException(Exception::TypeError(
+          String::New("first argument must be an array of [minx,miny,maxx,maxy]")));
+
+    unsigned densify = default_densify;
+    if (args.Length() > 1)
+    {
+        if (!args[1]->IsObject())
+            return ThrowException(Exception::TypeError(
+              String::New("optional second argument must be an options object, eg { densify: 20 }")));
+        Local<Object> options = args[1]->ToObject();
+        if (options->Has(String::New("densify")))
+        {
+            Local<Value> opt = options->Get(String::New("densify"));
+            if (!opt->IsNumber() || opt->NumberValue() < 0 || opt->NumberValue() > 10000)
+                return ThrowException(Exception::TypeError(
+                  String::New("'densify' must be a number of points from 0 to 10000")));
+            densify = opt->Uint32Value();
+        }
+    }
+
+    Local<Array> a = Local<Array>::Cast(args[0]);
+    mapnik::box2d<double> box(a->Get(0)->NumberValue(),
+                              a->Get(1)->NumberValue(),
+                              a->Get(2)->NumberValue(),
+                              a->Get(3)->NumberValue());
+    bool ok = forward ? forward_box(*p->projection_, p->merc_, box, densify)
+                      : inverse_box(*p->projection_, p->merc_, box, densify);
+    if (!ok)
+        return ThrowException(Exception::Error(
+          String::New("the box could not be projected")));
+
+    Local<Array> result = Array::New(4);
+    result->Set(0, Number::New(box.minx()));
+    result->Set(1, Number::New(box.miny()));
+    result->Set(2, Number::New(box.maxx()));
+    result->Set(3, Number::New(box.maxy()));
+    return scope.Close(result);
+}
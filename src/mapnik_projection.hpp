@@ -23,13 +23,23 @@ class Projection: public node::ObjectWrap {
 
     static Handle<Value> inverse(const Arguments& args);
     static Handle<Value> forward(const Arguments& args);
+    static Handle<Value> forwardMany(const Arguments& args);
+    static Handle<Value> inverseMany(const Arguments& args);
+    static Handle<Value> forwardBox(const Arguments& args);
+    static Handle<Value> inverseBox(const Arguments& args);
+    static int EIO_TransformMany(eio_req *req);
+    static int EIO_AfterTransformMany(eio_req *req);
 
     explicit Projection(std::string const& name);
     explicit Projection(std::string const& name, std::string const& srs);
 
   private:
     ~Projection();
+    static Handle<Value> transform_many(const Arguments& args, bool forward);
+    static Handle<Value> transform_box(const Arguments& args, bool forward);
     proj_ptr projection_;
+    // projected in closed form, see projection_batch.hpp
+    bool merc_;
 };
 
 #endif
@@ -0,0 +1,246 @@
+#include "mapnik_spherical_mercator.hpp"
+#include "mapnik_tile_iterator.hpp"
+#include "tile_math.hpp"
+#include "utils.hpp"
+
+// stl
+#include <cmath>
+#include <string>
+#include <vector>
+
+Persistent<FunctionTemplate> SphericalMercator::constructor;
+
+void SphericalMercator::Initialize(Handle<Object> target) {
+
+    HandleScope scope;
+
+    constructor = Persistent<FunctionTemplate>::New(FunctionTemplate::New(SphericalMercator::New));
+    constructor->InstanceTemplate()->SetInternalFieldCount(1);
+    constructor->SetClassName(String::NewSymbol("SphericalMercator"));
+
+    NODE_SET_PROTOTYPE_METHOD(constructor, "xyzToEnvelope", xyzToEnvelope);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "bboxToTileRange", bboxToTileRange);
+    NODE_SET_PROTOTYPE_METHOD(constructor, "tiles", tiles);
+
+    target->Set(String::NewSymbol("SphericalMercator"),constructor->GetFunction());
+}
+
+SphericalMercator::SphericalMercator() :
+  ObjectWrap() {}
+
+SphericalMercator::~SphericalMercator()
+{
+}
+
+Handle<Value> SphericalMercator::New(const Arguments& args)
+{
+    HandleScope scope;
+
+    if (!args.IsConstructCall())
+        return ThrowException(String::New("Cannot call constructor as function, you need to use 'new' keyword"));
+
+    SphericalMercator* m = new SphericalMercator();
+    m->Wrap(args.This());
+    return args.This();
+}
+
+static bool valid_zoom(double z)
+{
+    return z >= 0 && z <= max_tile_zoom && z == std::floor(z);
+}
+
+static bool is_zoom(Local<Value> value)
+{
+    return value->IsNumber() && valid_zoom(value->NumberValue());
+}
+
+// Reads options.name into value if it is there; false if it is not a
+// Boolean.
+static bool read_bool_option(Local<Object> options, const char* name, bool& value)
+{
+    if (!options->Has(String::New(name)))
+        return true;
+    Local<Value> opt = options->Get(String::New(name));
+    if (!opt->IsBoolean())
+        return false;
+    value = opt->BooleanValue();
+    return true;
+}
+
+// Reads the [minx,miny,maxx,maxy] in args[0] into bbox, and the zooms in
+// args[1] and args[2], or sets error.
+static bool read_tile_args(const Arguments& args,
+                           mapnik::box2d<double>& bbox,
+                           unsigned& zmin,
+                           unsigned& zmax,
+                           std::string& error)
+{
+    std::vector<double> box;
+    bool integral;
+    if (args.Length() < 1 || !read_number_array(args[0], box, integral) || box.size() != 4)
+    {
+        error = "first argument must be a bbox of [minx,miny,maxx,maxy] in longitude and latitude";
+        return false;
+    }
+    if (args.Length() < 3 || !is_zoom(args[1]) || !is_zoom(args[2]))
+    {
+        error = "second and third arguments must be the min and max zoom, from 0 to 30";
+        return false;
+    }
+    zmin = args[1]->Uint32Value();
+    zmax = args[2]->Uint32Value();
+    if (zmin > zmax)
+    {
+        error = "the min zoom must not be greater than the max zoom";
+        return false;
+    }
+    bbox.init(box[0], box[1], box[2], box[3]);
+    return true;
+}
+
+/*
+ * merc.xyzToEnvelope(x, y, z, [tms])
+ * merc.xyzToEnvelope(tiles, [options])
+ *
+ * The extent of tile x, y at zoom z in spherical mercator meters, as
+ * [minx,miny,maxx,maxy]. Given tiles, a Uint32Array or any array of x, y, z
+ * triples, the extents of all of them are returned one after another in a
+ * Float64Array. tms, or options.tms, counts rows from the south.
+ */
+Handle<Value> SphericalMercator::xyzToEnvelope(const Arguments& args)
+{
+    HandleScope scope;
+
+    if (args.Length() > 0 && args[0]->IsNumber())
+    {
+        if (args.Length() < 3 || !args[1]->IsNumber() || !is_zoom(args[2]))
+            return ThrowException(Exception::TypeError(
+              String::New("arguments must be x, y and a zoom from 0 to 30")));
+        bool tms = args.Length() > 3 && args[3]->BooleanValue();
+        double box[4];
+        xyz_to_envelope(args[0]->NumberValue(), args[1]->NumberValue(),
+                        args[2]->Uint32Value(), tms, box);
+        Local<Array> a = Array::New(4);
+        for (unsigned i = 0; i < 4; ++i)
+            a->Set(i, Number::New(box[i]));
+        return scope.Close(a);
+    }
+
+    std::vector<double> xyz;
+    bool integral;
+    if (args.Length() < 1 || !read_number_array(args[0], xyz, integral))
+        return ThrowException(Exception::TypeError(
+          String::New("first argument must be x or a Uint32Array of x, y, z triples")));
+    if (xyz.size() % 3 != 0)
+        return ThrowException(Exception::Error(
+          String::New("tiles must be x, y, z triples")));
+
+    bool tms = false;
+    if (args.Length() > 1)
+    {
+        if (!args[1]->IsObject())
+            return ThrowException(Exception::TypeError(
+              String::New("optional second argument must be an options object, eg { tms: true }")));
+        if (!read_bool_option(args[1]->ToObject(), "tms", tms))
+            return ThrowException(Exception::TypeError(
+              String::New("'tms' must be a Boolean")));
+    }
+
+    std::vector<double> boxes(xyz.size() / 3 * 4);
+    for (std::size_t i = 0; i < xyz.size() / 3; ++i)
+    {
+        if (!valid_zoom(xyz[3 * i + 2]))
+            return ThrowException(Exception::Error(
+              String::New("tile zooms must be from 0 to 30")));
+        xyz_to_envelope(xyz[3 * i], xyz[3 * i + 1],
+                        static_cast<unsigned>(xyz[3 * i + 2]), tms, &boxes[4 * i]);
+    }
+    return scope.Close(new_typed_array("Float64Array", boxes));
+}
+
+/*
+ * merc.bboxToTileRange(bbox, zmin, zmax, [options])
+ *
+ * The tiles covering bbox, [minx,miny,maxx,maxy] in longitude and
+ * latitude, at each zoom from zmin to zmax, as a Uint32Array of z, minx,
+ * miny, maxx, maxy per zoom. options.tms counts rows from the south.
+ */
+Handle<Value> SphericalMercator::bboxToTileRange(const Arguments& args)
+{
+    HandleScope scope;
+
+    mapnik::box2d<double> bbox;
+    unsigned zmin, zmax;
+    std::string error;
+    if (!read_tile_args(args, bbox, zmin, zmax, error))
+        return ThrowException(Exception::TypeError(String::New(error.c_str())));
+
+    bool tms = false;
+    if (args.Length() > 3)
+    {
+        if (!args[3]->IsObject())
+            return ThrowException(Exception::TypeError(
+              String::New("optional fourth argument must be an options object, eg { tms: true }")));
+        if (!read_bool_option(args[3]->ToObject(), "tms", tms))
+            return ThrowException(Exception::TypeError(
+              String::New("'tms' must be a Boolean")));
+    }
+
+    std::vector<uint32_t> ranges;
+    ranges.reserve(5 * (zmax - zmin + 1));
+    for (unsigned z = zmin; z <= zmax; ++z)
+    {
+        tile_range r = bbox_to_tile_range(bbox, z, tms);
+        ranges.push_back(r.z);
+        ranges.push_back(r.minx);
+        ranges.push_back(r.miny);
+        ranges.push_back(r.maxx);
+        ranges.push_back(r.maxy);
+    }
+    return scope.Close(new_typed_array("Uint32Array", ranges));
+}
+
+/*
+ * merc.tiles(bbox, zmin, zmax, [options])
+ *
+ * A TileIterator over the tiles covering bbox, in longitude and latitude,
+ * from zmin to zmax, a zoom at a time. Tiles are made as next() asks for
+ * them. options.order is 'row', the default, or 'hilbert', which keeps
+ * tiles that follow each other close together for caches downstream;
+ * options.tms counts rows from the south.
+ */
+Handle<Value> SphericalMercator::tiles(const Arguments& args)
+{
+    HandleScope scope;
+
+    mapnik::box2d<double> bbox;
+    unsigned zmin, zmax;
+    std::string error;
+    if (!read_tile_args(args, bbox, zmin, zmax, error))
+        return ThrowException(Exception::TypeError(String::New(error.c_str())));
+
+    bool tms = false;
+    bool hilbert = false;
+    if (args.Length() > 3)
+    {
+        if (!args[3]->IsObject())
+            return ThrowException(Exception::TypeError(
+              String::New("optional fourth argument must be an options object, eg { order: 'hilbert' }")));
+        Local<Object> options = args[3]->ToObject();
+        if (!read_bool_option(options, "tms", tms))
+            return ThrowException(Exception::TypeError(
+              String::New("'tms' must be a Boolean")));
+        if (options->Has(String::New("order")))
+        {
+            std::string order = TOSTR(options->Get(String::New("order")));
+            if (order == "hilbert")
+                hilbert = true;
+            else if (order != "row")
+                return ThrowException(Exception::TypeError(
+                  String::New("'order' must be 'row' or 'hilbert'")));
+        }
+    }
+
+    boost::shared_ptr<tile_enumerator> enumerator(new tile_enumerator(bbox, zmin, zmax, tms, hilbert));
+    return scope.Close(TileIterator::New(enumerator));
+}
@@ -0,0 +1,27 @@
+#ifndef __NODE_MAPNIK_SPHERICAL_MERCATOR_H__
+#define __NODE_MAPNIK_SPHERICAL_MERCATOR_H__
+
+#include <v8.h>
+#include <node.h>
+#include <node_object_wrap.h>
+
+using namespace v8;
+using namespace node;
+
+class SphericalMercator: public node::ObjectWrap {
+  public:
+    static Persistent<FunctionTemplate> constructor;
+    static void Initialize(Handle<Object> target);
+    static Handle<Value> New(const Arguments &args);
+
+    static Handle<Value> xyzToEnvelope(const Arguments& args);
+    static Handle<Value> bboxToTileRange(const Arguments& args);
+    static Handle<Value> tiles(const Arguments& args);
+
+    SphericalMercator();
+
+  private:
+    ~SphericalMercator();
+};
+
+#endif
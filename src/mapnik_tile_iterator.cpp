@@ -0,0 +1,102 @@
+#include "mapnik_tile_iterator.hpp"
+#include "utils.hpp"
+
+// stl
+#include <vector>
+
+// tiles per next() unless asked for another count, and at most
+const uint32_t default_page = 4096;
+const uint32_t max_page = 1 << 20;
+
+Persistent<FunctionTemplate> TileIterator::constructor;
+
+void TileIterator::Initialize(Handle<Object> target) {
+
+    HandleScope scope;
+
+    constructor = Persistent<FunctionTemplate>::New(FunctionTemplate::New(TileIterator::New));
+    constructor->InstanceTemplate()->SetInternalFieldCount(1);
+    constructor->SetClassName(String::NewSymbol("TileIterator"));
+
+    NODE_SET_PROTOTYPE_METHOD(constructor, "next", next);
+
+    ATTR(constructor, "count", get_prop, 0);
+
+    target->Set(String::NewSymbol("TileIterator"),constructor->GetFunction());
+}
+
+TileIterator::TileIterator() :
+  ObjectWrap(),
+  this_() {}
+
+TileIterator::~TileIterator()
+{
+}
+
+Handle<Value> TileIterator::New(const Arguments& args)
+{
+    HandleScope scope;
+
+    if (!args.IsConstructCall())
+        return ThrowException(String::New("Cannot call constructor as function, you need to use 'new' keyword"));
+
+    if (args[0]->IsExternal())
+    {
+        Local<External> ext = Local<External>::Cast(args[0]);
+        void* ptr = ext->Value();
+        TileIterator* it = static_cast<TileIterator*>(ptr);
+        it->Wrap(args.This());
+        return args.This();
+    }
+
+    return ThrowException(Exception::TypeError(
+      String::New("Sorry a TileIterator cannot currently be created, only accessed via SphericalMercator.tiles()")));
+}
+
+Handle<Value> TileIterator::New(boost::shared_ptr<tile_enumerator> tiles)
+{
+    HandleScope scope;
+    TileIterator* it = new TileIterator();
+    it->this_ = tiles;
+    Handle<Value> ext = External::New(it);
+    Handle<Object> obj = constructor->GetFunction()->NewInstance(1, &ext);
+    return scope.Close(obj);
+}
+
+Handle<Value> TileIterator::get_prop(Local<String> property,
+                                     const AccessorInfo& info)
+{
+    HandleScope scope;
+    TileIterator* it = ObjectWrap::Unwrap<TileIterator>(info.This());
+    std::string a = TOSTR(property);
+    if (a == "count")
+        return scope.Close(Number::New(it->this_->count()));
+    return Undefined();
+}
+
+/*
+ * tiles.next([count])
+ *
+ * The next count tiles, 4096 by default, as a Uint32Array of x, y, z
+ * triples; empty once all tiles are done. Where the runtime has no typed
+ * arrays a plain Array is returned.
+ */
+Handle<Value> TileIterator::next(const Arguments& args)
+{
+    HandleScope scope;
+    TileIterator* it = ObjectWrap::Unwrap<TileIterator>(args.This());
+
+    uint32_t count = default_page;
+    if (args.Length() > 0 && !args[0]->IsUndefined())
+    {
+        if (!args[0]->IsNumber() || args[0]->NumberValue() < 1 || args[0]->NumberValue() > max_page)
+            return ThrowException(Exception::TypeError(
+              String::New("optional argument must be a number of tiles from 1 to 1048576")));
+        count = args[0]->Uint32Value();
+    }
+
+    std::vector<uint32_t> xyz;
+    xyz.reserve(3 * count);
+    it->this_->next(xyz, count);
+    return scope.Close(new_typed_array("Uint32Array", xyz));
+}
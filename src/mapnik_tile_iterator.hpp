@@ -0,0 +1,33 @@
+#ifndef __NODE_MAPNIK_TILE_ITERATOR_H__
+#define __NODE_MAPNIK_TILE_ITERATOR_H__
+
+#include <v8.h>
+#include <node.h>
+#include <node_object_wrap.h>
+
+#include "tile_math.hpp"
+
+// boost
+#include <boost/shared_ptr.hpp>
+
+using namespace v8;
+using namespace node;
+
+class TileIterator: public node::ObjectWrap {
+  public:
+    static Persistent<FunctionTemplate> constructor;
+    static void Initialize(Handle<Object> target);
+    static Handle<Value> New(const Arguments &args);
+    static Handle<Value> New(boost::shared_ptr<tile_enumerator> tiles);
+    static Handle<Value> next(const Arguments &args);
+    static Handle<Value> get_prop(Local<String> property,
+                                  const AccessorInfo& info);
+
+    TileIterator();
+
+  private:
+    ~TileIterator();
+    boost::shared_ptr<tile_enumerator> this_;
+};
+
+#endif
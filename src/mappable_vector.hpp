@@ -0,0 +1,137 @@
+#ifndef __NODE_MAPNIK_MAPPABLE_VECTOR_H__
+#define __NODE_MAPNIK_MAPPABLE_VECTOR_H__
+
+// boost
+#include <boost/shared_ptr.hpp>
+
+// stl
+#include <algorithm>
+#include <vector>
+
+// An append-only array that either owns its elements or is a read-only
+// view of memory owned by someone else, typically a mapped snapshot file.
+// A view holds a reference to its owner, so the mapping stays alive as long
+// as any array points into it. The first write to a view copies it into
+// owned memory.
+//
+// T must be plain data: views are reinterpreted bytes.
+
+template <typename T>
+class mappable_vector
+{
+public:
+    typedef T value_type;
+    typedef T const* const_iterator;
+
+    mappable_vector()
+        : owned_(),
+          owner_(),
+          data_(0),
+          size_(0) {}
+
+    mappable_vector(std::size_t n, T const& value)
+        : owned_(n, value),
+          owner_()
+    {
+        sync();
+    }
+
+    mappable_vector(mappable_vector const& other)
+        : owned_(other.owned_),
+          owner_(other.owner_)
+    {
+        if (owner_)
+        {
+            data_ = other.data_;
+            size_ = other.size_;
+        }
+        else
+        {
+            sync();
+        }
+    }
+
+    mappable_vector& operator=(mappable_vector const& other)
+    {
+        mappable_vector tmp(other);
+        swap(tmp);
+        return *this;
+    }
+
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    T const* data() const { return data_; }
+    const_iterator begin() const { return data_; }
+    const_iterator end() const { return data_ + size_; }
+    T const& operator[](std::size_t i) const { return data_[i]; }
+    T const& back() const { return data_[size_ - 1]; }
+    bool is_mapped() const { return owner_; }
+
+    void push_back(T const& value)
+    {
+        detach();
+        owned_.push_back(value);
+        sync();
+    }
+
+    void append(T const* first, T const* last)
+    {
+        detach();
+        owned_.insert(owned_.end(), first, last);
+        sync();
+    }
+
+    void reserve(std::size_t n)
+    {
+        detach();
+        owned_.reserve(n);
+        sync();
+    }
+
+    void clear()
+    {
+        owner_.reset();
+        owned_.clear();
+        sync();
+    }
+
+    void swap(mappable_vector& other)
+    {
+        owned_.swap(other.owned_);
+        owner_.swap(other.owner_);
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+    }
+
+    // makes this a view of size elements at data, which owner keeps alive
+    void map(T const* data, std::size_t size, boost::shared_ptr<void const> const& owner)
+    {
+        std::vector<T>().swap(owned_);
+        owner_ = owner;
+        data_ = data;
+        size_ = size;
+    }
+
+private:
+    void detach()
+    {
+        if (owner_)
+        {
+            owned_.assign(data_, data_ + size_);
+            owner_.reset();
+        }
+    }
+
+    void sync()
+    {
+        data_ = owned_.empty() ? 0 : &owned_[0];
+        size_ = owned_.size();
+    }
+
+    std::vector<T> owned_;
+    boost::shared_ptr<void const> owner_;
+    T const* data_;
+    std::size_t size_;
+};
+
+#endif // __NODE_MAPNIK_MAPPABLE_VECTOR_H__
@@ -14,12 +14,17 @@ using namespace node;
 #include <mapnik/query.hpp>
 //#include <mapnik/unicode.hpp>
 //#include <mapnik/feature_factory.hpp> // TODO remove
+#include <set>
+#include <string>
 #include <vector>
 #include <boost/utility.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
 #include <algorithm>
 #include <mapnik/sql_utils.hpp>
 
+#include "feature_batch.hpp"
+
 
 class js_datasource : public mapnik::datasource
 {
@@ -35,6 +40,8 @@ public:
     size_t size() const;
     Persistent<Function> cb_;
 private:
+    // the thread that created it, the only one that may call cb_
+    boost::thread::id main_thread_;
     int type_;
     mutable mapnik::layer_descriptor desc_;
     mapnik::box2d<double> ext_;
@@ -43,6 +50,7 @@ private:
 
 js_datasource::js_datasource(const mapnik::parameters &params, bool bind, Local<Value> cb)
     : datasource (params),
+      main_thread_(boost::this_thread::get_id()),
       type_(datasource::Vector),
       desc_(*params.get<std::string>("type"), *params.get<std::string>("encoding","utf-8"))
 {
@@ -82,6 +90,24 @@ size_t js_datasource::size() const
 }
 
 
+// Calls the datasource's callback for features as mapnik asks for them.
+// The callback is called with the id of the next feature and an object
+// with the query extent and, if the query names the attributes it needs,
+// their names as properties, eg
+//
+//   {extent: [minx, miny, maxx, maxy], properties: ['name', 'rank']}
+//
+// Other properties are dropped without being read, so the callback may as
+// well leave them out. It returns one of:
+//
+//   - a single feature object, as taken by MemoryDatasource.add()
+//   - an array of such objects
+//   - a batch of points as taken by MemoryDatasource.addBatch()
+//   - undefined, or an empty array or batch, when there are no more
+//
+// Arrays and batches are buffered and handed out one feature at a time, so
+// a callback that returns many features per call crosses into V8 once per
+// batch instead of once per feature.
 class js_featureset : public mapnik::Featureset, private boost::noncopyable
 {
 public:
@@ -90,7 +116,11 @@ public:
           feature_id_(1),
           tr_(new mapnik::transcoder("utf-8")),
           ds_(ds),
-          obj_(Object::New())
+          obj_(Object::New()),
+          names_(q.property_names()),
+          features_(),
+          pos_(0),
+          done_(false)
     {
         Local<Array> a = Array::New(4);
         mapnik::box2d<double> const& e = q_.get_bbox();
@@ -99,14 +129,39 @@ public:
         a->Set(2, Number::New(e.maxx()));
         a->Set(3, Number::New(e.maxy()));
         obj_->Set(String::NewSymbol("extent"), a);
-        
+
+        if (!names_.empty())
+        {
+            Local<Array> p = Array::New(names_.size());
+            std::set<std::string>::const_iterator itr = names_.begin();
+            for (uint32_t i = 0; itr != names_.end(); ++itr, ++i)
+                p->Set(i, String::New(itr->c_str()));
+            obj_->Set(String::NewSymbol("properties"), p);
+        }
     }
 
     virtual ~js_featureset() {}
 
     mapnik::feature_ptr next()
     {
-
+        if (pos_ == features_.size())
+        {
+            features_.clear();
+            pos_ = 0;
+            if (done_ || !fetch())
+            {
+                done_ = true;
+                return mapnik::feature_ptr();
+            }
+        }
+        return features_[pos_++];
+    }
+        
+private:
+    // Calls the callback and buffers what it returns, returns false once
+    // it has no more features.
+    bool fetch()
+    {
         HandleScope scope;
         
         TryCatch try_catch;
@@ -114,79 +169,79 @@ public:
         Local<Value> val = ds_->cb_->Call(Context::GetCurrent()->Global(), 2, argv);
         if (try_catch.HasCaught()) {
             FatalException(try_catch);
+            return false;
         }
-        else
+        if (val->IsUndefined() || !val->IsObject())
+            return false;
+
+        std::string error_name;
+        if (val->IsArray())
         {
-            if (!val->IsUndefined())
+            Local<Array> a = Local<Array>::Cast(val);
+            uint32_t length = a->Length();
+            features_.reserve(length);
+            for (uint32_t i = 0; i < length; ++i)
             {
-                if (val->IsObject())
+                Local<Value> item = a->Get(i);
+                if (!item->IsObject())
+                    continue;
+                mapnik::feature_ptr feature;
+                if (!feature_from_object(item->ToObject(), feature_id_, *tr_, feature, error_name, property_filter()))
+                    throw mapnik::datasource_exception(error_name);
+                if (feature)
                 {
-                    Local<Object> obj = val->ToObject();
-                    if (obj->Has(String::New("x")) && obj->Has(String::New("y")))
-                    {
-                        Local<Value> x = obj->Get(String::New("x"));
-                        Local<Value> y = obj->Get(String::New("y"));
-                        if (!x->IsUndefined() && x->IsNumber() && !y->IsUndefined() && y->IsNumber())
-                        {
-                            mapnik::geometry_type * pt = new mapnik::geometry_type(mapnik::Point);
-                            pt->move_to(x->NumberValue(),y->NumberValue());
-                            mapnik::feature_ptr feature(new mapnik::Feature(feature_id_));
-                            ++feature_id_;
-                            feature->add_geometry(pt);
-                            if (obj->Has(String::New("properties")))
-                            {
-                                Local<Value> props = obj->Get(String::New("properties"));
-                                if (props->IsObject())
-                                {
-                                    Local<Object> p_obj = props->ToObject();
-                                    Local<Array> names = p_obj->GetPropertyNames();
-                                    uint32_t i = 0;
-                                    uint32_t a_length = names->Length();
-                                    while (i < a_length)
-                                    {
-                                        Local<Value> name = names->Get(i)->ToString();
-                                        // if name in q.property_names() ?
-                                        Local<Value> value = p_obj->Get(name);
-                                        if (value->IsString()) {
-                                            UnicodeString ustr = tr_->transcode(TOSTR(value));
-                                            boost::put(*feature,TOSTR(name),ustr);
-                                        } else if (value->IsNumber()) {
-                                            double num = value->NumberValue();
-                                            // todo - round
-                                            if (num == value->IntegerValue()) {
-                                                int integer = value->IntegerValue();
-                                                boost::put(*feature,TOSTR(name),integer);
-                                            } else {
-                                                double dub_val = value->NumberValue();
-                                                boost::put(*feature,TOSTR(name),dub_val);
-                                            }
-                                        }
-                                        i++;
-                                    }
-                                }
-                            }
-                            return feature;                
-                        }
-                    }
+                    ++feature_id_;
+                    features_.push_back(feature);
                 }
-            }        
+            }
+        }
+        else if (is_point_batch(val->ToObject()))
+        {
+            point_batch batch;
+            if (!read_point_batch(val->ToObject(), batch, error_name, property_filter()))
+                throw mapnik::datasource_exception(error_name);
+            build_point_batch(batch, feature_id_, *tr_, features_);
+            if (batch.ids.empty())
+                feature_id_ += batch.size();
+        }
+        else
+        {
+            mapnik::feature_ptr feature;
+            if (!feature_from_object(val->ToObject(), feature_id_, *tr_, feature, error_name, property_filter()))
+                throw mapnik::datasource_exception(error_name);
+            if (feature)
+            {
+                ++feature_id_;
+                features_.push_back(feature);
+            }
         }
+        return !features_.empty();
+    }
 
-        return mapnik::feature_ptr();
+    // a query that names no properties gets all of them
+    std::set<std::string> const* property_filter() const
+    {
+        return names_.empty() ? 0 : &names_;
     }
-        
-private:
+
     mapnik::query const& q_;
     unsigned int feature_id_;
     boost::scoped_ptr<mapnik::transcoder> tr_;
     const js_datasource* ds_;
     Local<Object> obj_;
-    
+    std::set<std::string> names_;
+    std::vector<mapnik::feature_ptr> features_;
+    std::size_t pos_;
+    bool done_;
 };
 
 
 mapnik::featureset_ptr js_datasource::features(const mapnik::query& q) const
 {
+    // Map.render() prefetches JS layers on the main thread, see
+    // js_prefetch.hpp; anything else must not reach V8 from a worker
+    if (boost::this_thread::get_id() != main_thread_)
+        throw mapnik::datasource_exception("JSDatasource can only be queried on the main thread");
     return mapnik::featureset_ptr(new js_featureset(q,this));
 }
 
@@ -0,0 +1,133 @@
+#ifndef __NODE_MAPNIK_MEMORY_SNAPSHOT_H__
+#define __NODE_MAPNIK_MEMORY_SNAPSHOT_H__
+
+// boost
+#include <boost/shared_ptr.hpp>
+
+// stl
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <stdint.h>
+
+#include "mappable_vector.hpp"
+
+// Binary snapshots of in-memory datasources. A snapshot is a sequence of
+// scalars and arrays in host byte order. Every array is its element count
+// as a uint64 followed by its elements, starting on an 8 byte boundary, so
+// a reader can point arrays straight into a mapped file without copying or
+// parsing them.
+
+class snapshot_writer
+{
+public:
+    explicit snapshot_writer(std::ostream& out)
+        : out_(out),
+          offset_(0) {}
+
+    void write_u32(uint32_t v) { write_raw(&v, sizeof(v)); }
+    void write_u64(uint64_t v) { write_raw(&v, sizeof(v)); }
+    void write_double(double v) { write_raw(&v, sizeof(v)); }
+
+    void write_string(std::string const& s)
+    {
+        write_u32(s.size());
+        write_raw(s.data(), s.size());
+    }
+
+    template <typename T>
+    void write_array(T const* data, std::size_t count)
+    {
+        align();
+        write_u64(count);
+        write_raw(data, count * sizeof(T));
+    }
+
+    template <typename Array>
+    void write_array(Array const& array)
+    {
+        write_array(array.empty() ? 0 : &array[0], array.size());
+    }
+
+private:
+    void align()
+    {
+        static char const zeros[8] = { 0 };
+        write_raw(zeros, (8 - (offset_ & 7)) & 7);
+    }
+
+    void write_raw(void const* data, std::size_t size)
+    {
+        out_.write(static_cast<char const*>(data), size);
+        offset_ += size;
+        if (!out_)
+            throw std::runtime_error("failed to write snapshot");
+    }
+
+    std::ostream& out_;
+    std::size_t offset_;
+};
+
+class snapshot_reader
+{
+public:
+    // owner keeps data alive for the arrays mapped from it
+    snapshot_reader(char const* data, std::size_t size, boost::shared_ptr<void const> const& owner)
+        : begin_(data),
+          pos_(data),
+          end_(data + size),
+          owner_(owner) {}
+
+    uint32_t read_u32() { uint32_t v; read_raw(&v, sizeof(v)); return v; }
+    uint64_t read_u64() { uint64_t v; read_raw(&v, sizeof(v)); return v; }
+    double read_double() { double v; read_raw(&v, sizeof(v)); return v; }
+
+    std::string read_string()
+    {
+        uint32_t size = read_u32();
+        need(size);
+        std::string s(pos_, size);
+        pos_ += size;
+        return s;
+    }
+
+    template <typename T>
+    void read_array(mappable_vector<T>& out)
+    {
+        align();
+        uint64_t count = read_u64();
+        if (count > static_cast<uint64_t>(end_ - pos_) / sizeof(T))
+            throw std::runtime_error("snapshot is truncated");
+        out.map(reinterpret_cast<T const*>(pos_), count, owner_);
+        pos_ += count * sizeof(T);
+    }
+
+private:
+    void align()
+    {
+        std::size_t offset = pos_ - begin_;
+        need((8 - (offset & 7)) & 7);
+        pos_ += (8 - (offset & 7)) & 7;
+    }
+
+    void need(std::size_t size) const
+    {
+        if (static_cast<std::size_t>(end_ - pos_) < size)
+            throw std::runtime_error("snapshot is truncated");
+    }
+
+    void read_raw(void* out, std::size_t size)
+    {
+        need(size);
+        std::memcpy(out, pos_, size);
+        pos_ += size;
+    }
+
+    char const* begin_;
+    char const* pos_;
+    char const* end_;
+    boost::shared_ptr<void const> owner_;
+};
+
+#endif // __NODE_MAPNIK_MEMORY_SNAPSHOT_H__
@@ -0,0 +1,199 @@
+#ifndef __NODE_MAPNIK_PACKED_RTREE_H__
+#define __NODE_MAPNIK_PACKED_RTREE_H__
+
+// mapnik
+#include <mapnik/box2d.hpp>
+
+// stl
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#include "memory_snapshot.hpp"
+
+// Static bulk-loaded R-tree. Items are sorted along a Hilbert curve through
+// their box centers, then packed bottom-up into nodes of node_size entries,
+// so the tree is perfectly balanced and stored in a few flat arrays:
+//
+//   boxes_    the item boxes in Hilbert order, followed by every level of
+//             node boxes up to the root
+//   indices_  for an item, its position in the caller's array; for a node,
+//             the position of its first child in boxes_
+//
+// The tree cannot be modified after build(); callers collect new items
+// elsewhere and rebuild in batches. A tree read from a snapshot is used in
+// place, without rebuilding.
+
+class packed_rtree
+{
+public:
+    enum { node_size = 16 };
+
+    packed_rtree()
+        : num_items_(0) {}
+
+    std::size_t size() const { return num_items_; }
+
+    void clear()
+    {
+        num_items_ = 0;
+        boxes_.clear();
+        indices_.clear();
+        level_bounds_.clear();
+    }
+
+    void swap(packed_rtree& other)
+    {
+        std::swap(num_items_, other.num_items_);
+        boxes_.swap(other.boxes_);
+        indices_.swap(other.indices_);
+        level_bounds_.swap(other.level_bounds_);
+    }
+
+    // Items is any array of box2d<double>.
+    template <typename Items>
+    void build(Items const& items)
+    {
+        clear();
+        num_items_ = items.size();
+        if (num_items_ == 0)
+            return;
+
+        mapnik::box2d<double> extent = items[0];
+        for (std::size_t i = 1; i < num_items_; ++i)
+            extent.expand_to_include(items[i]);
+
+        double width = extent.width();
+        double height = extent.height();
+        double sx = width > 0 ? 65535.0 / width : 0;
+        double sy = height > 0 ? 65535.0 / height : 0;
+
+        std::vector<std::pair<uint32_t, uint32_t> > order(num_items_);
+        for (std::size_t i = 0; i < num_items_; ++i)
+        {
+            mapnik::box2d<double> const& b = items[i];
+            uint32_t hx = static_cast<uint32_t>(((b.minx() + b.maxx()) / 2 - extent.minx()) * sx);
+            uint32_t hy = static_cast<uint32_t>(((b.miny() + b.maxy()) / 2 - extent.miny()) * sy);
+            order[i] = std::make_pair(hilbert(hx, hy), static_cast<uint32_t>(i));
+        }
+        std::sort(order.begin(), order.end());
+
+        // count the nodes of all levels up front
+        uint64_t n = num_items_;
+        uint64_t num_nodes = n;
+        level_bounds_.push_back(n);
+        do
+        {
+            n = (n + node_size - 1) / node_size;
+            num_nodes += n;
+            level_bounds_.push_back(num_nodes);
+        }
+        while (n > 1);
+
+        boxes_.reserve(num_nodes);
+        indices_.reserve(num_nodes);
+        for (std::size_t i = 0; i < num_items_; ++i)
+        {
+            boxes_.push_back(items[order[i].second]);
+            indices_.push_back(order[i].second);
+        }
+
+        std::size_t pos = 0;
+        for (std::size_t level = 0; level + 1 < level_bounds_.size(); ++level)
+        {
+            std::size_t end = level_bounds_[level];
+            while (pos < end)
+            {
+                std::size_t first = pos;
+                mapnik::box2d<double> node = boxes_[pos++];
+                for (unsigned j = 1; j < node_size && pos < end; ++j)
+                    node.expand_to_include(boxes_[pos++]);
+                boxes_.push_back(node);
+                indices_.push_back(static_cast<uint32_t>(first));
+            }
+        }
+    }
+
+    // Appends the positions of the items intersecting box to result, in
+    // no particular order.
+    void query(mapnik::box2d<double> const& box, std::vector<uint32_t>& result) const
+    {
+        if (num_items_ == 0)
+            return;
+
+        std::vector<std::pair<std::size_t, std::size_t> > stack;
+        std::size_t node = boxes_.size() - 1;
+        std::size_t level = level_bounds_.size() - 1;
+        for (;;)
+        {
+            // the children of a node are the node_size entries from its
+            // first child, without running into the next level
+            std::size_t end = std::min<std::size_t>(node + node_size, level_bounds_[level]);
+            for (std::size_t pos = node; pos < end; ++pos)
+            {
+                if (!box.intersects(boxes_[pos]))
+                    continue;
+                if (pos < num_items_)
+                    result.push_back(indices_[pos]);
+                else
+                    stack.push_back(std::make_pair(indices_[pos], level - 1));
+            }
+            if (stack.empty())
+                break;
+            node = stack.back().first;
+            level = stack.back().second;
+            stack.pop_back();
+        }
+    }
+
+    void write(snapshot_writer& out) const
+    {
+        out.write_u64(num_items_);
+        out.write_array(boxes_);
+        out.write_array(indices_);
+        out.write_array(level_bounds_);
+    }
+
+    void read(snapshot_reader& in)
+    {
+        num_items_ = in.read_u64();
+        in.read_array(boxes_);
+        in.read_array(indices_);
+        in.read_array(level_bounds_);
+        if (num_items_ > 0 &&
+            (level_bounds_.empty() || level_bounds_[0] != num_items_ ||
+             boxes_.size() != level_bounds_.back() || indices_.size() != boxes_.size()))
+            throw std::runtime_error("snapshot has an invalid spatial index");
+    }
+
+private:
+    // position of (x, y) along a Hilbert curve filling a 65536 x 65536 grid
+    static uint32_t hilbert(uint32_t x, uint32_t y)
+    {
+        uint32_t d = 0;
+        for (uint32_t s = 1 << 15; s > 0; s >>= 1)
+        {
+            uint32_t rx = (x & s) ? 1 : 0;
+            uint32_t ry = (y & s) ? 1 : 0;
+            d += s * s * ((3 * rx) ^ ry);
+            if (ry == 0)
+            {
+                if (rx == 1)
+                {
+                    x = 0xffff - x;
+                    y = 0xffff - y;
+                }
+                std::swap(x, y);
+            }
+        }
+        return d;
+    }
+
+    std::size_t num_items_;
+    mappable_vector<mapnik::box2d<double> > boxes_;
+    mappable_vector<uint32_t> indices_;
+    mappable_vector<uint64_t> level_bounds_;
+};
+
+#endif // __NODE_MAPNIK_PACKED_RTREE_H__
@@ -0,0 +1,276 @@
+#include "projection_batch.hpp"
+
+// stl
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+const double earth_radius = 6378137;
+const double deg_to_rad = M_PI / 180;
+const double rad_to_deg = 180 / M_PI;
+// how close to a pole, in radians, proj4's merc gives up
+const double pole_epsilon = 1e-10;
+// x of the antimeridian in spherical mercator
+const double max_mercator_x = M_PI * earth_radius;
+// where web maps cut mercator off, so the world is as tall as it is wide
+const double max_mercator_lat = 85.0511287798066;
+
+typedef std::map<std::string, std::string> proj_args;
+
+// "+proj=merc +a=6378137 +no_defs" -> {proj: merc, a: 6378137, no_defs: ""}
+void parse_proj(std::string const& params, proj_args& args)
+{
+    std::istringstream s(params);
+    std::string token;
+    while (s >> token)
+    {
+        if (token[0] == '+')
+            token.erase(0, 1);
+        std::string::size_type eq = token.find('=');
+        if (eq == std::string::npos)
+            args[token] = "";
+        else
+            args[token.substr(0, eq)] = token.substr(eq + 1);
+    }
+}
+
+// whether args has key with the number value, or lacks it and value is
+// the default
+bool has_number(proj_args const& args, const char* key, double value, bool is_default)
+{
+    proj_args::const_iterator it = args.find(key);
+    if (it == args.end())
+        return is_default;
+    char* end = 0;
+    double v = std::strtod(it->second.c_str(), &end);
+    return end != it->second.c_str() && *end == '\0' && v == value;
+}
+
+// x, y of the points along the edges of box, counterclockwise from its
+// lower left corner
+void edge_points(mapnik::box2d<double> const& box, unsigned densify, std::vector<double>& xy)
+{
+    double corners[5][2] = {
+        { box.minx(), box.miny() },
+        { box.maxx(), box.miny() },
+        { box.maxx(), box.maxy() },
+        { box.minx(), box.maxy() },
+        { box.minx(), box.miny() }
+    };
+    unsigned steps = densify + 1;
+    xy.clear();
+    xy.reserve(8 * steps);
+    for (unsigned edge = 0; edge < 4; ++edge)
+    {
+        double x0 = corners[edge][0];
+        double y0 = corners[edge][1];
+        double dx = corners[edge + 1][0] - x0;
+        double dy = corners[edge + 1][1] - y0;
+        for (unsigned i = 0; i < steps; ++i)
+        {
+            xy.push_back(x0 + dx * i / steps);
+            xy.push_back(y0 + dy * i / steps);
+        }
+    }
+}
+
+// the extent of the finite points in xy, where ok; false if there are none
+bool points_extent(std::vector<double> const& xy, std::vector<bool> const& ok,
+                   mapnik::box2d<double>& box)
+{
+    bool found = false;
+    double minx = 0, miny = 0, maxx = 0, maxy = 0;
+    for (std::size_t i = 0; i < ok.size(); ++i)
+    {
+        double x = xy[2 * i];
+        double y = xy[2 * i + 1];
+        // proj4 reports some failures as HUGE_VAL
+        if (!ok[i] || !(std::fabs(x) < HUGE_VAL) || !(std::fabs(y) < HUGE_VAL))
+            continue;
+        if (!found)
+        {
+            minx = maxx = x;
+            miny = maxy = y;
+            found = true;
+        }
+        else
+        {
+            minx = std::min(minx, x);
+            miny = std::min(miny, y);
+            maxx = std::max(maxx, x);
+            maxy = std::max(maxy, y);
+        }
+    }
+    if (found)
+        box.init(minx, miny, maxx, maxy);
+    return found;
+}
+
+// whether proj is a mercator projection, which cannot project the poles
+bool is_mercator(mapnik::projection const& proj)
+{
+    proj_args args;
+    parse_proj(proj.params(), args);
+    proj_args::const_iterator it = args.find("proj");
+    if (it != args.end())
+        return it->second == "merc";
+    it = args.find("init");
+    return it != args.end() &&
+        (it->second == "epsg:3857" || it->second == "epsg:3785" || it->second == "epsg:900913");
+}
+
+// Cuts the latitudes of box, in degrees, to the ones mercator covers. A
+// box reaching a pole then keeps the full height of the map, rather than
+// ending at the last of its edge samples mercator can project.
+void clamp_mercator_lat(mapnik::box2d<double>& box)
+{
+    double miny = std::max(box.miny(), -max_mercator_lat);
+    double maxy = std::min(box.maxy(), max_mercator_lat);
+    if (miny <= maxy)
+        box.init(box.minx(), miny, box.maxx(), maxy);
+}
+
+bool transform_box(mapnik::proj_transform const& prj_trans, bool forward,
+                   mapnik::box2d<double>& box, unsigned densify)
+{
+    mapnik::projection const& from = forward ? prj_trans.source() : prj_trans.dest();
+    mapnik::projection const& to = forward ? prj_trans.dest() : prj_trans.source();
+    if (from.is_geographic() && is_mercator(to))
+        clamp_mercator_lat(box);
+
+    std::vector<double> xy;
+    edge_points(box, densify, xy);
+    std::vector<bool> ok(xy.size() / 2);
+    for (std::size_t i = 0; i < ok.size(); ++i)
+    {
+        double z = 0;
+        ok[i] = forward ? prj_trans.forward(xy[2 * i], xy[2 * i + 1], z)
+                        : prj_trans.backward(xy[2 * i], xy[2 * i + 1], z);
+    }
+    return points_extent(xy, ok, box);
+}
+
+} // namespace
+
+bool is_spherical_mercator(std::string const& params)
+{
+    proj_args args;
+    parse_proj(params, args);
+
+    proj_args::const_iterator proj = args.find("proj");
+    if (proj == args.end() || proj->second != "merc")
+        return false;
+    proj_args::const_iterator units = args.find("units");
+    if (units != args.end() && units->second != "m")
+        return false;
+    // an ellipsoid, or anything else that changes the result
+    static const char* other[] = { "ellps", "datum", "R", "rf", "f", "es", "e",
+                                   "towgs84", "lat_0", "to_meter", "geoc", "axis",
+                                   "pm", "init" };
+    for (unsigned i = 0; i < sizeof(other) / sizeof(other[0]); ++i)
+        if (args.find(other[i]) != args.end())
+            return false;
+    return has_number(args, "a", earth_radius, false) &&
+           has_number(args, "b", earth_radius, false) &&
+           has_number(args, "lat_ts", 0, true) &&
+           has_number(args, "lon_0", 0, true) &&
+           has_number(args, "x_0", 0, true) &&
+           has_number(args, "y_0", 0, true) &&
+           has_number(args, "k", 1, true) &&
+           has_number(args, "k_0", 1, true);
+}
+
+void forward_many(mapnik::projection const& proj, bool merc, double* xy, std::size_t count)
+{
+    if (merc)
+    {
+        // a scalar loop; it skips proj4's per point overhead, but sin()
+        // and log() are library calls the compiler does not vectorize
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            double lon = xy[2 * i];
+            // proj4 wraps longitudes past the antimeridian, unless the
+            // projection has +over, so it does those
+            if (!(std::fabs(lon) <= 180))
+            {
+                proj.forward(xy[2 * i], xy[2 * i + 1]);
+                continue;
+            }
+            double lat = xy[2 * i + 1] * deg_to_rad;
+            // the poles are infinitely far, proj4 fails them and the
+            // latitudes past them with HUGE_VAL
+            if (std::fabs(lat) >= M_PI / 2 - pole_epsilon)
+            {
+                xy[2 * i] = HUGE_VAL;
+                xy[2 * i + 1] = HUGE_VAL;
+                continue;
+            }
+            double sin_lat = std::sin(lat);
+            xy[2 * i] = lon * deg_to_rad * earth_radius;
+            xy[2 * i + 1] = 0.5 * std::log((1 + sin_lat) / (1 - sin_lat)) * earth_radius;
+        }
+        return;
+    }
+    for (std::size_t i = 0; i < count; ++i)
+        proj.forward(xy[2 * i], xy[2 * i + 1]);
+}
+
+void inverse_many(mapnik::projection const& proj, bool merc, double* xy, std::size_t count)
+{
+    if (merc)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            double x = xy[2 * i];
+            double y = xy[2 * i + 1];
+            // past the antimeridian, left to proj4 as above
+            if (!(std::fabs(x) <= max_mercator_x))
+            {
+                proj.inverse(xy[2 * i], xy[2 * i + 1]);
+                continue;
+            }
+            xy[2 * i] = x / earth_radius * rad_to_deg;
+            xy[2 * i + 1] = (2 * std::atan(std::exp(y / earth_radius)) - M_PI / 2) * rad_to_deg;
+        }
+        return;
+    }
+    for (std::size_t i = 0; i < count; ++i)
+        proj.inverse(xy[2 * i], xy[2 * i + 1]);
+}
+
+bool forward_box(mapnik::projection const& proj, bool merc,
+                 mapnik::box2d<double>& box, unsigned densify)
+{
+    if (merc || is_mercator(proj))
+        clamp_mercator_lat(box);
+    std::vector<double> xy;
+    edge_points(box, densify, xy);
+    forward_many(proj, merc, &xy[0], xy.size() / 2);
+    return points_extent(xy, std::vector<bool>(xy.size() / 2, true), box);
+}
+
+bool inverse_box(mapnik::projection const& proj, bool merc,
+                 mapnik::box2d<double>& box, unsigned densify)
+{
+    std::vector<double> xy;
+    edge_points(box, densify, xy);
+    inverse_many(proj, merc, &xy[0], xy.size() / 2);
+    return points_extent(xy, std::vector<bool>(xy.size() / 2, true), box);
+}
+
+bool forward_box(mapnik::proj_transform const& prj_trans,
+                 mapnik::box2d<double>& box, unsigned densify)
+{
+    return transform_box(prj_trans, true, box, densify);
+}
+
+bool backward_box(mapnik::proj_transform const& prj_trans,
+                  mapnik::box2d<double>& box, unsigned densify)
+{
+    return transform_box(prj_trans, false, box, densify);
+}
@@ -0,0 +1,59 @@
+#ifndef __NODE_MAPNIK_PROJECTION_BATCH_H__
+#define __NODE_MAPNIK_PROJECTION_BATCH_H__
+
+// mapnik
+#include <mapnik/box2d.hpp>
+#include <mapnik/projection.hpp>
+#include <mapnik/proj_transform.hpp>
+
+// stl
+#include <cstddef>
+#include <string>
+
+// Projects whole coordinate buffers at once. None of these touch V8, so
+// they can run on the thread pool.
+
+// Whether the proj4 string params is spherical mercator as used by web
+// maps, eg "+proj=merc +a=6378137 +b=6378137 +lat_ts=0.0 +lon_0=0.0
+// +x_0=0.0 +y_0=0 +k=1.0 +units=m +nadgrids=@null +wktext +no_defs": a
+// mercator projection on a sphere of radius 6378137 without offsets. Such
+// projections are done in closed form instead of through proj4, except
+// for points past the antimeridian, which proj4 wraps unless the
+// projection has +over.
+bool is_spherical_mercator(std::string const& params);
+
+// Projects the count x, y pairs interleaved in xy from longitude and
+// latitude in degrees, in place, like mapnik::projection::forward does
+// point by point. Points that cannot be projected, like the poles in
+// mercator, are set to HUGE_VAL as proj4 does.
+void forward_many(mapnik::projection const& proj, bool merc, double* xy, std::size_t count);
+
+// The reverse of forward_many.
+void inverse_many(mapnik::projection const& proj, bool merc, double* xy, std::size_t count);
+
+// Boxes are projected by sampling their edges, densify points between
+// each pair of corners, and taking the extent of the projected samples, so
+// the result contains the whole projected box for transforms that curve
+// its edges. Longitude and latitude boxes going to mercator are cut to
+// +-85.0511 degrees first, the extent of web maps, so boxes reaching the
+// poles cover the full height of the map. Other samples that cannot be
+// projected are left out; the functions return false if none can. Boxes
+// across a pole or the antimeridian of the target are not split.
+
+// The default number of samples between corners, enough for the curves of
+// common transforms to stay within a few meters of the edges.
+const unsigned default_densify = 20;
+
+bool forward_box(mapnik::projection const& proj, bool merc,
+                 mapnik::box2d<double>& box, unsigned densify = default_densify);
+bool inverse_box(mapnik::projection const& proj, bool merc,
+                 mapnik::box2d<double>& box, unsigned densify = default_densify);
+
+// the same for a box in the source srs of prj_trans, or, backward_box, in
+// its destination srs
+bool forward_box(mapnik::proj_transform const& prj_trans,
+                 mapnik::box2d<double>& box, unsigned densify = default_densify);
+bool backward_box(mapnik::proj_transform const& prj_trans,
+                  mapnik::box2d<double>& box, unsigned densify = default_densify);
+
+#endif // __NODE_MAPNIK_PROJECTION_BATCH_H__
@@ -0,0 +1,140 @@
+#include "projection_cache.hpp"
+
+// boost
+#include <boost/thread/mutex.hpp>
+
+// stl
+#include <map>
+#include <vector>
+
+namespace {
+
+// idle objects kept per key, about one per thread pool thread
+const std::size_t max_idle = 16;
+
+// source and dest are initialized before the transform that refers to them
+struct transform_holder
+{
+    transform_holder(std::string const& s, std::string const& d)
+        : source(s),
+          dest(d),
+          transform(source, dest) {}
+
+    mapnik::projection source;
+    mapnik::projection dest;
+    mapnik::proj_transform transform;
+};
+
+template <typename T>
+class object_pool
+{
+public:
+    object_pool()
+        : mutex_(), idle_(), hits_(0), misses_(0) {}
+
+    // an idle object for key, or null after counting a miss
+    T* take(std::string const& key)
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        typename idle_map::iterator it = idle_.find(key);
+        if (it == idle_.end() || it->second.empty())
+        {
+            ++misses_;
+            return 0;
+        }
+        ++hits_;
+        T* obj = it->second.back();
+        it->second.pop_back();
+        return obj;
+    }
+
+    void give_back(std::string const& key, T* obj)
+    {
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            std::vector<T*>& objs = idle_[key];
+            if (objs.size() < max_idle)
+            {
+                objs.push_back(obj);
+                return;
+            }
+        }
+        delete obj;
+    }
+
+    void stats(projection_cache_stats& s)
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        s.hits = hits_;
+        s.misses = misses_;
+        s.idle = 0;
+        typename idle_map::const_iterator it = idle_.begin();
+        for (; it != idle_.end(); ++it)
+            s.idle += it->second.size();
+    }
+
+private:
+    typedef std::map<std::string, std::vector<T*> > idle_map;
+    boost::mutex mutex_;
+    idle_map idle_;
+    unsigned long hits_;
+    unsigned long misses_;
+};
+
+// never destroyed, pointers may be released while statics are torn down
+object_pool<mapnik::projection>& projection_pool()
+{
+    static object_pool<mapnik::projection>* pool = new object_pool<mapnik::projection>();
+    return *pool;
+}
+
+object_pool<transform_holder>& transform_pool()
+{
+    static object_pool<transform_holder>* pool = new object_pool<transform_holder>();
+    return *pool;
+}
+
+template <typename T>
+struct return_to_pool
+{
+    return_to_pool(object_pool<T>& pool, std::string const& key)
+        : pool_(&pool), key_(key) {}
+
+    void operator()(T* obj) const
+    {
+        pool_->give_back(key_, obj);
+    }
+
+    object_pool<T>* pool_;
+    std::string key_;
+};
+
+} // namespace
+
+boost::shared_ptr<mapnik::projection> acquire_projection(std::string const& params)
+{
+    object_pool<mapnik::projection>& pool = projection_pool();
+    mapnik::projection* proj = pool.take(params);
+    if (!proj)
+        proj = new mapnik::projection(params);
+    return boost::shared_ptr<mapnik::projection>(proj, return_to_pool<mapnik::projection>(pool, params));
+}
+
+boost::shared_ptr<mapnik::proj_transform> acquire_transform(std::string const& source,
+                                                            std::string const& dest)
+{
+    // proj4 strings hold no newlines
+    std::string key = source + "\n" + dest;
+    object_pool<transform_holder>& pool = transform_pool();
+    transform_holder* holder = pool.take(key);
+    if (!holder)
+        holder = new transform_holder(source, dest);
+    boost::shared_ptr<transform_holder> owner(holder, return_to_pool<transform_holder>(pool, key));
+    return boost::shared_ptr<mapnik::proj_transform>(owner, &owner->transform);
+}
+
+void projection_stats(projection_cache_stats& projections, projection_cache_stats& transforms)
+{
+    projection_pool().stats(projections);
+    transform_pool().stats(transforms);
+}
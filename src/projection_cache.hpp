@@ -0,0 +1,39 @@
+#ifndef __NODE_MAPNIK_PROJECTION_CACHE_H__
+#define __NODE_MAPNIK_PROJECTION_CACHE_H__
+
+// mapnik
+#include <mapnik/projection.hpp>
+#include <mapnik/proj_transform.hpp>
+
+// boost
+#include <boost/shared_ptr.hpp>
+
+// stl
+#include <string>
+
+// Pools of initialized projections and transforms, keyed by their proj4
+// strings, so rendering and mapnik.Projection do not parse and initialize
+// proj4 definitions over and over.
+//
+// proj4 objects cannot be used by two threads at once, so an object is
+// never shared: each call hands out one nobody else holds, and it goes back
+// to its pool once the last copy of the pointer is released.
+
+boost::shared_ptr<mapnik::projection> acquire_projection(std::string const& params);
+
+// A transform from source to dest, which owns both of its projections.
+boost::shared_ptr<mapnik::proj_transform> acquire_transform(std::string const& source,
+                                                            std::string const& dest);
+
+struct projection_cache_stats
+{
+    // objects handed out from a pool and newly initialized
+    unsigned long hits;
+    unsigned long misses;
+    // objects waiting in the pools
+    unsigned idle;
+};
+
+void projection_stats(projection_cache_stats& projections, projection_cache_stats& transforms);
+
+#endif // __NODE_MAPNIK_PROJECTION_CACHE_H__
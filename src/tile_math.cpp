@@ -0,0 +1,193 @@
+#include "tile_math.hpp"
+
+// stl
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const double earth_radius = 6378137;
+// half the width of the world in meters
+const double origin_shift = M_PI * earth_radius;
+const double deg_to_rad = M_PI / 180;
+const double tile_size = 256;
+
+// longitude, latitude in degrees to pixels at zoom z, rounded like
+// SphericalMercator.ll_to_px
+void ll_to_px(double lon, double lat, unsigned z, double& px, double& py)
+{
+    double size = tile_size * std::pow(2.0, static_cast<double>(z));
+    double half = size / 2;
+    double f = std::min(std::max(std::sin(lat * deg_to_rad), -0.9999), 0.9999);
+    px = std::floor(half + lon * size / 360 + 0.5);
+    py = std::floor(half - 0.5 * std::log((1 + f) / (1 - f)) * size / (2 * M_PI) + 0.5);
+}
+
+uint32_t clamp_tile(double t, uint32_t last)
+{
+    if (!(t > 0))
+        return 0;
+    if (t > last)
+        return last;
+    return static_cast<uint32_t>(t);
+}
+
+// x, y of position d on the Hilbert curve filling a square of the given
+// side, a power of two
+void hilbert_xy(uint32_t side, uint64_t d, uint32_t& x, uint32_t& y)
+{
+    x = 0;
+    y = 0;
+    for (uint32_t s = 1; s < side; s *= 2)
+    {
+        uint32_t rx = static_cast<uint32_t>(1 & (d / 2));
+        uint32_t ry = static_cast<uint32_t>(1 & (d ^ rx));
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+        x += s * rx;
+        y += s * ry;
+        d /= 4;
+    }
+}
+
+} // namespace
+
+void xyz_to_envelope(double x, double y, unsigned z, bool tms, double* box)
+{
+    double tiles = std::pow(2.0, static_cast<double>(z));
+    if (tms)
+        y = tiles - 1 - y;
+    double width = 2 * origin_shift / tiles;
+    box[0] = x * width - origin_shift;
+    box[1] = origin_shift - (y + 1) * width;
+    box[2] = (x + 1) * width - origin_shift;
+    box[3] = origin_shift - y * width;
+}
+
+tile_range bbox_to_tile_range(mapnik::box2d<double> const& bbox, unsigned z, bool tms)
+{
+    double x0, y0, x1, y1;
+    ll_to_px(bbox.minx(), bbox.miny(), z, x0, y0);
+    ll_to_px(bbox.maxx(), bbox.maxy(), z, x1, y1);
+    uint32_t last = (static_cast<uint32_t>(1) << z) - 1;
+
+    tile_range r;
+    r.z = z;
+    r.minx = clamp_tile(std::floor(x0 / tile_size), last);
+    r.miny = clamp_tile(std::floor(y1 / tile_size), last);
+    // the pixel at the upper right is not in the bbox, unless it is all
+    // there is to it
+    r.maxx = std::max(r.minx, clamp_tile(std::floor((x1 - 1) / tile_size), last));
+    r.maxy = std::max(r.miny, clamp_tile(std::floor((y0 - 1) / tile_size), last));
+    if (tms)
+    {
+        uint32_t miny = last - r.maxy;
+        r.maxy = last - r.miny;
+        r.miny = miny;
+    }
+    return r;
+}
+
+tile_enumerator::tile_enumerator(mapnik::box2d<double> const& bbox, unsigned zmin, unsigned zmax,
+                                 bool tms, bool hilbert)
+    : ranges_(),
+      hilbert_(hilbert),
+      range_(0),
+      d_(0),
+      end_(0),
+      side_(0)
+{
+    for (unsigned z = zmin; z <= zmax; ++z)
+        ranges_.push_back(bbox_to_tile_range(bbox, z, tms));
+    start_zoom();
+}
+
+void tile_enumerator::start_zoom()
+{
+    d_ = 0;
+    if (range_ >= ranges_.size())
+    {
+        end_ = 0;
+        return;
+    }
+    tile_range const& r = ranges_[range_];
+    uint64_t width = r.maxx - r.minx + 1;
+    uint64_t height = r.maxy - r.miny + 1;
+    if (hilbert_)
+    {
+        side_ = 1;
+        while (side_ < width || side_ < height)
+            side_ *= 2;
+        end_ = static_cast<uint64_t>(side_) * side_;
+    }
+    else
+    {
+        end_ = width * height;
+    }
+}
+
+std::size_t tile_enumerator::next(std::vector<uint32_t>& xyz, std::size_t max)
+{
+    std::size_t n = 0;
+    while (n < max && range_ < ranges_.size())
+    {
+        if (d_ >= end_)
+        {
+            ++range_;
+            start_zoom();
+            continue;
+        }
+        tile_range const& r = ranges_[range_];
+        uint32_t width = r.maxx - r.minx + 1;
+        uint32_t height = r.maxy - r.miny + 1;
+        uint32_t x, y;
+        if (hilbert_)
+        {
+            hilbert_xy(side_, d_, x, y);
+            if (x >= width || y >= height)
+            {
+                // the 4^k positions from a multiple of 4^k fill an aligned
+                // square of side 2^k, skip the largest one off the range
+                uint64_t skip = 1;
+                uint32_t s = 1;
+                while (s < side_ && d_ % (skip * 4) == 0)
+                {
+                    uint32_t mask = ~(2 * s - 1);
+                    if ((x & mask) < width && (y & mask) < height)
+                        break;
+                    skip *= 4;
+                    s *= 2;
+                }
+                d_ += skip;
+                continue;
+            }
+        }
+        else
+        {
+            x = static_cast<uint32_t>(d_ % width);
+            y = static_cast<uint32_t>(d_ / width);
+        }
+        ++d_;
+        xyz.push_back(r.minx + x);
+        xyz.push_back(r.miny + y);
+        xyz.push_back(r.z);
+        ++n;
+    }
+    return n;
+}
+
+double tile_enumerator::count() const
+{
+    double total = 0;
+    for (std::size_t i = 0; i < ranges_.size(); ++i)
+        total += static_cast<double>(ranges_[i].maxx - ranges_[i].minx + 1) *
+                 (ranges_[i].maxy - ranges_[i].miny + 1);
+    return total;
+}
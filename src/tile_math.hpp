@@ -0,0 +1,64 @@
+#ifndef __NODE_MAPNIK_TILE_MATH_H__
+#define __NODE_MAPNIK_TILE_MATH_H__
+
+// mapnik
+#include <mapnik/box2d.hpp>
+
+// stl
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+
+// Tile math for the spherical mercator tiles of web maps. None of these
+// touch V8, so they can run on the thread pool.
+
+// tile x and y fit 32 bit integers up to here
+const unsigned max_tile_zoom = 30;
+
+// The extent of tile x, y at zoom z in spherical mercator meters, as minx,
+// miny, maxx, maxy into box. tms counts rows from the south instead of
+// from the north.
+void xyz_to_envelope(double x, double y, unsigned z, bool tms, double* box);
+
+struct tile_range
+{
+    unsigned z;
+    uint32_t minx;
+    uint32_t miny;
+    uint32_t maxx;
+    uint32_t maxy;
+};
+
+// The tiles at zoom z covering bbox, in longitude and latitude, rounded to
+// pixels of 256 pixel tiles the way lib/sphericalmercator.js does.
+tile_range bbox_to_tile_range(mapnik::box2d<double> const& bbox, unsigned z, bool tms);
+
+// Enumerates the tiles covering a bbox from zoom zmin to zmax, a zoom at a
+// time, in pages. The tiles of a zoom go row by row, or along a Hilbert
+// curve, which keeps tiles that follow each other close together.
+class tile_enumerator
+{
+public:
+    tile_enumerator(mapnik::box2d<double> const& bbox, unsigned zmin, unsigned zmax,
+                    bool tms, bool hilbert);
+
+    // Appends up to max tiles to xyz as x, y, z triples; returns how many,
+    // 0 once all are done.
+    std::size_t next(std::vector<uint32_t>& xyz, std::size_t max);
+
+    // how many tiles there are in all
+    double count() const;
+
+private:
+    void start_zoom();
+    std::vector<tile_range> ranges_;
+    bool hilbert_;
+    std::size_t range_;
+    // position on the curve, or in the rows, of the current zoom
+    uint64_t d_;
+    uint64_t end_;
+    // the side of the square the curve fills
+    uint32_t side_;
+};
+
+#endif // __NODE_MAPNIK_TILE_MATH_H__
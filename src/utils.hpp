@@ -6,9 +6,13 @@
 
 // node
 #include <node.h>
+#include <node_version.h>
 
 // stl
+#include <cstring>
 #include <string>
+#include <vector>
+#include <stdint.h>
 
 // core types
 #include <mapnik/unicode.hpp>
@@ -31,6 +35,98 @@
 using namespace v8;
 using namespace node;
 
+template <typename T>
+static inline void copy_external_array(void* data, int length, std::vector<double>& out)
+{
+    T const* p = static_cast<T const*>(data);
+    out.assign(p, p + length);
+}
+
+// Copies a numeric array into out. Typed arrays are read straight from
+// their backing store; anything else with a length is read element by
+// element. integral is set when the values came from an integer typed
+// array. Returns false if value is not an array.
+static inline bool read_number_array(Local<Value> value, std::vector<double>& out, bool& integral)
+{
+    integral = false;
+    if (!value->IsObject())
+        return false;
+    Local<Object> obj = value->ToObject();
+    if (obj->HasIndexedPropertiesInExternalArrayData())
+    {
+        void* data = obj->GetIndexedPropertiesExternalArrayData();
+        int length = obj->GetIndexedPropertiesExternalArrayDataLength();
+        integral = true;
+        switch (obj->GetIndexedPropertiesExternalArrayDataType())
+        {
+        case kExternalByteArray:
+            copy_external_array<int8_t>(data, length, out);
+            return true;
+        case kExternalUnsignedByteArray:
+            copy_external_array<uint8_t>(data, length, out);
+            return true;
+        case kExternalShortArray:
+            copy_external_array<int16_t>(data, length, out);
+            return true;
+        case kExternalUnsignedShortArray:
+            copy_external_array<uint16_t>(data, length, out);
+            return true;
+        case kExternalIntArray:
+            copy_external_array<int32_t>(data, length, out);
+            return true;
+        case kExternalUnsignedIntArray:
+            copy_external_array<uint32_t>(data, length, out);
+            return true;
+        case kExternalFloatArray:
+            integral = false;
+            copy_external_array<float>(data, length, out);
+            return true;
+#if NODE_VERSION_AT_LEAST(0,5,0)
+        case kExternalDoubleArray:
+            integral = false;
+            copy_external_array<double>(data, length, out);
+            return true;
+#endif
+        default:
+            integral = false;
+            break;
+        }
+    }
+    if (!obj->IsArray() && !obj->Has(String::NewSymbol("length")))
+        return false;
+    uint32_t length = obj->Get(String::NewSymbol("length"))->Uint32Value();
+    out.resize(length);
+    for (uint32_t i = 0; i < length; ++i)
+        out[i] = obj->Get(i)->NumberValue();
+    return true;
+}
+
+// A new typed array of the given type, eg "Float64Array", holding values.
+// Where the runtime has no typed arrays it falls back to a plain Array.
+template <typename T>
+static Local<Object> new_typed_array(const char* type, std::vector<T> const& values)
+{
+    uint32_t length = values.size();
+    Local<Value> ctor = Context::GetCurrent()->Global()->Get(String::NewSymbol(type));
+    if (ctor->IsFunction())
+    {
+        Local<Value> argv[1] = { Integer::NewFromUnsigned(length) };
+        Local<Object> a = Local<Function>::Cast(ctor)->NewInstance(1, argv);
+        if (!a.IsEmpty() &&
+            a->HasIndexedPropertiesInExternalArrayData() &&
+            static_cast<uint32_t>(a->GetIndexedPropertiesExternalArrayDataLength()) == length)
+        {
+            if (length > 0)
+                memcpy(a->GetIndexedPropertiesExternalArrayData(), &values[0], length * sizeof(T));
+            return a;
+        }
+    }
+    Local<Array> a = Array::New(length);
+    for (uint32_t i = 0; i < length; ++i)
+        a->Set(i, Number::New(values[i]));
+    return a;
+}
+
 // adapted to work for both mapnik features and mapnik parameters
 struct params_to_object : public boost::static_visitor<>
 {
@@ -0,0 +1,43 @@
+#ifndef __NODE_MAPNIK_WRITABLE_MEMORY_DATASOURCE_H__
+#define __NODE_MAPNIK_WRITABLE_MEMORY_DATASOURCE_H__
+
+// mapnik
+#include <mapnik/datasource.hpp>
+#include <mapnik/feature.hpp>
+#include <mapnik/params.hpp>
+
+// stl
+#include <string>
+#include <vector>
+
+// What mapnik.MemoryDatasource needs from the datasource it wraps, so the
+// js methods work the same whichever way the features are stored.
+// Implementations lock internally; all methods may be called while another
+// thread queries the datasource.
+
+class writable_memory_datasource : public mapnik::datasource
+{
+public:
+    explicit writable_memory_datasource(mapnik::parameters const& params)
+        : mapnik::datasource(params) {}
+
+    virtual ~writable_memory_datasource() {}
+
+    // features without geometries can never match a query and are dropped
+    virtual void push(mapnik::feature_ptr const& feature) = 0;
+    // adds many features under a single lock
+    virtual void push(std::vector<mapnik::feature_ptr> const& features) = 0;
+    // takes over the contents of features and drops the current ones;
+    // concurrent queries see either the old or the new features
+    virtual void replace(std::vector<mapnik::feature_ptr>& features) = 0;
+    // replaces the feature with the same id, or adds it if there is none;
+    // returns whether one was replaced
+    virtual bool update(mapnik::feature_ptr const& feature) = 0;
+    // returns false if there is no feature with that id
+    virtual bool remove(int id) = 0;
+    virtual void clear() = 0;
+    // writes a snapshot that mapnik.MemoryDatasource({file: path}) loads
+    virtual void save(std::string const& path) const = 0;
+};
+
+#endif // __NODE_MAPNIK_WRITABLE_MEMORY_DATASOURCE_H__
@@ -2,6 +2,7 @@ var mapnik = require('mapnik');
 var assert = require('assert');
 var fs = require('fs');
 var path = require('path');
+var helper = require('./support/helper');
 
 exports['test datasource creation'] = function() {
     assert.throws(function() { mapnik.Datasource('foo'); });
@@ -133,3 +134,442 @@ exports['test JSON datasource'] = function() {
         has_features: true
     });
 };
+
+exports['test memory datasource'] = function() {
+    var ds = new mapnik.MemoryDatasource({'extent': '-180,-90,180,90'});
+    assert.ok(ds);
+    for (var i = 0; i < 1000; ++i) {
+        ds.add({ 'x': (i % 100) - 50, 'y': Math.floor(i / 100) - 5, 'properties': { 'name': 'p' + i } });
+    }
+
+    // the first query indexes the features, features keep insertion order
+    var features = ds.features();
+    assert.equal(features.length, 1000);
+    assert.deepEqual(features[0], { name: 'p0', __id__: 1 });
+    assert.deepEqual(features[999], { name: 'p999', __id__: 1000 });
+
+    // features added after that are found as well
+    for (var i = 1000; i < 1010; ++i) {
+        ds.add({ 'x': 60, 'y': 60, 'properties': { 'name': 'p' + i } });
+    }
+    features = ds.features();
+    assert.equal(features.length, 1010);
+    assert.deepEqual(features[1009], { name: 'p1009', __id__: 1010 });
+
+    var desc = ds.describe();
+    assert.deepEqual(desc.extent, [-50, -5, 60, 60]);
+    assert.equal(desc.geometry_type, 'point');
+    assert.equal(desc.has_features, true);
+};
+
+exports['test memory datasource batch'] = function(beforeExit) {
+    var ds = new mapnik.MemoryDatasource({'extent': '-180,-90,180,90'});
+    var count = ds.addBatch({
+        x: [0, 10, 20],
+        y: [0, 5, 10],
+        columns: { name: ['a', 'b', null], speed: [1, 2.5, 3] }
+    });
+    assert.equal(count, 3);
+    var features = ds.features();
+    assert.equal(features.length, 3);
+    assert.deepEqual(features[0], { name: 'a', speed: 1, __id__: 1 });
+    assert.deepEqual(features[1], { name: 'b', speed: 2.5, __id__: 2 });
+    assert.deepEqual(features[2], { speed: 3, __id__: 3 });
+    assert.deepEqual(ds.describe().extent, [0, 0, 20, 10]);
+
+    assert.throws(function() { ds.addBatch({ x: [1, 2], y: [1] }); });
+    assert.throws(function() { ds.addBatch({ x: [1], y: [1], columns: { name: [] } }); });
+    assert.throws(function() { ds.addBatch({ x: [1], y: [1], ids: [1.5] }); });
+    assert.throws(function() { ds.addBatch({ x: [1], y: [1], ids: [Math.pow(2, 40)] }); });
+
+    if (typeof Float64Array !== 'undefined') {
+        var n = 1000;
+        var x = new Float64Array(n), y = new Float64Array(n), ids = new Uint32Array(n);
+        for (var i = 0; i < n; ++i) {
+            x[i] = i * 0.5;
+            y[i] = -i * 0.5;
+            ids[i] = 100 + i;
+        }
+        var called = false;
+        ds.addBatch({ x: x, y: y, ids: ids, columns: { rank: ids } }, function(err, added) {
+            called = true;
+            assert.ok(!err);
+            assert.equal(added, n);
+            var features = ds.features();
+            assert.equal(features.length, n + 3);
+            assert.deepEqual(features[n + 2], { rank: 100 + n - 1, __id__: 100 + n - 1 });
+
+            // add() numbers past the ids of the batch
+            ds.add({ x: 1, y: 1 });
+            var last = ds.features();
+            assert.equal(last.length, n + 4);
+            assert.equal(last[n + 3].__id__, 100 + n);
+        });
+        beforeExit(function() {
+            assert.ok(called);
+        });
+    }
+};
+
+exports['test memory datasource load'] = function(beforeExit) {
+    var ds = new mapnik.MemoryDatasource({'extent': '-180,-90,180,90'});
+    ds.add({ 'wkt': 'LINESTRING (0 0, 1 1)', 'properties': { 'name': 'line' } });
+    assert.throws(function() { ds.add({ 'wkt': 'LINESTRING (0 0' }); });
+    assert.throws(function() { ds.load('{}', { format: 'kml' }, function() {}); });
+
+    var geojson = JSON.stringify({
+        type: 'FeatureCollection',
+        features: [
+            { type: 'Feature', id: 7, properties: { name: 'square', area: 100 },
+              geometry: { type: 'Polygon', coordinates: [[[0, 0], [10, 0], [10, 10], [0, 10], [0, 0]]] } },
+            { type: 'Feature', properties: { name: 'two squares' },
+              geometry: { type: 'MultiPolygon', coordinates: [
+                  [[[20, 20], [30, 20], [30, 30], [20, 20]]],
+                  [[[40, 40], [50, 40], [50, 50], [40, 40]]]] } }
+        ]
+    });
+
+    var done = 0;
+    ds.load(new Buffer(geojson), { format: 'geojson' }, function(err, count) {
+        assert.ok(!err);
+        assert.equal(count, 2);
+        // replaces the line added before
+        var features = ds.features();
+        assert.equal(features.length, 2);
+        assert.deepEqual(features[0], { name: 'square', area: 100, __id__: 7 });
+        assert.deepEqual(features[1], { name: 'two squares', __id__: 1 });
+        var desc = ds.describe();
+        assert.deepEqual(desc.extent, [0, 0, 50, 50]);
+        assert.equal(desc.geometry_type, 'polygon');
+
+        ds.load('POINT (60 60)\nMULTIPOINT (70 70, 80 80)', { format: 'wkt', append: true }, function(err, count) {
+            assert.ok(!err);
+            assert.equal(count, 2);
+            assert.equal(ds.features().length, 4);
+            assert.deepEqual(ds.describe().extent, [0, 0, 80, 80]);
+
+            ds.load('{"type": "Feature", "geometry": ', function(err) {
+                assert.ok(err);
+                assert.ok(err.message.match(/GeoJSON parse error/));
+                // nothing changed
+                assert.equal(ds.features().length, 4);
+                done++;
+            });
+        });
+    });
+
+    beforeExit(function() {
+        assert.equal(done, 1);
+    });
+};
+
+exports['test memory datasource load ids'] = function(beforeExit) {
+    var ds = new mapnik.MemoryDatasource({'extent': '-180,-90,180,90'});
+    var geojson = JSON.stringify({
+        type: 'FeatureCollection',
+        features: [
+            { type: 'Feature', properties: {}, geometry: { type: 'Point', coordinates: [0, 0] } },
+            { type: 'Feature', id: 1, properties: {}, geometry: { type: 'Point', coordinates: [1, 1] } }
+        ]
+    });
+    var done = false;
+    ds.load(geojson, function(err, count) {
+        assert.ok(!err);
+        assert.equal(count, 2);
+        // features without an id are numbered around the given ones
+        assert.deepEqual(ds.features(), [{ __id__: 2 }, { __id__: 1 }]);
+        ds.add({ x: 2, y: 2 });
+        assert.equal(ds.features()[2].__id__, 3);
+        done = true;
+    });
+    // the ids of the load are not known yet
+    assert.throws(function() { ds.add({ x: 0, y: 0 }); });
+    assert.throws(function() { ds.load(geojson, function() {}); });
+
+    // nesting that would overflow the stack is refused
+    var deep = new Array(100001).join('[');
+    var refused = false;
+    new mapnik.MemoryDatasource({'extent': '-180,-90,180,90'}).load(
+        '{"type": "Point", "coordinates": ' + deep + '}', function(err) {
+            assert.ok(err.message.match(/nested too deeply/));
+            refused = true;
+        });
+
+    beforeExit(function() {
+        assert.ok(done);
+        assert.ok(refused);
+    });
+};
+
+exports['test columnar memory datasource'] = function() {
+    assert.throws(function() { new mapnik.MemoryDatasource({ schema: { name: 'blob' } }); });
+
+    var ds = new mapnik.MemoryDatasource({
+        'extent': '-180,-90,180,90',
+        'schema': { name: 'string', lanes: 'int', speed: 'double' }
+    });
+    for (var i = 0; i < 300; ++i) {
+        ds.add({ 'x': i % 30, 'y': Math.floor(i / 30),
+                 'properties': { 'name': i % 2 ? 'residential' : 'primary', 'lanes': i % 4, 'speed': i / 2, 'other': 1 } });
+    }
+    ds.add({ 'wkt': 'POLYGON ((40 0, 50 0, 50 10, 40 0))', 'properties': { 'lanes': 'many' } });
+    ds.add({ 'x': 1, 'y': 1, 'properties': { 'lanes': 1e10 } });
+    ds.add({ 'x': 1, 'y': 1, 'properties': { 'lanes': NaN } });
+
+    var desc = ds.describe();
+    assert.deepEqual(desc.fields, { name: 'String', lanes: 'Number', speed: 'Number' });
+    assert.deepEqual(desc.extent, [0, 0, 50, 10]);
+
+    // properties outside the schema are dropped, values that do not fit
+    // the column type are null
+    var features = ds.features();
+    assert.equal(features.length, 303);
+    assert.deepEqual(features[0], { name: 'primary', lanes: 0, speed: 0, __id__: 1 });
+    assert.deepEqual(features[3], { name: 'residential', lanes: 3, speed: 1.5, __id__: 4 });
+    assert.deepEqual(features[300], { __id__: 301 });
+    assert.deepEqual(features[301], { __id__: 302 });
+    assert.deepEqual(features[302], { __id__: 303 });
+};
+
+exports['test memory datasource properties'] = function() {
+    assert.throws(function() { new mapnik.MemoryDatasource({ 'extent': '-180,-90,180,90', 'properties': 'name' }); });
+    assert.throws(function() { new mapnik.MemoryDatasource({ 'extent': '-180,-90,180,90', 'properties': [1] }); });
+
+    // only the listed properties are kept
+    var ds = new mapnik.MemoryDatasource({ 'extent': '-180,-90,180,90', 'properties': ['name'] });
+    ds.add({ 'x': 0, 'y': 0, 'properties': { 'name': 'a', 'rank': 1, 'note': 'unused' } });
+    ds.addBatch({ 'x': [1], 'y': [1], 'columns': { 'name': ['b'], 'rank': [2] } });
+    assert.deepEqual(ds.features(), [{ name: 'a', __id__: 1 }, { name: 'b', __id__: 2 }]);
+    assert.equal(ds.parameters().properties, undefined);
+};
+
+exports['test memory datasource update and remove'] = function() {
+    var options = [
+        { 'extent': '-180,-90,180,90' },
+        { 'extent': '-180,-90,180,90', 'schema': { name: 'string' } }
+    ];
+    options.forEach(function(opts) {
+        var ds = new mapnik.MemoryDatasource(opts);
+        for (var i = 0; i < 1000; ++i) {
+            ds.add({ 'x': i % 100, 'y': Math.floor(i / 100), 'properties': { 'name': 'p' + i } });
+        }
+        assert.equal(ds.features().length, 1000);
+
+        // an updated feature keeps its id and is drawn last
+        assert.equal(ds.update(5, { 'x': 150, 'y': 50, 'properties': { 'name': 'moved' } }), true);
+        var features = ds.features();
+        assert.equal(features.length, 1000);
+        assert.deepEqual(features[999], { name: 'moved', __id__: 5 });
+        assert.deepEqual(ds.describe().extent, [0, 0, 150, 50]);
+
+        // updating a missing id adds the feature, add() does not reuse it
+        assert.equal(ds.update(2000, { 'wkt': 'POINT (1 1)' }), false);
+        ds.add({ 'x': 2, 'y': 2 });
+        features = ds.features();
+        assert.deepEqual(features[features.length - 1], { __id__: 2001 });
+
+        assert.equal(ds.remove(1), true);
+        assert.equal(ds.remove(1), false);
+        features = ds.features();
+        assert.equal(features.length, 1001);
+        assert.deepEqual(features[0], { name: 'p1', __id__: 2 });
+
+        // enough removals to compact the datasource
+        for (var id = 2; id <= 800; ++id) {
+            ds.remove(id);
+        }
+        features = ds.features();
+        assert.equal(features.length, 202);
+        assert.deepEqual(features[0], { name: 'p800', __id__: 801 });
+
+        assert.throws(function() { ds.update(3, { 'properties': {} }); });
+        assert.throws(function() { ds.remove('3'); });
+
+        ds.clear();
+        assert.equal(ds.features().length, 0);
+    });
+};
+
+exports['test js datasource batches'] = function() {
+    var calls = 0;
+    var next = function(id, options) {
+        ++calls;
+        if (calls == 1) {
+            return [{ 'x': 0, 'y': 0, 'properties': { 'name': 'a' } },
+                    { 'wkt': 'POINT (1 1)', 'properties': { 'name': 'b' } }];
+        } else if (calls == 2) {
+            assert.equal(id, 3);
+            var x = [2, 3, 4];
+            return { 'x': x, 'y': x, 'columns': { 'rank': [1, 2.5, 'c'] } };
+        } else if (calls == 3) {
+            return { 'x': 5, 'y': 5 };
+        }
+    };
+    var ds = new mapnik.JSDatasource({ 'extent': '-180,-90,180,90' }, next);
+    var map = new mapnik.Map(256, 256);
+    var layer = new mapnik.Layer('test');
+    layer.datasource = ds;
+    map.add_layer(layer);
+
+    var features = map.features(0);
+    assert.equal(calls, 4);
+    assert.equal(features.length, 6);
+    assert.deepEqual(features[1], { name: 'b', __id__: 2 });
+    assert.deepEqual(features[3], { rank: 2.5, __id__: 4 });
+    assert.deepEqual(features[4], { rank: 'c', __id__: 5 });
+    assert.deepEqual(features[5], { __id__: 6 });
+};
+
+exports['test memory datasource snapshot'] = function(beforeExit) {
+    var ds = new mapnik.MemoryDatasource({'extent': '-180,-90,180,90'});
+    for (var i = 0; i < 500; ++i) {
+        ds.add({ 'x': i % 50, 'y': Math.floor(i / 50), 'properties': { 'name': 'p' + (i % 7), 'rank': i } });
+    }
+    ds.add({ 'wkt': 'LINESTRING (60 0, 70 10)', 'properties': { 'rank': 1.5 } });
+
+    var filename = helper.filename('snapshot');
+    ds.save(filename);
+    assert.throws(function() { new mapnik.MemoryDatasource({ file: filename, schema: { name: 'string' } }); });
+    assert.throws(function() { new mapnik.MemoryDatasource({ file: 'test/data/does_not_exist' }); });
+
+    [true, false].forEach(function(mmap) {
+        var copy = new mapnik.MemoryDatasource({ file: filename, mmap: mmap });
+        var desc = copy.describe();
+        assert.deepEqual(desc.fields, { name: 'String', rank: 'Number' });
+        assert.deepEqual(desc.extent, [0, 0, 70, 10]);
+        assert.deepEqual(copy.features(), ds.features());
+
+        // mapped snapshots can still be added to
+        copy.add({ 'x': 80, 'y': 20, 'properties': { 'name': 'new' } });
+        assert.equal(copy.features().length, 502);
+    });
+
+    var saved = false;
+    var schema_ds = new mapnik.MemoryDatasource({ schema: { name: 'string' } });
+    schema_ds.add({ 'x': 1, 'y': 1, 'properties': { 'name': 'one' } });
+    var async_filename = helper.filename('snapshot');
+    schema_ds.save(async_filename, function(err) {
+        assert.ok(!err);
+        var copy = new mapnik.MemoryDatasource({ file: async_filename });
+        assert.deepEqual(copy.features(), [{ name: 'one', __id__: 1 }]);
+        saved = true;
+    });
+
+    beforeExit(function() {
+        assert.ok(saved);
+    });
+};
+
+exports['test async datasource creation'] = function(beforeExit) {
+    assert.throws(function() { mapnik.Datasource.create({ type: 'shape' }); });
+    assert.throws(function() { mapnik.Datasource.create({ type: 'shape', bind: 'yes' }, function() {}); });
+
+    var created = false;
+    var failed = false;
+    mapnik.Datasource.create({ type: 'shape', file: './examples/data/world_merc.shp' }, function(err, ds) {
+        created = true;
+        assert.ok(!err);
+        assert.ok(ds instanceof mapnik.Datasource);
+        assert.equal(ds.features().length, 245);
+    });
+    mapnik.Datasource.create({ type: 'shape' }, function(err, ds) {
+        failed = true;
+        assert.ok(err);
+        assert.ok(/missing <file> parameter/.test(err.message));
+        assert.equal(ds, undefined);
+    });
+
+    beforeExit(function() {
+        assert.ok(created);
+        assert.ok(failed);
+    });
+};
+
+exports['test shared datasources'] = function() {
+    assert.throws(function() { new mapnik.Datasource({ type: 'shape', file: './examples/data/world_merc.shp', shared: 'yes' }); });
+    assert.throws(function() { new mapnik.Map(256, 256).load('./examples/stylesheet.xml', { shared: 1 }); });
+
+    var key = 'file=./examples/data/world_merc.shp&type=shape';
+    var refs = function(key) {
+        var found = mapnik.shared_datasources().filter(function(entry) { return entry.key === key; });
+        return found.length ? found[0].refs : -1;
+    };
+
+    var a = new mapnik.Datasource({ type: 'shape', file: './examples/data/world_merc.shp', shared: true });
+    var b = new mapnik.Datasource({ file: './examples/data/world_merc.shp', type: 'shape', shared: true });
+    assert.deepEqual(a.parameters(), { type: 'shape', file: './examples/data/world_merc.shp' });
+    assert.equal(b.features().length, 245);
+    assert.equal(refs(key), 2);
+
+    // in use, so only dropped when asked for by key
+    assert.equal(mapnik.evict_datasources(), 0);
+    assert.equal(mapnik.evict_datasources({ type: 'shape', file: './examples/data/world_merc.shp' }), 1);
+    assert.equal(refs(key), -1);
+    assert.equal(a.features().length, 245);
+
+    // bind is not a parameter, and shared datasources are always bound
+    var unbound = new mapnik.Datasource({ type: 'shape', file: './examples/data/world_merc.shp', bind: false, shared: true });
+    var bound = new mapnik.Datasource({ type: 'shape', file: './examples/data/world_merc.shp', shared: true });
+    assert.deepEqual(unbound.parameters(), { type: 'shape', file: './examples/data/world_merc.shp' });
+    assert.equal(refs(key), 2);
+    assert.equal(unbound.features().length, 245);
+    assert.equal(mapnik.evict_datasources(key), 1);
+
+    var map1 = new mapnik.Map(256, 256);
+    var map2 = new mapnik.Map(256, 256);
+    map1.load('./examples/stylesheet.xml', { shared: true });
+    map2.load('./examples/stylesheet.xml', { shared: true });
+    var loaded = mapnik.shared_datasources().filter(function(entry) {
+        return /world_merc\.shp/.test(entry.key) && entry.key !== key;
+    });
+    assert.equal(loaded.length, 1);
+    assert.ok(loaded[0].refs >= 2);
+    assert.equal(mapnik.evict_datasources(loaded[0].key), 1);
+};
+
+exports['test datasource statistics'] = function(beforeExit) {
+    var ds = new mapnik.Datasource({ type: 'shape', file: './examples/data/world_merc.shp' });
+    assert.throws(function() { ds.statistics(); });
+
+    var scanned = false;
+    ds.statistics(function(err, stats) {
+        scanned = true;
+        assert.ok(!err);
+        assert.equal(stats.count, 245);
+        assert.equal(stats.extent.length, 4);
+        assert.deepEqual(Object.keys(stats.geometry_types), ['polygon']);
+        assert.equal(stats.fields.NAME.type, 'String');
+        assert.equal(stats.fields.NAME.nulls, 0);
+        assert.ok(Math.abs(stats.fields.ISO3.distinct - 245) < 10);
+        assert.equal(stats.fields.POP2005.type, 'Number');
+        assert.ok(stats.fields.POP2005.max >= 143953092);
+        assert.equal(ds.describe().geometry_type, 'polygon');
+    });
+
+    var mem = new mapnik.MemoryDatasource({ 'extent': '-180,-90,180,90' });
+    mem.add({ x: 0, y: 0, properties: { name: 'a', size: 1 } });
+    mem.add({ x: 10, y: 5, properties: { name: 'b' } });
+    var updated = false;
+    mem.statistics(function(err, stats) {
+        assert.ok(!err);
+        assert.equal(stats.count, 2);
+        assert.deepEqual(stats.extent, [0, 0, 10, 5]);
+        assert.equal(stats.fields.size.nulls, 1);
+        assert.equal(stats.fields.name.min, 'a');
+        assert.equal(stats.fields.name.max, 'b');
+        // adding features drops the cached statistics
+        mem.add({ x: -20, y: 1, properties: { name: 'c', size: 3 } });
+        mem.statistics(function(err, stats) {
+            updated = true;
+            assert.equal(stats.count, 3);
+            assert.deepEqual(stats.extent, [-20, 0, 10, 5]);
+            assert.equal(stats.fields.size.max, 3);
+            assert.equal(stats.fields.name.distinct, 3);
+        });
+    });
+
+    beforeExit(function() {
+        assert.ok(scanned);
+        assert.ok(updated);
+    });
+};
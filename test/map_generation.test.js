@@ -252,3 +252,203 @@ exports['test map datasource'] = function() {
     assert.deepEqual(added.datasource, options);
     assert.deepEqual(added.datasource, new mapnik.Datasource(options).parameters());
 };
+
+exports['test asynchronous rendering of a js datasource'] = function(beforeExit) {
+    var completed = false;
+    var calls = 0;
+    var ds = new mapnik.JSDatasource({ 'extent': '-180,-90,180,90' }, function() {
+        if (calls++ > 0) return;
+        return [{ 'x': 0, 'y': 0, 'properties': { 'name': 'a' } },
+                { 'x': 10, 'y': 10, 'properties': { 'name': 'b' } }];
+    });
+    var map = new Map(256, 256);
+    var layer = new mapnik.Layer('js');
+    layer.datasource = ds;
+    map.add_layer(layer);
+    map.zoom_all();
+
+    // the callback runs before the render leaves the main thread
+    map.render(map.extent(), 'png', function(err, buffer) {
+        completed = true;
+        assert.ok(!err);
+        assert.ok(buffer.length > 0);
+    });
+    assert.equal(calls, 2);
+
+    beforeExit(function() {
+        assert.ok(completed);
+    });
+};
+
+exports['test paging through a featureset'] = function(beforeExit) {
+    var ds = map.get_layer(0).datasource;
+    assert.throws(function() { ds.featureset({ extent: [0, 0] }); });
+    assert.throws(function() { ds.featureset({ properties: 'NAME' }); });
+
+    var featureset = ds.featureset({ properties: ['NAME'] });
+    var count = 0;
+    var pages = 0;
+    function read() {
+        featureset.next(100, function(err, features) {
+            assert.ok(!err);
+            ++pages;
+            count += features.length;
+            if (count == features.length) {
+                assert.deepEqual(features[0], { NAME: 'Antigua and Barbuda', __id__: 1 });
+            }
+            if (features.length == 100) read();
+        });
+        assert.throws(function() { featureset.next(); });
+    }
+    read();
+
+    // only the features within the extent
+    var some = ds.featureset({ extent: [0, 0, 1000000, 1000000] });
+    var found = 0;
+    while (some.next()) found++;
+    assert.ok(found > 0 && found < 245);
+
+    // only the features the filter is true for, also from the map and layer
+    assert.throws(function() { ds.featureset({ filter: 1 }); });
+    assert.throws(function() { ds.featureset({ filter: '[NAME] = ' }); });
+    var sets = [ds.featureset({ properties: ['NAME'], filter: "[NAME] = 'Iceland'" }),
+                map.featureset(0, { filter: "[NAME] = 'Iceland'" }),
+                map.get_layer(0).featureset({ filter: "[NAME] = 'Iceland'" })];
+    sets.forEach(function(iceland) {
+        var feature = iceland.next();
+        assert.equal(feature.NAME, 'Iceland');
+        assert.ok(!iceland.next());
+    });
+    var large = 0;
+    some = ds.featureset({ properties: ['NAME'], filter: '[POP2005] > 100000000' });
+    while (some.next()) large++;
+    assert.ok(large > 0 && large < 245);
+
+    beforeExit(function() {
+        assert.equal(pages, 3);
+        assert.equal(count, 245);
+    });
+};
+
+exports['test reading a featureset in columns'] = function(beforeExit) {
+    var ds = map.get_layer(0).datasource;
+    var featureset = ds.featureset();
+    assert.throws(function() { featureset.nextBatch(); });
+    assert.throws(function() { featureset.nextBatch(10, { fields: 'NAME' }); });
+
+    var batch = featureset.nextBatch(3, { fields: ['NAME', 'POP2005'], extent: true });
+    assert.equal(batch.length, 3);
+    assert.equal(batch.ids[0], 1);
+    assert.equal(batch.ids[2], 3);
+    assert.deepEqual(Object.keys(batch.columns), ['NAME', 'POP2005']);
+    assert.equal(batch.columns.NAME[1], 'Algeria');
+    assert.equal(batch.columns.POP2005[0], 83039);
+    assert.equal(batch.extents.length, 12);
+    assert.ok(batch.extents[0] <= batch.extents[2]);
+
+    var called = false;
+    featureset.nextBatch(1000, function(err, rest) {
+        called = true;
+        assert.ok(!err);
+        assert.equal(rest.length, 242);
+        assert.equal(rest.columns.NAME[241], 'Russia');
+        assert.equal(rest.extents, undefined);
+        assert.equal(featureset.nextBatch(10).length, 0);
+    });
+
+    beforeExit(function() {
+        assert.ok(called);
+    });
+};
+
+exports['test reading boolean columns'] = function(beforeExit) {
+    var ds = new mapnik.MemoryDatasource({ 'extent': '-180,-90,180,90' });
+    var geojson = '{"type": "Point", "coordinates": [0, 0]}\n' +
+                  '{"type": "Feature", "properties": {"open": true}, "geometry": {"type": "Point", "coordinates": [1, 1]}}\n' +
+                  '{"type": "Feature", "properties": {"open": false}, "geometry": {"type": "Point", "coordinates": [2, 2]}}';
+    var called = false;
+    ds.load(geojson, function(err) {
+        assert.ok(!err);
+        var batch = ds.featureset().nextBatch(10, { fields: ['open'] });
+        var open = batch.columns.open;
+        // as next() reports them, with NaN where the property is missing
+        assert.ok(isNaN(open[0]));
+        assert.equal(open[1], 1);
+        assert.equal(open[2], 0);
+        called = true;
+    });
+    beforeExit(function() {
+        assert.ok(called);
+    });
+};
+
+exports['test reading geometries from a featureset'] = function() {
+    var ds = new mapnik.MemoryDatasource({ 'extent': '-180,-90,180,90' });
+    ds.add({ 'x': 1, 'y': 2, 'properties': { 'name': 'a' } });
+    ds.add({ 'wkt': 'POLYGON ((0 0, 10 0, 10 10, 0 0))', 'properties': { 'name': 'b' } });
+
+    assert.throws(function() { ds.featureset().next({ geometry: 'geojson' }); });
+
+    // little-endian WKB point: byte order, type 1, x, y
+    var point = ds.featureset().next({ geometry: 'wkb' });
+    assert.equal(point.name, 'a');
+    assert.equal(point._geometry.length, 21);
+    assert.equal(point._geometry[0], 1);
+    assert.equal(point._geometry[1], 1);
+
+    var batch = ds.featureset().nextBatch(10, { geometry: 'wkb' });
+    assert.equal(batch.length, 2);
+    assert.equal(batch.geometryOffsets[1], 21);
+    assert.equal(batch.geometryOffsets[2], batch.geometry.length);
+    // a polygon with one ring of four points
+    assert.equal(batch.geometry.length, 21 + 1 + 4 + 4 + 4 + 4 * 16);
+
+    var coords = ds.featureset().nextBatch(10, { geometry: 'coords' }).geometry;
+    assert.equal(coords.coords.length, 2 + 8);
+    assert.deepEqual([coords.coords[0], coords.coords[1]], [1, 2]);
+    assert.deepEqual([coords.rings[0], coords.rings[1], coords.rings[2]], [0, 1, 5]);
+    assert.deepEqual([coords.types[0], coords.types[1]], [1, 3]);
+    assert.deepEqual([coords.features[0], coords.features[1], coords.features[2]], [0, 1, 2]);
+};
+
+exports['test caching the features of a layer'] = function(beforeExit) {
+    var map = new mapnik.Map(256, 256);
+    map.load('./examples/stylesheet.xml');
+    assert.throws(function() { map.cache_layer(); });
+    assert.throws(function() { map.cache_layer(5); });
+    assert.throws(function() { map.cache_layer(0, { max_bytes: 'lots' }); });
+
+    // memory datasources change under the cache
+    var memory = new mapnik.Layer('memory');
+    memory.datasource = new mapnik.MemoryDatasource({ 'extent': '-180,-90,180,90' });
+    var other = new mapnik.Map(256, 256);
+    other.add_layer(memory);
+    assert.throws(function() { other.cache_layer(0); }, /memory datasource/);
+
+    map.cache_layer(0, { max_bytes: 32 * 1024 * 1024 });
+    map.zoom_to_box([-20037508, -20037508, 0, 0]);
+
+    var rendered = 0;
+    map.render(map.extent(), 'png', function(err, first) {
+        assert.ok(!err);
+        var stats = map.cache_stats().world;
+        assert.equal(stats.max_bytes, 32 * 1024 * 1024);
+        assert.ok(stats.cells > 0);
+        // the same tile again comes from the cache and looks the same
+        map.render(map.extent(), 'png', function(err, second) {
+            assert.ok(!err);
+            var after = map.cache_stats().world;
+            assert.equal(after.misses, stats.misses);
+            assert.ok(after.hits > stats.hits);
+            assert.equal(first.length, second.length);
+            rendered++;
+
+            map.cache_layer(0, false);
+            assert.deepEqual(map.cache_stats(), {});
+        });
+    });
+
+    beforeExit(function() {
+        assert.equal(rendered, 1);
+    });
+};
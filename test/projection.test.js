@@ -46,3 +46,143 @@ exports['test projection'] = function() {
     assert.notStrictEqual(long_lat_bounds, merc.inverse(merc.forward(long_lat_bounds)));
 };
 
+
+exports['test projecting many points'] = function(beforeExit) {
+    var merc = new mapnik.Projection('+proj=merc +a=6378137 +b=6378137 +lat_ts=0.0 +lon_0=0.0 +x_0=0.0 +y_0=0 +k=1.0 +units=m +nadgrids=@null +wktext +no_defs +over');
+    var utm = new mapnik.Projection('+proj=utm +zone=10 +datum=WGS84');
+    assert.throws(function() { merc.forwardMany(); });
+    assert.throws(function() { merc.forwardMany([1, 2, 3]); });
+    assert.throws(function() { merc.forwardMany([1, 2], { inPlace: 'yes' }); });
+
+    var coords = [-122.33517, 47.63752, -122.420654, 47.605006, 0, 0];
+    [merc, utm].forEach(function(proj) {
+        var projected = proj.forwardMany(coords);
+        assert.equal(projected.length, 6);
+        for (var i = 0; i < 6; i += 2) {
+            var one = proj.forward([coords[i], coords[i + 1]]);
+            assert.ok(Math.abs(projected[i] - one[0]) < 1e-6);
+            assert.ok(Math.abs(projected[i + 1] - one[1]) < 1e-6);
+        }
+        var back = proj.inverseMany(projected);
+        for (var i = 0; i < 6; ++i)
+            assert.ok(Math.abs(back[i] - coords[i]) < 1e-7);
+    });
+
+    // proj4 wraps longitudes past the antimeridian unless +over is given
+    var wrapped = new mapnik.Projection('+proj=merc +a=6378137 +b=6378137 +lat_ts=0.0 +lon_0=0.0 +x_0=0.0 +y_0=0 +k=1.0 +units=m +nadgrids=@null +wktext +no_defs');
+    var far = [190, 0, -200, 10];
+    [merc, wrapped].forEach(function(proj) {
+        var projected = proj.forwardMany(far);
+        var unprojected = proj.inverseMany([21150000, 0]);
+        for (var i = 0; i < 4; i += 2) {
+            var one = proj.forward([far[i], far[i + 1]]);
+            assert.ok(Math.abs(projected[i] - one[0]) < 1e-6);
+            assert.ok(Math.abs(projected[i + 1] - one[1]) < 1e-6);
+        }
+        var back = proj.inverse([21150000, 0]);
+        assert.ok(Math.abs(unprojected[0] - back[0]) < 1e-9);
+    });
+    assert.ok(wrapped.forwardMany(far)[0] < 0);
+
+    // the poles cannot be projected to mercator
+    var poles = merc.forwardMany([10, 90, 10, -90, 10, 89]);
+    for (var i = 0; i < 4; ++i)
+        assert.equal(poles[i], Infinity);
+    assert.ok(isFinite(poles[5]) && poles[5] > 0);
+
+    var copy = coords.slice();
+    assert.strictEqual(merc.forwardMany(copy, { inPlace: true }), copy);
+    assert.ok(Math.abs(copy[0] - -13618288.8305) < 1e-3);
+
+    var done = false;
+    merc.forwardMany(coords, function(err, projected) {
+        assert.ok(!err);
+        assert.ok(Math.abs(projected[0] - copy[0]) < 1e-6);
+        merc.inverseMany(projected, { inPlace: true }, function(err, back) {
+            done = true;
+            assert.ok(!err);
+            if (typeof Float64Array !== 'undefined' && projected instanceof Float64Array)
+                assert.strictEqual(back, projected);
+            assert.ok(Math.abs(back[1] - coords[1]) < 1e-7);
+        });
+    });
+
+    beforeExit(function() {
+        assert.ok(done);
+    });
+};
+
+exports['test projecting boxes'] = function() {
+    var utm = new mapnik.Projection('+proj=utm +zone=10 +datum=WGS84');
+    assert.throws(function() { utm.forwardBox([1, 2]); });
+    assert.throws(function() { utm.forwardBox([-126, 40, -120, 50], { densify: -1 }); });
+
+    // the southern edge of the box dips below its corners at the central
+    // meridian, -123
+    var bbox = [-126, 40, -120, 50];
+    var corners = utm.forward(bbox);
+    var box = utm.forwardBox(bbox);
+    assert.equal(box.length, 4);
+    assert.ok(box[1] < corners[1] - 1000);
+    assert.ok(box[0] <= corners[0] + 1e-6 && box[2] >= corners[2] - 1e-6 && box[3] >= corners[3] - 1e-6);
+    var plain = utm.forwardBox(bbox, { densify: 0 });
+    assert.ok(plain[1] > box[1]);
+
+    var back = utm.inverseBox(box);
+    assert.ok(back[0] <= bbox[0] && back[1] <= bbox[1] && back[2] >= bbox[2] && back[3] >= bbox[3]);
+
+    // mercator cannot project the poles, a box reaching them covers the
+    // whole height of web maps
+    var merc = new mapnik.Projection('+proj=merc +a=6378137 +b=6378137 +lat_ts=0.0 +lon_0=0.0 +x_0=0.0 +y_0=0 +k=1.0 +units=m +nadgrids=@null +wktext +no_defs +over');
+    var world = merc.forwardBox([-180, -90, 180, 90]);
+    [-20037508.34, -20037508.34, 20037508.34, 20037508.34].forEach(function(v, i) {
+        assert.ok(Math.abs(world[i] - v) < 0.01);
+    });
+};
+
+exports['test projection cache'] = function() {
+    var before = mapnik.projection_cache();
+    assert.ok(before.projections.hits >= 0 && before.projections.idle >= 0);
+    assert.ok(before.transforms.misses >= 0);
+
+    // a definition no earlier test used has to be initialized
+    var proj = new mapnik.Projection('+proj=merc +lon_0=7 +units=m');
+    var after = mapnik.projection_cache();
+    assert.equal(after.projections.misses, before.projections.misses + 1);
+    assert.equal(after.projections.hits, before.projections.hits);
+    assert.throws(function() { new mapnik.Projection('+proj +foo'); });
+};
+
+exports['test projection cache hits'] = function(beforeExit) {
+    // a render hands the transform between the srs of the map and of a js
+    // layer back to the pool, where the next render finds it
+    var fresh = true;
+    var ds = new mapnik.JSDatasource({ 'extent': '-180,-90,180,90' }, function() {
+        if (!fresh) return;
+        fresh = false;
+        return [{ 'x': 0, 'y': 0, 'properties': { 'name': 'a' } }];
+    });
+    var map = new mapnik.Map(256, 256);
+    var layer = new mapnik.Layer('js');
+    layer.datasource = ds;
+    map.add_layer(layer);
+    map.zoom_all();
+
+    var rendered = 0;
+    map.render(map.extent(), 'png', function(err) {
+        assert.ok(!err);
+        ++rendered;
+        var first = mapnik.projection_cache().transforms;
+        assert.ok(first.idle > 0);
+        fresh = true;
+        map.render(map.extent(), 'png', function(err) {
+            assert.ok(!err);
+            ++rendered;
+            assert.ok(mapnik.projection_cache().transforms.hits > first.hits);
+        });
+    });
+
+    beforeExit(function() {
+        assert.equal(rendered, 2);
+    });
+};
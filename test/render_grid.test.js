@@ -36,3 +36,193 @@ exports['test simple_grid rendering'] = function(beforeExit) {
         assert.ok(rendered);
     });
 };
+
+exports['test grid rendering with the binary rasterizer'] = function(beforeExit) {
+    var rendered = false;
+    if (!mapnik.supports.grid) {
+        var reference = JSON.parse(fs.readFileSync('./test/support/simple_grid.json', 'utf8'));
+
+        var map_grid = new mapnik.Map(256, 256);
+        map_grid.load('./examples/stylesheet.xml');
+        map_grid.zoom_all();
+
+        assert.throws(function() {
+            map_grid._render_grid(0, 4, 'FIPS', {rasterizer: 'subpixel'}, function(err, grid) {});
+        });
+
+        map_grid._render_grid(0, 4, 'FIPS', {rasterizer: 'binary'}, function(err, grid) {
+            rendered = true;
+            assert.ok(!err);
+            // pixel center sampling may differ from the antialiased
+            // rasterizer along feature edges, the layout must not
+            assert.equal(grid.grid.length, reference.grid.length);
+            assert.ok(grid.keys.length > 1);
+        });
+    } else {
+        rendered = true;
+    }
+
+    beforeExit(function() {
+        assert.ok(rendered);
+    });
+};
+
+// decodes the binary grid into rows of keys
+function decode_rle(buf) {
+    var pos = 0;
+    function u32() {
+        var v = buf[pos] + (buf[pos + 1] << 8) + (buf[pos + 2] << 16) + (buf[pos + 3] * 16777216);
+        pos += 4;
+        return v;
+    }
+    assert.equal(u32(), 0x314c5247);
+    var width = u32();
+    var height = u32();
+    var num_keys = u32();
+    var keys = [];
+    for (var k = 0; k < num_keys; ++k) {
+        var len = u32();
+        keys.push(buf.toString('utf8', pos, pos + len));
+        pos += (len + 3) & ~3;
+    }
+    var rows = [];
+    for (var y = 0; y < height; ++y) {
+        var num_runs = u32();
+        if (num_runs === 0) {
+            rows.push(rows[y - 1]);
+            continue;
+        }
+        var row = [];
+        for (var r = 0; r < num_runs; ++r) {
+            var key = keys[u32()];
+            var run = u32();
+            while (run--) row.push(key);
+        }
+        assert.equal(row.length, width);
+        rows.push(row);
+    }
+    assert.equal(pos, buf.length);
+    return { keys: keys, rows: rows };
+}
+
+// decodes the UTFGrid rows into rows of keys
+function decode_utf(rows, keys) {
+    return rows.map(function(line) {
+        var row = [];
+        for (var x = 0; x < line.length; ++x) {
+            var c = line.charCodeAt(x);
+            if (c >= 93) c--;
+            if (c >= 35) c--;
+            row.push(keys[c - 32]);
+        }
+        return row;
+    });
+}
+
+exports['test rle grid matches the utf grid'] = function(beforeExit) {
+    var rendered = 0;
+    var map_grid = new mapnik.Map(256, 256);
+    map_grid.load('./examples/stylesheet.xml');
+    map_grid.zoom_all();
+
+    function compare(utf, rle) {
+        var decoded = decode_rle(rle.grid);
+        assert.deepEqual(decoded.keys, rle.keys);
+        assert.deepEqual(rle.keys, utf.keys);
+        var rows = typeof utf.grid === 'string' ? JSON.parse(utf.grid) : utf.grid;
+        assert.deepEqual(decoded.rows, decode_utf(rows, utf.keys));
+    }
+
+    if (mapnik.supports.grid) {
+        var options = {'resolution': 4, 'key': '__id__'};
+        assert.throws(function() {
+            map_grid.render_grid('world', {format: 'png'}, function(err, grid) {});
+        });
+        map_grid.render_grid('world', options, function(err, utf) {
+            assert.ok(!err);
+            options.format = 'rle';
+            map_grid.render_grid('world', options, function(err, rle) {
+                assert.ok(!err);
+                assert.ok(Buffer.isBuffer(rle.grid));
+                compare(utf, rle);
+                rendered++;
+            });
+        });
+    } else {
+        map_grid._render_grid(0, 4, 'FIPS', function(err, utf) {
+            assert.ok(!err);
+            map_grid._render_grid(0, 4, 'FIPS', {format: 'rle'}, function(err, rle) {
+                assert.ok(!err);
+                assert.ok(Buffer.isBuffer(rle.grid));
+                compare(utf, rle);
+                rendered++;
+            });
+        });
+    }
+
+    beforeExit(function() {
+        assert.equal(rendered, 1);
+    });
+};
+
+exports['test grid of a polar tile'] = function(beforeExit) {
+    var rendered = 0;
+    // the grid renderer of mapnik is not affected
+    if (!mapnik.supports.grid) {
+        // a layer in longitude and latitude reaching the poles, in a
+        // mercator map, has features in the top row of tiles
+        var ds = new mapnik.MemoryDatasource({ 'extent': '-180,-90,180,90' });
+        ds.add({ 'x': -180, 'y': -90 });
+        ds.add({ 'x': 180, 'y': 90 });
+        ds.add({ 'wkt': 'POLYGON ((-15 83, -5 83, -5 84.5, -15 84.5, -15 83))', 'properties': { 'name': 'polar' } });
+        var layer = new mapnik.Layer('polar');
+        layer.datasource = ds;
+
+        var map = new mapnik.Map(256, 256);
+        map.srs = '+proj=merc +a=6378137 +b=6378137 +lat_ts=0.0 +lon_0=0.0 +x_0=0.0 +y_0=0 +k=1.0 +units=m +nadgrids=@null +wktext +no_defs +over';
+        map.add_layer(layer);
+        map.zoom_to_box(new mapnik.SphericalMercator().xyzToEnvelope(7, 0, 4));
+        map._render_grid(0, 4, 'name', function(err, grid) {
+            assert.ok(!err);
+            assert.ok(grid.keys.indexOf('polar') >= 0);
+            rendered++;
+        });
+    } else {
+        rendered++;
+    }
+
+    beforeExit(function() {
+        assert.equal(rendered, 1);
+    });
+};
+
+exports['test grid of a js layer'] = function(beforeExit) {
+    var rendered = 0;
+    var calls = 0;
+    var ds = new mapnik.JSDatasource({ 'extent': '-180,-90,180,90' }, function() {
+        if (calls++ > 0) return;
+        return [{ 'x': 0, 'y': 0, 'properties': { 'name': 'a' } }];
+    });
+    var layer = new mapnik.Layer('js');
+    layer.datasource = ds;
+    var map = new mapnik.Map(256, 256);
+    map.add_layer(layer);
+    map.zoom_all();
+
+    // the features are read before the render leaves the main thread
+    var done = function(err, grid) {
+        assert.ok(!err);
+        if (!mapnik.supports.grid)
+            assert.ok(grid.keys.indexOf('a') >= 0);
+        rendered++;
+    };
+    if (mapnik.supports.grid)
+        map.render_grid('js', { 'resolution': 4, 'key': 'name' }, done);
+    else
+        map._render_grid(0, 4, 'name', done);
+    assert.equal(calls, 2);
+
+    beforeExit(function() {
+        assert.equal(rendered, 1);
+    });
+};
@@ -0,0 +1,83 @@
+var mapnik = require('mapnik');
+var assert = require('assert');
+
+var origin = 20037508.342789244;
+
+function near(a, b) {
+    return Math.abs(a - b) < 1e-3;
+}
+
+exports['test tile envelopes'] = function() {
+    var merc = new mapnik.SphericalMercator();
+
+    var world = merc.xyzToEnvelope(0, 0, 0);
+    assert.equal(world.length, 4);
+    assert.ok(near(world[0], -origin) && near(world[1], -origin));
+    assert.ok(near(world[2], origin) && near(world[3], origin));
+
+    // the north east tile, or the south east one counting rows from the south
+    var ne = merc.xyzToEnvelope(1, 0, 1);
+    assert.ok(near(ne[0], 0) && near(ne[1], 0) && near(ne[3], origin));
+    var se = merc.xyzToEnvelope(1, 0, 1, true);
+    assert.ok(near(se[1], -origin) && near(se[3], 0));
+
+    var boxes = merc.xyzToEnvelope([0, 0, 0, 1, 0, 1]);
+    assert.equal(boxes.length, 8);
+    for (var i = 0; i < 4; ++i) {
+        assert.ok(near(boxes[i], world[i]));
+        assert.ok(near(boxes[4 + i], ne[i]));
+    }
+    assert.throws(function() { merc.xyzToEnvelope([0, 0]); });
+    assert.throws(function() { merc.xyzToEnvelope(0, 0, 31); });
+};
+
+exports['test tile ranges'] = function() {
+    var merc = new mapnik.SphericalMercator();
+    var world = [-180, -85.0511, 180, 85.0511];
+
+    var ranges = merc.bboxToTileRange(world, 0, 2);
+    assert.equal(ranges.length, 15);
+    assert.deepEqual([ranges[0], ranges[1], ranges[2], ranges[3], ranges[4]], [0, 0, 0, 0, 0]);
+    assert.deepEqual([ranges[10], ranges[11], ranges[12], ranges[13], ranges[14]], [2, 0, 0, 3, 3]);
+
+    // a point is in one tile
+    var point = merc.bboxToTileRange([10, 10, 10, 10], 5, 5);
+    assert.equal(point[1], point[3]);
+    assert.equal(point[2], point[4]);
+
+    assert.throws(function() { merc.bboxToTileRange(world, 3, 2); });
+    assert.throws(function() { merc.bboxToTileRange([0, 0, 1], 0, 2); });
+};
+
+exports['test iterating tiles'] = function() {
+    var merc = new mapnik.SphericalMercator();
+    var bbox = [-130, 20, -60, 55];
+
+    var ranges = merc.bboxToTileRange(bbox, 0, 6);
+    var expected = 0;
+    for (var i = 0; i < ranges.length; i += 5)
+        expected += (ranges[i + 3] - ranges[i + 1] + 1) * (ranges[i + 4] - ranges[i + 2] + 1);
+
+    ['row', 'hilbert'].forEach(function(order) {
+        var tiles = merc.tiles(bbox, 0, 6, { order: order });
+        assert.equal(tiles.count, expected);
+        var seen = {};
+        var total = 0;
+        var page;
+        while ((page = tiles.next(100)).length > 0) {
+            assert.ok(page.length <= 300);
+            for (var j = 0; j < page.length; j += 3) {
+                var key = page[j + 2] + '/' + page[j] + '/' + page[j + 1];
+                assert.ok(!seen[key], order + ' repeats ' + key);
+                seen[key] = true;
+                var r = ranges.subarray ? ranges.subarray(5 * page[j + 2]) : ranges.slice(5 * page[j + 2]);
+                assert.ok(page[j] >= r[1] && page[j] <= r[3] && page[j + 1] >= r[2] && page[j + 1] <= r[4]);
+                ++total;
+            }
+        }
+        assert.equal(total, expected);
+        assert.equal(tiles.next().length, 0);
+    });
+
+    assert.throws(function() { merc.tiles(bbox, 0, 6, { order: 'random' }); });
+};